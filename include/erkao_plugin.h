@@ -11,7 +11,7 @@ extern "C" {
 #endif
 
 #define ERKAO_PLUGIN_API_VERSION 1
-#define ERKAO_PLUGIN_ABI_VERSION 1
+#define ERKAO_PLUGIN_ABI_VERSION 3
 #define ERKAO_PLUGIN_INIT "erkao_init"
 
 #if defined(_WIN32)
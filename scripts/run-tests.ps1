@@ -206,6 +206,10 @@ try {
     if (-not $httpTestEnabled) {
       $tests = $tests | Where-Object { $_.Name -ne "15_http.ek" }
     }
+    # Tests that need Linux-only facilities (such as pidfds) end in _linux.ek.
+    if (-not $IsLinux) {
+      $tests = $tests | Where-Object { $_.Name -notlike "*_linux.ek" }
+    }
 
     $failed = 0
     $updated = 0
@@ -211,6 +211,17 @@ if [ "$http_test_enabled" -eq 0 ]; then
   tests=("${filtered[@]}")
 fi
 
+# Tests that need Linux-only facilities (such as pidfds) end in _linux.ek.
+if [ "$(uname -s)" != "Linux" ]; then
+  filtered=()
+  for test in "${tests[@]}"; do
+    if [[ "$(basename "$test")" != *_linux.ek ]]; then
+      filtered+=("$test")
+    fi
+  done
+  tests=("${filtered[@]}")
+fi
+
 failed=0
 updated=0
 
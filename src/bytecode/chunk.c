@@ -16,6 +16,9 @@ void initChunk(Chunk* chunk) {
 }
 
 void freeChunk(Chunk* chunk) {
+  for (int i = 0; chunk->caches && i < chunk->count; i++) {
+    FREE_ARRAY(InlineCacheEntry, chunk->caches[i].entries, IC_WAYS);
+  }
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
   FREE_ARRAY(Token, chunk->tokens, chunk->capacity);
   FREE_ARRAY(InlineCache, chunk->caches, chunk->capacity);
@@ -23,47 +26,6 @@ void freeChunk(Chunk* chunk) {
   initChunk(chunk);
 }
 
-Chunk* cloneChunk(const Chunk* chunk) {
-  Chunk* copy = (Chunk*)malloc(sizeof(Chunk));
-  if (!copy) {
-    fprintf(stderr, "RuntimeError: Out of memory.\n");
-    return NULL;
-  }
-  initChunk(copy);
-
-  if (chunk->count > 0) {
-    copy->capacity = chunk->count;
-    copy->count = chunk->count;
-    copy->code = GROW_ARRAY(uint8_t, copy->code, 0, copy->capacity);
-    copy->tokens = GROW_ARRAY(Token, copy->tokens, 0, copy->capacity);
-    copy->caches = GROW_ARRAY(InlineCache, copy->caches, 0, copy->capacity);
-    if (!copy->code || !copy->tokens || !copy->caches) {
-      fprintf(stderr, "RuntimeError: Out of memory.\n");
-      freeChunk(copy);
-      free(copy);
-      return NULL;
-    }
-    memcpy(copy->code, chunk->code, (size_t)chunk->count);
-    memcpy(copy->tokens, chunk->tokens, sizeof(Token) * (size_t)chunk->count);
-    memset(copy->caches, 0, sizeof(InlineCache) * (size_t)copy->capacity);
-  }
-
-  if (chunk->constantsCount > 0) {
-    copy->constantsCapacity = chunk->constantsCount;
-    copy->constantsCount = chunk->constantsCount;
-    copy->constants = GROW_ARRAY(Value, copy->constants, 0, copy->constantsCapacity);
-    if (!copy->constants) {
-      fprintf(stderr, "RuntimeError: Out of memory.\n");
-      freeChunk(copy);
-      free(copy);
-      return NULL;
-    }
-    memcpy(copy->constants, chunk->constants, sizeof(Value) * (size_t)chunk->constantsCount);
-  }
-
-  return copy;
-}
-
 void writeChunk(Chunk* chunk, uint8_t byte, Token token) {
   if (chunk->capacity < chunk->count + 1) {
     int oldCapacity = chunk->capacity;
@@ -117,3 +79,36 @@ int addConstant(Chunk* chunk, Value value) {
   chunk->constants[chunk->constantsCount] = value;
   return chunk->constantsCount++;
 }
+
+InlineCacheEntry* inlineCacheAdd(InlineCache* cache, InlineCacheKind kind, ObjShape* shape,
+                                 ObjMap* map, ObjClass* klass) {
+  cache->misses++;
+  InlineCacheEntry* entry = NULL;
+  for (int i = 0; i < cache->count; i++) {
+    InlineCacheEntry* candidate = &cache->entries[i];
+    if (candidate->kind == kind && candidate->shape == shape &&
+        candidate->map == map && candidate->klass == klass) {
+      entry = candidate;
+      break;
+    }
+  }
+  if (!entry) {
+    if (cache->megamorphic) return NULL;
+    if (cache->count >= IC_WAYS) {
+      cache->megamorphic = true;
+      cache->count = 0;
+      return NULL;
+    }
+    if (!cache->entries) {
+      cache->entries = GROW_ARRAY(InlineCacheEntry, NULL, 0, IC_WAYS);
+      if (!cache->entries) return NULL;
+    }
+    entry = &cache->entries[cache->count++];
+  }
+  memset(entry, 0, sizeof(InlineCacheEntry));
+  entry->kind = kind;
+  entry->shape = shape;
+  entry->map = map;
+  entry->klass = klass;
+  return entry;
+}
@@ -6,17 +6,36 @@
 typedef enum {
   IC_NONE,
   IC_FIELD,
+  IC_SHAPE,
+  IC_SHAPE_ADD,
   IC_METHOD,
   IC_MAP
 } InlineCacheKind;
 
+#define IC_WAYS 4
+
+// IC_SHAPE hits when the receiver has `shape` and reads slot `index`.
+// IC_SHAPE_ADD caches the transition from `shape` to `nextShape` on a store.
 typedef struct {
   InlineCacheKind kind;
   ObjMap* map;
-  ObjString* key;
   ObjClass* klass;
   ObjFunction* method;
+  ObjShape* shape;
+  ObjShape* nextShape;
   int index;
+} InlineCacheEntry;
+
+// A site keeps up to IC_WAYS entries in miss order. A miss with every way taken
+// makes the site megamorphic: it drops its entries and stops caching.
+// `deopts` counts quickened forms of the instruction that failed their guard.
+typedef struct {
+  InlineCacheEntry* entries;
+  uint8_t count;
+  bool megamorphic;
+  uint8_t deopts;
+  uint32_t hits;
+  uint32_t misses;
 } InlineCache;
 
 typedef enum {
@@ -29,6 +48,13 @@ typedef enum {
   OP_SET_VAR,
   OP_DEFINE_VAR,
   OP_DEFINE_CONST,
+  OP_GET_LOCAL,
+  OP_SET_LOCAL,
+  OP_DEFINE_LOCAL,
+  OP_UNSET_LOCAL,
+  OP_GET_UPVALUE,
+  OP_SET_UPVALUE,
+  OP_CLOSE_UPVALUES,
   OP_GET_PROPERTY,
   OP_GET_PROPERTY_OPTIONAL,
   OP_SET_PROPERTY,
@@ -82,7 +108,35 @@ typedef enum {
   OP_ARRAY_APPEND,
   OP_MAP,
   OP_MAP_SET,
-  OP_GC
+  OP_GC,
+  OP_ITER_INIT,
+  OP_ITER_NEXT,
+  OP_RANGE,
+  OP_RANGE_INIT,
+  OP_RANGE_NEXT,
+  OP_YIELD,
+  // Quickened forms. The interpreter rewrites a generic instruction into one of
+  // these after seeing its operand types; the compiler never emits them.
+  OP_ADD_NUM,
+  OP_ADD_STR,
+  OP_EQUAL_NUM,
+  OP_GET_INDEX_ARRAY_NUM,
+  OP_SET_INDEX_ARRAY_NUM,
+  OP_GET_INDEX_TYPED,
+  OP_SET_INDEX_TYPED,
+  // Superinstructions. optimizeChunk fuses common sequences into these; see
+  // fusionRules in singlepass_optimize.c.
+  OP_GET_LOCAL_GET_LOCAL,
+  OP_GET_LOCAL_GET_PROPERTY,
+  OP_INC_LOCAL,
+  OP_INC_VAR,
+  OP_SET_VAR_POP,
+  OP_LESS_JUMP_IF_FALSE,
+  OP_CALL0,
+  OP_CALL1,
+  OP_CALL2,
+  // Not an instruction: the number of opcodes, for tables indexed by them.
+  OP_COUNT
 } OpCode;
 
 struct Chunk {
@@ -98,8 +152,11 @@ struct Chunk {
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
-Chunk* cloneChunk(const Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, Token token);
 int addConstant(Chunk* chunk, Value value);
+// Returns the entry guarded by (kind, shape, map, klass), reusing a stale one
+// or taking a free way. Counts a miss; NULL once the site is megamorphic.
+InlineCacheEntry* inlineCacheAdd(InlineCache* cache, InlineCacheKind kind, ObjShape* shape,
+                                 ObjMap* map, ObjClass* klass);
 
 #endif
@@ -1,5 +1,6 @@
 #include "disasm.h"
 #include "value.h"
+#include "program.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -106,6 +107,19 @@ static int invokeInstruction(const char* name, const Chunk* chunk, int offset) {
   return offset + 4;
 }
 
+static int slotConstantInstruction(const char* name, const Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint16_t constant = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+  printf("%-16s %4u %4u '", name, slot, constant);
+  if (constant < (uint16_t)chunk->constantsCount) {
+    printValue(chunk->constants[constant]);
+  } else {
+    printf("<invalid>");
+  }
+  printf("'\n");
+  return offset + 4;
+}
+
 static int jumpInstruction(const char* name, int sign, const Chunk* chunk, int offset) {
   uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
   int destination = offset + 3 + sign * (int)jump;
@@ -113,6 +127,28 @@ static int jumpInstruction(const char* name, int sign, const Chunk* chunk, int o
   return offset + 3;
 }
 
+static int slotJumpInstruction(const char* name, const Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint16_t jump = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+  printf("%-16s %4u %4d -> %d\n", name, slot, offset, offset + 4 + (int)jump);
+  return offset + 4;
+}
+
+static int incVarInstruction(const Chunk* chunk, int offset) {
+  uint16_t name = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+  uint16_t step = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+  printf("%-16s %4u %4u '", "OP_INC_VAR", name, step);
+  if (name < (uint16_t)chunk->constantsCount && step < (uint16_t)chunk->constantsCount) {
+    printValue(chunk->constants[name]);
+    printf("' '");
+    printValue(chunk->constants[step]);
+  } else {
+    printf("<invalid>");
+  }
+  printf("'\n");
+  return offset + 5;
+}
+
 static int disassembleInstruction(const Chunk* chunk, int offset) {
   printf("%04d ", offset);
   printLine(chunk, offset);
@@ -137,6 +173,20 @@ static int disassembleInstruction(const Chunk* chunk, int offset) {
       return constantInstruction("OP_DEFINE_VAR", chunk, offset);
     case OP_DEFINE_CONST:
       return constantInstruction("OP_DEFINE_CONST", chunk, offset);
+    case OP_GET_LOCAL:
+      return byteInstruction("OP_GET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL:
+      return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    case OP_DEFINE_LOCAL:
+      return byteInstruction("OP_DEFINE_LOCAL", chunk, offset);
+    case OP_UNSET_LOCAL:
+      return byteInstruction("OP_UNSET_LOCAL", chunk, offset);
+    case OP_GET_UPVALUE:
+      return byteInstruction("OP_GET_UPVALUE", chunk, offset);
+    case OP_SET_UPVALUE:
+      return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+    case OP_CLOSE_UPVALUES:
+      return byteInstruction("OP_CLOSE_UPVALUES", chunk, offset);
     case OP_GET_PROPERTY:
       return constantInstruction("OP_GET_PROPERTY", chunk, offset);
     case OP_GET_PROPERTY_OPTIONAL:
@@ -265,6 +315,52 @@ static int disassembleInstruction(const Chunk* chunk, int offset) {
       return simpleInstruction("OP_MAP_SET", chunk, offset);
     case OP_GC:
       return simpleInstruction("OP_GC", chunk, offset);
+    case OP_ITER_INIT:
+      return byteInstruction("OP_ITER_INIT", chunk, offset);
+    case OP_ITER_NEXT:
+      return jumpInstruction("OP_ITER_NEXT", 1, chunk, offset);
+    case OP_RANGE:
+      return simpleInstruction("OP_RANGE", chunk, offset);
+    case OP_RANGE_INIT:
+      return byteInstruction("OP_RANGE_INIT", chunk, offset);
+    case OP_RANGE_NEXT:
+      return slotJumpInstruction("OP_RANGE_NEXT", chunk, offset);
+    case OP_YIELD:
+      return simpleInstruction("OP_YIELD", chunk, offset);
+    case OP_ADD_NUM:
+      return simpleInstruction("OP_ADD_NUM", chunk, offset);
+    case OP_ADD_STR:
+      return simpleInstruction("OP_ADD_STR", chunk, offset);
+    case OP_EQUAL_NUM:
+      return simpleInstruction("OP_EQUAL_NUM", chunk, offset);
+    case OP_GET_INDEX_ARRAY_NUM:
+      return simpleInstruction("OP_GET_INDEX_ARRAY_NUM", chunk, offset);
+    case OP_SET_INDEX_ARRAY_NUM:
+      return simpleInstruction("OP_SET_INDEX_ARRAY_NUM", chunk, offset);
+    case OP_GET_INDEX_TYPED:
+      return simpleInstruction("OP_GET_INDEX_TYPED", chunk, offset);
+    case OP_SET_INDEX_TYPED:
+      return simpleInstruction("OP_SET_INDEX_TYPED", chunk, offset);
+    case OP_GET_LOCAL_GET_LOCAL:
+      printf("%-16s %4u %4u\n", "OP_GET_LOCAL_GET_LOCAL", chunk->code[offset + 1],
+             chunk->code[offset + 2]);
+      return offset + 3;
+    case OP_GET_LOCAL_GET_PROPERTY:
+      return slotConstantInstruction("OP_GET_LOCAL_GET_PROPERTY", chunk, offset);
+    case OP_INC_LOCAL:
+      return slotConstantInstruction("OP_INC_LOCAL", chunk, offset);
+    case OP_INC_VAR:
+      return incVarInstruction(chunk, offset);
+    case OP_SET_VAR_POP:
+      return constantInstruction("OP_SET_VAR_POP", chunk, offset);
+    case OP_LESS_JUMP_IF_FALSE:
+      return jumpInstruction("OP_LESS_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_CALL0:
+      return simpleInstruction("OP_CALL0", chunk, offset);
+    case OP_CALL1:
+      return simpleInstruction("OP_CALL1", chunk, offset);
+    case OP_CALL2:
+      return simpleInstruction("OP_CALL2", chunk, offset);
     default:
       printf("OP_UNKNOWN %d\n", instruction);
       return offset + 1;
@@ -283,3 +379,203 @@ void disassembleFunction(const ObjFunction* function) {
   const char* name = function->name ? function->name->chars : "<script>";
   disassembleChunk(function->chunk, name);
 }
+
+static const char* const opcodeNames[] = {
+  [OP_CONSTANT] = "OP_CONSTANT",
+  [OP_NULL] = "OP_NULL",
+  [OP_TRUE] = "OP_TRUE",
+  [OP_FALSE] = "OP_FALSE",
+  [OP_POP] = "OP_POP",
+  [OP_GET_VAR] = "OP_GET_VAR",
+  [OP_SET_VAR] = "OP_SET_VAR",
+  [OP_DEFINE_VAR] = "OP_DEFINE_VAR",
+  [OP_DEFINE_CONST] = "OP_DEFINE_CONST",
+  [OP_GET_LOCAL] = "OP_GET_LOCAL",
+  [OP_SET_LOCAL] = "OP_SET_LOCAL",
+  [OP_DEFINE_LOCAL] = "OP_DEFINE_LOCAL",
+  [OP_UNSET_LOCAL] = "OP_UNSET_LOCAL",
+  [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+  [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+  [OP_CLOSE_UPVALUES] = "OP_CLOSE_UPVALUES",
+  [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+  [OP_GET_PROPERTY_OPTIONAL] = "OP_GET_PROPERTY_OPTIONAL",
+  [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+  [OP_GET_THIS] = "OP_GET_THIS",
+  [OP_GET_INDEX] = "OP_GET_INDEX",
+  [OP_GET_INDEX_OPTIONAL] = "OP_GET_INDEX_OPTIONAL",
+  [OP_SET_INDEX] = "OP_SET_INDEX",
+  [OP_MATCH_ENUM] = "OP_MATCH_ENUM",
+  [OP_IS_ARRAY] = "OP_IS_ARRAY",
+  [OP_IS_MAP] = "OP_IS_MAP",
+  [OP_LEN] = "OP_LEN",
+  [OP_MAP_HAS] = "OP_MAP_HAS",
+  [OP_EQUAL] = "OP_EQUAL",
+  [OP_GREATER] = "OP_GREATER",
+  [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+  [OP_LESS] = "OP_LESS",
+  [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+  [OP_ADD] = "OP_ADD",
+  [OP_SUBTRACT] = "OP_SUBTRACT",
+  [OP_MULTIPLY] = "OP_MULTIPLY",
+  [OP_DIVIDE] = "OP_DIVIDE",
+  [OP_MODULO] = "OP_MODULO",
+  [OP_NOT] = "OP_NOT",
+  [OP_NEGATE] = "OP_NEGATE",
+  [OP_STRINGIFY] = "OP_STRINGIFY",
+  [OP_JUMP] = "OP_JUMP",
+  [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+  [OP_LOOP] = "OP_LOOP",
+  [OP_TRY] = "OP_TRY",
+  [OP_END_TRY] = "OP_END_TRY",
+  [OP_THROW] = "OP_THROW",
+  [OP_DEFER] = "OP_DEFER",
+  [OP_CALL] = "OP_CALL",
+  [OP_CALL_OPTIONAL] = "OP_CALL_OPTIONAL",
+  [OP_INVOKE] = "OP_INVOKE",
+  [OP_ARG_COUNT] = "OP_ARG_COUNT",
+  [OP_CLOSURE] = "OP_CLOSURE",
+  [OP_RETURN] = "OP_RETURN",
+  [OP_TRY_UNWRAP] = "OP_TRY_UNWRAP",
+  [OP_BEGIN_SCOPE] = "OP_BEGIN_SCOPE",
+  [OP_END_SCOPE] = "OP_END_SCOPE",
+  [OP_CLASS] = "OP_CLASS",
+  [OP_STRUCT] = "OP_STRUCT",
+  [OP_IMPORT] = "OP_IMPORT",
+  [OP_IMPORT_MODULE] = "OP_IMPORT_MODULE",
+  [OP_EXPORT] = "OP_EXPORT",
+  [OP_PRIVATE] = "OP_PRIVATE",
+  [OP_EXPORT_VALUE] = "OP_EXPORT_VALUE",
+  [OP_EXPORT_FROM] = "OP_EXPORT_FROM",
+  [OP_ARRAY] = "OP_ARRAY",
+  [OP_ARRAY_APPEND] = "OP_ARRAY_APPEND",
+  [OP_MAP] = "OP_MAP",
+  [OP_MAP_SET] = "OP_MAP_SET",
+  [OP_GC] = "OP_GC",
+  [OP_ITER_INIT] = "OP_ITER_INIT",
+  [OP_ITER_NEXT] = "OP_ITER_NEXT",
+  [OP_RANGE] = "OP_RANGE",
+  [OP_RANGE_INIT] = "OP_RANGE_INIT",
+  [OP_RANGE_NEXT] = "OP_RANGE_NEXT",
+  [OP_YIELD] = "OP_YIELD",
+  [OP_ADD_NUM] = "OP_ADD_NUM",
+  [OP_ADD_STR] = "OP_ADD_STR",
+  [OP_EQUAL_NUM] = "OP_EQUAL_NUM",
+  [OP_GET_INDEX_ARRAY_NUM] = "OP_GET_INDEX_ARRAY_NUM",
+  [OP_SET_INDEX_ARRAY_NUM] = "OP_SET_INDEX_ARRAY_NUM",
+  [OP_GET_INDEX_TYPED] = "OP_GET_INDEX_TYPED",
+  [OP_SET_INDEX_TYPED] = "OP_SET_INDEX_TYPED",
+  [OP_GET_LOCAL_GET_LOCAL] = "OP_GET_LOCAL_GET_LOCAL",
+  [OP_GET_LOCAL_GET_PROPERTY] = "OP_GET_LOCAL_GET_PROPERTY",
+  [OP_INC_LOCAL] = "OP_INC_LOCAL",
+  [OP_INC_VAR] = "OP_INC_VAR",
+  [OP_SET_VAR_POP] = "OP_SET_VAR_POP",
+  [OP_LESS_JUMP_IF_FALSE] = "OP_LESS_JUMP_IF_FALSE",
+  [OP_CALL0] = "OP_CALL0",
+  [OP_CALL1] = "OP_CALL1",
+  [OP_CALL2] = "OP_CALL2",
+};
+
+// C99 has no static_assert: the array size goes negative when an opcode
+// added at the end of the enum has no name here.
+typedef char opcodeNamesCoverEveryOpcode
+    [sizeof(opcodeNames) / sizeof(opcodeNames[0]) == OP_COUNT ? 1 : -1];
+
+static bool isIndexInstruction(uint8_t instruction) {
+  switch (instruction) {
+    case OP_GET_INDEX:
+    case OP_GET_INDEX_OPTIONAL:
+    case OP_SET_INDEX:
+    case OP_GET_INDEX_ARRAY_NUM:
+    case OP_SET_INDEX_ARRAY_NUM:
+    case OP_GET_INDEX_TYPED:
+    case OP_SET_INDEX_TYPED:
+      return true;
+    default:
+      return false;
+  }
+}
+
+const char* opcodeName(uint8_t instruction) {
+  if (instruction >= sizeof(opcodeNames) / sizeof(opcodeNames[0]) ||
+      !opcodeNames[instruction]) {
+    return "OP_UNKNOWN";
+  }
+  return opcodeNames[instruction];
+}
+
+void dumpInlineCaches(const ObjFunction* function, FILE* out) {
+  if (!function || !function->chunk || !function->chunk->caches) return;
+  const Chunk* chunk = function->chunk;
+  const char* where = "<script>";
+  if (function->program && function->program->path) {
+    where = function->program->path;
+  } else if (function->name) {
+    where = function->name->chars;
+  }
+  for (int offset = 0; offset < chunk->count; offset++) {
+    const InlineCache* cache = &chunk->caches[offset];
+    if (cache->hits == 0 && cache->misses == 0) continue;
+    uint8_t instruction = chunk->code[offset];
+    bool property = instruction == OP_GET_PROPERTY || instruction == OP_GET_PROPERTY_OPTIONAL ||
+                    instruction == OP_SET_PROPERTY || instruction == OP_INVOKE ||
+                    instruction == OP_GET_LOCAL_GET_PROPERTY;
+    // A property site is located at its name operand, which sits behind the
+    // fused receiver load for OP_GET_LOCAL_GET_PROPERTY. Other sites have no
+    // operand and are located at the opcode itself.
+    int operand = instruction == OP_GET_LOCAL_GET_PROPERTY ? offset + 2 : offset + 1;
+    Token token = chunk->tokens[property ? operand : offset];
+    const char* quote = "";
+    const char* name = isIndexInstruction(instruction) ? "<index>" : "<binary>";
+    int nameLength = (int)strlen(name);
+    if (property) {
+      quote = "'";
+      name = "";
+      nameLength = 0;
+      uint16_t constant = (uint16_t)((chunk->code[operand] << 8) | chunk->code[operand + 1]);
+      if (constant < (uint16_t)chunk->constantsCount &&
+          isObjType(chunk->constants[constant], OBJ_STRING)) {
+        ObjString* key = (ObjString*)AS_OBJ(chunk->constants[constant]);
+        name = key->chars;
+        nameLength = key->length;
+      }
+    }
+    const char* state = cache->megamorphic ? "megamorphic"
+                        : cache->count > 1 ? "polymorphic"
+                                           : "monomorphic";
+    if (token.line > 0) {
+      fprintf(out, "ic %s:%d:%d ", where, token.line, token.column);
+    } else {
+      fprintf(out, "ic %s:? ", where);
+    }
+    fprintf(out, "%s %s%.*s%s %s ways=%d hits=%u misses=%u\n", opcodeName(instruction),
+            quote, nameLength, name, quote, state, cache->count, cache->hits, cache->misses);
+  }
+}
+
+#define OPCODE_PAIR_TOP 24
+
+void dumpOpcodePairs(const uint64_t* counts, FILE* out) {
+  if (!counts) return;
+  uint64_t total = 0;
+  uint32_t top[OPCODE_PAIR_TOP];
+  int topCount = 0;
+  for (uint32_t pair = 0; pair < 256 * 256; pair++) {
+    uint64_t count = counts[pair];
+    if (count == 0) continue;
+    total += count;
+    int at = topCount;
+    while (at > 0 && counts[top[at - 1]] < count) at--;
+    if (at >= OPCODE_PAIR_TOP) continue;
+    int last = topCount < OPCODE_PAIR_TOP ? topCount : OPCODE_PAIR_TOP - 1;
+    memmove(&top[at + 1], &top[at], sizeof(top[0]) * (size_t)(last - at));
+    top[at] = pair;
+    if (topCount < OPCODE_PAIR_TOP) topCount++;
+  }
+  fprintf(out, "opcode pairs total=%llu\n", (unsigned long long)total);
+  for (int i = 0; i < topCount; i++) {
+    uint64_t count = counts[top[i]];
+    fprintf(out, "pair %-24s %-24s %12llu %5.1f%%\n",
+            opcodeName((uint8_t)(top[i] >> 8)), opcodeName((uint8_t)(top[i] & 0xff)),
+            (unsigned long long)count, 100.0 * (double)count / (double)total);
+  }
+}
@@ -5,5 +5,8 @@
 
 void disassembleChunk(const Chunk* chunk, const char* name);
 void disassembleFunction(const ObjFunction* function);
+void dumpInlineCaches(const ObjFunction* function, FILE* out);
+const char* opcodeName(uint8_t instruction);
+void dumpOpcodePairs(const uint64_t* counts, FILE* out);
 
 #endif
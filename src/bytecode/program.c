@@ -1,4 +1,5 @@
 #include "program.h"
+#include "chunk.h"
 #include "interpreter.h"
 
 #include <stdio.h>
@@ -31,6 +32,21 @@ static void programFree(VM* vm, Program* program) {
   free(program);
 }
 
+// Nested prototypes are compiled before their program exists. Each one takes a
+// reference, like any other function that points at the program.
+static void programAdoptPrototypes(Program* program, ObjFunction* function) {
+  if (!function->chunk) return;
+  for (int i = 0; i < function->chunk->constantsCount; i++) {
+    Value constant = function->chunk->constants[i];
+    if (!isObjType(constant, OBJ_FUNCTION)) continue;
+    ObjFunction* proto = (ObjFunction*)AS_OBJ(constant);
+    if (proto->program) continue;
+    proto->program = program;
+    programRetain(program);
+    programAdoptPrototypes(program, proto);
+  }
+}
+
 Program* programCreate(VM* vm, char* source, const char* path, ObjFunction* function) {
   Program* program = (Program*)malloc(sizeof(Program));
   if (!program) {
@@ -57,6 +73,7 @@ Program* programCreate(VM* vm, char* source, const char* path, ObjFunction* func
   program->running = 0;
   program->next = vm->programs;
   vm->programs = program;
+  if (function) programAdoptPrototypes(program, function);
   return program;
 }
 
@@ -1,6 +1,6 @@
 #include "singlepass_internal.h"
 
-#include <math.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -32,7 +32,7 @@ bool constValueFromValue(Value value, ConstValue* out) {
   }
   if (IS_NUMBER(value)) {
     out->type = CONST_NUMBER;
-    out->as.number = AS_NUMBER(value);
+    out->as.number = value;
     return true;
   }
   if (isObjType(value, OBJ_STRING)) {
@@ -53,7 +53,7 @@ bool constValueEquals(const ConstValue* a, const ConstValue* b) {
     case CONST_BOOL:
       return a->as.boolean == b->as.boolean;
     case CONST_NUMBER:
-      return a->as.number == b->as.number;
+      return numbersEqual(a->as.number, b->as.number);
     case CONST_STRING:
       if (a->as.string.length != b->as.string.length) return false;
       return memcmp(a->as.string.chars, b->as.string.chars,
@@ -105,7 +105,11 @@ bool constValueStringify(const ConstValue* input, ConstValue* out) {
       }
       break;
     case CONST_NUMBER:
-      length = snprintf(buffer, sizeof(buffer), "%g", input->as.number);
+      if (IS_INT(input->as.number)) {
+        length = snprintf(buffer, sizeof(buffer), "%" PRId64, AS_INT(input->as.number));
+      } else {
+        length = snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(input->as.number));
+      }
       if (length < 0) length = 0;
       if (length >= (int)sizeof(buffer)) {
         length = (int)sizeof(buffer) - 1;
@@ -131,369 +135,6 @@ bool constValueStringify(const ConstValue* input, ConstValue* out) {
   return true;
 }
 
-typedef struct {
-  uint8_t op;
-  int offset;
-  int length;
-  Token token;
-} InstrInfo;
-
-typedef struct {
-  uint8_t* code;
-  Token* tokens;
-  InlineCache* caches;
-  int count;
-  int capacity;
-} CodeBuilder;
-
-void codeBuilderInit(CodeBuilder* out) {
-  out->code = NULL;
-  out->tokens = NULL;
-  out->caches = NULL;
-  out->count = 0;
-  out->capacity = 0;
-}
-
-void codeBuilderEnsure(CodeBuilder* out, int needed) {
-  if (out->capacity >= needed) return;
-  int oldCapacity = out->capacity;
-  out->capacity = GROW_CAPACITY(oldCapacity);
-  while (out->capacity < needed) {
-    out->capacity = GROW_CAPACITY(out->capacity);
-  }
-  out->code = GROW_ARRAY(uint8_t, out->code, oldCapacity, out->capacity);
-  out->tokens = GROW_ARRAY(Token, out->tokens, oldCapacity, out->capacity);
-  out->caches = GROW_ARRAY(InlineCache, out->caches, oldCapacity, out->capacity);
-  if (out->caches) {
-    memset(out->caches + oldCapacity, 0,
-           sizeof(InlineCache) * (size_t)(out->capacity - oldCapacity));
-  }
-}
-
-void codeEmitByte(CodeBuilder* out, uint8_t byte, Token token) {
-  codeBuilderEnsure(out, out->count + 1);
-  out->code[out->count] = byte;
-  out->tokens[out->count] = token;
-  if (out->caches) {
-    memset(&out->caches[out->count], 0, sizeof(InlineCache));
-  }
-  out->count++;
-}
-
-void codeEmitShort(CodeBuilder* out, uint16_t value, Token token) {
-  codeEmitByte(out, (uint8_t)((value >> 8) & 0xff), token);
-  codeEmitByte(out, (uint8_t)(value & 0xff), token);
-}
-
-int instructionLength(const Chunk* chunk, int offset) {
-  uint8_t op = chunk->code[offset];
-  switch (op) {
-    case OP_CONSTANT:
-    case OP_GET_VAR:
-    case OP_SET_VAR:
-    case OP_DEFINE_VAR:
-    case OP_DEFINE_CONST:
-    case OP_GET_PROPERTY:
-    case OP_GET_PROPERTY_OPTIONAL:
-    case OP_SET_PROPERTY:
-    case OP_GET_THIS:
-    case OP_CLOSURE:
-    case OP_EXPORT:
-    case OP_EXPORT_VALUE:
-    case OP_PRIVATE:
-    case OP_JUMP:
-    case OP_JUMP_IF_FALSE:
-    case OP_LOOP:
-    case OP_TRY:
-    case OP_ARRAY:
-    case OP_MAP:
-      return 3;
-    case OP_MATCH_ENUM:
-      return 5;
-    case OP_EXPORT_FROM: {
-      if (offset + 3 > chunk->count) return 1;
-      uint16_t count = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
-      return 3 + (int)count * 4;
-    }
-    case OP_DEFER:
-    case OP_CALL:
-    case OP_CALL_OPTIONAL:
-      return 2;
-    case OP_INVOKE:
-      return 4;
-    case OP_CLASS:
-      return 5;
-    case OP_STRUCT:
-      return 3;
-    case OP_END_TRY:
-    case OP_THROW:
-    case OP_TRY_UNWRAP:
-      return 1;
-    case OP_IMPORT:
-      return 4;
-    case OP_IMPORT_MODULE:
-      return 1;
-    default:
-      return 1;
-  }
-}
-
-bool instrPushesConst(const Chunk* chunk, const InstrInfo* instr, ConstValue* out) {
-  switch (instr->op) {
-    case OP_TRUE:
-      out->type = CONST_BOOL;
-      out->ownsString = false;
-      out->as.boolean = true;
-      return true;
-    case OP_FALSE:
-      out->type = CONST_BOOL;
-      out->ownsString = false;
-      out->as.boolean = false;
-      return true;
-    case OP_NULL:
-      out->type = CONST_NULL;
-      out->ownsString = false;
-      return true;
-    case OP_CONSTANT: {
-      uint16_t index = (uint16_t)((chunk->code[instr->offset + 1] << 8) |
-                                  chunk->code[instr->offset + 2]);
-      if (index >= (uint16_t)chunk->constantsCount) return false;
-      return constValueFromValue(chunk->constants[index], out);
-    }
-    default:
-      return false;
-  }
-}
-
-static bool emitConstValue(VM* vm, Chunk* chunk, CodeBuilder* out,
-                           const ConstValue* value, Token token) {
-  switch (value->type) {
-    case CONST_NULL:
-      codeEmitByte(out, OP_NULL, token);
-      return true;
-    case CONST_BOOL:
-      codeEmitByte(out, value->as.boolean ? OP_TRUE : OP_FALSE, token);
-      return true;
-    case CONST_NUMBER: {
-      int constant = addConstant(chunk, NUMBER_VAL(value->as.number));
-      if (constant > UINT16_MAX) return false;
-      codeEmitByte(out, OP_CONSTANT, token);
-      codeEmitShort(out, (uint16_t)constant, token);
-      return true;
-    }
-    case CONST_STRING: {
-      ObjString* str = copyStringWithLength(vm, value->as.string.chars,
-                                            value->as.string.length);
-      int constant = addConstant(chunk, OBJ_VAL(str));
-      if (constant > UINT16_MAX) return false;
-      codeEmitByte(out, OP_CONSTANT, token);
-      codeEmitShort(out, (uint16_t)constant, token);
-      return true;
-    }
-  }
-  return false;
-}
-
-static void emitInstructionRaw(CodeBuilder* out, const Chunk* chunk,
-                               const InstrInfo* instr) {
-  for (int i = 0; i < instr->length; i++) {
-    codeEmitByte(out, chunk->code[instr->offset + i],
-                 chunk->tokens[instr->offset + i]);
-  }
-}
-
-void optimizeChunk(VM* vm, Chunk* chunk) {
-  if (!chunk || chunk->count == 0) return;
-  int capacity = 64;
-  int instrCount = 0;
-  InstrInfo* instrs = (InstrInfo*)malloc(sizeof(InstrInfo) * (size_t)capacity);
-  if (!instrs) {
-    fprintf(stderr, "Out of memory.\n");
-    exit(1);
-  }
-
-  int offset = 0;
-  while (offset < chunk->count) {
-    if (instrCount >= capacity) {
-      int oldCap = capacity;
-      capacity = GROW_CAPACITY(oldCap);
-      instrs = GROW_ARRAY(InstrInfo, instrs, oldCap, capacity);
-      if (!instrs) {
-        fprintf(stderr, "Out of memory.\n");
-        exit(1);
-      }
-    }
-    uint8_t op = chunk->code[offset];
-    int length = instructionLength(chunk, offset);
-    if (offset + length > chunk->count) {
-      length = 1;
-    }
-    instrs[instrCount].op = op;
-    instrs[instrCount].offset = offset;
-    instrs[instrCount].length = length;
-    instrs[instrCount].token = chunk->tokens[offset];
-    instrCount++;
-    offset += length;
-  }
-
-  CodeBuilder out;
-  codeBuilderInit(&out);
-
-  for (int i = 0; i < instrCount; ) {
-    ConstValue a;
-    ConstValue b;
-    ConstValue result;
-
-    if (i + 1 < instrCount &&
-        instrPushesConst(chunk, &instrs[i], &a)) {
-      uint8_t op = instrs[i + 1].op;
-      if (op == OP_NEGATE && a.type == CONST_NUMBER) {
-        result.type = CONST_NUMBER;
-        result.ownsString = false;
-        result.as.number = -a.as.number;
-        if (emitConstValue(vm, chunk, &out, &result, instrs[i + 1].token)) {
-          i += 2;
-          continue;
-        }
-      }
-      if (op == OP_NOT) {
-        result.type = CONST_BOOL;
-        result.ownsString = false;
-        result.as.boolean = !constValueIsTruthy(&a);
-        if (emitConstValue(vm, chunk, &out, &result, instrs[i + 1].token)) {
-          i += 2;
-          continue;
-        }
-      }
-      if (op == OP_STRINGIFY) {
-        if (constValueStringify(&a, &result)) {
-          bool emitted = emitConstValue(vm, chunk, &out, &result, instrs[i + 1].token);
-          constValueFree(&result);
-          if (emitted) {
-            i += 2;
-            continue;
-          }
-        }
-      }
-    }
-
-    if (i + 2 < instrCount &&
-        instrPushesConst(chunk, &instrs[i], &a) &&
-        instrPushesConst(chunk, &instrs[i + 1], &b)) {
-      uint8_t op = instrs[i + 2].op;
-      bool folded = false;
-      switch (op) {
-        case OP_ADD:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_NUMBER;
-            result.ownsString = false;
-            result.as.number = a.as.number + b.as.number;
-            folded = true;
-          } else if (constValueConcat(&a, &b, &result)) {
-            folded = true;
-          }
-          break;
-        case OP_SUBTRACT:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_NUMBER;
-            result.ownsString = false;
-            result.as.number = a.as.number - b.as.number;
-            folded = true;
-          }
-          break;
-        case OP_MULTIPLY:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_NUMBER;
-            result.ownsString = false;
-            result.as.number = a.as.number * b.as.number;
-            folded = true;
-          }
-          break;
-        case OP_DIVIDE:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_NUMBER;
-            result.ownsString = false;
-            result.as.number = a.as.number / b.as.number;
-            folded = true;
-          }
-          break;
-        case OP_MODULO:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_NUMBER;
-            result.ownsString = false;
-            result.as.number = fmod(a.as.number, b.as.number);
-            folded = true;
-          }
-          break;
-        case OP_EQUAL:
-          result.type = CONST_BOOL;
-          result.ownsString = false;
-          result.as.boolean = constValueEquals(&a, &b);
-          folded = true;
-          break;
-        case OP_GREATER:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_BOOL;
-            result.ownsString = false;
-            result.as.boolean = a.as.number > b.as.number;
-            folded = true;
-          }
-          break;
-        case OP_GREATER_EQUAL:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_BOOL;
-            result.ownsString = false;
-            result.as.boolean = a.as.number >= b.as.number;
-            folded = true;
-          }
-          break;
-        case OP_LESS:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_BOOL;
-            result.ownsString = false;
-            result.as.boolean = a.as.number < b.as.number;
-            folded = true;
-          }
-          break;
-        case OP_LESS_EQUAL:
-          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
-            result.type = CONST_BOOL;
-            result.ownsString = false;
-            result.as.boolean = a.as.number <= b.as.number;
-            folded = true;
-          }
-          break;
-        default:
-          break;
-      }
-
-      if (folded) {
-        if (emitConstValue(vm, chunk, &out, &result, instrs[i + 2].token)) {
-          constValueFree(&result);
-          i += 3;
-          continue;
-        }
-        constValueFree(&result);
-      }
-    }
-
-    emitInstructionRaw(&out, chunk, &instrs[i]);
-    i++;
-  }
-
-  free(instrs);
-
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(Token, chunk->tokens, chunk->capacity);
-  FREE_ARRAY(InlineCache, chunk->caches, chunk->capacity);
-
-  chunk->code = out.code;
-  chunk->tokens = out.tokens;
-  chunk->caches = out.caches;
-  chunk->count = out.count;
-  chunk->capacity = out.capacity;
-}
-
 bool isAtEnd(Compiler* c) {
   if (c->current >= c->tokens->count) return true;
   return c->tokens->tokens[c->current].type == TOKEN_EOF;
@@ -906,6 +547,11 @@ void emitShort(Compiler* c, uint16_t value, Token token) {
 }
 
 int makeConstant(Compiler* c, Value value, Token token) {
+  // Constants are interned whatever their length, so equal literals share one
+  // string and compare by pointer.
+  if (isObjType(value, OBJ_STRING)) {
+    value = OBJ_VAL(stringIntern(c->vm, (ObjString*)AS_OBJ(value)));
+  }
   int index = addConstant(c->chunk, value);
   if (index > UINT16_MAX) {
     errorAt(c, token, "Too many constants in chunk.");
@@ -965,19 +611,408 @@ int emitTempNameConstant(Compiler* c, const char* prefix) {
   return emitStringConstantFromChars(c, buffer, length);
 }
 
+void compilerInitLocals(Compiler* c, int firstSlot) {
+  c->locals = NULL;
+  c->localCount = 0;
+  c->localCapacity = 0;
+  c->localsDepth = -1;
+  c->nextSlot = firstSlot;
+  c->slotCount = firstSlot;
+  c->upvalues = NULL;
+  c->upvalueCount = 0;
+  c->upvalueCapacity = 0;
+}
+
+void compilerLocalsFree(Compiler* c) {
+  FREE_ARRAY(Local, c->locals, c->localCapacity);
+  FREE_ARRAY(UpvalueRef, c->upvalues, c->upvalueCapacity);
+  c->locals = NULL;
+  c->localCount = 0;
+  c->localCapacity = 0;
+  c->upvalues = NULL;
+  c->upvalueCount = 0;
+  c->upvalueCapacity = 0;
+}
+
+void storeFunctionUpvalues(Compiler* c, ObjFunction* function) {
+  function->upvalueCount = c->upvalueCount;
+  if (c->upvalueCount == 0) return;
+  function->upvalueDescs = (UpvalueDesc*)malloc(sizeof(UpvalueDesc) * (size_t)c->upvalueCount);
+  if (!function->upvalueDescs) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+  for (int i = 0; i < c->upvalueCount; i++) {
+    function->upvalueDescs[i].index = c->upvalues[i].index;
+    function->upvalueDescs[i].isLocal = c->upvalues[i].isLocal;
+    function->upvalueDescs[i].name = c->upvalues[i].name;
+  }
+}
+
+static bool scopeUsesSlots(const Compiler* c, int depth) {
+  return c->localsDepth >= 0 && depth >= c->localsDepth;
+}
+
+// A scope keeps its names in frame slots unless something inside it can
+// observe the Env chain: classes, imports and defers all capture or re-enter
+// vm->env, so those scopes stay on the dynamic path. Nested functions reach
+// slot locals through upvalues instead.
+bool scopeCapturesEnv(Compiler* c, int start) {
+  int depth = 0;
+  for (int i = start; i < c->tokens->count; i++) {
+    switch (c->tokens->tokens[i].type) {
+      case TOKEN_CLASS:
+      case TOKEN_STRUCT:
+      case TOKEN_ENUM:
+      case TOKEN_INTERFACE:
+      case TOKEN_IMPORT:
+      case TOKEN_EXPORT:
+      case TOKEN_PRIVATE:
+      case TOKEN_DEFER:
+        return true;
+      case TOKEN_LEFT_BRACE:
+        depth++;
+        break;
+      case TOKEN_RIGHT_BRACE:
+        if (--depth < 0) return false;
+        break;
+      case TOKEN_EOF:
+        return false;
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+// Returns the index of the '}' closing the body of the function or class
+// declared at `start`, skipping parameter lists and default values.
+static int skipDeclarationBody(Compiler* c, int start) {
+  int nesting = 0;
+  int i = start + 1;
+  for (; i < c->tokens->count; i++) {
+    ErkaoTokenType type = c->tokens->tokens[i].type;
+    if (type == TOKEN_EOF) return i - 1;
+    if (type == TOKEN_LEFT_PAREN || type == TOKEN_LEFT_BRACKET) nesting++;
+    if (type == TOKEN_RIGHT_PAREN || type == TOKEN_RIGHT_BRACKET) nesting--;
+    if (type == TOKEN_LEFT_BRACE && nesting == 0) break;
+  }
+  int depth = 0;
+  for (; i < c->tokens->count; i++) {
+    ErkaoTokenType type = c->tokens->tokens[i].type;
+    if (type == TOKEN_EOF) return i - 1;
+    if (type == TOKEN_LEFT_BRACE) depth++;
+    if (type == TOKEN_RIGHT_BRACE && --depth == 0) return i;
+  }
+  return i;
+}
+
+// A yield inside a nested function or method makes that function the
+// generator, so nested declarations are skipped.
+bool bodyContainsYield(Compiler* c, int start) {
+  int depth = 0;
+  for (int i = start; i < c->tokens->count; i++) {
+    switch (c->tokens->tokens[i].type) {
+      case TOKEN_YIELD:
+        return true;
+      case TOKEN_FUN:
+      case TOKEN_CLASS:
+        i = skipDeclarationBody(c, i);
+        break;
+      case TOKEN_LEFT_BRACE:
+        depth++;
+        break;
+      case TOKEN_RIGHT_BRACE:
+        if (--depth < 0) return false;
+        break;
+      case TOKEN_EOF:
+        return false;
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+static bool localNameEquals(ObjString* a, ObjString* b) {
+  if (a == b) return true;
+  return a->length == b->length && memcmp(a->chars, b->chars, (size_t)a->length) == 0;
+}
+
+int addLocal(Compiler* c, ObjString* name, bool isConst, Token token) {
+  if (c->nextSlot > UINT8_MAX) {
+    errorAt(c, token, "Too many local variables in function.");
+    return -1;
+  }
+  if (c->localCapacity < c->localCount + 1) {
+    int oldCapacity = c->localCapacity;
+    c->localCapacity = GROW_CAPACITY(oldCapacity);
+    c->locals = GROW_ARRAY(Local, c->locals, oldCapacity, c->localCapacity);
+  }
+  Local* local = &c->locals[c->localCount++];
+  local->name = name;
+  local->depth = c->scopeDepth;
+  local->slot = c->nextSlot++;
+  local->isConst = isConst;
+  local->isCaptured = false;
+  local->isDeclared = true;
+  if (c->nextSlot > c->slotCount) {
+    c->slotCount = c->nextSlot;
+  }
+  return local->slot;
+}
+
+// Claims `count` consecutive frame slots for compiler temporaries in the
+// current scope. Returns the first slot, or -1 when the scope has no slots.
+int addTempLocals(Compiler* c, const char* prefix, int count, Token token) {
+  if (!scopeUsesSlots(c, c->scopeDepth)) return -1;
+  int first = -1;
+  for (int i = 0; i < count; i++) {
+    char buffer[64];
+    int length = snprintf(buffer, sizeof(buffer), "__%s%d", prefix, c->tempIndex++);
+    if (length < 0) length = 0;
+    if (length >= (int)sizeof(buffer)) length = (int)sizeof(buffer) - 1;
+    int slot = addLocal(c, copyStringWithLength(c->vm, buffer, length), false, token);
+    if (slot < 0) return -1;
+    if (first < 0) first = slot;
+  }
+  return first;
+}
+
+static Local* findScopeLocal(Compiler* c, ObjString* name) {
+  for (int i = c->localCount - 1; i >= 0; i--) {
+    Local* local = &c->locals[i];
+    if (local->depth < c->scopeDepth) break;
+    if (localNameEquals(local->name, name)) return local;
+  }
+  return NULL;
+}
+
+static int declareLocal(Compiler* c, ObjString* name, bool isConst, Token token) {
+  Local* local = findScopeLocal(c, name);
+  if (local) {
+    local->isConst = isConst;
+    local->isDeclared = true;
+    return local->slot;
+  }
+  return addLocal(c, name, isConst, token);
+}
+
+// Names declared directly in a braced slot scope get their slot up front, so
+// a function declared earlier in the block can still reach a later `let` or
+// `fun`, the way late binding through the Env chain used to allow. Code in
+// the block itself only sees a name once its declaration has run. When the
+// block creates closures, those slots start out unset so that a closure
+// reading one early falls back to the name outside the block.
+void forwardDeclareLocals(Compiler* c, int start) {
+  int depth = 0;
+  int firstLocal = c->localCount;
+  bool createsClosures = false;
+  for (int i = start; i < c->tokens->count - 1 && depth >= 0; i++) {
+    Token* token = &c->tokens->tokens[i];
+    switch (token->type) {
+      case TOKEN_LEFT_BRACE:
+      case TOKEN_LEFT_PAREN:
+      case TOKEN_LEFT_BRACKET:
+        depth++;
+        break;
+      case TOKEN_RIGHT_BRACE:
+      case TOKEN_RIGHT_PAREN:
+      case TOKEN_RIGHT_BRACKET:
+        depth--;
+        break;
+      case TOKEN_EOF:
+        depth = -1;
+        break;
+      case TOKEN_LET:
+      case TOKEN_CONST:
+      case TOKEN_FUN: {
+        if (token->type == TOKEN_FUN) createsClosures = true;
+        Token* next = &c->tokens->tokens[i + 1];
+        if (depth != 0 || next->type != TOKEN_IDENTIFIER) break;
+        ObjString* name = stringFromToken(c->vm, *next);
+        if (findScopeLocal(c, name)) break;
+        if (addLocal(c, name, false, *next) < 0) return;
+        c->locals[c->localCount - 1].isDeclared = false;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  if (!createsClosures) return;
+  for (int i = firstLocal; i < c->localCount; i++) {
+    emitBytes(c, OP_UNSET_LOCAL, (uint8_t)c->locals[i].slot, noToken());
+  }
+}
+
+static Local* resolveLocal(Compiler* c, ObjString* name, bool includeForward) {
+  for (int i = c->localCount - 1; i >= 0; i--) {
+    Local* local = &c->locals[i];
+    if (!includeForward && !local->isDeclared) continue;
+    if (localNameEquals(local->name, name)) {
+      return local;
+    }
+  }
+  return NULL;
+}
+
+static int addUpvalue(Compiler* c, ObjString* name, int index, bool isLocal, bool isConst,
+                      Token token) {
+  for (int i = 0; i < c->upvalueCount; i++) {
+    UpvalueRef* upvalue = &c->upvalues[i];
+    if (upvalue->index == index && upvalue->isLocal == isLocal) {
+      return i;
+    }
+  }
+  if (c->upvalueCount > UINT8_MAX) {
+    errorAt(c, token, "Too many closure variables in function.");
+    return -1;
+  }
+  if (c->upvalueCapacity < c->upvalueCount + 1) {
+    int oldCapacity = c->upvalueCapacity;
+    c->upvalueCapacity = GROW_CAPACITY(oldCapacity);
+    c->upvalues = GROW_ARRAY(UpvalueRef, c->upvalues, oldCapacity, c->upvalueCapacity);
+  }
+  UpvalueRef* upvalue = &c->upvalues[c->upvalueCount];
+  upvalue->name = name;
+  upvalue->index = (uint8_t)index;
+  upvalue->isLocal = isLocal;
+  upvalue->isConst = isConst;
+  return c->upvalueCount++;
+}
+
+static int resolveUpvalue(Compiler* c, ObjString* name, Token token) {
+  Compiler* enclosing = c->enclosing;
+  if (!enclosing) return -1;
+  Local* local = resolveLocal(enclosing, name, true);
+  if (local) {
+    local->isCaptured = true;
+    return addUpvalue(c, name, local->slot, true, local->isConst, token);
+  }
+  int index = resolveUpvalue(enclosing, name, token);
+  if (index < 0) return -1;
+  return addUpvalue(c, name, index, false, enclosing->upvalues[index].isConst, token);
+}
+
+// Methods keep the receiver in slot 0, where the callee sits for plain calls.
+void declareReceiver(Compiler* c) {
+  if (c->localCapacity < c->localCount + 1) {
+    int oldCapacity = c->localCapacity;
+    c->localCapacity = GROW_CAPACITY(oldCapacity);
+    c->locals = GROW_ARRAY(Local, c->locals, oldCapacity, c->localCapacity);
+  }
+  Local* local = &c->locals[c->localCount++];
+  local->name = copyStringWithLength(c->vm, "this", 4);
+  local->depth = 0;
+  local->slot = 0;
+  local->isConst = true;
+  local->isCaptured = false;
+  local->isDeclared = true;
+}
+
+void declareVariable(Compiler* c, int nameIdx, Token token) {
+  if (!scopeUsesSlots(c, c->scopeDepth)) return;
+  ObjString* name = (ObjString*)AS_OBJ(c->chunk->constants[nameIdx]);
+  declareLocal(c, name, false, token);
+}
+
+static bool emitResolvedVariable(Compiler* c, bool isSet, ObjString* name, Token token) {
+  Local* local = resolveLocal(c, name, false);
+  if (local) {
+    if (isSet && local->isConst) {
+      errorAt(c, token, "Cannot assign to const variable.");
+    }
+    emitBytes(c, isSet ? OP_SET_LOCAL : OP_GET_LOCAL, (uint8_t)local->slot, token);
+    return true;
+  }
+  int upvalue = resolveUpvalue(c, name, token);
+  if (upvalue >= 0) {
+    if (isSet && c->upvalues[upvalue].isConst) {
+      errorAt(c, token, "Cannot assign to const variable.");
+    }
+    emitBytes(c, isSet ? OP_SET_UPVALUE : OP_GET_UPVALUE, (uint8_t)upvalue, token);
+    return true;
+  }
+  return false;
+}
+
+void emitVariable(Compiler* c, uint8_t op, int nameIdx, Token token) {
+  ObjString* name = (ObjString*)AS_OBJ(c->chunk->constants[nameIdx]);
+  if (op == OP_DEFINE_VAR || op == OP_DEFINE_CONST) {
+    if (scopeUsesSlots(c, c->scopeDepth)) {
+      int slot = declareLocal(c, name, op == OP_DEFINE_CONST, token);
+      if (slot >= 0) {
+        emitBytes(c, OP_DEFINE_LOCAL, (uint8_t)slot, token);
+        return;
+      }
+    }
+  } else if (emitResolvedVariable(c, op == OP_SET_VAR, name, token)) {
+    return;
+  }
+  emitByte(c, op, token);
+  emitShort(c, (uint16_t)nameIdx, token);
+}
+
+void emitThis(Compiler* c, Token token) {
+  int nameIdx = emitStringConstant(c, token);
+  ObjString* name = (ObjString*)AS_OBJ(c->chunk->constants[nameIdx]);
+  if (emitResolvedVariable(c, false, name, token)) return;
+  emitByte(c, OP_GET_THIS, token);
+  emitShort(c, (uint16_t)nameIdx, token);
+}
+
 void emitGetVarConstant(Compiler* c, int idx) {
-  emitByte(c, OP_GET_VAR, noToken());
-  emitShort(c, (uint16_t)idx, noToken());
+  emitVariable(c, OP_GET_VAR, idx, noToken());
 }
 
 void emitSetVarConstant(Compiler* c, int idx) {
-  emitByte(c, OP_SET_VAR, noToken());
-  emitShort(c, (uint16_t)idx, noToken());
+  emitVariable(c, OP_SET_VAR, idx, noToken());
 }
 
 void emitDefineVarConstant(Compiler* c, int idx) {
-  emitByte(c, OP_DEFINE_VAR, noToken());
-  emitShort(c, (uint16_t)idx, noToken());
+  emitVariable(c, OP_DEFINE_VAR, idx, noToken());
+}
+
+void emitCloseUpvalues(Compiler* c, int firstSlot) {
+  emitBytes(c, OP_CLOSE_UPVALUES, (uint8_t)firstSlot, noToken());
+}
+
+void beginScope(Compiler* c) {
+  c->scopeDepth++;
+  if (c->localsDepth < 0 && !scopeCapturesEnv(c, c->current)) {
+    c->localsDepth = c->scopeDepth;
+  }
+  if (!scopeUsesSlots(c, c->scopeDepth)) {
+    emitByte(c, OP_BEGIN_SCOPE, noToken());
+  } else if (c->current > 0 &&
+             c->tokens->tokens[c->current - 1].type == TOKEN_LEFT_BRACE) {
+    forwardDeclareLocals(c, c->current);
+  }
+}
+
+bool endScope(Compiler* c) {
+  bool usesEnv = !scopeUsesSlots(c, c->scopeDepth);
+  if (usesEnv) {
+    emitByte(c, OP_END_SCOPE, noToken());
+  }
+  int firstSlot = -1;
+  bool captured = false;
+  while (c->localCount > 0 && c->locals[c->localCount - 1].depth >= c->scopeDepth) {
+    Local* local = &c->locals[c->localCount - 1];
+    firstSlot = local->slot;
+    captured = captured || local->isCaptured;
+    c->nextSlot = local->slot;
+    c->localCount--;
+  }
+  if (captured) {
+    emitCloseUpvalues(c, firstSlot);
+  }
+  if (c->localsDepth == c->scopeDepth) {
+    c->localsDepth = -1;
+  }
+  c->scopeDepth--;
+  return usesEnv;
 }
 
 void emitExportName(Compiler* c, Token name) {
@@ -1038,7 +1073,15 @@ void patchJumpList(Compiler* c, JumpList* list, int target, Token token) {
 }
 
 void emitScopeExits(Compiler* c, int targetDepth) {
+  int firstSlot = -1;
+  for (int i = c->localCount - 1; i >= 0 && c->locals[i].depth > targetDepth; i--) {
+    firstSlot = c->locals[i].slot;
+  }
+  if (firstSlot >= 0) {
+    emitCloseUpvalues(c, firstSlot);
+  }
   for (int depth = c->scopeDepth; depth > targetDepth; depth--) {
+    if (scopeUsesSlots(c, depth)) continue;
     emitByte(c, OP_END_SCOPE, noToken());
   }
 }
@@ -24,6 +24,22 @@ typedef struct BreakContext {
   JumpList continues;
 } BreakContext;
 
+typedef struct {
+  ObjString* name;
+  int depth;
+  int slot;
+  bool isConst;
+  bool isCaptured;
+  bool isDeclared;
+} Local;
+
+typedef struct {
+  ObjString* name;
+  uint8_t index;
+  bool isLocal;
+  bool isConst;
+} UpvalueRef;
+
 typedef struct TypeChecker TypeChecker;
 typedef struct EnumInfo EnumInfo;
 typedef struct StructInfo StructInfo;
@@ -38,14 +54,21 @@ typedef struct Compiler {
   bool hadError;
   Chunk* chunk;
   int scopeDepth;
+  Local* locals;
+  int localCount;
+  int localCapacity;
+  int localsDepth;
+  int nextSlot;
+  int slotCount;
+  UpvalueRef* upvalues;
+  int upvalueCount;
+  int upvalueCapacity;
   int tempIndex;
   bool pendingOptionalCall;
   bool forbidCall;
   bool lastExprWasVar;
   Token lastExprVar;
   bool hasYield;
-  int yieldName;
-  int yieldFlagName;
   BreakContext* breakContext;
   struct Compiler* enclosing;
   TypeChecker* typecheck;
@@ -17,7 +17,7 @@ typedef struct {
   bool ownsString;
   union {
     bool boolean;
-    double number;
+    Value number;
     struct { const char* chars; int length; } string;
   } as;
 } ConstValue;
@@ -267,7 +267,7 @@ struct StructInfo {
   int nameLength;
 };
 
-extern TypeRegistry* gTypeRegistry;
+extern ERKAO_THREAD_LOCAL TypeRegistry* gTypeRegistry;
 
 bool isAtEnd(Compiler* c);
 Token peek(Compiler* c);
@@ -302,6 +302,21 @@ int emitTempNameConstant(Compiler* c, const char* prefix);
 void emitGetVarConstant(Compiler* c, int idx);
 void emitSetVarConstant(Compiler* c, int idx);
 void emitDefineVarConstant(Compiler* c, int idx);
+void emitVariable(Compiler* c, uint8_t op, int nameIdx, Token token);
+void compilerInitLocals(Compiler* c, int firstSlot);
+void compilerLocalsFree(Compiler* c);
+bool scopeCapturesEnv(Compiler* c, int start);
+int addLocal(Compiler* c, ObjString* name, bool isConst, Token token);
+int addTempLocals(Compiler* c, const char* prefix, int count, Token token);
+void forwardDeclareLocals(Compiler* c, int start);
+void declareVariable(Compiler* c, int nameIdx, Token token);
+void declareReceiver(Compiler* c);
+bool bodyContainsYield(Compiler* c, int start);
+void emitThis(Compiler* c, Token token);
+void storeFunctionUpvalues(Compiler* c, ObjFunction* function);
+void emitCloseUpvalues(Compiler* c, int firstSlot);
+void beginScope(Compiler* c);
+bool endScope(Compiler* c);
 void emitExportName(Compiler* c, Token name);
 void emitExportValue(Compiler* c, uint16_t nameIdx, Token token);
 void emitPrivateName(Compiler* c, int nameIdx, Token token);
@@ -412,7 +427,7 @@ char* parseStringChars(const char* start, int length);
 bool isTripleQuoted(Token token);
 char* parseStringLiteral(Token token);
 char* parseStringSegment(Token token);
-double parseNumberToken(Token token);
+Value parseNumberToken(Token token);
 bool tokenMatches(Token token, const char* text);
 
 Pattern* parsePattern(Compiler* c);
@@ -0,0 +1,662 @@
+#include "singlepass_internal.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  uint8_t op;
+  int offset;
+  int length;
+  Token token;
+  bool isJumpTarget;
+  bool skipsTargetPop;
+  int newOffset;
+} InstrInfo;
+
+typedef struct {
+  uint8_t* code;
+  Token* tokens;
+  InlineCache* caches;
+  int count;
+  int capacity;
+} CodeBuilder;
+
+void codeBuilderInit(CodeBuilder* out) {
+  out->code = NULL;
+  out->tokens = NULL;
+  out->caches = NULL;
+  out->count = 0;
+  out->capacity = 0;
+}
+
+void codeBuilderEnsure(CodeBuilder* out, int needed) {
+  if (out->capacity >= needed) return;
+  int oldCapacity = out->capacity;
+  out->capacity = GROW_CAPACITY(oldCapacity);
+  while (out->capacity < needed) {
+    out->capacity = GROW_CAPACITY(out->capacity);
+  }
+  out->code = GROW_ARRAY(uint8_t, out->code, oldCapacity, out->capacity);
+  out->tokens = GROW_ARRAY(Token, out->tokens, oldCapacity, out->capacity);
+  out->caches = GROW_ARRAY(InlineCache, out->caches, oldCapacity, out->capacity);
+  if (out->caches) {
+    memset(out->caches + oldCapacity, 0,
+           sizeof(InlineCache) * (size_t)(out->capacity - oldCapacity));
+  }
+}
+
+void codeEmitByte(CodeBuilder* out, uint8_t byte, Token token) {
+  codeBuilderEnsure(out, out->count + 1);
+  out->code[out->count] = byte;
+  out->tokens[out->count] = token;
+  if (out->caches) {
+    memset(&out->caches[out->count], 0, sizeof(InlineCache));
+  }
+  out->count++;
+}
+
+void codeEmitShort(CodeBuilder* out, uint16_t value, Token token) {
+  codeEmitByte(out, (uint8_t)((value >> 8) & 0xff), token);
+  codeEmitByte(out, (uint8_t)(value & 0xff), token);
+}
+
+int instructionLength(const Chunk* chunk, int offset) {
+  uint8_t op = chunk->code[offset];
+  switch (op) {
+    case OP_CONSTANT:
+    case OP_GET_VAR:
+    case OP_SET_VAR:
+    case OP_DEFINE_VAR:
+    case OP_DEFINE_CONST:
+    case OP_GET_PROPERTY:
+    case OP_GET_PROPERTY_OPTIONAL:
+    case OP_SET_PROPERTY:
+    case OP_GET_THIS:
+    case OP_CLOSURE:
+    case OP_EXPORT:
+    case OP_EXPORT_VALUE:
+    case OP_PRIVATE:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_TRY:
+    case OP_ARRAY:
+    case OP_MAP:
+    case OP_GET_LOCAL_GET_LOCAL:
+    case OP_SET_VAR_POP:
+    case OP_LESS_JUMP_IF_FALSE:
+    case OP_ITER_NEXT:
+      return 3;
+    case OP_GET_LOCAL_GET_PROPERTY:
+    case OP_INC_LOCAL:
+    case OP_RANGE_NEXT:
+      return 4;
+    case OP_INC_VAR:
+      return 5;
+    case OP_MATCH_ENUM:
+      return 5;
+    case OP_EXPORT_FROM: {
+      if (offset + 3 > chunk->count) return 1;
+      uint16_t count = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+      return 3 + (int)count * 4;
+    }
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_DEFINE_LOCAL:
+    case OP_UNSET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_CLOSE_UPVALUES:
+    case OP_DEFER:
+    case OP_CALL:
+    case OP_CALL_OPTIONAL:
+    case OP_ITER_INIT:
+    case OP_RANGE_INIT:
+      return 2;
+    case OP_INVOKE:
+      return 4;
+    case OP_CLASS:
+      return 5;
+    case OP_STRUCT:
+      return 3;
+    case OP_END_TRY:
+    case OP_THROW:
+    case OP_TRY_UNWRAP:
+      return 1;
+    case OP_IMPORT:
+      return 4;
+    case OP_IMPORT_MODULE:
+      return 1;
+    default:
+      return 1;
+  }
+}
+
+bool instrPushesConst(const Chunk* chunk, const InstrInfo* instr, ConstValue* out) {
+  switch (instr->op) {
+    case OP_TRUE:
+      out->type = CONST_BOOL;
+      out->ownsString = false;
+      out->as.boolean = true;
+      return true;
+    case OP_FALSE:
+      out->type = CONST_BOOL;
+      out->ownsString = false;
+      out->as.boolean = false;
+      return true;
+    case OP_NULL:
+      out->type = CONST_NULL;
+      out->ownsString = false;
+      return true;
+    case OP_CONSTANT: {
+      uint16_t index = (uint16_t)((chunk->code[instr->offset + 1] << 8) |
+                                  chunk->code[instr->offset + 2]);
+      if (index >= (uint16_t)chunk->constantsCount) return false;
+      return constValueFromValue(chunk->constants[index], out);
+    }
+    default:
+      return false;
+  }
+}
+
+static bool emitConstValue(VM* vm, Chunk* chunk, CodeBuilder* out,
+                           const ConstValue* value, Token token) {
+  switch (value->type) {
+    case CONST_NULL:
+      codeEmitByte(out, OP_NULL, token);
+      return true;
+    case CONST_BOOL:
+      codeEmitByte(out, value->as.boolean ? OP_TRUE : OP_FALSE, token);
+      return true;
+    case CONST_NUMBER: {
+      int constant = addConstant(chunk, value->as.number);
+      if (constant > UINT16_MAX) return false;
+      codeEmitByte(out, OP_CONSTANT, token);
+      codeEmitShort(out, (uint16_t)constant, token);
+      return true;
+    }
+    case CONST_STRING: {
+      ObjString* str = copyStringWithLength(vm, value->as.string.chars,
+                                            value->as.string.length);
+      if (!str) return false;
+      str = stringIntern(vm, str);
+      int constant = addConstant(chunk, OBJ_VAL(str));
+      if (constant > UINT16_MAX) return false;
+      codeEmitByte(out, OP_CONSTANT, token);
+      codeEmitShort(out, (uint16_t)constant, token);
+      return true;
+    }
+  }
+  return false;
+}
+
+// A jump's offset is always the last two bytes of the instruction and counts
+// from the end of it.
+static bool isJumpInstruction(uint8_t op) {
+  return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP || op == OP_TRY ||
+         op == OP_LESS_JUMP_IF_FALSE || op == OP_ITER_NEXT || op == OP_RANGE_NEXT;
+}
+
+static int jumpTargetOffset(const uint8_t* code, int offset, int length) {
+  int end = offset + length;
+  uint16_t jump = (uint16_t)((code[end - 2] << 8) | code[end - 1]);
+  if (code[offset] == OP_LOOP) {
+    return end - (int)jump;
+  }
+  return end + (int)jump;
+}
+
+static int findInstrIndex(const InstrInfo* instrs, int count, int offset) {
+  int low = 0;
+  int high = count - 1;
+  while (low <= high) {
+    int mid = low + (high - low) / 2;
+    if (instrs[mid].offset == offset) return mid;
+    if (instrs[mid].offset < offset) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return -1;
+}
+
+// Folding must not swallow an instruction that a jump lands on, and every
+// jump has to be re-pointed once the folded code shrinks. A conditional jump
+// onto a POP may be fused to land just past it, so that next instruction is
+// kept as a target too.
+static void markJumpTargets(const Chunk* chunk, InstrInfo* instrs, int instrCount) {
+  for (int i = 0; i < instrCount; i++) {
+    if (!isJumpInstruction(instrs[i].op)) continue;
+    int target = findInstrIndex(instrs, instrCount,
+                                jumpTargetOffset(chunk->code, instrs[i].offset,
+                                                 instrs[i].length));
+    if (target < 0) continue;
+    instrs[target].isJumpTarget = true;
+    if (instrs[i].op == OP_JUMP_IF_FALSE && instrs[target].op == OP_POP &&
+        target + 1 < instrCount) {
+      instrs[target + 1].isJumpTarget = true;
+    }
+  }
+}
+
+static void relocateJumps(const Chunk* chunk, const InstrInfo* instrs, int instrCount,
+                          CodeBuilder* out) {
+  for (int i = 0; i < instrCount; i++) {
+    if (!isJumpInstruction(instrs[i].op)) continue;
+    int from = instrs[i].newOffset;
+    int length = instrs[i].length;
+    int oldTarget = jumpTargetOffset(chunk->code, instrs[i].offset, length);
+    int target = oldTarget >= chunk->count
+                     ? out->count
+                     : findInstrIndex(instrs, instrCount, oldTarget);
+    if (from < 0 || target < 0) continue;
+    if (oldTarget < chunk->count && instrs[i].skipsTargetPop) target++;
+    if (oldTarget < chunk->count) {
+      target = target < instrCount ? instrs[target].newOffset : out->count;
+    }
+    int end = from + length;
+    int jump = instrs[i].op == OP_LOOP ? end - target : target - end;
+    if (jump < 0 || jump > UINT16_MAX) continue;
+    out->code[end - 2] = (uint8_t)((jump >> 8) & 0xff);
+    out->code[end - 1] = (uint8_t)(jump & 0xff);
+  }
+}
+
+static void emitInstructionRaw(CodeBuilder* out, const Chunk* chunk,
+                               const InstrInfo* instr) {
+  for (int i = 0; i < instr->length; i++) {
+    codeEmitByte(out, chunk->code[instr->offset + i],
+                 chunk->tokens[instr->offset + i]);
+  }
+}
+
+static uint16_t instrShort(const Chunk* chunk, const InstrInfo* instr, int at) {
+  return (uint16_t)((chunk->code[instr->offset + at] << 8) |
+                    chunk->code[instr->offset + at + 1]);
+}
+
+static uint8_t instrByte(const Chunk* chunk, const InstrInfo* instr, int at) {
+  return chunk->code[instr->offset + at];
+}
+
+static bool instrConstantIs(const Chunk* chunk, const InstrInfo* instr, ObjType type) {
+  uint16_t index = instrShort(chunk, instr, 1);
+  return index < (uint16_t)chunk->constantsCount &&
+         isObjType(chunk->constants[index], type);
+}
+
+// Each emitter returns how many instructions it replaced, or 0 to leave the
+// sequence alone. Operand bytes carry the token of the instruction they came
+// from so runtime errors still point at the right source.
+typedef int (*FusionEmitFn)(const Chunk* chunk, InstrInfo* instrs, int index,
+                            int instrCount, CodeBuilder* out);
+
+// GET x; CONSTANT n; ADD; SET x; POP  ->  INC x n
+static int fuseIncLocal(const Chunk* chunk, InstrInfo* instrs, int index,
+                        int instrCount, CodeBuilder* out) {
+  (void)instrCount;
+  const InstrInfo* get = &instrs[index];
+  const InstrInfo* add = &instrs[index + 2];
+  uint16_t constant = instrShort(chunk, &instrs[index + 1], 1);
+  if (instrByte(chunk, get, 1) != instrByte(chunk, &instrs[index + 3], 1)) return 0;
+  if (constant >= (uint16_t)chunk->constantsCount ||
+      !IS_NUMBER(chunk->constants[constant])) {
+    return 0;
+  }
+  codeEmitByte(out, OP_INC_LOCAL, add->token);
+  codeEmitByte(out, instrByte(chunk, get, 1), add->token);
+  codeEmitShort(out, constant, add->token);
+  return 5;
+}
+
+static int fuseIncVar(const Chunk* chunk, InstrInfo* instrs, int index,
+                      int instrCount, CodeBuilder* out) {
+  (void)instrCount;
+  const InstrInfo* get = &instrs[index];
+  const InstrInfo* add = &instrs[index + 2];
+  const InstrInfo* set = &instrs[index + 3];
+  uint16_t constant = instrShort(chunk, &instrs[index + 1], 1);
+  if (!instrConstantIs(chunk, get, OBJ_STRING) || !instrConstantIs(chunk, set, OBJ_STRING) ||
+      AS_OBJ(chunk->constants[instrShort(chunk, get, 1)]) !=
+          AS_OBJ(chunk->constants[instrShort(chunk, set, 1)])) {
+    return 0;
+  }
+  if (constant >= (uint16_t)chunk->constantsCount ||
+      !IS_NUMBER(chunk->constants[constant])) {
+    return 0;
+  }
+  codeEmitByte(out, OP_INC_VAR, get->token);
+  codeEmitShort(out, instrShort(chunk, get, 1), set->token);
+  codeEmitShort(out, constant, add->token);
+  return 5;
+}
+
+// LESS; JUMP_IF_FALSE; POP where the jump lands on a POP. Neither path needs
+// the boolean, so the jump is re-pointed past the POP at its target. The
+// operand keeps the comparison's token, since a type error in the compare is
+// reported after the operand has been read.
+static int fuseLessJumpIfFalse(const Chunk* chunk, InstrInfo* instrs, int index,
+                               int instrCount, CodeBuilder* out) {
+  InstrInfo* jump = &instrs[index + 1];
+  if (jump->length != 3) return 0;
+  int target = findInstrIndex(instrs, instrCount,
+                              jumpTargetOffset(chunk->code, jump->offset, jump->length));
+  if (target < 0 || target + 1 >= instrCount || instrs[target].op != OP_POP) return 0;
+  jump->newOffset = out->count;
+  jump->skipsTargetPop = true;
+  codeEmitByte(out, OP_LESS_JUMP_IF_FALSE, instrs[index].token);
+  codeEmitShort(out, instrShort(chunk, jump, 1), instrs[index].token);
+  return 3;
+}
+
+static int fuseGetLocalProperty(const Chunk* chunk, InstrInfo* instrs, int index,
+                                int instrCount, CodeBuilder* out) {
+  (void)instrCount;
+  const InstrInfo* local = &instrs[index];
+  const InstrInfo* property = &instrs[index + 1];
+  codeEmitByte(out, OP_GET_LOCAL_GET_PROPERTY, local->token);
+  codeEmitByte(out, instrByte(chunk, local, 1), local->token);
+  codeEmitShort(out, instrShort(chunk, property, 1), property->token);
+  return 2;
+}
+
+static int fuseGetLocals(const Chunk* chunk, InstrInfo* instrs, int index,
+                         int instrCount, CodeBuilder* out) {
+  (void)instrCount;
+  codeEmitByte(out, OP_GET_LOCAL_GET_LOCAL, instrs[index].token);
+  codeEmitByte(out, instrByte(chunk, &instrs[index], 1), instrs[index].token);
+  codeEmitByte(out, instrByte(chunk, &instrs[index + 1], 1), instrs[index + 1].token);
+  return 2;
+}
+
+// A local assignment statement stores and pops, which is what DEFINE_LOCAL does.
+static int fuseSetLocalPop(const Chunk* chunk, InstrInfo* instrs, int index,
+                           int instrCount, CodeBuilder* out) {
+  (void)instrCount;
+  codeEmitByte(out, OP_DEFINE_LOCAL, instrs[index].token);
+  codeEmitByte(out, instrByte(chunk, &instrs[index], 1), instrs[index].token);
+  return 2;
+}
+
+static int fuseSetVarPop(const Chunk* chunk, InstrInfo* instrs, int index,
+                         int instrCount, CodeBuilder* out) {
+  (void)instrCount;
+  codeEmitByte(out, OP_SET_VAR_POP, instrs[index].token);
+  codeEmitShort(out, instrShort(chunk, &instrs[index], 1), instrs[index].token);
+  return 2;
+}
+
+// Nested block ends leave runs of safe points; one is enough.
+static int fuseSafePoints(const Chunk* chunk, InstrInfo* instrs, int index,
+                          int instrCount, CodeBuilder* out) {
+  (void)chunk;
+  int end = index + 1;
+  while (end < instrCount && instrs[end].op == OP_GC && !instrs[end].isJumpTarget) {
+    end++;
+  }
+  codeEmitByte(out, OP_GC, instrs[index].token);
+  return end - index;
+}
+
+static int fuseSmallCall(const Chunk* chunk, InstrInfo* instrs, int index,
+                         int instrCount, CodeBuilder* out) {
+  (void)instrCount;
+  uint8_t argCount = instrByte(chunk, &instrs[index], 1);
+  if (argCount > 2) return 0;
+  codeEmitByte(out, (uint8_t)(OP_CALL0 + argCount), instrs[index].token);
+  return 1;
+}
+
+#define FUSION_MAX_OPS 5
+
+typedef struct {
+  uint8_t ops[FUSION_MAX_OPS];
+  int count;
+  FusionEmitFn emit;
+} FusionRule;
+
+// Picked from `erkao run --profile-opcode-pairs` over bench/. Rules are tried
+// in order, so longer sequences come first.
+static const FusionRule fusionRules[] = {
+  {{OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP}, 5, fuseIncLocal},
+  {{OP_GET_VAR, OP_CONSTANT, OP_ADD, OP_SET_VAR, OP_POP}, 5, fuseIncVar},
+  {{OP_LESS, OP_JUMP_IF_FALSE, OP_POP}, 3, fuseLessJumpIfFalse},
+  {{OP_GET_LOCAL, OP_GET_PROPERTY}, 2, fuseGetLocalProperty},
+  {{OP_GET_LOCAL, OP_GET_LOCAL}, 2, fuseGetLocals},
+  {{OP_SET_LOCAL, OP_POP}, 2, fuseSetLocalPop},
+  {{OP_SET_VAR, OP_POP}, 2, fuseSetVarPop},
+  {{OP_GC, OP_GC}, 2, fuseSafePoints},
+  {{OP_CALL}, 1, fuseSmallCall},
+};
+
+static int fuseInstructions(const Chunk* chunk, InstrInfo* instrs, int index,
+                            int instrCount, CodeBuilder* out) {
+  for (size_t r = 0; r < sizeof(fusionRules) / sizeof(fusionRules[0]); r++) {
+    const FusionRule* rule = &fusionRules[r];
+    if (index + rule->count > instrCount) continue;
+    bool matches = true;
+    for (int k = 0; k < rule->count && matches; k++) {
+      const InstrInfo* instr = &instrs[index + k];
+      matches = instr->op == rule->ops[k] &&
+                instr->length == instructionLength(chunk, instr->offset) &&
+                (k == 0 || !instr->isJumpTarget);
+    }
+    if (!matches) continue;
+    int fused = rule->emit(chunk, instrs, index, instrCount, out);
+    if (fused > 0) return fused;
+  }
+  return 0;
+}
+
+void optimizeChunk(VM* vm, Chunk* chunk) {
+  if (!chunk || chunk->count == 0) return;
+  int capacity = 64;
+  int instrCount = 0;
+  InstrInfo* instrs = (InstrInfo*)malloc(sizeof(InstrInfo) * (size_t)capacity);
+  if (!instrs) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+
+  int offset = 0;
+  while (offset < chunk->count) {
+    if (instrCount >= capacity) {
+      int oldCap = capacity;
+      capacity = GROW_CAPACITY(oldCap);
+      instrs = GROW_ARRAY(InstrInfo, instrs, oldCap, capacity);
+      if (!instrs) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+      }
+    }
+    uint8_t op = chunk->code[offset];
+    int length = instructionLength(chunk, offset);
+    if (offset + length > chunk->count) {
+      length = 1;
+    }
+    instrs[instrCount].op = op;
+    instrs[instrCount].offset = offset;
+    instrs[instrCount].length = length;
+    instrs[instrCount].token = chunk->tokens[offset];
+    instrs[instrCount].isJumpTarget = false;
+    instrs[instrCount].skipsTargetPop = false;
+    instrs[instrCount].newOffset = -1;
+    instrCount++;
+    offset += length;
+  }
+
+  markJumpTargets(chunk, instrs, instrCount);
+
+  CodeBuilder out;
+  codeBuilderInit(&out);
+
+  for (int i = 0; i < instrCount; ) {
+    ConstValue a;
+    ConstValue b;
+    ConstValue result;
+
+    instrs[i].newOffset = out.count;
+
+    if (i + 1 < instrCount &&
+        !instrs[i + 1].isJumpTarget &&
+        instrPushesConst(chunk, &instrs[i], &a)) {
+      uint8_t op = instrs[i + 1].op;
+      if (op == OP_NEGATE && a.type == CONST_NUMBER) {
+        result.type = CONST_NUMBER;
+        result.ownsString = false;
+        result.as.number = numberNegate(a.as.number);
+        if (emitConstValue(vm, chunk, &out, &result, instrs[i + 1].token)) {
+          i += 2;
+          continue;
+        }
+      }
+      if (op == OP_NOT) {
+        result.type = CONST_BOOL;
+        result.ownsString = false;
+        result.as.boolean = !constValueIsTruthy(&a);
+        if (emitConstValue(vm, chunk, &out, &result, instrs[i + 1].token)) {
+          i += 2;
+          continue;
+        }
+      }
+      if (op == OP_STRINGIFY) {
+        if (constValueStringify(&a, &result)) {
+          bool emitted = emitConstValue(vm, chunk, &out, &result, instrs[i + 1].token);
+          constValueFree(&result);
+          if (emitted) {
+            i += 2;
+            continue;
+          }
+        }
+      }
+    }
+
+    if (i + 2 < instrCount &&
+        !instrs[i + 1].isJumpTarget &&
+        !instrs[i + 2].isJumpTarget &&
+        instrPushesConst(chunk, &instrs[i], &a) &&
+        instrPushesConst(chunk, &instrs[i + 1], &b)) {
+      uint8_t op = instrs[i + 2].op;
+      bool folded = false;
+      switch (op) {
+        case OP_ADD:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_NUMBER;
+            result.ownsString = false;
+            result.as.number = numberAdd(a.as.number, b.as.number);
+            folded = true;
+          } else if (constValueConcat(&a, &b, &result)) {
+            folded = true;
+          }
+          break;
+        case OP_SUBTRACT:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_NUMBER;
+            result.ownsString = false;
+            result.as.number = numberSubtract(a.as.number, b.as.number);
+            folded = true;
+          }
+          break;
+        case OP_MULTIPLY:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_NUMBER;
+            result.ownsString = false;
+            result.as.number = numberMultiply(a.as.number, b.as.number);
+            folded = true;
+          }
+          break;
+        case OP_DIVIDE:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_NUMBER;
+            result.ownsString = false;
+            result.as.number = numberDivide(a.as.number, b.as.number);
+            folded = true;
+          }
+          break;
+        case OP_MODULO:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_NUMBER;
+            result.ownsString = false;
+            result.as.number = numberModulo(a.as.number, b.as.number);
+            folded = true;
+          }
+          break;
+        case OP_EQUAL:
+          result.type = CONST_BOOL;
+          result.ownsString = false;
+          result.as.boolean = constValueEquals(&a, &b);
+          folded = true;
+          break;
+        case OP_GREATER:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_BOOL;
+            result.ownsString = false;
+            result.as.boolean = numberLess(b.as.number, a.as.number);
+            folded = true;
+          }
+          break;
+        case OP_GREATER_EQUAL:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_BOOL;
+            result.ownsString = false;
+            result.as.boolean = numberLessEqual(b.as.number, a.as.number);
+            folded = true;
+          }
+          break;
+        case OP_LESS:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_BOOL;
+            result.ownsString = false;
+            result.as.boolean = numberLess(a.as.number, b.as.number);
+            folded = true;
+          }
+          break;
+        case OP_LESS_EQUAL:
+          if (a.type == CONST_NUMBER && b.type == CONST_NUMBER) {
+            result.type = CONST_BOOL;
+            result.ownsString = false;
+            result.as.boolean = numberLessEqual(a.as.number, b.as.number);
+            folded = true;
+          }
+          break;
+        default:
+          break;
+      }
+
+      if (folded) {
+        if (emitConstValue(vm, chunk, &out, &result, instrs[i + 2].token)) {
+          constValueFree(&result);
+          i += 3;
+          continue;
+        }
+        constValueFree(&result);
+      }
+    }
+
+    int fused = fuseInstructions(chunk, instrs, i, instrCount, &out);
+    if (fused > 0) {
+      i += fused;
+      continue;
+    }
+
+    emitInstructionRaw(&out, chunk, &instrs[i]);
+    i++;
+  }
+
+  relocateJumps(chunk, instrs, instrCount, &out);
+
+  free(instrs);
+
+  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY(Token, chunk->tokens, chunk->capacity);
+  FREE_ARRAY(InlineCache, chunk->caches, chunk->capacity);
+
+  chunk->code = out.code;
+  chunk->tokens = out.tokens;
+  chunk->caches = out.caches;
+  chunk->count = out.count;
+  chunk->capacity = out.capacity;
+}
@@ -466,6 +466,14 @@ static bool isTraceFlag(const char* arg) {
   return isFlag(arg, "--trace", NULL);
 }
 
+static bool isDumpCachesFlag(const char* arg) {
+  return isFlag(arg, "--dump-ic", NULL);
+}
+
+static bool isProfilePairsFlag(const char* arg) {
+  return isFlag(arg, "--profile-opcode-pairs", NULL);
+}
+
 static bool optionWithValue(const char* arg, const char* longName, const char** inlineValue) {
   if (!arg || !longName) return false;
   size_t prefixLen = strlen(longName);
@@ -547,12 +555,12 @@ static void printHelp(const char* exe) {
           "Usage:\n"
           "  %s [--help|-h] [--version|-v]\n"
           "  %s repl\n"
-          "  %s run [--bytecode|--disasm] [--trace] <file> [-- args...]\n"
+          "  %s run [--bytecode|--disasm] [--trace] [--dump-ic] [--profile-opcode-pairs] <file> [-- args...]\n"
           "  %s typecheck <file>\n"
           "  %s pkg <command>\n"
           "  %s fmt <file> [--check]\n"
           "  %s lint <file>\n"
-          "  %s [--bytecode|--disasm] [--trace] <file> [args...]\n"
+          "  %s [--bytecode|--disasm] [--trace] [--dump-ic] [--profile-opcode-pairs] <file> [args...]\n"
           "\n"
           "Commands:\n"
           "  run   Run a script file.\n"
@@ -568,6 +576,8 @@ static void printHelp(const char* exe) {
           "  --bytecode     Print bytecode before running.\n"
           "  --disasm       Alias for --bytecode.\n"
           "  --trace        Print source locations as they execute.\n"
+          "  --dump-ic      Print inline cache hit/miss counts per site on exit.\n"
+          "  --profile-opcode-pairs  Print the most frequent adjacent opcode pairs on exit.\n"
           "  --allow-unsafe Enable unsafe features (none|proc|ffi|plugins|all, comma-separated).\n"
           "  --module-path  Add a module search path.\n"
           "  --check        Check formatting without writing changes.\n"
@@ -790,6 +800,16 @@ static int runFileCommand(VM* vm, const char* exe, int argc, const char** argv,
       index++;
       continue;
     }
+    if (isDumpCachesFlag(argv[index])) {
+      vm->dumpInlineCaches = true;
+      index++;
+      continue;
+    }
+    if (isProfilePairsFlag(argv[index])) {
+      vm->profileOpcodePairs = true;
+      index++;
+      continue;
+    }
     if (isFlag(argv[index], "--module-path", "-M")) {
       if (index + 1 >= argc) {
         fprintf(stderr, "Missing value for --module-path.\n");
@@ -984,7 +1004,8 @@ int main(int argc, const char** argv) {
   } else {
     int index = 1;
     while (index < argc) {
-      if (isDebugFlag(argv[index]) || isTraceFlag(argv[index])) {
+      if (isDebugFlag(argv[index]) || isTraceFlag(argv[index]) ||
+          isDumpCachesFlag(argv[index]) || isProfilePairsFlag(argv[index])) {
         index++;
         continue;
       }
@@ -12,6 +12,13 @@
 
 #define ERK_MAX_ARGS 255
 
+// Per-thread storage for the few globals that workers must not share.
+#if defined(_MSC_VER)
+#define ERKAO_THREAD_LOCAL __declspec(thread)
+#else
+#define ERKAO_THREAD_LOCAL __thread
+#endif
+
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
 #define GROW_ARRAY(type, pointer, oldCount, newCount) \
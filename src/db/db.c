@@ -41,7 +41,7 @@ static ObjInstance* makeModule(VM* vm, const char* name) {
   ObjString* className = copyString(vm, name);
   ObjMap* methods = newMap(vm);
   ObjClass* klass = newClass(vm, className, methods);
-  return newInstance(vm, klass);
+  return newInstanceWithFields(vm, klass, newMap(vm));
 }
 
 static void moduleAdd(VM* vm, ObjInstance* module, const char* name, NativeFn fn, int arity) {
@@ -559,12 +559,12 @@ static bool dbSqlAppendWhere(DbSqlBuilder* builder, ObjMap* query, char* error,
   for (int i = 0; i < query->capacity; i++) {
     if (!query->entries[i].key) continue;
     ObjString* key = query->entries[i].key;
-    if (!dbSqlIdentValid(key->chars)) {
-      snprintf(error, errorSize, "Invalid column name '%s'.", key->chars);
+    if (!dbSqlIdentValid(stringChars(key))) {
+      snprintf(error, errorSize, "Invalid column name '%s'.", stringChars(key));
       return false;
     }
     if (clauses > 0) dbStringAppend(&builder->sql, " AND ");
-    dbStringAppend(&builder->sql, key->chars);
+    dbStringAppend(&builder->sql, stringChars(key));
     Value value = query->entries[i].value;
     if (IS_NULL(value)) {
       dbStringAppend(&builder->sql, " IS NULL");
@@ -635,13 +635,13 @@ static bool dbSqlBuildSelect(VM* vm, DbParamStyle style, const char* table,
   if (dbOptionNumber(options, "limit", &limitValue)) {
     if (limitValue >= 0) {
       dbStringAppend(&out->sql, " LIMIT ");
-      dbSqlAddParam(out, NUMBER_VAL(limitValue));
+      dbSqlAddParam(out, INT_VAL((int64_t)limitValue));
     }
   }
   if (dbOptionNumber(options, "offset", &offsetValue)) {
     if (offsetValue >= 0) {
       dbStringAppend(&out->sql, " OFFSET ");
-      dbSqlAddParam(out, NUMBER_VAL(offsetValue));
+      dbSqlAddParam(out, INT_VAL((int64_t)offsetValue));
     }
   }
   return true;
@@ -710,7 +710,7 @@ static Value dbExecResultToValue(VM* vm, const DbExecResult* result) {
     mapSet(map, rowsKey, NULL_VAL);
   }
   if (result && result->affected >= 0) {
-    mapSet(map, affectedKey, NUMBER_VAL((double)result->affected));
+    mapSet(map, affectedKey, INT_VAL((int64_t)result->affected));
   } else {
     mapSet(map, affectedKey, NULL_VAL);
   }
@@ -727,7 +727,7 @@ static DbConnection* dbConnectionFromValue(VM* vm, Value value, ObjInstance** ou
   }
   ObjString* idKey = copyString(vm, "id");
   Value idValue;
-  if (!mapGet(instance->fields, idKey, &idValue) || !IS_NUMBER(idValue)) {
+  if (!instanceGetField(instance, idKey, &idValue) || !IS_NUMBER(idValue)) {
     runtimeErrorValue(vm, "db expects a connection instance.");
     return NULL;
   }
@@ -755,7 +755,7 @@ static Value nativeDbConnect(VM* vm, int argc, Value* args) {
   }
 
   char scheme[32];
-  if (!dbParseScheme(uri->chars, scheme, sizeof(scheme))) {
+  if (!dbParseScheme(stringChars(uri), scheme, sizeof(scheme))) {
     return runtimeErrorValue(vm, "db.connect expects a uri like driver://...");
   }
   const char* driverName = dbNormalizeScheme(scheme);
@@ -767,7 +767,7 @@ static Value nativeDbConnect(VM* vm, int argc, Value* args) {
 
   void* handle = NULL;
   char error[256] = {0};
-  if (!driver->connect || !driver->connect(vm, uri->chars, options, &handle, error, sizeof(error))) {
+  if (!driver->connect || !driver->connect(vm, stringChars(uri), options, &handle, error, sizeof(error))) {
     return runtimeErrorValue(vm, error[0] ? error : "db.connect failed.");
   }
 
@@ -789,16 +789,16 @@ static Value nativeDbConnect(VM* vm, int argc, Value* args) {
   }
 
   ObjInstance* instance = newInstance(vm, state->connectionClass);
-  mapSet(instance->fields, copyString(vm, "id"), NUMBER_VAL((double)conn->id));
-  mapSet(instance->fields, copyString(vm, "driver"), OBJ_VAL(copyString(vm, driver->name)));
-  mapSet(instance->fields, copyString(vm, "kind"),
+  instanceSetField(vm, instance, copyString(vm, "id"), INT_VAL((int64_t)conn->id));
+  instanceSetField(vm, instance, copyString(vm, "driver"), OBJ_VAL(copyString(vm, driver->name)));
+  instanceSetField(vm, instance, copyString(vm, "kind"),
          OBJ_VAL(copyString(vm, driver->kind == DB_KIND_SQL ? "sql" : "document")));
-  mapSet(instance->fields, copyString(vm, "closed"), BOOL_VAL(false));
+  instanceSetField(vm, instance, copyString(vm, "closed"), BOOL_VAL(false));
 
   if (driver == &DB_MEMORY_DRIVER && handle) {
     DbMemoryHandle* mem = (DbMemoryHandle*)handle;
     if (mem->collections) {
-      mapSet(instance->fields, copyString(vm, "store"), OBJ_VAL(mem->collections));
+      instanceSetField(vm, instance, copyString(vm, "store"), OBJ_VAL(mem->collections));
     }
   }
 
@@ -816,7 +816,7 @@ static Value nativeDbClose(VM* vm, int argc, Value* args) {
   conn->open = false;
   conn->handle = NULL;
   if (instance) {
-    mapSet(instance->fields, copyString(vm, "closed"), BOOL_VAL(true));
+    instanceSetField(vm, instance, copyString(vm, "closed"), BOOL_VAL(true));
   }
   return BOOL_VAL(true);
 }
@@ -838,7 +838,7 @@ static Value nativeDbSupports(VM* vm, int argc, Value* args) {
   ObjString* name = dbExpectString(vm, args[0], "db.supports expects a driver name string.");
   if (!name) return NULL_VAL;
   DbState* state = dbStateEnsure(vm);
-  return BOOL_VAL(dbFindDriver(state, name->chars) != NULL);
+  return BOOL_VAL(dbFindDriver(state, stringChars(name)) != NULL);
 }
 
 static Value nativeDbInsert(VM* vm, int argc, Value* args) {
@@ -852,7 +852,7 @@ static Value nativeDbInsert(VM* vm, int argc, Value* args) {
   char error[256] = {0};
   if (conn->driver->insert) {
     Value result = NULL_VAL;
-    if (!conn->driver->insert(vm, conn->handle, collection->chars, doc, &result,
+    if (!conn->driver->insert(vm, conn->handle, stringChars(collection), doc, &result,
                               error, sizeof(error))) {
       return runtimeErrorValue(vm, error[0] ? error : "db.insert failed.");
     }
@@ -861,7 +861,7 @@ static Value nativeDbInsert(VM* vm, int argc, Value* args) {
 
   if (conn->driver->exec && conn->driver->kind == DB_KIND_SQL) {
     DbSqlBuilder builder;
-    if (!dbSqlBuildInsert(vm, conn->driver->paramStyle, collection->chars, doc,
+    if (!dbSqlBuildInsert(vm, conn->driver->paramStyle, stringChars(collection), doc,
                           &builder, error, sizeof(error))) {
       return runtimeErrorValue(vm, error);
     }
@@ -899,7 +899,7 @@ static Value nativeDbFind(VM* vm, int argc, Value* args) {
   char error[256] = {0};
   if (conn->driver->find) {
     ObjArray* results = NULL;
-    if (!conn->driver->find(vm, conn->handle, collection->chars, query, options,
+    if (!conn->driver->find(vm, conn->handle, stringChars(collection), query, options,
                              &results, error, sizeof(error))) {
       return runtimeErrorValue(vm, error[0] ? error : "db.find failed.");
     }
@@ -908,7 +908,7 @@ static Value nativeDbFind(VM* vm, int argc, Value* args) {
 
   if (conn->driver->exec && conn->driver->kind == DB_KIND_SQL) {
     DbSqlBuilder builder;
-    if (!dbSqlBuildSelect(vm, conn->driver->paramStyle, collection->chars, query, options,
+    if (!dbSqlBuildSelect(vm, conn->driver->paramStyle, stringChars(collection), query, options,
                           &builder, error, sizeof(error))) {
       return runtimeErrorValue(vm, error);
     }
@@ -946,16 +946,16 @@ static Value nativeDbUpdate(VM* vm, int argc, Value* args) {
   char error[256] = {0};
   if (conn->driver->update) {
     int updated = 0;
-    if (!conn->driver->update(vm, conn->handle, collection->chars, query, update,
+    if (!conn->driver->update(vm, conn->handle, stringChars(collection), query, update,
                               options, &updated, error, sizeof(error))) {
       return runtimeErrorValue(vm, error[0] ? error : "db.update failed.");
     }
-    return NUMBER_VAL((double)updated);
+    return INT_VAL((int64_t)updated);
   }
 
   if (conn->driver->exec && conn->driver->kind == DB_KIND_SQL) {
     DbSqlBuilder builder;
-    if (!dbSqlBuildUpdate(vm, conn->driver->paramStyle, collection->chars, query, update,
+    if (!dbSqlBuildUpdate(vm, conn->driver->paramStyle, stringChars(collection), query, update,
                           &builder, error, sizeof(error))) {
       return runtimeErrorValue(vm, error);
     }
@@ -967,7 +967,7 @@ static Value nativeDbUpdate(VM* vm, int argc, Value* args) {
       return runtimeErrorValue(vm, error[0] ? error : "db.update failed.");
     }
     int affected = execResult.affected >= 0 ? execResult.affected : 0;
-    return NUMBER_VAL((double)affected);
+    return INT_VAL((int64_t)affected);
   }
 
   return runtimeErrorValue(vm, "db.update not supported by this driver.");
@@ -991,16 +991,16 @@ static Value nativeDbDelete(VM* vm, int argc, Value* args) {
   char error[256] = {0};
   if (conn->driver->remove) {
     int removed = 0;
-    if (!conn->driver->remove(vm, conn->handle, collection->chars, query,
+    if (!conn->driver->remove(vm, conn->handle, stringChars(collection), query,
                               options, &removed, error, sizeof(error))) {
       return runtimeErrorValue(vm, error[0] ? error : "db.delete failed.");
     }
-    return NUMBER_VAL((double)removed);
+    return INT_VAL((int64_t)removed);
   }
 
   if (conn->driver->exec && conn->driver->kind == DB_KIND_SQL) {
     DbSqlBuilder builder;
-    if (!dbSqlBuildDelete(vm, conn->driver->paramStyle, collection->chars, query,
+    if (!dbSqlBuildDelete(vm, conn->driver->paramStyle, stringChars(collection), query,
                           &builder, error, sizeof(error))) {
       return runtimeErrorValue(vm, error);
     }
@@ -1012,7 +1012,7 @@ static Value nativeDbDelete(VM* vm, int argc, Value* args) {
       return runtimeErrorValue(vm, error[0] ? error : "db.delete failed.");
     }
     int affected = execResult.affected >= 0 ? execResult.affected : 0;
-    return NUMBER_VAL((double)affected);
+    return INT_VAL((int64_t)affected);
   }
 
   return runtimeErrorValue(vm, "db.delete not supported by this driver.");
@@ -1040,7 +1040,7 @@ static Value nativeDbExec(VM* vm, int argc, Value* args) {
   }
   DbExecResult result = { NULL, -1 };
   char error[256] = {0};
-  if (!conn->driver->exec(vm, conn->handle, sql->chars, params, &result,
+  if (!conn->driver->exec(vm, conn->handle, stringChars(sql), params, &result,
                           error, sizeof(error))) {
     return runtimeErrorValue(vm, error[0] ? error : "db.exec failed.");
   }
@@ -69,12 +69,15 @@ static bool mongoAppendValue(bson_t* doc, const char* key, Value value) {
   if (IS_BOOL(value)) {
     return bson_append_bool(doc, key, -1, AS_BOOL(value));
   }
+  if (IS_INT(value)) {
+    return bson_append_int64(doc, key, -1, AS_INT(value));
+  }
   if (IS_NUMBER(value)) {
     return bson_append_double(doc, key, -1, AS_NUMBER(value));
   }
   if (isObjType(value, OBJ_STRING)) {
     ObjString* str = (ObjString*)AS_OBJ(value);
-    return bson_append_utf8(doc, key, -1, str->chars, str->length);
+    return bson_append_utf8(doc, key, -1, stringChars(str), str->length);
   }
   if (isObjType(value, OBJ_ARRAY)) {
     return mongoAppendArray(doc, key, (ObjArray*)AS_OBJ(value));
@@ -119,9 +122,9 @@ static Value mongoValueFromBson(VM* vm, bson_iter_t* iter) {
     case BSON_TYPE_BOOL:
       return BOOL_VAL(bson_iter_bool(iter));
     case BSON_TYPE_INT32:
-      return NUMBER_VAL((double)bson_iter_int32(iter));
+      return INT_VAL(bson_iter_int32(iter));
     case BSON_TYPE_INT64:
-      return NUMBER_VAL((double)bson_iter_int64(iter));
+      return INT_VAL(bson_iter_int64(iter));
     case BSON_TYPE_DOUBLE:
       return NUMBER_VAL(bson_iter_double(iter));
     case BSON_TYPE_UTF8: {
@@ -1,6 +1,7 @@
 #include "db.h"
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -89,14 +90,14 @@ static bool mysqlParseUri(const char* uri, MysqlConfig* cfg,
 
 static Value mysqlValueFromString(VM* vm, const char* text) {
   if (!text) return NULL_VAL;
-  if (strcmp(text, "0") == 0) return NUMBER_VAL(0);
-  if (strcmp(text, "1") == 0) return NUMBER_VAL(1);
+  if (strcmp(text, "0") == 0) return INT_VAL(0);
+  if (strcmp(text, "1") == 0) return INT_VAL(1);
   if (strcmp(text, "true") == 0 || strcmp(text, "TRUE") == 0) return BOOL_VAL(true);
   if (strcmp(text, "false") == 0 || strcmp(text, "FALSE") == 0) return BOOL_VAL(false);
   char* end = NULL;
-  double value = strtod(text, &end);
-  if (end && *end == '\0') {
-    return NUMBER_VAL(value);
+  strtod(text, &end);
+  if (end && *end == '\0' && end != text) {
+    return numberFromText(text, (int)(end - text));
   }
   return OBJ_VAL(copyString(vm, text));
 }
@@ -180,7 +181,9 @@ static char* mysqlValueLiteral(MYSQL* conn, Value value, char* error, size_t err
   }
   if (IS_NUMBER(value)) {
     char buffer[64];
-    int length = snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
+    int length = IS_INT(value)
+                     ? snprintf(buffer, sizeof(buffer), "%" PRId64, AS_INT(value))
+                     : snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
     if (length < 0) length = 0;
     return dbStrndup(buffer, (size_t)length);
   }
@@ -196,7 +199,7 @@ static char* mysqlValueLiteral(MYSQL* conn, Value value, char* error, size_t err
       return NULL;
     }
     buffer[0] = '\'';
-    unsigned long written = mysql_real_escape_string(conn, buffer + 1, str->chars,
+    unsigned long written = mysql_real_escape_string(conn, buffer + 1, stringChars(str),
                                                      (unsigned long)str->length);
     buffer[1 + written] = '\'';
     buffer[2 + written] = '\0';
@@ -1,6 +1,7 @@
 #include "db.h"
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,9 +24,9 @@ static Value pgValueFromString(VM* vm, const char* text) {
   if (pgValueIsTrue(text)) return BOOL_VAL(true);
   if (pgValueIsFalse(text)) return BOOL_VAL(false);
   char* end = NULL;
-  double value = strtod(text, &end);
-  if (end && *end == '\0') {
-    return NUMBER_VAL(value);
+  strtod(text, &end);
+  if (end && *end == '\0' && end != text) {
+    return numberFromText(text, (int)(end - text));
   }
   return OBJ_VAL(copyString(vm, text));
 }
@@ -81,7 +82,9 @@ static bool pgExec(VM* vm, void* handle, const char* sql, ObjArray* params,
     }
     if (IS_NUMBER(value)) {
       char buffer[64];
-      int length = snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
+      int length = IS_INT(value)
+                       ? snprintf(buffer, sizeof(buffer), "%" PRId64, AS_INT(value))
+                       : snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
       allocated[i] = (char*)malloc((size_t)length + 1);
       if (!allocated[i]) {
         snprintf(error, errorSize, "postgres exec out of memory.");
@@ -106,7 +109,7 @@ static bool pgExec(VM* vm, void* handle, const char* sql, ObjArray* params,
     }
     if (isObjType(value, OBJ_STRING)) {
       ObjString* string = (ObjString*)AS_OBJ(value);
-      values[i] = string->chars;
+      values[i] = stringChars(string);
       continue;
     }
     snprintf(error, errorSize, "postgres exec unsupported param type.");
@@ -26,18 +26,12 @@ static ParseRule* getRule(ErkaoTokenType type);
 static void number(Compiler* c, bool canAssign) {
   (void)canAssign;
   Token token = previous(c);
-  char* temp = copyTokenLexeme(token);
-  double value = strtod(temp, NULL);
-  free(temp);
-  emitConstant(c, NUMBER_VAL(value), token);
+  emitConstant(c, parseNumberToken(token), token);
   typePush(c, typeNumber());
 }
 
-double parseNumberToken(Token token) {
-  char* temp = copyTokenLexeme(token);
-  double value = strtod(temp, NULL);
-  free(temp);
-  return value;
+Value parseNumberToken(Token token) {
+  return numberFromText(token.start, token.length);
 }
 
 static void string(Compiler* c, bool canAssign) {
@@ -190,8 +184,7 @@ static void matchExpression(Compiler* c, bool canAssign) {
       previousJump = emitJump(c, OP_JUMP_IF_FALSE, keyword);
       emitByte(c, OP_POP, noToken());
 
-      emitByte(c, OP_BEGIN_SCOPE, noToken());
-      c->scopeDepth++;
+      beginScope(c);
       typeCheckerEnterScope(c);
       emitPatternBindings(c, matchValue, &bindings, OP_DEFINE_VAR, matchType);
       if (typecheckEnabled(c) && hasMatchVar &&
@@ -223,8 +216,7 @@ static void matchExpression(Compiler* c, bool canAssign) {
       if (match(c, TOKEN_SEMICOLON)) {
       }
 
-      emitByte(c, OP_END_SCOPE, noToken());
-      c->scopeDepth--;
+      bool scopeUsesEnv = endScope(c);
       typeCheckerExitScope(c);
       emitGc(c);
 
@@ -234,7 +226,7 @@ static void matchExpression(Compiler* c, bool canAssign) {
       if (guardJump != -1) {
         patchJump(c, guardJump, keyword);
         emitByte(c, OP_POP, noToken());
-        emitByte(c, OP_END_SCOPE, noToken());
+        if (scopeUsesEnv) emitByte(c, OP_END_SCOPE, noToken());
         emitGc(c);
       }
 
@@ -308,8 +300,7 @@ static void variable(Compiler* c, bool canAssign) {
   if (check(c, TOKEN_LEFT_BRACE) && findStructInfo(c, name)) {
     c->pendingOptionalCall = false;
     c->lastExprWasVar = false;
-    emitByte(c, OP_GET_VAR, name);
-    emitShort(c, (uint16_t)nameIdx, name);
+    emitVariable(c, OP_GET_VAR, nameIdx, name);
     typePush(c, typeLookup(c, name));
     consume(c, TOKEN_LEFT_BRACE, "Expect '{' after struct name.");
     map(c, false);
@@ -328,11 +319,9 @@ static void variable(Compiler* c, bool canAssign) {
     Type* valueType = typePop(c);
     typeAssign(c, name, valueType);
     typePush(c, valueType);
-    emitByte(c, OP_SET_VAR, name);
-    emitShort(c, (uint16_t)nameIdx, name);
+    emitVariable(c, OP_SET_VAR, nameIdx, name);
   } else {
-    emitByte(c, OP_GET_VAR, name);
-    emitShort(c, (uint16_t)nameIdx, name);
+    emitVariable(c, OP_GET_VAR, nameIdx, name);
     typePush(c, typeLookup(c, name));
     c->lastExprWasVar = true;
     c->lastExprVar = name;
@@ -342,9 +331,7 @@ static void variable(Compiler* c, bool canAssign) {
 static void thisExpr(Compiler* c, bool canAssign) {
   (void)canAssign;
   Token token = previous(c);
-  int name = emitStringConstant(c, token);
-  emitByte(c, OP_GET_THIS, token);
-  emitShort(c, (uint16_t)name, token);
+  emitThis(c, token);
   typePush(c, typeAny());
 }
 
@@ -379,19 +366,7 @@ static void binary(Compiler* c, bool canAssign) {
   Type* left = typePop(c);
   typePush(c, typeBinaryResult(c, op, left, right));
   switch (op.type) {
-    case TOKEN_DOT_DOT: {
-      int rightTemp = emitTempNameConstant(c, "range_r");
-      emitDefineVarConstant(c, rightTemp);
-      int leftTemp = emitTempNameConstant(c, "range_l");
-      emitDefineVarConstant(c, leftTemp);
-      int rangeFn = emitStringConstantFromChars(c, "range", 5);
-      emitGetVarConstant(c, rangeFn);
-      emitGetVarConstant(c, leftTemp);
-      emitGetVarConstant(c, rightTemp);
-      emitByte(c, OP_CALL, op);
-      emitByte(c, 2, op);
-      break;
-    }
+    case TOKEN_DOT_DOT: emitByte(c, OP_RANGE, op); break;
     case TOKEN_PLUS: emitByte(c, OP_ADD, op); break;
     case TOKEN_MINUS: emitByte(c, OP_SUBTRACT, op); break;
     case TOKEN_STAR: emitByte(c, OP_MULTIPLY, op); break;
@@ -972,8 +947,7 @@ static void varDeclaration(Compiler* c, bool isConst, bool isExport, bool isPriv
     }
     consume(c, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
     int nameIdx = emitStringConstant(c, name);
-    emitByte(c, isConst ? OP_DEFINE_CONST : OP_DEFINE_VAR, name);
-    emitShort(c, (uint16_t)nameIdx, name);
+    emitVariable(c, isConst ? OP_DEFINE_CONST : OP_DEFINE_VAR, nameIdx, name);
     if (typecheckEnabled(c)) {
       if (hasType) {
         if (hasInitializer && !typeAssignable(declaredType, valueType)) {
@@ -1074,12 +1048,10 @@ static void block(Compiler* c, Token open) {
 
 static void blockStatement(Compiler* c) {
   Token open = previous(c);
-  emitByte(c, OP_BEGIN_SCOPE, noToken());
-  c->scopeDepth++;
+  beginScope(c);
   typeCheckerEnterScope(c);
   block(c, open);
-  emitByte(c, OP_END_SCOPE, noToken());
-  c->scopeDepth--;
+  endScope(c);
   typeCheckerExitScope(c);
   emitGc(c);
 }
@@ -1103,8 +1075,7 @@ static void ifStatement(Compiler* c) {
     int thenJump = emitJump(c, OP_JUMP_IF_FALSE, keyword);
     emitByte(c, OP_POP, noToken());
 
-    emitByte(c, OP_BEGIN_SCOPE, noToken());
-    c->scopeDepth++;
+    beginScope(c);
     typeCheckerEnterScope(c);
     emitPatternBindings(c, matchValue, &bindings, OP_DEFINE_VAR, matchType);
     if (typecheckEnabled(c) && hasMatchVar &&
@@ -1129,8 +1100,7 @@ static void ifStatement(Compiler* c) {
 
     statement(c);
 
-    emitByte(c, OP_END_SCOPE, noToken());
-    c->scopeDepth--;
+    bool scopeUsesEnv = endScope(c);
     typeCheckerExitScope(c);
     emitGc(c);
 
@@ -1144,7 +1114,7 @@ static void ifStatement(Compiler* c) {
     if (guardJump != -1) {
       patchJump(c, guardJump, keyword);
       emitByte(c, OP_POP, noToken());
-      emitByte(c, OP_END_SCOPE, noToken());
+      if (scopeUsesEnv) emitByte(c, OP_END_SCOPE, noToken());
       emitGc(c);
       guardToElse = emitJump(c, OP_JUMP, keyword);
     }
@@ -1183,8 +1153,7 @@ static void ifStatement(Compiler* c) {
     int thenJump = emitJump(c, OP_JUMP_IF_FALSE, keyword);
     emitByte(c, OP_POP, noToken());
 
-    emitByte(c, OP_BEGIN_SCOPE, noToken());
-    c->scopeDepth++;
+    beginScope(c);
     typeCheckerEnterScope(c);
     emitPatternBindings(c, matchValue, &bindings, OP_DEFINE_VAR, matchType);
     if (typecheckEnabled(c) && hasMatchVar &&
@@ -1210,8 +1179,7 @@ static void ifStatement(Compiler* c) {
     consumeClosing(c, TOKEN_RIGHT_PAREN, "Expect ')' after if condition.", openParen);
     statement(c);
 
-    emitByte(c, OP_END_SCOPE, noToken());
-    c->scopeDepth--;
+    bool scopeUsesEnv = endScope(c);
     typeCheckerExitScope(c);
     emitGc(c);
 
@@ -1225,7 +1193,7 @@ static void ifStatement(Compiler* c) {
     if (guardJump != -1) {
       patchJump(c, guardJump, keyword);
       emitByte(c, OP_POP, noToken());
-      emitByte(c, OP_END_SCOPE, noToken());
+      if (scopeUsesEnv) emitByte(c, OP_END_SCOPE, noToken());
       emitGc(c);
       guardToElse = emitJump(c, OP_JUMP, keyword);
     }
@@ -1289,8 +1257,7 @@ static void whileStatement(Compiler* c) {
     emitByte(c, OP_POP, noToken());
 
     int loopScopeDepth = c->scopeDepth;
-    emitByte(c, OP_BEGIN_SCOPE, noToken());
-    c->scopeDepth++;
+    beginScope(c);
     typeCheckerEnterScope(c);
     emitPatternBindings(c, matchValue, &bindings, OP_DEFINE_VAR, matchType);
     if (typecheckEnabled(c) && hasMatchVar &&
@@ -1322,8 +1289,7 @@ static void whileStatement(Compiler* c) {
     c->breakContext = &loop;
 
     statement(c);
-    emitByte(c, OP_END_SCOPE, noToken());
-    c->scopeDepth--;
+    bool scopeUsesEnv = endScope(c);
     typeCheckerExitScope(c);
     int continueTarget = c->chunk->count;
     emitGc(c);
@@ -1334,7 +1300,7 @@ static void whileStatement(Compiler* c) {
     if (guardJump != -1) {
       patchJump(c, guardJump, keyword);
       emitByte(c, OP_POP, noToken());
-      emitByte(c, OP_END_SCOPE, noToken());
+      if (scopeUsesEnv) emitByte(c, OP_END_SCOPE, noToken());
       emitGc(c);
       guardToExit = emitJump(c, OP_JUMP, keyword);
     }
@@ -1374,8 +1340,7 @@ static void whileStatement(Compiler* c) {
     emitByte(c, OP_POP, noToken());
 
     int loopScopeDepth = c->scopeDepth;
-    emitByte(c, OP_BEGIN_SCOPE, noToken());
-    c->scopeDepth++;
+    beginScope(c);
     typeCheckerEnterScope(c);
     emitPatternBindings(c, matchValue, &bindings, OP_DEFINE_VAR, matchType);
     if (typecheckEnabled(c) && hasMatchVar &&
@@ -1409,8 +1374,7 @@ static void whileStatement(Compiler* c) {
     c->breakContext = &loop;
 
     statement(c);
-    emitByte(c, OP_END_SCOPE, noToken());
-    c->scopeDepth--;
+    bool scopeUsesEnv = endScope(c);
     typeCheckerExitScope(c);
     int continueTarget = c->chunk->count;
     emitGc(c);
@@ -1421,7 +1385,7 @@ static void whileStatement(Compiler* c) {
     if (guardJump != -1) {
       patchJump(c, guardJump, keyword);
       emitByte(c, OP_POP, noToken());
-      emitByte(c, OP_END_SCOPE, noToken());
+      if (scopeUsesEnv) emitByte(c, OP_END_SCOPE, noToken());
       emitGc(c);
       guardToExit = emitJump(c, OP_JUMP, keyword);
     }
@@ -1475,8 +1439,7 @@ static void whileStatement(Compiler* c) {
 
 static void forStatement(Compiler* c) {
   Token keyword = previous(c);
-  emitByte(c, OP_BEGIN_SCOPE, noToken());
-  c->scopeDepth++;
+  beginScope(c);
   typeCheckerEnterScope(c);
   Token openParen = consume(c, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
 
@@ -1541,16 +1504,49 @@ static void forStatement(Compiler* c) {
   freeJumpList(&loop.breaks);
   freeJumpList(&loop.continues);
 
-  emitByte(c, OP_END_SCOPE, noToken());
-  c->scopeDepth--;
+  endScope(c);
   typeCheckerExitScope(c);
   emitGc(c);
 }
 
+// `foreach (i in a..b)` counts in frame slots instead of building a range,
+// when the range is the whole iterable: exactly one `..` at the top level and
+// no operator there that binds looser than it.
+static bool foreachIsCountingRange(Compiler* c) {
+  int depth = 0;
+  int ranges = 0;
+  for (int i = c->current; i < c->tokens->count; i++) {
+    ErkaoTokenType type = c->tokens->tokens[i].type;
+    switch (type) {
+      case TOKEN_LEFT_PAREN:
+      case TOKEN_LEFT_BRACKET:
+      case TOKEN_LEFT_BRACE:
+        depth++;
+        continue;
+      case TOKEN_RIGHT_PAREN:
+      case TOKEN_RIGHT_BRACKET:
+      case TOKEN_RIGHT_BRACE:
+        if (--depth < 0) return ranges == 1;
+        continue;
+      case TOKEN_EOF:
+        return false;
+      default:
+        break;
+    }
+    if (depth > 0) continue;
+    if (type == TOKEN_DOT_DOT) {
+      ranges++;
+      continue;
+    }
+    Precedence prec = getRule(type)->precedence;
+    if (prec != PREC_NONE && prec <= PREC_RANGE) return false;
+  }
+  return false;
+}
+
 static void foreachStatement(Compiler* c) {
   Token keyword = previous(c);
-  emitByte(c, OP_BEGIN_SCOPE, noToken());
-  c->scopeDepth++;
+  beginScope(c);
   typeCheckerEnterScope(c);
   Token openParen = consume(c, TOKEN_LEFT_PAREN, "Expect '(' after 'foreach'.");
 
@@ -1565,39 +1561,37 @@ static void foreachStatement(Compiler* c) {
     hasKey = true;
   }
   consume(c, TOKEN_IN, "Expect 'in' after foreach variable.");
-  expression(c);
-  Type* iterType = typePop(c);
+  int rangeSlot = foreachIsCountingRange(c) ? addTempLocals(c, "range", 3, keyword) : -1;
+  Type* iterType = NULL;
+  if (rangeSlot >= 0) {
+    parsePrecedence(c, (Precedence)(PREC_RANGE + 1));
+    Token dots = consume(c, TOKEN_DOT_DOT, "Expect '..' in range.");
+    parsePrecedence(c, (Precedence)(PREC_RANGE + 1));
+    Type* endType = typePop(c);
+    Type* startType = typePop(c);
+    iterType = typeBinaryResult(c, dots, startType, endType);
+    emitBytes(c, OP_RANGE_INIT, (uint8_t)rangeSlot, dots);
+  } else {
+    expression(c);
+    iterType = typePop(c);
+  }
   consumeClosing(c, TOKEN_RIGHT_PAREN, "Expect ')' after foreach iterable.", openParen);
 
-  int iterableName = emitTempNameConstant(c, "iterable");
-  emitDefineVarConstant(c, iterableName);
-
-  int iterFn = emitStringConstantFromChars(c, "iter", 4);
-  emitGetVarConstant(c, iterFn);
-  emitGetVarConstant(c, iterableName);
-  emitByte(c, OP_CALL, noToken());
-  emitByte(c, 1, noToken());
-  int iterName = emitTempNameConstant(c, "iter");
-  emitDefineVarConstant(c, iterName);
-
-  int loopStart = c->chunk->count;
-  int nextFn = emitStringConstantFromChars(c, "next", 4);
-  emitGetVarConstant(c, nextFn);
-  emitGetVarConstant(c, iterName);
-  emitByte(c, OP_CALL, noToken());
-  emitByte(c, 1, noToken());
-  int stepName = emitTempNameConstant(c, "step");
-  emitDefineVarConstant(c, stepName);
-
-  Token doneToken = syntheticToken("done");
-  emitGetVarConstant(c, stepName);
-  emitPatternKeyConstant(c, doneToken, false, doneToken);
-  emitByte(c, OP_GET_INDEX, keyword);
-  int bodyJump = emitJump(c, OP_JUMP_IF_FALSE, keyword);
-  emitByte(c, OP_POP, noToken());
-  int exitJump = emitJump(c, OP_JUMP, keyword);
-  patchJump(c, bodyJump, keyword);
-  emitByte(c, OP_POP, noToken());
+  int loopStart;
+  int exitJump;
+  if (rangeSlot >= 0) {
+    loopStart = c->chunk->count;
+    emitBytes(c, OP_RANGE_NEXT, (uint8_t)rangeSlot, keyword);
+    emitShort(c, 0xffff, keyword);
+    exitJump = c->chunk->count - 2;
+  } else {
+    emitBytes(c, OP_ITER_INIT, hasKey ? 1 : 0, keyword);
+    int iterName = emitTempNameConstant(c, "iter");
+    emitDefineVarConstant(c, iterName);
+    loopStart = c->chunk->count;
+    emitGetVarConstant(c, iterName);
+    exitJump = emitJump(c, OP_ITER_NEXT, keyword);
+  }
 
   BreakContext loop;
   loop.type = BREAK_LOOP;
@@ -1607,29 +1601,17 @@ static void foreachStatement(Compiler* c) {
   initJumpList(&loop.continues);
   c->breakContext = &loop;
 
-  Token valueField = syntheticToken("value");
-  Token keyField = syntheticToken("key");
-  if (hasKey) {
-    int keyName = emitStringConstant(c, keyToken);
-    int valueName = emitStringConstant(c, valueToken);
-    emitGetVarConstant(c, stepName);
-    emitPatternKeyConstant(c, keyField, false, keyField);
-    emitByte(c, OP_GET_INDEX, keyToken);
-    emitByte(c, OP_DEFINE_VAR, keyToken);
-    emitShort(c, (uint16_t)keyName, keyToken);
-
-    emitGetVarConstant(c, stepName);
-    emitPatternKeyConstant(c, valueField, false, valueField);
-    emitByte(c, OP_GET_INDEX, valueToken);
-    emitByte(c, OP_DEFINE_VAR, valueToken);
-    emitShort(c, (uint16_t)valueName, valueToken);
-  } else {
-    int valueName = emitStringConstant(c, valueToken);
-    emitGetVarConstant(c, stepName);
-    emitPatternKeyConstant(c, valueField, false, valueField);
-    emitByte(c, OP_GET_INDEX, valueToken);
-    emitByte(c, OP_DEFINE_VAR, valueToken);
-    emitShort(c, (uint16_t)valueName, valueToken);
+  // OP_ITER_NEXT leaves the value and then the key on the stack. A counting
+  // range pushes one number, which is both.
+  int keyName = hasKey ? emitStringConstant(c, keyToken) : -1;
+  int valueName = emitStringConstant(c, valueToken);
+  if (hasKey && rangeSlot < 0) {
+    emitVariable(c, OP_DEFINE_VAR, keyName, keyToken);
+  }
+  emitVariable(c, OP_DEFINE_VAR, valueName, valueToken);
+  if (hasKey && rangeSlot >= 0) {
+    emitVariable(c, OP_GET_VAR, valueName, valueToken);
+    emitVariable(c, OP_DEFINE_VAR, keyName, keyToken);
   }
 
   if (typecheckEnabled(c)) {
@@ -1652,7 +1634,7 @@ static void foreachStatement(Compiler* c) {
   }
 
   statement(c);
-  int continueTarget = loopStart;
+  int continueTarget = c->chunk->count;
   emitGc(c);
   emitLoop(c, loopStart, keyword);
   c->breakContext = loop.enclosing;
@@ -1665,8 +1647,7 @@ static void foreachStatement(Compiler* c) {
   freeJumpList(&loop.breaks);
   freeJumpList(&loop.continues);
 
-  emitByte(c, OP_END_SCOPE, noToken());
-  c->scopeDepth--;
+  endScope(c);
   typeCheckerExitScope(c);
   emitGc(c);
 }
@@ -1675,8 +1656,7 @@ static void switchStatement(Compiler* c) {
   Token keyword = previous(c);
   const char* keywordName = keyword.type == TOKEN_MATCH ? "match" : "switch";
   char message[64];
-  emitByte(c, OP_BEGIN_SCOPE, noToken());
-  c->scopeDepth++;
+  beginScope(c);
   typeCheckerEnterScope(c);
   snprintf(message, sizeof(message), "Expect '(' after '%s'.", keywordName);
   Token openParen = consume(c, TOKEN_LEFT_PAREN, message);
@@ -1720,6 +1700,7 @@ static void switchStatement(Compiler* c) {
       }
       int guardJump = -1;
       bool guardScope = false;
+      bool guardScopeUsesEnv = false;
       if (isMatch) {
         Pattern* pattern = parsePattern(c);
         bool hasGuard = false;
@@ -1788,8 +1769,7 @@ static void switchStatement(Compiler* c) {
         previousJump = emitJump(c, OP_JUMP_IF_FALSE, keyword);
         emitByte(c, OP_POP, noToken());
         if (hasGuard) {
-          emitByte(c, OP_BEGIN_SCOPE, noToken());
-          c->scopeDepth++;
+          beginScope(c);
           typeCheckerEnterScope(c);
           guardScope = true;
         }
@@ -1831,8 +1811,7 @@ static void switchStatement(Compiler* c) {
         declaration(c);
       }
       if (guardScope) {
-        emitByte(c, OP_END_SCOPE, noToken());
-        c->scopeDepth--;
+        guardScopeUsesEnv = endScope(c);
         typeCheckerExitScope(c);
         emitGc(c);
       }
@@ -1842,7 +1821,7 @@ static void switchStatement(Compiler* c) {
         patchJump(c, guardJump, keyword);
         emitByte(c, OP_POP, noToken());
         if (guardScope) {
-          emitByte(c, OP_END_SCOPE, noToken());
+          if (guardScopeUsesEnv) emitByte(c, OP_END_SCOPE, noToken());
           emitGc(c);
         }
       }
@@ -1897,8 +1876,7 @@ static void switchStatement(Compiler* c) {
   free(variantUsed);
   constValueListFree(literalUsed, literalUsedCount, literalUsedCapacity);
 
-  emitByte(c, OP_END_SCOPE, noToken());
-  c->scopeDepth--;
+  endScope(c);
   typeCheckerExitScope(c);
   emitGc(c);
 }
@@ -1908,19 +1886,21 @@ static void tryStatement(Compiler* c) {
   Token openBrace = consume(c, TOKEN_LEFT_BRACE, "Expect '{' after 'try'.");
 
   int handlerJump = emitJump(c, OP_TRY, keyword);
+  int firstSlot = c->nextSlot;
 
-  emitByte(c, OP_BEGIN_SCOPE, noToken());
-  c->scopeDepth++;
+  beginScope(c);
   typeCheckerEnterScope(c);
   block(c, openBrace);
-  emitByte(c, OP_END_SCOPE, noToken());
-  c->scopeDepth--;
+  endScope(c);
   typeCheckerExitScope(c);
   emitGc(c);
 
   emitByte(c, OP_END_TRY, keyword);
   int endJump = emitJump(c, OP_JUMP, keyword);
   patchJump(c, handlerJump, keyword);
+  if (c->slotCount > firstSlot) {
+    emitCloseUpvalues(c, firstSlot);
+  }
 
   consume(c, TOKEN_CATCH, "Expect 'catch' after try block.");
   Token openParen = consume(c, TOKEN_LEFT_PAREN, "Expect '(' after 'catch'.");
@@ -1928,21 +1908,18 @@ static void tryStatement(Compiler* c) {
   consumeClosing(c, TOKEN_RIGHT_PAREN, "Expect ')' after catch binding.", openParen);
   Token catchBrace = consume(c, TOKEN_LEFT_BRACE, "Expect '{' after catch clause.");
 
-  emitByte(c, OP_BEGIN_SCOPE, noToken());
-  c->scopeDepth++;
+  beginScope(c);
   typeCheckerEnterScope(c);
 
   int nameIdx = emitStringConstant(c, name);
-  emitByte(c, OP_DEFINE_VAR, name);
-  emitShort(c, (uint16_t)nameIdx, name);
+  emitVariable(c, OP_DEFINE_VAR, nameIdx, name);
   if (typecheckEnabled(c)) {
     typeDefine(c, name, typeAny(), true);
   }
 
   block(c, catchBrace);
 
-  emitByte(c, OP_END_SCOPE, noToken());
-  c->scopeDepth--;
+  endScope(c);
   typeCheckerExitScope(c);
   emitGc(c);
 
@@ -2019,21 +1996,15 @@ static void yieldStatement(Compiler* c) {
     errorAt(c, keyword, "Cannot use 'yield' outside of a function.");
     return;
   }
-  if (c->yieldName < 0 || c->yieldFlagName < 0) {
+  if (!c->hasYield) {
     errorAt(c, keyword, "Yield is not available here.");
     return;
   }
-  emitByte(c, OP_TRUE, keyword);
-  emitSetVarConstant(c, c->yieldFlagName);
-  emitByte(c, OP_POP, noToken());
-  emitGetVarConstant(c, c->yieldName);
   expression(c);
   typePop(c);
   consume(c, TOKEN_SEMICOLON, "Expect ';' after yield value.");
-  emitByte(c, OP_ARRAY_APPEND, keyword);
-  emitByte(c, OP_POP, noToken());
+  emitByte(c, OP_YIELD, keyword);
   emitGc(c);
-  c->hasYield = true;
 }
 
 static void breakStatement(Compiler* c) {
@@ -2088,19 +2059,7 @@ static void returnStatement(Compiler* c) {
     emitByte(c, OP_NULL, noToken());
   }
   consume(c, TOKEN_SEMICOLON, "Expect ';' after return value.");
-  if (c->yieldName >= 0 && c->yieldFlagName >= 0) {
-    emitGetVarConstant(c, c->yieldFlagName);
-    int normalJump = emitJump(c, OP_JUMP_IF_FALSE, keyword);
-    emitByte(c, OP_POP, noToken());
-    emitByte(c, OP_POP, noToken());
-    emitGetVarConstant(c, c->yieldName);
-    emitByte(c, OP_RETURN, keyword);
-    patchJump(c, normalJump, keyword);
-    emitByte(c, OP_POP, noToken());
-    emitByte(c, OP_RETURN, keyword);
-  } else {
-    emitByte(c, OP_RETURN, keyword);
-  }
+  emitByte(c, OP_RETURN, keyword);
 }
 
 static void importStatement(Compiler* c) {
@@ -2171,20 +2130,20 @@ static void fromImportStatement(Compiler* c) {
 }
 
 static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
-                                    Type** outType, bool defineType);
+                                    bool isMethod, Type** outType, bool defineType);
 
 static void functionDeclaration(Compiler* c, bool isExport, bool isPrivate) {
     Token name = consume(c, TOKEN_IDENTIFIER, "Expect function name.");
     Type* functionType = NULL;
-    ObjFunction* function = compileFunction(c, name, false, &functionType, true);
+    int nameIdx = emitStringConstant(c, name);
+    declareVariable(c, nameIdx, name);
+    ObjFunction* function = compileFunction(c, name, false, false, &functionType, true);
     (void)functionType;
   if (!function) return;
   int constant = makeConstant(c, OBJ_VAL(function), name);
   emitByte(c, OP_CLOSURE, name);
   emitShort(c, (uint16_t)constant, name);
-  int nameIdx = emitStringConstant(c, name);
-  emitByte(c, OP_DEFINE_VAR, name);
-  emitShort(c, (uint16_t)nameIdx, name);
+  emitVariable(c, OP_DEFINE_VAR, nameIdx, name);
   if (isPrivate) {
     emitPrivateName(c, nameIdx, name);
   }
@@ -2565,7 +2524,7 @@ static void classDeclarationWithName(Compiler* c, Token name,
       Token methodName = consume(c, TOKEN_IDENTIFIER, "Expect method name.");
       bool isInit = methodName.length == 4 && memcmp(methodName.start, "init", 4) == 0;
       Type* methodType = NULL;
-      ObjFunction* method = compileFunction(c, methodName, isInit,
+      ObjFunction* method = compileFunction(c, methodName, isInit, true,
                                             typecheckEnabled(c) ? &methodType : NULL, false);
       if (!method) {
         classOk = false;
@@ -2657,7 +2616,7 @@ static void enumDeclaration(Compiler* c, bool isExport, bool isPrivate) {
     int arity;
     bool hasPayload;
     bool hasValue;
-    double value;
+    Value value;
   } EnumVariantTemp;
 
   EnumVariantTemp* variants = NULL;
@@ -2684,7 +2643,7 @@ static void enumDeclaration(Compiler* c, bool isExport, bool isPrivate) {
       }
 
       bool hasValue = false;
-      double value = 0.0;
+      Value value = INT_VAL(0);
       if (match(c, TOKEN_EQUAL)) {
         if (hasPayload) {
           errorAt(c, member, "Enum variants with payloads cannot have explicit values.");
@@ -2696,7 +2655,7 @@ static void enumDeclaration(Compiler* c, bool isExport, bool isPrivate) {
         }
         Token numToken = consume(c, TOKEN_NUMBER, "Expect number after '='.");
         value = parseNumberToken(numToken);
-        if (negative) value = -value;
+        if (negative) value = numberNegate(value);
       }
 
       if (variantCount >= variantCapacity) {
@@ -2734,7 +2693,7 @@ static void enumDeclaration(Compiler* c, bool isExport, bool isPrivate) {
   int sizeOffset = c->chunk->count - 2;
 
   if (!anyPayload) {
-    double nextValue = 0.0;
+    Value nextValue = INT_VAL(0);
     for (int i = 0; i < variantCount; i++) {
       Token member = variants[i].name;
       enumInfoAddVariant(enumInfo, member, 0);
@@ -2742,10 +2701,10 @@ static void enumDeclaration(Compiler* c, bool isExport, bool isPrivate) {
       ObjString* keyStr = takeStringWithLength(c->vm, memberName, member.length);
       emitConstant(c, OBJ_VAL(keyStr), member);
 
-      double value = variants[i].hasValue ? variants[i].value : nextValue;
-      nextValue = value + 1.0;
+      Value value = variants[i].hasValue ? variants[i].value : nextValue;
+      nextValue = numberAdd(value, INT_VAL(1));
 
-      emitConstant(c, NUMBER_VAL(value), member);
+      emitConstant(c, value, member);
       emitByte(c, OP_MAP_SET, member);
     }
   } else {
@@ -2845,7 +2804,7 @@ static void exportDeclaration(Compiler* c) {
         if (match(c, TOKEN_FUN)) {
         Token name = consume(c, TOKEN_IDENTIFIER, "Expect function name.");
         Type* functionType = NULL;
-        ObjFunction* function = compileFunction(c, name, false, &functionType, true);
+        ObjFunction* function = compileFunction(c, name, false, false, &functionType, true);
         (void)functionType;
         if (!function) return;
       int constant = makeConstant(c, OBJ_VAL(function), name);
@@ -3086,7 +3045,7 @@ static void statement(Compiler* c) {
 }
 
 static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
-                                    Type** outType, bool defineType) {
+                                    bool isMethod, Type** outType, bool defineType) {
   int typeParamCount = 0;
   TypeParam* typeParams = parseTypeParams(c, &typeParamCount);
   int savedTypeParamCount = 0;
@@ -3236,6 +3195,11 @@ static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
   }
   Token openBrace = consume(c, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
   int bodyStart = c->current;
+  // Calling a generator returns the generator, whatever the body returns.
+  bool isGenerator = bodyContainsYield(c, bodyStart);
+  if (isGenerator) {
+    returnType = typeAny();
+  }
 
   Type* functionType = NULL;
   if (outType) {
@@ -3263,6 +3227,7 @@ static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
 
   ObjString* fnName = stringFromToken(c->vm, name);
   ObjFunction* function = newFunction(c->vm, fnName, arity, minArity, isInitializer, params, chunk, NULL, NULL);
+  function->isGenerator = isGenerator;
 
   Compiler fnCompiler;
   fnCompiler.vm = c->vm;
@@ -3274,14 +3239,27 @@ static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
   fnCompiler.hadError = false;
   fnCompiler.chunk = chunk;
   fnCompiler.scopeDepth = 0;
+  compilerInitLocals(&fnCompiler, 1);
+  if (isMethod) {
+    declareReceiver(&fnCompiler);
+  }
+  if (!scopeCapturesEnv(&fnCompiler, bodyStart)) {
+    fnCompiler.localsDepth = 0;
+    for (int i = 0; i < arity; i++) {
+      addLocal(&fnCompiler, params[i], false, paramTokens[i]);
+    }
+    forwardDeclareLocals(&fnCompiler, bodyStart);
+    function->paramsInSlots = true;
+  } else {
+    fnCompiler.nextSlot = 1 + arity;
+    fnCompiler.slotCount = 1 + arity;
+  }
   fnCompiler.tempIndex = 0;
   fnCompiler.pendingOptionalCall = false;
   fnCompiler.forbidCall = false;
   fnCompiler.lastExprWasVar = false;
   memset(&fnCompiler.lastExprVar, 0, sizeof(Token));
-  fnCompiler.hasYield = false;
-  fnCompiler.yieldName = -1;
-  fnCompiler.yieldFlagName = -1;
+  fnCompiler.hasYield = isGenerator;
   fnCompiler.breakContext = NULL;
   fnCompiler.enclosing = c;
   fnCompiler.enums = NULL;
@@ -3308,25 +3286,12 @@ static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
     }
   }
 
-  fnCompiler.yieldName = emitStringConstantFromChars(&fnCompiler, "__yield", 7);
-  emitByte(&fnCompiler, OP_ARRAY, noToken());
-  emitShort(&fnCompiler, 0, noToken());
-  emitDefineVarConstant(&fnCompiler, fnCompiler.yieldName);
-  fnCompiler.yieldFlagName = emitStringConstantFromChars(&fnCompiler, "__yield_used", 12);
-  emitByte(&fnCompiler, OP_FALSE, noToken());
-  emitDefineVarConstant(&fnCompiler, fnCompiler.yieldFlagName);
-  if (typecheckEnabled(&fnCompiler)) {
-    typeDefine(&fnCompiler, syntheticToken("__yield"),
-               typeArray(fnCompiler.typecheck, typeAny()), true);
-    typeDefine(&fnCompiler, syntheticToken("__yield_used"), typeBool(), true);
-  }
-
   for (int i = 0; i < arity; i++) {
     if (!defaultStarts || defaultStarts[i] < 0) continue;
 
     Token ptoken = paramTokens[i];
     emitByte(&fnCompiler, OP_ARG_COUNT, ptoken);
-    emitConstant(&fnCompiler, NUMBER_VAL((double)(i + 1)), ptoken);
+    emitConstant(&fnCompiler, INT_VAL(i + 1), ptoken);
     emitByte(&fnCompiler, OP_LESS, ptoken);
     int skipJump = emitJump(&fnCompiler, OP_JUMP_IF_FALSE, ptoken);
     emitByte(&fnCompiler, OP_POP, noToken());
@@ -3347,8 +3312,7 @@ static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
     fnCompiler.current = savedCurrent;
 
     int nameIndex = emitStringConstant(&fnCompiler, ptoken);
-    emitByte(&fnCompiler, OP_SET_VAR, ptoken);
-    emitShort(&fnCompiler, (uint16_t)nameIndex, ptoken);
+    emitVariable(&fnCompiler, OP_SET_VAR, nameIndex, ptoken);
     emitByte(&fnCompiler, OP_POP, noToken());
 
     int endJump = emitJump(&fnCompiler, OP_JUMP, ptoken);
@@ -3384,19 +3348,7 @@ static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
   consumeClosing(&fnCompiler, TOKEN_RIGHT_BRACE, "Expect '}' after function body.", openBrace);
 
   emitByte(&fnCompiler, OP_NULL, noToken());
-  if (fnCompiler.yieldName >= 0 && fnCompiler.yieldFlagName >= 0) {
-    emitGetVarConstant(&fnCompiler, fnCompiler.yieldFlagName);
-    int normalJump = emitJump(&fnCompiler, OP_JUMP_IF_FALSE, noToken());
-    emitByte(&fnCompiler, OP_POP, noToken());
-    emitByte(&fnCompiler, OP_POP, noToken());
-    emitGetVarConstant(&fnCompiler, fnCompiler.yieldName);
-    emitByte(&fnCompiler, OP_RETURN, noToken());
-    patchJump(&fnCompiler, normalJump, noToken());
-    emitByte(&fnCompiler, OP_POP, noToken());
-    emitByte(&fnCompiler, OP_RETURN, noToken());
-  } else {
-    emitByte(&fnCompiler, OP_RETURN, noToken());
-  }
+  emitByte(&fnCompiler, OP_RETURN, noToken());
 
   c->current = fnCompiler.current;
 
@@ -3424,6 +3376,9 @@ static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
   typeCheckerFree(&fnTypeChecker);
   compilerEnumsFree(&fnCompiler);
   compilerStructsFree(&fnCompiler);
+  function->slotCount = fnCompiler.slotCount;
+  storeFunctionUpvalues(&fnCompiler, function);
+  compilerLocalsFree(&fnCompiler);
 
   if (fnCompiler.hadError) {
     c->hadError = true;
@@ -3431,6 +3386,7 @@ static ObjFunction* compileFunction(Compiler* c, Token name, bool isInitializer,
   }
 
   optimizeChunk(c->vm, chunk);
+  functionFinishChunk(c->vm, function);
   return function;
 }
 
@@ -3463,14 +3419,13 @@ ObjFunction* compileSinglePassLegacyBody(VM* vm, const TokenArray* tokens,
   c.hadError = false;
   c.chunk = chunk;
   c.scopeDepth = 0;
+  compilerInitLocals(&c, 1);
   c.tempIndex = 0;
   c.pendingOptionalCall = false;
   c.forbidCall = false;
   c.lastExprWasVar = false;
   memset(&c.lastExprVar, 0, sizeof(Token));
   c.hasYield = false;
-  c.yieldName = -1;
-  c.yieldFlagName = -1;
   c.breakContext = NULL;
   c.enclosing = NULL;
   c.typecheck = &typecheck;
@@ -3490,6 +3445,8 @@ ObjFunction* compileSinglePassLegacyBody(VM* vm, const TokenArray* tokens,
 
   vm->compiler = NULL;
   gTypeRegistry = NULL;
+  function->slotCount = c.slotCount;
+  compilerLocalsFree(&c);
 
   *hadErrorOut = c.hadError;
   if (c.hadError) {
@@ -3503,6 +3460,7 @@ ObjFunction* compileSinglePassLegacyBody(VM* vm, const TokenArray* tokens,
   compilerStructsFree(&c);
   typeCheckerFree(&typecheck);
   typeRegistryFree(&registry);
+  functionFinishChunk(vm, function);
   return function;
 }
 
@@ -3527,6 +3485,7 @@ ObjFunction* compileSinglePassLegacyUnoptimized(VM* vm, const TokenArray* tokens
 void compileSinglePassLegacyOptimize(VM* vm, ObjFunction* function) {
   if (!vm || !function || !function->chunk) return;
   optimizeChunk(vm, function->chunk);
+  functionFinishChunk(vm, function);
 }
 
 ObjFunction* compileSinglePassLegacy(VM* vm, const TokenArray* tokens,
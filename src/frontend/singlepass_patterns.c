@@ -539,7 +539,7 @@ static void emitPatternValueSteps(Compiler* c, int switchValue,
       emitPatternKeyConstant(c, step.key, step.keyIsString, token);
       emitByte(c, OP_GET_INDEX, token);
     } else {
-      emitConstant(c, NUMBER_VAL((double)step.index), token);
+      emitConstant(c, INT_VAL(step.index), token);
       emitByte(c, OP_GET_INDEX, token);
     }
   }
@@ -553,8 +553,7 @@ void emitPatternLiteral(Compiler* c, Pattern* pattern) {
   Token token = pattern->token;
   switch (token.type) {
     case TOKEN_NUMBER: {
-      double value = parseNumberToken(token);
-      emitConstant(c, NUMBER_VAL(value), token);
+      emitConstant(c, parseNumberToken(token), token);
       break;
     }
     case TOKEN_STRING: {
@@ -758,8 +757,7 @@ static void emitPatternChecks(Compiler* c, int switchValue, Pattern* pattern,
       }
       emitPatternValue(c, switchValue, path, pattern->token);
       int nameIdx = emitStringConstant(c, pattern->token);
-      emitByte(c, OP_GET_VAR, pattern->token);
-      emitShort(c, (uint16_t)nameIdx, pattern->token);
+      emitVariable(c, OP_GET_VAR, nameIdx, pattern->token);
       emitByte(c, OP_EQUAL, pattern->token);
       emitPatternCheckJump(c, failJumps, pattern->token);
       return;
@@ -777,7 +775,7 @@ static void emitPatternChecks(Compiler* c, int switchValue, Pattern* pattern,
 
       emitPatternValue(c, switchValue, path, pattern->token);
       emitByte(c, OP_LEN, pattern->token);
-      emitConstant(c, NUMBER_VAL((double)pattern->as.array.count), pattern->token);
+      emitConstant(c, INT_VAL(pattern->as.array.count), pattern->token);
       emitByte(c, pattern->as.array.hasRest ? OP_GREATER_EQUAL : OP_EQUAL, pattern->token);
       emitPatternCheckJump(c, failJumps, pattern->token);
 
@@ -893,8 +891,7 @@ static void emitPatternChecksDetailed(Compiler* c, int switchValue, Pattern* pat
       }
       emitPatternValue(c, switchValue, path, pattern->token);
       int nameIdx = emitStringConstant(c, pattern->token);
-      emitByte(c, OP_GET_VAR, pattern->token);
-      emitShort(c, (uint16_t)nameIdx, pattern->token);
+      emitVariable(c, OP_GET_VAR, nameIdx, pattern->token);
       emitByte(c, OP_EQUAL, pattern->token);
       emitPatternCheckJumpDetailed(c, failures, path, pattern->token);
       return;
@@ -912,7 +909,7 @@ static void emitPatternChecksDetailed(Compiler* c, int switchValue, Pattern* pat
 
       emitPatternValue(c, switchValue, path, pattern->token);
       emitByte(c, OP_LEN, pattern->token);
-      emitConstant(c, NUMBER_VAL((double)pattern->as.array.count), pattern->token);
+      emitConstant(c, INT_VAL(pattern->as.array.count), pattern->token);
       emitByte(c, pattern->as.array.hasRest ? OP_GREATER_EQUAL : OP_EQUAL, pattern->token);
       emitPatternCheckJumpDetailed(c, failures, path, pattern->token);
 
@@ -1194,7 +1191,7 @@ void emitPatternBindings(Compiler* c, int switchValue, PatternBindingList* bindi
         int restFn = emitStringConstantFromChars(c, "arrayRest", 9);
         emitGetVarConstant(c, restFn);
         emitGetVarConstant(c, arrayTemp);
-        emitConstant(c, NUMBER_VAL((double)binding->restIndex), binding->name);
+        emitConstant(c, INT_VAL(binding->restIndex), binding->name);
         emitByte(c, OP_CALL, binding->name);
         emitByte(c, 2, binding->name);
         break;
@@ -1216,8 +1213,7 @@ void emitPatternBindings(Compiler* c, int switchValue, PatternBindingList* bindi
       }
     }
     int nameIdx = emitStringConstant(c, binding->name);
-    emitByte(c, defineOp, binding->name);
-    emitShort(c, (uint16_t)nameIdx, binding->name);
+    emitVariable(c, defineOp, nameIdx, binding->name);
     if (defineOp == OP_SET_VAR) {
       emitByte(c, OP_POP, binding->name);
     }
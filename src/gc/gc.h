@@ -18,6 +18,7 @@ void gcRememberObjectIfYoungRefs(VM* vm, Obj* object);
 void gcMaybe(VM* vm);
 void gcCollect(VM* vm);
 void freeObject(VM* vm, Obj* object);
+void gcDumpInlineCaches(VM* vm, bool unmarkedOnly);
 size_t gcTotalHeapBytes(const VM* vm);
 
 #endif
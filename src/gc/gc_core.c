@@ -130,10 +130,8 @@ static void rebuildRemembered(VM* vm) {
 void gcWriteBarrier(VM* vm, Obj* owner, Value value) {
   if (!vm || !owner) return;
   if (owner->generation != OBJ_GEN_OLD) return;
-  if (!IS_OBJ(value)) return;
-
-  Obj* child = AS_OBJ(value);
-  if (child->generation != OBJ_GEN_YOUNG) return;
+  Obj* child = valueHeapObject(value);
+  if (!child || child->generation != OBJ_GEN_YOUNG) return;
   rememberObject(vm, owner);
 }
 
@@ -206,6 +204,10 @@ void gcCollect(VM* vm) {
 
   markRoots(vm);
   traceFull(vm);
+  stringTableRemoveUnmarked(&vm->strings);
+  if (vm->dumpInlineCaches) {
+    gcDumpInlineCaches(vm, true);
+  }
   sweepYoung(vm, true);
   updateYoungNext(vm);
 
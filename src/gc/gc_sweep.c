@@ -1,22 +1,30 @@
 #include "gc_internal.h"
 #include "chunk.h"
 #include "program.h"
+#include "disasm.h"
 
 void freeObject(VM* vm, Obj* object) {
   switch (object->type) {
     case OBJ_STRING: {
       ObjString* string = (ObjString*)object;
-      free(string->chars);
+      if (string->chars && string->chars != string->bytes) {
+        releaseExternalString(string);
+      }
       free(string);
       return;
     }
     case OBJ_FUNCTION: {
       ObjFunction* function = (ObjFunction*)object;
-      if (function->chunk) {
-        freeChunk(function->chunk);
-        free(function->chunk);
+      if (function->proto) {
+        FREE_ARRAY(ObjUpvalue*, function->upvalues, function->upvalueCount);
+      } else {
+        if (function->chunk) {
+          freeChunk(function->chunk);
+          free(function->chunk);
+        }
+        FREE_ARRAY(ObjString*, function->params, function->arity);
+        FREE_ARRAY(UpvalueDesc, function->upvalueDescs, function->upvalueCount);
       }
-      FREE_ARRAY(ObjString*, function->params, function->arity);
       programRelease(vm, function->program);
       free(function);
       return;
@@ -30,9 +38,12 @@ void freeObject(VM* vm, Obj* object) {
     case OBJ_CLASS:
       free(object);
       return;
-    case OBJ_INSTANCE:
-      free(object);
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)object;
+      FREE_ARRAY(Value, instance->slots, instance->slotCapacity);
+      free(instance);
       return;
+    }
     case OBJ_ARRAY: {
       ObjArray* array = (ObjArray*)object;
       FREE_ARRAY(Value, array->items, array->capacity);
@@ -48,6 +59,49 @@ void freeObject(VM* vm, Obj* object) {
     case OBJ_BOUND_METHOD:
       free(object);
       return;
+    case OBJ_UPVALUE:
+      free(object);
+      return;
+    case OBJ_ITERATOR:
+    case OBJ_RANGE:
+    case OBJ_TYPED_ARRAY:
+    case OBJ_BOXED_INT:
+      free(object);
+      return;
+    case OBJ_STRING_BUILDER:
+      stringBuilderRelease((ObjStringBuilder*)object);
+      free(object);
+      return;
+    case OBJ_GENERATOR:
+      generatorRelease((ObjGenerator*)object);
+      free(object);
+      return;
+    case OBJ_FIBER: {
+      ObjFiber* fiber = (ObjFiber*)object;
+      fiberRelease(fiber);
+      FREE_ARRAY(ObjFiber*, fiber->waiters, fiber->waiterCapacity);
+      FREE_ARRAY(ObjChannel*, fiber->waitChannels, fiber->waitChannelCapacity);
+      free(fiber);
+      return;
+    }
+    case OBJ_CHANNEL: {
+      ObjChannel* channel = (ObjChannel*)object;
+      FREE_ARRAY(Value, channel->items, channel->capacity);
+      FREE_ARRAY(ChannelReceiver, channel->receivers, channel->receiverCapacity);
+      FREE_ARRAY(ChannelSender, channel->senders, channel->senderCapacity);
+      free(channel);
+      return;
+    }
+    case OBJ_WORKER:
+      workerRelease((ObjWorker*)object);
+      free(object);
+      return;
+    case OBJ_SHAPE: {
+      ObjShape* shape = (ObjShape*)object;
+      FREE_ARRAY(ObjShape*, shape->transitions, shape->transitionCapacity);
+      free(shape);
+      return;
+    }
   }
 }
 
@@ -139,3 +193,18 @@ bool sweepOldStep(VM* vm, size_t budget) {
 
   return vm->gcSweepOld == NULL && vm->gcSweepEnv == NULL;
 }
+
+// Functions are dumped before anything is freed so their constants still name
+// each site.
+void gcDumpInlineCaches(VM* vm, bool unmarkedOnly) {
+  Obj* lists[2] = {vm->oldObjects, vm->youngObjects};
+  for (int i = 0; i < 2; i++) {
+    for (Obj* object = lists[i]; object; object = object->next) {
+      if (object->type != OBJ_FUNCTION || (unmarkedOnly && object->marked)) continue;
+      ObjFunction* function = (ObjFunction*)object;
+      if (!function->proto) {
+        dumpInlineCaches(function, stderr);
+      }
+    }
+  }
+}
@@ -8,11 +8,13 @@ static void markEnv(VM* vm, Env* env);
 static void blackenObject(VM* vm, Obj* object);
 static void blackenEnv(VM* vm, Env* env);
 static void markChunk(VM* vm, Chunk* chunk);
+static void markFrame(VM* vm, CallFrame* frame);
 
 static void markYoungValue(VM* vm, Value value);
 static void markYoungObject(VM* vm, Obj* object);
 static void markYoungFromEnv(VM* vm, Env* env);
 static void markYoungChunk(VM* vm, Chunk* chunk);
+static void markYoungFrame(VM* vm, CallFrame* frame);
 static bool valueHasYoung(Value value);
 static bool envHasYoungValues(Env* env);
 
@@ -49,9 +51,8 @@ static void markEnv(VM* vm, Env* env) {
 }
 
 static void markValue(VM* vm, Value value) {
-  if (IS_OBJ(value)) {
-    markObject(vm, AS_OBJ(value));
-  }
+  Obj* object = valueHeapObject(value);
+  if (object) markObject(vm, object);
 }
 
 static void markObject(VM* vm, Obj* object) {
@@ -68,7 +69,23 @@ static void blackenEnv(VM* vm, Env* env) {
 
 static void blackenObject(VM* vm, Obj* object) {
   switch (object->type) {
-    case OBJ_STRING:
+    case OBJ_STRING: {
+      ObjString* string = (ObjString*)object;
+      if (stringIsRope(string)) {
+        ObjString* left;
+        ObjString* right;
+        stringRopeChildren(string, &left, &right);
+        markObject(vm, (Obj*)left);
+        markObject(vm, (Obj*)right);
+      } else {
+        markObject(vm, (Obj*)stringViewTrace(string));
+      }
+      break;
+    }
+    case OBJ_RANGE:
+    case OBJ_WORKER:
+    case OBJ_STRING_BUILDER:
+    case OBJ_BOXED_INT:
       break;
     case OBJ_FUNCTION: {
       ObjFunction* function = (ObjFunction*)object;
@@ -78,6 +95,13 @@ static void blackenObject(VM* vm, Obj* object) {
       }
       markEnv(vm, function->closure);
       markChunk(vm, function->chunk);
+      markObject(vm, (Obj*)function->proto);
+      for (int i = 0; i < function->upvalueCount && function->upvalueDescs; i++) {
+        markObject(vm, (Obj*)function->upvalueDescs[i].name);
+      }
+      for (int i = 0; i < function->upvalueCount && function->upvalues; i++) {
+        markObject(vm, (Obj*)function->upvalues[i]);
+      }
       break;
     }
     case OBJ_NATIVE: {
@@ -98,12 +122,18 @@ static void blackenObject(VM* vm, Obj* object) {
       if (klass->structFields) markObject(vm, (Obj*)klass->structFields);
       if (klass->structDefaults) markObject(vm, (Obj*)klass->structDefaults);
       if (klass->structReadonly) markObject(vm, (Obj*)klass->structReadonly);
+      markObject(vm, (Obj*)klass->rootShape);
       break;
     }
     case OBJ_INSTANCE: {
       ObjInstance* instance = (ObjInstance*)object;
       markObject(vm, (Obj*)instance->klass);
+      markObject(vm, (Obj*)instance->shape);
       markObject(vm, (Obj*)instance->fields);
+      int fieldCount = instance->shape ? instance->shape->fieldCount : 0;
+      for (int i = 0; i < fieldCount; i++) {
+        markValue(vm, instance->slots[i]);
+      }
       break;
     }
     case OBJ_ARRAY: {
@@ -128,13 +158,101 @@ static void blackenObject(VM* vm, Obj* object) {
       markObject(vm, (Obj*)bound->method);
       break;
     }
+    case OBJ_UPVALUE:
+      markValue(vm, ((ObjUpvalue*)object)->closed);
+      break;
+    case OBJ_SHAPE: {
+      ObjShape* shape = (ObjShape*)object;
+      markObject(vm, (Obj*)shape->parent);
+      markObject(vm, (Obj*)shape->name);
+      for (int i = 0; i < shape->transitionCount; i++) {
+        markObject(vm, (Obj*)shape->transitions[i]);
+      }
+      break;
+    }
+    case OBJ_ITERATOR: {
+      ObjIterator* iterator = (ObjIterator*)object;
+      markValue(vm, iterator->source);
+      markObject(vm, (Obj*)iterator->keys);
+      markObject(vm, (Obj*)iterator->cursorName);
+      break;
+    }
+    case OBJ_GENERATOR: {
+      ObjGenerator* generator = (ObjGenerator*)object;
+      markObject(vm, (Obj*)generator->function);
+      markValue(vm, generator->receiver);
+      markEnv(vm, generator->env);
+      for (int i = 0; i < generator->stackCount; i++) {
+        markValue(vm, generator->stack[i]);
+      }
+      for (int i = 0; i < generator->upvalueCount; i++) {
+        markObject(vm, (Obj*)generator->upvalues[i]);
+      }
+      for (int i = 0; i < generator->tryCount; i++) {
+        markEnv(vm, generator->tries[i].env);
+      }
+      for (int i = 0; i < generator->deferCount; i++) {
+        markValue(vm, generator->defers[i].callee);
+        for (int j = 0; j < generator->defers[i].argCount; j++) {
+          markValue(vm, generator->defers[i].args[j]);
+        }
+      }
+      break;
+    }
+    case OBJ_FIBER: {
+      ObjFiber* fiber = (ObjFiber*)object;
+      markValue(vm, fiber->result);
+      markEnv(vm, fiber->env);
+      markObject(vm, (Obj*)fiber->resumer);
+      for (int i = 0; i < fiber->stackCount; i++) {
+        markValue(vm, fiber->stack[i]);
+      }
+      for (int i = 0; i < fiber->frameCount; i++) {
+        markFrame(vm, &fiber->frames[i]);
+      }
+      for (int i = 0; i < fiber->upvalueCount; i++) {
+        markObject(vm, (Obj*)fiber->upvalues[i]);
+      }
+      for (int i = 0; i < fiber->tryCount; i++) {
+        markEnv(vm, fiber->tries[i].env);
+      }
+      for (int i = 0; i < fiber->deferCount; i++) {
+        markValue(vm, fiber->defers[i].callee);
+        for (int j = 0; j < fiber->defers[i].argCount; j++) {
+          markValue(vm, fiber->defers[i].args[j]);
+        }
+      }
+      for (int i = 0; i < fiber->waiterCount; i++) {
+        markObject(vm, (Obj*)fiber->waiters[i]);
+      }
+      for (int i = 0; i < fiber->waitChannelCount; i++) {
+        markObject(vm, (Obj*)fiber->waitChannels[i]);
+      }
+      break;
+    }
+    case OBJ_TYPED_ARRAY:
+      markObject(vm, (Obj*)((ObjTypedArray*)object)->owner);
+      break;
+    case OBJ_CHANNEL: {
+      ObjChannel* channel = (ObjChannel*)object;
+      for (int i = 0; i < channel->count; i++) {
+        markValue(vm, channel->items[(channel->head + i) % channel->capacity]);
+      }
+      for (int i = 0; i < channel->receiverCount; i++) {
+        markObject(vm, (Obj*)channel->receivers[i].fiber);
+      }
+      for (int i = 0; i < channel->senderCount; i++) {
+        markObject(vm, (Obj*)channel->senders[i].fiber);
+        markValue(vm, channel->senders[i].value);
+      }
+      break;
+    }
   }
 }
 
 static void markYoungValue(VM* vm, Value value) {
-  if (IS_OBJ(value)) {
-    markYoungObject(vm, AS_OBJ(value));
-  }
+  Obj* object = valueHeapObject(value);
+  if (object) markYoungObject(vm, object);
 }
 
 static void markYoungObject(VM* vm, Obj* object) {
@@ -157,7 +275,23 @@ static void markYoungFromEnv(VM* vm, Env* env) {
 
 void blackenYoungObject(VM* vm, Obj* object) {
   switch (object->type) {
-    case OBJ_STRING:
+    case OBJ_STRING: {
+      ObjString* string = (ObjString*)object;
+      if (stringIsRope(string)) {
+        ObjString* left;
+        ObjString* right;
+        stringRopeChildren(string, &left, &right);
+        markYoungObject(vm, (Obj*)left);
+        markYoungObject(vm, (Obj*)right);
+      } else {
+        markYoungObject(vm, (Obj*)stringViewTrace(string));
+      }
+      break;
+    }
+    case OBJ_RANGE:
+    case OBJ_WORKER:
+    case OBJ_STRING_BUILDER:
+    case OBJ_BOXED_INT:
       break;
     case OBJ_FUNCTION: {
       ObjFunction* function = (ObjFunction*)object;
@@ -165,6 +299,9 @@ void blackenYoungObject(VM* vm, Obj* object) {
       for (int i = 0; i < function->arity; i++) {
         markYoungObject(vm, (Obj*)function->params[i]);
       }
+      for (int i = 0; i < function->upvalueCount && function->upvalueDescs; i++) {
+        markYoungObject(vm, (Obj*)function->upvalueDescs[i].name);
+      }
       markYoungFromEnv(vm, function->closure);
       markYoungChunk(vm, function->chunk);
       break;
@@ -193,6 +330,10 @@ void blackenYoungObject(VM* vm, Obj* object) {
       ObjInstance* instance = (ObjInstance*)object;
       markYoungObject(vm, (Obj*)instance->klass);
       markYoungObject(vm, (Obj*)instance->fields);
+      int fieldCount = instance->shape ? instance->shape->fieldCount : 0;
+      for (int i = 0; i < fieldCount; i++) {
+        markYoungValue(vm, instance->slots[i]);
+      }
       break;
     }
     case OBJ_ARRAY: {
@@ -217,6 +358,83 @@ void blackenYoungObject(VM* vm, Obj* object) {
       markYoungObject(vm, (Obj*)bound->method);
       break;
     }
+    case OBJ_UPVALUE:
+      markYoungValue(vm, ((ObjUpvalue*)object)->closed);
+      break;
+    case OBJ_SHAPE:
+      markYoungObject(vm, (Obj*)((ObjShape*)object)->name);
+      break;
+    case OBJ_ITERATOR: {
+      ObjIterator* iterator = (ObjIterator*)object;
+      markYoungValue(vm, iterator->source);
+      markYoungObject(vm, (Obj*)iterator->keys);
+      markYoungObject(vm, (Obj*)iterator->cursorName);
+      break;
+    }
+    case OBJ_GENERATOR: {
+      ObjGenerator* generator = (ObjGenerator*)object;
+      markYoungObject(vm, (Obj*)generator->function);
+      markYoungValue(vm, generator->receiver);
+      markYoungFromEnv(vm, generator->env);
+      for (int i = 0; i < generator->stackCount; i++) {
+        markYoungValue(vm, generator->stack[i]);
+      }
+      for (int i = 0; i < generator->tryCount; i++) {
+        markYoungFromEnv(vm, generator->tries[i].env);
+      }
+      for (int i = 0; i < generator->deferCount; i++) {
+        markYoungValue(vm, generator->defers[i].callee);
+        for (int j = 0; j < generator->defers[i].argCount; j++) {
+          markYoungValue(vm, generator->defers[i].args[j]);
+        }
+      }
+      break;
+    }
+    case OBJ_FIBER: {
+      ObjFiber* fiber = (ObjFiber*)object;
+      markYoungValue(vm, fiber->result);
+      markYoungFromEnv(vm, fiber->env);
+      markYoungObject(vm, (Obj*)fiber->resumer);
+      for (int i = 0; i < fiber->stackCount; i++) {
+        markYoungValue(vm, fiber->stack[i]);
+      }
+      for (int i = 0; i < fiber->frameCount; i++) {
+        markYoungFrame(vm, &fiber->frames[i]);
+      }
+      for (int i = 0; i < fiber->tryCount; i++) {
+        markYoungFromEnv(vm, fiber->tries[i].env);
+      }
+      for (int i = 0; i < fiber->deferCount; i++) {
+        markYoungValue(vm, fiber->defers[i].callee);
+        for (int j = 0; j < fiber->defers[i].argCount; j++) {
+          markYoungValue(vm, fiber->defers[i].args[j]);
+        }
+      }
+      for (int i = 0; i < fiber->waiterCount; i++) {
+        markYoungObject(vm, (Obj*)fiber->waiters[i]);
+      }
+      for (int i = 0; i < fiber->waitChannelCount; i++) {
+        markYoungObject(vm, (Obj*)fiber->waitChannels[i]);
+      }
+      break;
+    }
+    case OBJ_TYPED_ARRAY:
+      markYoungObject(vm, (Obj*)((ObjTypedArray*)object)->owner);
+      break;
+    case OBJ_CHANNEL: {
+      ObjChannel* channel = (ObjChannel*)object;
+      for (int i = 0; i < channel->count; i++) {
+        markYoungValue(vm, channel->items[(channel->head + i) % channel->capacity]);
+      }
+      for (int i = 0; i < channel->receiverCount; i++) {
+        markYoungObject(vm, (Obj*)channel->receivers[i].fiber);
+      }
+      for (int i = 0; i < channel->senderCount; i++) {
+        markYoungObject(vm, (Obj*)channel->senders[i].fiber);
+        markYoungValue(vm, channel->senders[i].value);
+      }
+      break;
+    }
   }
 }
 
@@ -225,6 +443,15 @@ static void markChunk(VM* vm, Chunk* chunk) {
   for (int i = 0; i < chunk->constantsCount; i++) {
     markValue(vm, chunk->constants[i]);
   }
+  // Keep cache guards alive so a recycled address can never produce a false hit.
+  for (int i = 0; chunk->caches && i < chunk->count; i++) {
+    InlineCache* cache = &chunk->caches[i];
+    for (int way = 0; way < cache->count; way++) {
+      markObject(vm, (Obj*)cache->entries[way].shape);
+      markObject(vm, (Obj*)cache->entries[way].nextShape);
+      markObject(vm, (Obj*)cache->entries[way].klass);
+    }
+  }
 }
 
 static void markYoungChunk(VM* vm, Chunk* chunk) {
@@ -235,7 +462,8 @@ static void markYoungChunk(VM* vm, Chunk* chunk) {
 }
 
 static bool valueHasYoung(Value value) {
-  return IS_OBJ(value) && AS_OBJ(value)->generation == OBJ_GEN_YOUNG;
+  Obj* object = valueHeapObject(value);
+  return object && object->generation == OBJ_GEN_YOUNG;
 }
 
 static bool envHasYoungValues(Env* env) {
@@ -250,38 +478,75 @@ static bool envHasYoungValues(Env* env) {
   return false;
 }
 
+static void markFrame(VM* vm, CallFrame* frame) {
+  markObject(vm, (Obj*)frame->function);
+  markValue(vm, frame->receiver);
+  markObject(vm, (Obj*)frame->generator);
+  markEnv(vm, frame->previousEnv);
+  markObject(vm, (Obj*)frame->moduleInstance);
+  markObject(vm, (Obj*)frame->moduleKey);
+  markObject(vm, (Obj*)frame->moduleAlias);
+  markObject(vm, (Obj*)frame->modulePrivate);
+}
+
+static void markYoungFrame(VM* vm, CallFrame* frame) {
+  markYoungObject(vm, (Obj*)frame->function);
+  markYoungValue(vm, frame->receiver);
+  markYoungObject(vm, (Obj*)frame->generator);
+  markYoungFromEnv(vm, frame->previousEnv);
+  markYoungObject(vm, (Obj*)frame->moduleInstance);
+  markYoungObject(vm, (Obj*)frame->moduleKey);
+  markYoungObject(vm, (Obj*)frame->moduleAlias);
+  markYoungObject(vm, (Obj*)frame->modulePrivate);
+}
+
+static bool objectIsYoung(Obj* object) {
+  return object && object->generation == OBJ_GEN_YOUNG;
+}
+
+static bool frameHasYoung(CallFrame* frame) {
+  return valueHasYoung(frame->receiver) || envHasYoungValues(frame->previousEnv) ||
+         objectIsYoung((Obj*)frame->generator) || objectIsYoung((Obj*)frame->moduleInstance) ||
+         objectIsYoung((Obj*)frame->modulePrivate);
+}
+
 void markRoots(VM* vm) {
   markEnv(vm, vm->globals);
   markEnv(vm, vm->env);
+  markValue(vm, vm->pendingThrow);
   if (vm->args) {
     markObject(vm, (Obj*)vm->args);
   }
   if (vm->modules) {
     markObject(vm, (Obj*)vm->modules);
   }
-  if (vm->strings) {
-    markObject(vm, (Obj*)vm->strings);
-  }
   for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
     markValue(vm, *slot);
   }
+  for (ObjUpvalue* upvalue = vm->openUpvalues; upvalue; upvalue = upvalue->nextOpen) {
+    markObject(vm, (Obj*)upvalue);
+  }
   for (int i = 0; i < vm->frameCount; i++) {
-    markObject(vm, (Obj*)vm->frames[i].function);
-    markValue(vm, vm->frames[i].receiver);
-    markEnv(vm, vm->frames[i].previousEnv);
-    if (vm->frames[i].moduleInstance) {
-      markObject(vm, (Obj*)vm->frames[i].moduleInstance);
-    }
-    if (vm->frames[i].moduleKey) {
-      markObject(vm, (Obj*)vm->frames[i].moduleKey);
-    }
-    if (vm->frames[i].moduleAlias) {
-      markObject(vm, (Obj*)vm->frames[i].moduleAlias);
-    }
-      if (vm->frames[i].modulePrivate) {
-        markObject(vm, (Obj*)vm->frames[i].modulePrivate);
-      }
-    }
+    markFrame(vm, &vm->frames[i]);
+  }
+
+  markObject(vm, (Obj*)vm->currentFiber);
+  for (int i = 0; i < vm->readyCount; i++) {
+    markObject(vm, (Obj*)vm->readyFibers[(vm->readyHead + i) % vm->readyCapacity]);
+  }
+  for (int i = 0; i < vm->failedTaskCount; i++) {
+    markObject(vm, (Obj*)vm->failedTasks[i]);
+  }
+  for (int i = 0; i < vm->fiberTimerCount; i++) {
+    markObject(vm, (Obj*)vm->fiberTimers[i].fiber);
+  }
+  for (int i = 0; i < vm->workerWaitCount; i++) {
+    markObject(vm, (Obj*)vm->workerWaits[i].worker);
+    markObject(vm, (Obj*)vm->workerWaits[i].fiber);
+  }
+  for (int i = 0; i < vm->ioWaitCount; i++) {
+    markObject(vm, (Obj*)vm->ioWaits[i].fiber);
+  }
 
   for (int i = 0; i < vm->deferCount; i++) {
     DeferEntry* entry = &vm->defers[i];
@@ -301,37 +566,39 @@ void markRoots(VM* vm) {
 }
 
 void markYoungRoots(VM* vm) {
+  markYoungValue(vm, vm->pendingThrow);
   if (vm->args) {
     markYoungObject(vm, (Obj*)vm->args);
   }
   if (vm->modules) {
     markYoungObject(vm, (Obj*)vm->modules);
   }
-  if (vm->strings) {
-    markYoungObject(vm, (Obj*)vm->strings);
-  }
   markYoungFromEnv(vm, vm->globals);
   markYoungFromEnv(vm, vm->env);
   for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
     markYoungValue(vm, *slot);
   }
   for (int i = 0; i < vm->frameCount; i++) {
-    markYoungObject(vm, (Obj*)vm->frames[i].function);
-    markYoungValue(vm, vm->frames[i].receiver);
-    markYoungFromEnv(vm, vm->frames[i].previousEnv);
-    if (vm->frames[i].moduleInstance) {
-      markYoungObject(vm, (Obj*)vm->frames[i].moduleInstance);
-    }
-    if (vm->frames[i].moduleKey) {
-      markYoungObject(vm, (Obj*)vm->frames[i].moduleKey);
-    }
-    if (vm->frames[i].moduleAlias) {
-      markYoungObject(vm, (Obj*)vm->frames[i].moduleAlias);
-    }
-      if (vm->frames[i].modulePrivate) {
-        markYoungObject(vm, (Obj*)vm->frames[i].modulePrivate);
-      }
-    }
+    markYoungFrame(vm, &vm->frames[i]);
+  }
+
+  markYoungObject(vm, (Obj*)vm->currentFiber);
+  for (int i = 0; i < vm->readyCount; i++) {
+    markYoungObject(vm, (Obj*)vm->readyFibers[(vm->readyHead + i) % vm->readyCapacity]);
+  }
+  for (int i = 0; i < vm->failedTaskCount; i++) {
+    markYoungObject(vm, (Obj*)vm->failedTasks[i]);
+  }
+  for (int i = 0; i < vm->fiberTimerCount; i++) {
+    markYoungObject(vm, (Obj*)vm->fiberTimers[i].fiber);
+  }
+  for (int i = 0; i < vm->workerWaitCount; i++) {
+    markYoungObject(vm, (Obj*)vm->workerWaits[i].worker);
+    markYoungObject(vm, (Obj*)vm->workerWaits[i].fiber);
+  }
+  for (int i = 0; i < vm->ioWaitCount; i++) {
+    markYoungObject(vm, (Obj*)vm->ioWaits[i].fiber);
+  }
 
   for (int i = 0; i < vm->deferCount; i++) {
     DeferEntry* entry = &vm->defers[i];
@@ -362,7 +629,18 @@ bool gcObjectHasYoungRefs(Obj* object) {
   if (!object) return false;
 
   switch (object->type) {
-    case OBJ_STRING:
+    case OBJ_STRING: {
+      ObjString* string = (ObjString*)object;
+      if (!stringIsRope(string)) return objectIsYoung((Obj*)stringViewParent(string));
+      ObjString* left;
+      ObjString* right;
+      stringRopeChildren(string, &left, &right);
+      return left->obj.generation == OBJ_GEN_YOUNG || right->obj.generation == OBJ_GEN_YOUNG;
+    }
+    case OBJ_RANGE:
+    case OBJ_WORKER:
+    case OBJ_STRING_BUILDER:
+    case OBJ_BOXED_INT:
       return false;
     case OBJ_FUNCTION: {
       ObjFunction* function = (ObjFunction*)object;
@@ -374,6 +652,10 @@ bool gcObjectHasYoungRefs(Obj* object) {
           return true;
         }
       }
+      for (int i = 0; i < function->upvalueCount && function->upvalueDescs; i++) {
+        ObjString* name = function->upvalueDescs[i].name;
+        if (name && name->obj.generation == OBJ_GEN_YOUNG) return true;
+      }
       if (envHasYoungValues(function->closure)) return true;
       if (function->chunk) {
         for (int i = 0; i < function->chunk->constantsCount; i++) {
@@ -404,6 +686,10 @@ bool gcObjectHasYoungRefs(Obj* object) {
     case OBJ_INSTANCE: {
       ObjInstance* instance = (ObjInstance*)object;
       if (instance->klass && instance->klass->obj.generation == OBJ_GEN_YOUNG) return true;
+      int fieldCount = instance->shape ? instance->shape->fieldCount : 0;
+      for (int i = 0; i < fieldCount; i++) {
+        if (valueHasYoung(instance->slots[i])) return true;
+      }
       return instance->fields && instance->fields->obj.generation == OBJ_GEN_YOUNG;
     }
     case OBJ_ARRAY: {
@@ -427,6 +713,80 @@ bool gcObjectHasYoungRefs(Obj* object) {
       if (valueHasYoung(bound->receiver)) return true;
       return bound->method && bound->method->obj.generation == OBJ_GEN_YOUNG;
     }
+    case OBJ_UPVALUE:
+      return valueHasYoung(((ObjUpvalue*)object)->closed);
+    case OBJ_SHAPE: {
+      ObjShape* shape = (ObjShape*)object;
+      return shape->name && shape->name->obj.generation == OBJ_GEN_YOUNG;
+    }
+    case OBJ_ITERATOR: {
+      ObjIterator* iterator = (ObjIterator*)object;
+      if (valueHasYoung(iterator->source)) return true;
+      if (iterator->keys && iterator->keys->obj.generation == OBJ_GEN_YOUNG) return true;
+      return iterator->cursorName && iterator->cursorName->obj.generation == OBJ_GEN_YOUNG;
+    }
+    case OBJ_GENERATOR: {
+      ObjGenerator* generator = (ObjGenerator*)object;
+      if (valueHasYoung(generator->receiver)) return true;
+      if (envHasYoungValues(generator->env)) return true;
+      for (int i = 0; i < generator->stackCount; i++) {
+        if (valueHasYoung(generator->stack[i])) return true;
+      }
+      for (int i = 0; i < generator->tryCount; i++) {
+        if (envHasYoungValues(generator->tries[i].env)) return true;
+      }
+      for (int i = 0; i < generator->deferCount; i++) {
+        if (valueHasYoung(generator->defers[i].callee)) return true;
+        for (int j = 0; j < generator->defers[i].argCount; j++) {
+          if (valueHasYoung(generator->defers[i].args[j])) return true;
+        }
+      }
+      return false;
+    }
+    case OBJ_FIBER: {
+      ObjFiber* fiber = (ObjFiber*)object;
+      if (valueHasYoung(fiber->result)) return true;
+      if (envHasYoungValues(fiber->env)) return true;
+      if (objectIsYoung((Obj*)fiber->resumer)) return true;
+      for (int i = 0; i < fiber->stackCount; i++) {
+        if (valueHasYoung(fiber->stack[i])) return true;
+      }
+      for (int i = 0; i < fiber->frameCount; i++) {
+        if (frameHasYoung(&fiber->frames[i])) return true;
+      }
+      for (int i = 0; i < fiber->tryCount; i++) {
+        if (envHasYoungValues(fiber->tries[i].env)) return true;
+      }
+      for (int i = 0; i < fiber->deferCount; i++) {
+        if (valueHasYoung(fiber->defers[i].callee)) return true;
+        for (int j = 0; j < fiber->defers[i].argCount; j++) {
+          if (valueHasYoung(fiber->defers[i].args[j])) return true;
+        }
+      }
+      for (int i = 0; i < fiber->waiterCount; i++) {
+        if (objectIsYoung((Obj*)fiber->waiters[i])) return true;
+      }
+      for (int i = 0; i < fiber->waitChannelCount; i++) {
+        if (objectIsYoung((Obj*)fiber->waitChannels[i])) return true;
+      }
+      return false;
+    }
+    case OBJ_TYPED_ARRAY:
+      return objectIsYoung((Obj*)((ObjTypedArray*)object)->owner);
+    case OBJ_CHANNEL: {
+      ObjChannel* channel = (ObjChannel*)object;
+      for (int i = 0; i < channel->count; i++) {
+        if (valueHasYoung(channel->items[(channel->head + i) % channel->capacity])) return true;
+      }
+      for (int i = 0; i < channel->receiverCount; i++) {
+        if (objectIsYoung((Obj*)channel->receivers[i].fiber)) return true;
+      }
+      for (int i = 0; i < channel->senderCount; i++) {
+        if (objectIsYoung((Obj*)channel->senders[i].fiber)) return true;
+        if (valueHasYoung(channel->senders[i].value)) return true;
+      }
+      return false;
+    }
   }
 
   return false;
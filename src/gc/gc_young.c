@@ -19,6 +19,16 @@ static void pruneRemembered(VM* vm) {
   vm->gcRememberedCount = write;
 }
 
+// The intern table holds its strings weakly. Young strings nothing reached
+// leave it before the sweep frees them.
+static void removeDeadYoungStrings(VM* vm) {
+  for (Obj* object = vm->youngObjects; object; object = object->next) {
+    if (object->type == OBJ_STRING && !object->marked) {
+      stringTableRemove(&vm->strings, (ObjString*)object);
+    }
+  }
+}
+
 void gcCollectYoung(VM* vm) {
   if (!vm) return;
   vm->gcPendingYoung = false;
@@ -41,6 +51,7 @@ void gcCollectYoung(VM* vm) {
   }
 
   traceYoung(vm);
+  removeDeadYoungStrings(vm);
   sweepYoung(vm, false);
   pruneRemembered(vm);
   updateYoungNext(vm);
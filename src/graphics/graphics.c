@@ -206,7 +206,7 @@ static bool parseColor(VM* vm, Value value, Uint8* r, Uint8* g, Uint8* b, Uint8*
   if (isObjType(value, OBJ_STRING)) {
     ObjString* str = (ObjString*)AS_OBJ(value);
     for (int i = 0; gColors[i].name != NULL; i++) {
-      if (strcmp(str->chars, gColors[i].name) == 0) {
+      if (strcmp(stringChars(str), gColors[i].name) == 0) {
         *r = gColors[i].r;
         *g = gColors[i].g;
         *b = gColors[i].b;
@@ -539,7 +539,7 @@ static Value nativeGfxInit(VM* vm, int argc, Value* args) {
   const char* title = "Erkao";
 
   if (argc >= 3 && isObjType(args[2], OBJ_STRING)) {
-    title = ((ObjString*)AS_OBJ(args[2]))->chars;
+    title = stringChars((ObjString*)AS_OBJ(args[2]));
   }
 
   if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
@@ -873,7 +873,7 @@ static Value nativeGfxImage(VM* vm, int argc, Value* args) {
   if (!isObjType(args[0], OBJ_STRING)) return gfxError(vm, "gfx.image path must be string");
 
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  CachedTexture* tex = getTexture(vm, path->chars);
+  CachedTexture* tex = getTexture(vm, stringChars(path));
   if (!tex) return gfxError(vm, "Failed to load image");
 
   double worldX = AS_NUMBER(args[1]);
@@ -899,7 +899,7 @@ static Value nativeGfxImageEx(VM* vm, int argc, Value* args) {
   if (!isObjType(args[0], OBJ_STRING)) return gfxError(vm, "path must be string");
 
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  CachedTexture* tex = getTexture(vm, path->chars);
+  CachedTexture* tex = getTexture(vm, stringChars(path));
   if (!tex) return gfxError(vm, "Failed to load image");
 
   double worldX = AS_NUMBER(args[1]);
@@ -928,7 +928,7 @@ static Value nativeGfxImageSize(VM* vm, int argc, Value* args) {
   }
 
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  CachedTexture* tex = getTexture(vm, path->chars);
+  CachedTexture* tex = getTexture(vm, stringChars(path));
   if (!tex) return gfxError(vm, "Failed to load image");
 
   ObjMap* result = newMap(vm);
@@ -1019,7 +1019,7 @@ static Value nativeGfxSprite(VM* vm, int argc, Value* args) {
     return gfxError(vm, "gfx.sprite expects (path, frameW?, frameH?).");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  CachedTexture* tex = getTexture(vm, path->chars);
+  CachedTexture* tex = getTexture(vm, stringChars(path));
   if (!tex) return gfxError(vm, "Failed to load image");
 
   int frameW = tex->width;
@@ -1055,15 +1055,15 @@ static Value nativeGfxSprite(VM* vm, int argc, Value* args) {
 static SDL_RendererFlip parseSpriteFlip(Value value) {
   if (!isObjType(value, OBJ_STRING)) return SDL_FLIP_NONE;
   ObjString* text = (ObjString*)AS_OBJ(value);
-  if (strcmp(text->chars, "x") == 0 || strcmp(text->chars, "h") == 0 ||
-      strcmp(text->chars, "horizontal") == 0) {
+  if (strcmp(stringChars(text), "x") == 0 || strcmp(stringChars(text), "h") == 0 ||
+      strcmp(stringChars(text), "horizontal") == 0) {
     return SDL_FLIP_HORIZONTAL;
   }
-  if (strcmp(text->chars, "y") == 0 || strcmp(text->chars, "v") == 0 ||
-      strcmp(text->chars, "vertical") == 0) {
+  if (strcmp(stringChars(text), "y") == 0 || strcmp(stringChars(text), "v") == 0 ||
+      strcmp(stringChars(text), "vertical") == 0) {
     return SDL_FLIP_VERTICAL;
   }
-  if (strcmp(text->chars, "xy") == 0 || strcmp(text->chars, "both") == 0) {
+  if (strcmp(stringChars(text), "xy") == 0 || strcmp(stringChars(text), "both") == 0) {
     return (SDL_RendererFlip)(SDL_FLIP_HORIZONTAL | SDL_FLIP_VERTICAL);
   }
   return SDL_FLIP_NONE;
@@ -1079,7 +1079,7 @@ static Value nativeGfxSpriteDraw(VM* vm, int argc, Value* args) {
   if (!mapGetStringField(vm, sprite, "path", &path)) {
     return gfxError(vm, "gfx.spriteDraw expects a sprite from gfx.sprite().");
   }
-  CachedTexture* tex = getTexture(vm, path->chars);
+  CachedTexture* tex = getTexture(vm, stringChars(path));
   if (!tex) return gfxError(vm, "Failed to load image");
 
   double frameWValue = (double)tex->width;
@@ -1166,7 +1166,7 @@ static Value nativeGfxText(VM* vm, int argc, Value* args) {
   }
 
   SDL_Color color = {r, g, b, a};
-  SDL_Surface* surface = TTF_RenderUTF8_Blended(gDefaultFont, text->chars, color);
+  SDL_Surface* surface = TTF_RenderUTF8_Blended(gDefaultFont, stringChars(text), color);
   if (!surface) return gfxError(vm, "Failed to render text");
 
   SDL_Texture* texture = SDL_CreateTextureFromSurface(gRenderer, surface);
@@ -1199,7 +1199,7 @@ static Value nativeGfxTextSize(VM* vm, int argc, Value* args) {
   }
 
   int w, h;
-  TTF_SizeUTF8(gDefaultFont, text->chars, &w, &h);
+  TTF_SizeUTF8(gDefaultFont, stringChars(text), &w, &h);
 
   ObjMap* result = newMap(vm);
   mapSet(result, copyString(vm, "w"), NUMBER_VAL(w));
@@ -1214,7 +1214,7 @@ static Value nativeGfxKey(VM* vm, int argc, Value* args) {
   }
 
   ObjString* keyName = (ObjString*)AS_OBJ(args[0]);
-  SDL_Scancode code = getKeyCode(keyName->chars);
+  SDL_Scancode code = getKeyCode(stringChars(keyName));
   if (code == SDL_SCANCODE_UNKNOWN) return BOOL_VAL(false);
 
   int index = (int)code;
@@ -1231,7 +1231,7 @@ static Value nativeGfxKeyPressed(VM* vm, int argc, Value* args) {
   }
 
   ObjString* keyName = (ObjString*)AS_OBJ(args[0]);
-  SDL_Scancode code = getKeyCode(keyName->chars);
+  SDL_Scancode code = getKeyCode(stringChars(keyName));
   if (code == SDL_SCANCODE_UNKNOWN) return BOOL_VAL(false);
 
   int index = (int)code;
@@ -1369,7 +1369,7 @@ static Value nativeGfxSound(VM* vm, int argc, Value* args) {
   }
 
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  Mix_Chunk* chunk = getSound(path->chars);
+  Mix_Chunk* chunk = getSound(stringChars(path));
   if (!chunk) return gfxError(vm, "Failed to load sound");
 
   Mix_PlayChannel(-1, chunk, 0);
@@ -1389,7 +1389,7 @@ static Value nativeGfxMusic(VM* vm, int argc, Value* args) {
     gCurrentMusic = NULL;
   }
 
-  gCurrentMusic = Mix_LoadMUS(path->chars);
+  gCurrentMusic = Mix_LoadMUS(stringChars(path));
   if (!gCurrentMusic) return gfxError(vm, "Failed to load music");
 
   Mix_PlayMusic(gCurrentMusic, loop ? -1 : 1);
@@ -1461,7 +1461,7 @@ static Value nativeGfxTitle(VM* vm, int argc, Value* args) {
   if (!gWindow) return NULL_VAL;
   if (argc >= 1 && isObjType(args[0], OBJ_STRING)) {
     ObjString* title = (ObjString*)AS_OBJ(args[0]);
-    SDL_SetWindowTitle(gWindow, title->chars);
+    SDL_SetWindowTitle(gWindow, stringChars(title));
   }
   return NULL_VAL;
 }
@@ -2,6 +2,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,10 +11,21 @@
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
 #endif
+#include <winsock2.h>
 #include <windows.h>
 #else
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#if defined(__linux__)
+#define PLATFORM_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
 #endif
 
 static void platformOutOfMemory(void) {
@@ -237,3 +249,415 @@ char* platform_get_cwd(void) {
   return getcwd(NULL, 0);
 #endif
 }
+
+#ifdef _WIN32
+struct PlatformThread {
+  HANDLE handle;
+  void (*entry)(void*);
+  void* arg;
+};
+
+struct PlatformMutex {
+  CRITICAL_SECTION section;
+};
+
+struct PlatformCond {
+  CONDITION_VARIABLE variable;
+};
+
+static DWORD WINAPI platformThreadMain(LPVOID param) {
+  PlatformThread* thread = (PlatformThread*)param;
+  thread->entry(thread->arg);
+  return 0;
+}
+#else
+struct PlatformThread {
+  pthread_t handle;
+  void (*entry)(void*);
+  void* arg;
+};
+
+struct PlatformMutex {
+  pthread_mutex_t lock;
+};
+
+struct PlatformCond {
+  pthread_cond_t variable;
+};
+
+static void* platformThreadMain(void* param) {
+  PlatformThread* thread = (PlatformThread*)param;
+  thread->entry(thread->arg);
+  return NULL;
+}
+#endif
+
+PlatformThread* platform_thread_start(void (*entry)(void*), void* arg) {
+  PlatformThread* thread = (PlatformThread*)malloc(sizeof(PlatformThread));
+  if (!thread) return NULL;
+  thread->entry = entry;
+  thread->arg = arg;
+#ifdef _WIN32
+  thread->handle = CreateThread(NULL, 0, platformThreadMain, thread, 0, NULL);
+  if (!thread->handle) {
+    free(thread);
+    return NULL;
+  }
+#else
+  if (pthread_create(&thread->handle, NULL, platformThreadMain, thread) != 0) {
+    free(thread);
+    return NULL;
+  }
+#endif
+  return thread;
+}
+
+void platform_thread_join(PlatformThread* thread) {
+  if (!thread) return;
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else
+  pthread_join(thread->handle, NULL);
+#endif
+  free(thread);
+}
+
+PlatformMutex* platform_mutex_create(void) {
+  PlatformMutex* mutex = (PlatformMutex*)malloc(sizeof(PlatformMutex));
+  if (!mutex) platformOutOfMemory();
+#ifdef _WIN32
+  InitializeCriticalSection(&mutex->section);
+#else
+  if (pthread_mutex_init(&mutex->lock, NULL) != 0) {
+    free(mutex);
+    return NULL;
+  }
+#endif
+  return mutex;
+}
+
+void platform_mutex_destroy(PlatformMutex* mutex) {
+  if (!mutex) return;
+#ifdef _WIN32
+  DeleteCriticalSection(&mutex->section);
+#else
+  pthread_mutex_destroy(&mutex->lock);
+#endif
+  free(mutex);
+}
+
+void platform_mutex_lock(PlatformMutex* mutex) {
+#ifdef _WIN32
+  EnterCriticalSection(&mutex->section);
+#else
+  pthread_mutex_lock(&mutex->lock);
+#endif
+}
+
+void platform_mutex_unlock(PlatformMutex* mutex) {
+#ifdef _WIN32
+  LeaveCriticalSection(&mutex->section);
+#else
+  pthread_mutex_unlock(&mutex->lock);
+#endif
+}
+
+PlatformCond* platform_cond_create(void) {
+  PlatformCond* cond = (PlatformCond*)malloc(sizeof(PlatformCond));
+  if (!cond) platformOutOfMemory();
+#ifdef _WIN32
+  InitializeConditionVariable(&cond->variable);
+#else
+  pthread_cond_init(&cond->variable, NULL);
+#endif
+  return cond;
+}
+
+void platform_cond_destroy(PlatformCond* cond) {
+  if (!cond) return;
+#ifndef _WIN32
+  pthread_cond_destroy(&cond->variable);
+#endif
+  free(cond);
+}
+
+void platform_cond_wait(PlatformCond* cond, PlatformMutex* mutex, double seconds) {
+#ifdef _WIN32
+  DWORD millis = seconds < 0 ? INFINITE : (DWORD)(seconds * 1000.0);
+  SleepConditionVariableCS(&cond->variable, &mutex->section, millis);
+#else
+  if (seconds < 0) {
+    pthread_cond_wait(&cond->variable, &mutex->lock);
+    return;
+  }
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  time_t whole = (time_t)seconds;
+  deadline.tv_sec += whole;
+  deadline.tv_nsec += (long)((seconds - (double)whole) * 1000000000.0);
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  pthread_cond_timedwait(&cond->variable, &mutex->lock, &deadline);
+#endif
+}
+
+void platform_cond_broadcast(PlatformCond* cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(&cond->variable);
+#else
+  pthread_cond_broadcast(&cond->variable);
+#endif
+}
+
+void platform_flag_raise(PlatformFlag* flag) {
+#ifdef _WIN32
+  InterlockedExchange(flag, 1);
+#else
+  __atomic_store_n(flag, 1, __ATOMIC_RELEASE);
+#endif
+}
+
+bool platform_flag_is_raised(PlatformFlag* flag) {
+#ifdef _WIN32
+  return InterlockedCompareExchange(flag, 0, 0) != 0;
+#else
+  return __atomic_load_n(flag, __ATOMIC_ACQUIRE) != 0;
+#endif
+}
+
+static int platformPollMillis(double seconds) {
+  if (seconds < 0) return -1;
+  double millis = ceil(seconds * 1000.0);
+  if (millis > 2147483647.0) return 2147483647;
+  return (int)millis;
+}
+
+#ifdef PLATFORM_EPOLL
+struct PlatformPoller {
+  int epoll;
+  int wake;
+};
+
+PlatformPoller* platform_poller_create(void) {
+  PlatformPoller* poller = (PlatformPoller*)malloc(sizeof(PlatformPoller));
+  if (!poller) return NULL;
+  poller->epoll = epoll_create1(EPOLL_CLOEXEC);
+  poller->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = poller->wake;
+  if (poller->epoll < 0 || poller->wake < 0 ||
+      epoll_ctl(poller->epoll, EPOLL_CTL_ADD, poller->wake, &event) != 0) {
+    platform_poller_destroy(poller);
+    return NULL;
+  }
+  return poller;
+}
+
+void platform_poller_destroy(PlatformPoller* poller) {
+  if (!poller) return;
+  if (poller->epoll >= 0) close(poller->epoll);
+  if (poller->wake >= 0) close(poller->wake);
+  free(poller);
+}
+
+bool platform_poller_set(PlatformPoller* poller, intptr_t fd, int events) {
+  if (events == 0) {
+    return epoll_ctl(poller->epoll, EPOLL_CTL_DEL, (int)fd, NULL) == 0 || errno == ENOENT;
+  }
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  if (events & PLATFORM_POLL_READ) event.events |= EPOLLIN;
+  if (events & PLATFORM_POLL_WRITE) event.events |= EPOLLOUT;
+  event.data.fd = (int)fd;
+  if (epoll_ctl(poller->epoll, EPOLL_CTL_MOD, (int)fd, &event) == 0) return true;
+  return errno == ENOENT && epoll_ctl(poller->epoll, EPOLL_CTL_ADD, (int)fd, &event) == 0;
+}
+
+int platform_poller_wait(PlatformPoller* poller, double seconds,
+                         PlatformPollEvent* out, int max) {
+  struct epoll_event events[64];
+  int limit = max + 1 < 64 ? max + 1 : 64;
+  int ready = epoll_wait(poller->epoll, events, limit, platformPollMillis(seconds));
+  if (ready < 0) return errno == EINTR ? 0 : -1;
+  int count = 0;
+  for (int i = 0; i < ready; i++) {
+    if (events[i].data.fd == poller->wake) {
+      uint64_t value;
+      while (read(poller->wake, &value, sizeof(value)) > 0) {
+      }
+      continue;
+    }
+    if (count == max) continue;
+    int flags = 0;
+    if (events[i].events & EPOLLIN) flags |= PLATFORM_POLL_READ;
+    if (events[i].events & EPOLLOUT) flags |= PLATFORM_POLL_WRITE;
+    if (events[i].events & (EPOLLERR | EPOLLHUP)) flags |= PLATFORM_POLL_ERROR;
+    out[count].fd = events[i].data.fd;
+    out[count].events = flags;
+    count++;
+  }
+  return count;
+}
+
+void platform_poller_wake(PlatformPoller* poller) {
+  uint64_t one = 1;
+  ssize_t written = write(poller->wake, &one, sizeof(one));
+  (void)written;
+}
+#else
+#ifdef _WIN32
+typedef WSAPOLLFD PlatformPollFd;
+#else
+typedef struct pollfd PlatformPollFd;
+#endif
+
+// Without epoll the poller keeps the watched descriptors in an array. POSIX
+// wakes poll() through a self-pipe, which sits in slot 0. WSAPoll cannot
+// wait on a pipe, so Windows waits in short slices and checks a flag.
+struct PlatformPoller {
+  PlatformPollFd* fds;
+  int count;
+  int capacity;
+#ifdef _WIN32
+  volatile LONG woken;
+#else
+  int wakeRead;
+  int wakeWrite;
+#endif
+};
+
+static int pollerFind(PlatformPoller* poller, intptr_t fd) {
+  for (int i = 0; i < poller->count; i++) {
+    if ((intptr_t)poller->fds[i].fd == fd) return i;
+  }
+  return -1;
+}
+
+static bool pollerAdd(PlatformPoller* poller, intptr_t fd, short events) {
+  if (poller->count == poller->capacity) {
+    int capacity = poller->capacity < 8 ? 8 : poller->capacity * 2;
+    PlatformPollFd* fds = (PlatformPollFd*)realloc(poller->fds,
+                                                   sizeof(PlatformPollFd) * (size_t)capacity);
+    if (!fds) return false;
+    poller->fds = fds;
+    poller->capacity = capacity;
+  }
+  PlatformPollFd* entry = &poller->fds[poller->count++];
+  memset(entry, 0, sizeof(PlatformPollFd));
+  entry->fd = fd;
+  entry->events = events;
+  return true;
+}
+
+PlatformPoller* platform_poller_create(void) {
+  PlatformPoller* poller = (PlatformPoller*)calloc(1, sizeof(PlatformPoller));
+  if (!poller) return NULL;
+#ifndef _WIN32
+  int pipes[2];
+  if (pipe(pipes) != 0) {
+    free(poller);
+    return NULL;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(pipes[i], F_SETFL, fcntl(pipes[i], F_GETFL) | O_NONBLOCK);
+    fcntl(pipes[i], F_SETFD, FD_CLOEXEC);
+  }
+  poller->wakeRead = pipes[0];
+  poller->wakeWrite = pipes[1];
+  if (!pollerAdd(poller, pipes[0], POLLIN)) {
+    platform_poller_destroy(poller);
+    return NULL;
+  }
+#endif
+  return poller;
+}
+
+void platform_poller_destroy(PlatformPoller* poller) {
+  if (!poller) return;
+#ifndef _WIN32
+  close(poller->wakeRead);
+  close(poller->wakeWrite);
+#endif
+  free(poller->fds);
+  free(poller);
+}
+
+bool platform_poller_set(PlatformPoller* poller, intptr_t fd, int events) {
+  short flags = 0;
+  if (events & PLATFORM_POLL_READ) flags |= POLLIN;
+  if (events & PLATFORM_POLL_WRITE) flags |= POLLOUT;
+  int index = pollerFind(poller, fd);
+  if (index < 0) return events == 0 || pollerAdd(poller, fd, flags);
+  if (events != 0) {
+    poller->fds[index].events = flags;
+    return true;
+  }
+  poller->fds[index] = poller->fds[--poller->count];
+  return true;
+}
+
+static int pollerCollect(PlatformPoller* poller, int first, PlatformPollEvent* out, int max) {
+  int count = 0;
+  for (int i = first; i < poller->count && count < max; i++) {
+    short revents = poller->fds[i].revents;
+    if (revents == 0) continue;
+    int flags = 0;
+    if (revents & POLLIN) flags |= PLATFORM_POLL_READ;
+    if (revents & POLLOUT) flags |= PLATFORM_POLL_WRITE;
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) flags |= PLATFORM_POLL_ERROR;
+    out[count].fd = (intptr_t)poller->fds[i].fd;
+    out[count].events = flags;
+    count++;
+  }
+  return count;
+}
+
+#ifdef _WIN32
+int platform_poller_wait(PlatformPoller* poller, double seconds,
+                         PlatformPollEvent* out, int max) {
+  int remaining = platformPollMillis(seconds);
+  for (;;) {
+    if (InterlockedExchange(&poller->woken, 0)) return 0;
+    int slice = remaining < 0 || remaining > 10 ? 10 : remaining;
+    if (poller->count == 0) {
+      Sleep((DWORD)slice);
+    } else {
+      int ready = WSAPoll(poller->fds, (ULONG)poller->count, slice);
+      if (ready == SOCKET_ERROR) return -1;
+      if (ready > 0) return pollerCollect(poller, 0, out, max);
+    }
+    if (remaining >= 0) {
+      remaining -= slice;
+      if (remaining <= 0) return 0;
+    }
+  }
+}
+
+void platform_poller_wake(PlatformPoller* poller) {
+  InterlockedExchange(&poller->woken, 1);
+}
+#else
+int platform_poller_wait(PlatformPoller* poller, double seconds,
+                         PlatformPollEvent* out, int max) {
+  int ready = poll(poller->fds, (nfds_t)poller->count, platformPollMillis(seconds));
+  if (ready < 0) return errno == EINTR ? 0 : -1;
+  if (poller->fds[0].revents) {
+    char drain[64];
+    while (read(poller->wakeRead, drain, sizeof(drain)) > 0) {
+    }
+  }
+  return pollerCollect(poller, 1, out, max);
+}
+
+void platform_poller_wake(PlatformPoller* poller) {
+  char byte = 1;
+  ssize_t written = write(poller->wakeWrite, &byte, 1);
+  (void)written;
+}
+#endif
+#endif
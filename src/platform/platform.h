@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 char* platform_strdup(const char* src);
 char* platform_strndup(const char* src, size_t length);
@@ -23,4 +24,54 @@ bool platform_make_dir(const char* path);
 bool platform_ensure_dir(const char* path);
 char* platform_get_cwd(void);
 
+// Threads and locks are opaque handles so callers need no OS headers.
+typedef struct PlatformThread PlatformThread;
+typedef struct PlatformMutex PlatformMutex;
+typedef struct PlatformCond PlatformCond;
+
+PlatformThread* platform_thread_start(void (*entry)(void*), void* arg);
+void platform_thread_join(PlatformThread* thread);
+
+PlatformMutex* platform_mutex_create(void);
+void platform_mutex_destroy(PlatformMutex* mutex);
+void platform_mutex_lock(PlatformMutex* mutex);
+void platform_mutex_unlock(PlatformMutex* mutex);
+
+PlatformCond* platform_cond_create(void);
+void platform_cond_destroy(PlatformCond* cond);
+// Waits at most `seconds`, or without a limit when it is negative.
+void platform_cond_wait(PlatformCond* cond, PlatformMutex* mutex, double seconds);
+void platform_cond_broadcast(PlatformCond* cond);
+
+// A flag that one thread raises and others poll without taking a lock.
+typedef volatile long PlatformFlag;
+
+void platform_flag_raise(PlatformFlag* flag);
+bool platform_flag_is_raised(PlatformFlag* flag);
+
+// A poller waits for readiness on a set of file descriptors, or sockets on
+// Windows, and can be woken from any thread. It uses epoll on Linux and
+// poll() on other POSIX systems; Windows polls sockets with WSAPoll.
+typedef struct PlatformPoller PlatformPoller;
+
+#define PLATFORM_POLL_READ 1
+#define PLATFORM_POLL_WRITE 2
+#define PLATFORM_POLL_ERROR 4
+
+typedef struct {
+  intptr_t fd;
+  int events;
+} PlatformPollEvent;
+
+PlatformPoller* platform_poller_create(void);
+void platform_poller_destroy(PlatformPoller* poller);
+// Sets the events to watch on `fd`; zero stops watching it.
+bool platform_poller_set(PlatformPoller* poller, intptr_t fd, int events);
+// Waits at most `seconds`, or without a limit when it is negative, and
+// returns the number of ready descriptors stored in `out`, or -1 on error.
+// A wakeup ends the wait early without reporting a descriptor.
+int platform_poller_wait(PlatformPoller* poller, double seconds,
+                         PlatformPollEvent* out, int max);
+void platform_poller_wake(PlatformPoller* poller);
+
 #endif
@@ -27,7 +27,7 @@ static ErkaoModule* apiCreateModule(VM* vm, const char* name) {
   ObjString* className = copyString(vm, name);
   ObjMap* methods = newMap(vm);
   ObjClass* klass = newClass(vm, className, methods);
-  ObjInstance* module = newInstance(vm, klass);
+  ObjInstance* module = newInstanceWithFields(vm, klass, newMap(vm));
   return (ErkaoModule*)module;
 }
 
@@ -15,7 +15,7 @@ static bool updateBestSuggestionFromMap(ObjMap* map, const char* target, int tar
     int maxDist = *bestDist - 1;
     if (maxDist < 0) return true;
     if (maxDist > ERKAO_DIAG_MAX_DISTANCE) maxDist = ERKAO_DIAG_MAX_DISTANCE;
-    int dist = diag_edit_distance_limited(target, targetLen, key->chars, key->length,
+    int dist = diag_edit_distance_limited(target, targetLen, stringChars(key), key->length,
                                           maxDist);
     if (dist < *bestDist) {
       *bestDist = dist;
@@ -35,7 +35,7 @@ static bool suggestNameFromEnv(Env* env, const char* target, int targetLen,
     updateBestSuggestionFromMap(current->values, target, targetLen, &best, &bestDist);
   }
   if (!best || bestDist > ERKAO_DIAG_MAX_DISTANCE) return false;
-  snprintf(out, outSize, "%.*s", best->length, best->chars);
+  snprintf(out, outSize, "%.*s", best->length, stringChars(best));
   return true;
 }
 
@@ -48,7 +48,7 @@ static bool suggestNameFromInstance(ObjInstance* instance, const char* target, i
   updateBestSuggestionFromMap(instance->klass ? instance->klass->methods : NULL,
                               target, targetLen, &best, &bestDist);
   if (!best || bestDist > ERKAO_DIAG_MAX_DISTANCE) return false;
-  snprintf(out, outSize, "%.*s", best->length, best->chars);
+  snprintf(out, outSize, "%.*s", best->length, stringChars(best));
   return true;
 }
 
@@ -183,17 +183,8 @@ static bool valueIsInteger(Value value, int* out) {
 }
 
 static Value concatenateStrings(VM* vm, ObjString* a, ObjString* b) {
-  int length = a->length + b->length;
-  char* buffer = (char*)malloc((size_t)length + 1);
-  if (!buffer) {
-    runtimeOutOfMemory(vm, "Out of memory while concatenating strings.");
-    return NULL_VAL;
-  }
-  memcpy(buffer, a->chars, (size_t)a->length);
-  memcpy(buffer + a->length, b->chars, (size_t)b->length);
-  buffer[length] = '\0';
-  ObjString* result = copyStringWithLength(vm, buffer, length);
-  free(buffer);
+  ObjString* result = concatStrings(vm, a, b);
+  if (!result) return NULL_VAL;
   return OBJ_VAL(result);
 }
 
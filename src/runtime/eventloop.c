@@ -0,0 +1,199 @@
+#include "interpreter_internal.h"
+#include "platform.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The event loop is where a VM waits when no task is ready. One poller
+// watches the descriptors that tasks and natives wait on, and its timeout is
+// the earliest timer deadline. Other threads wake it through the same poller:
+// a worker posting to its parent, or the parent closing a worker's queue.
+//
+// A loop is reference-counted because those threads may still hold it after
+// its VM is freed. Only the owning VM's thread changes the watched set or
+// waits; any thread may wake it.
+
+#define EVENT_LOOP_BATCH 32
+
+struct EventLoop {
+  PlatformMutex* lock;
+  PlatformPoller* poller;
+  int refCount;
+};
+
+EventLoop* eventLoopCreate(void) {
+  EventLoop* loop = (EventLoop*)malloc(sizeof(EventLoop));
+  if (!loop) return NULL;
+  loop->poller = platform_poller_create();
+  if (!loop->poller) {
+    free(loop);
+    return NULL;
+  }
+  loop->lock = platform_mutex_create();
+  if (!loop->lock) {
+    platform_poller_destroy(loop->poller);
+    free(loop);
+    return NULL;
+  }
+  loop->refCount = 1;
+  return loop;
+}
+
+EventLoop* vmEventLoop(VM* vm) {
+  if (!vm->eventLoop) vm->eventLoop = eventLoopCreate();
+  return vm->eventLoop;
+}
+
+void eventLoopRetain(EventLoop* loop) {
+  platform_mutex_lock(loop->lock);
+  loop->refCount++;
+  platform_mutex_unlock(loop->lock);
+}
+
+void eventLoopRelease(EventLoop* loop) {
+  if (!loop) return;
+  platform_mutex_lock(loop->lock);
+  int refCount = --loop->refCount;
+  platform_mutex_unlock(loop->lock);
+  if (refCount > 0) return;
+  platform_poller_destroy(loop->poller);
+  platform_mutex_destroy(loop->lock);
+  free(loop);
+}
+
+void eventLoopWake(EventLoop* loop) {
+  platform_poller_wake(loop->poller);
+}
+
+static EventLoop* requireEventLoop(VM* vm) {
+  EventLoop* loop = vmEventLoop(vm);
+  if (!loop) runtimeOutOfMemory(vm, "Out of memory while starting the event loop.");
+  return loop;
+}
+
+// The events still wanted on `fd` by the waits in the list.
+static int ioWatched(VM* vm, intptr_t fd) {
+  int events = 0;
+  for (int i = 0; i < vm->ioWaitCount; i++) {
+    if (vm->ioWaits[i].fd == fd) events |= vm->ioWaits[i].events;
+  }
+  return events;
+}
+
+static bool ioWaitAdd(VM* vm, IoWait wait) {
+  EventLoop* loop = requireEventLoop(vm);
+  if (!loop) return false;
+  if (vm->ioWaitCount == vm->ioWaitCapacity) {
+    int capacity = GROW_CAPACITY(vm->ioWaitCapacity);
+    IoWait* waits = GROW_ARRAY(IoWait, vm->ioWaits, vm->ioWaitCapacity, capacity);
+    if (!waits) return runtimeOutOfMemory(vm, "Out of memory while waiting on a descriptor.");
+    vm->ioWaits = waits;
+    vm->ioWaitCapacity = capacity;
+  }
+  if (!platform_poller_set(loop->poller, wait.fd, ioWatched(vm, wait.fd) | wait.events)) {
+    Token token;
+    memset(&token, 0, sizeof(Token));
+    runtimeError(vm, token, "Could not watch a descriptor for readiness.");
+    return false;
+  }
+  vm->ioWaits[vm->ioWaitCount++] = wait;
+  return true;
+}
+
+// Drops the in-place wait that reports into `fired`, if it has not fired.
+static void ioWaitCancel(VM* vm, int* fired) {
+  for (int i = 0; i < vm->ioWaitCount; i++) {
+    if (vm->ioWaits[i].fired != fired) continue;
+    intptr_t fd = vm->ioWaits[i].fd;
+    vm->ioWaits[i] = vm->ioWaits[--vm->ioWaitCount];
+    platform_poller_set(vm->eventLoop->poller, fd, ioWatched(vm, fd));
+    return;
+  }
+}
+
+// Removes every wait on `fd` that `events` satisfies, then wakes it. An
+// error or hang-up satisfies any wait, so the reader sees it.
+static bool ioDispatch(VM* vm, intptr_t fd, int events) {
+  int kept = 0;
+  bool ok = true;
+  for (int i = 0; i < vm->ioWaitCount; i++) {
+    IoWait wait = vm->ioWaits[i];
+    int fired = events & (wait.events | PLATFORM_POLL_ERROR);
+    if (wait.fd != fd || fired == 0) {
+      vm->ioWaits[kept++] = wait;
+      continue;
+    }
+    if (!wait.fiber) {
+      *wait.fired = fired;
+      continue;
+    }
+    Value value = wait.ready ? wait.ready(vm, wait.fd, wait.data, fired) : BOOL_VAL(true);
+    if (ok && !fiberWake(vm, wait.fiber, value)) ok = false;
+  }
+  vm->ioWaitCount = kept;
+  platform_poller_set(vm->eventLoop->poller, fd, ioWatched(vm, fd));
+  return ok;
+}
+
+// Sleeps until a watched descriptor is ready, the loop is woken, or `until`,
+// and wakes whatever waited on the descriptors that fired.
+bool eventLoopWait(VM* vm, double until) {
+  EventLoop* loop = requireEventLoop(vm);
+  if (!loop) return false;
+  double timeout = -1;
+  if (!isinf(until)) {
+    timeout = until - schedulerNow();
+    if (timeout < 0) timeout = 0;
+  }
+  PlatformPollEvent events[EVENT_LOOP_BATCH];
+  int count = platform_poller_wait(loop->poller, timeout, events, EVENT_LOOP_BATCH);
+  if (count < 0) {
+    Token token;
+    memset(&token, 0, sizeof(Token));
+    runtimeError(vm, token, "The event loop failed while waiting.");
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    if (!ioDispatch(vm, events[i].fd, events[i].events)) return false;
+  }
+  return true;
+}
+
+void eventLoopFree(VM* vm) {
+  FREE_ARRAY(IoWait, vm->ioWaits, vm->ioWaitCapacity);
+  vm->ioWaits = NULL;
+  vm->ioWaitCount = 0;
+  vm->ioWaitCapacity = 0;
+  eventLoopRelease(vm->eventLoop);
+  vm->eventLoop = NULL;
+}
+
+// Parks the current task until `fd` is ready for `events`. The task resumes
+// with what `ready` returns for the descriptor and `data`, or true without it.
+bool ioPark(VM* vm, intptr_t fd, int events, IoReadyFn ready, intptr_t data) {
+  IoWait wait = {fd, events, vm->currentFiber, ready, data, NULL};
+  if (!ioWaitAdd(vm, wait)) return false;
+  fiberPark(vm, FIBER_PARKED);
+  return true;
+}
+
+// Waits in place until `fd` is ready for `events`, or `timeout` seconds pass
+// when it is not negative, running other tasks meanwhile. `outEvents` is
+// zero on a timeout.
+bool ioBlock(VM* vm, intptr_t fd, int events, double timeout, int* outEvents) {
+  *outEvents = 0;
+  IoWait wait = {fd, events, NULL, NULL, 0, outEvents};
+  if (!ioWaitAdd(vm, wait)) return false;
+  double deadline = timeout < 0 ? INFINITY : schedulerNow() + timeout;
+  bool ok = true;
+  while (*outEvents == 0) {
+    if (schedulerStep(vm, deadline) == SCHEDULER_ERROR) {
+      ok = false;
+      break;
+    }
+    if (schedulerNow() >= deadline) break;
+  }
+  if (*outEvents == 0) ioWaitCancel(vm, outEvents);
+  return ok;
+}
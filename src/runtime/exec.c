@@ -6,19 +6,64 @@
 #include "program.h"
 #include "diagnostics.h"
 
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef ERKAO_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define ERKAO_COMPUTED_GOTO 1
+#else
+#define ERKAO_COMPUTED_GOTO 0
+#endif
+#endif
+
+static ObjUpvalue* captureUpvalue(VM* vm, Value* local) {
+  ObjUpvalue* previous = NULL;
+  ObjUpvalue* upvalue = vm->openUpvalues;
+  while (upvalue && upvalue->location > local) {
+    previous = upvalue;
+    upvalue = upvalue->nextOpen;
+  }
+  if (upvalue && upvalue->location == local) return upvalue;
+
+  ObjUpvalue* created = newUpvalue(vm, local);
+  if (!created) return NULL;
+  created->nextOpen = upvalue;
+  if (previous) {
+    previous->nextOpen = created;
+  } else {
+    vm->openUpvalues = created;
+  }
+  return created;
+}
+
+static void closeUpvalues(VM* vm, Value* last) {
+  while (vm->openUpvalues && vm->openUpvalues->location >= last) {
+    ObjUpvalue* upvalue = vm->openUpvalues;
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    gcWriteBarrier(vm, (Obj*)upvalue, upvalue->closed);
+    vm->openUpvalues = upvalue->nextOpen;
+  }
+}
+
 static void resetStack(VM* vm) {
+  closeUpvalues(vm, vm->stack);
   vm->stackTop = vm->stack;
   vm->frameCount = 0;
   vm->tryCount = 0;
+  vm->pendingThrow = NULL_VAL;
+  vm->throwPending = false;
   for (int i = 0; i < vm->deferCount; i++) {
     free(vm->defers[i].args);
   }
   vm->deferCount = 0;
+  vm->currentFiber = NULL;
+  vm->callDepth = 0;
+  vm->fiberParking = false;
 }
 
 static void push(VM* vm, Value value) {
@@ -42,10 +87,12 @@ static void popTryFramesForFrame(VM* vm, int frameIndex) {
   }
 }
 
-static bool ensureDeferCapacity(VM* vm) {
-  if (vm->deferCapacity < vm->deferCount + 1) {
+static bool ensureDeferCapacity(VM* vm, int extra) {
+  if (vm->deferCapacity < vm->deferCount + extra) {
     int oldCap = vm->deferCapacity;
-    vm->deferCapacity = GROW_CAPACITY(oldCap);
+    while (vm->deferCapacity < vm->deferCount + extra) {
+      vm->deferCapacity = GROW_CAPACITY(vm->deferCapacity);
+    }
     DeferEntry* resized = GROW_ARRAY(DeferEntry, vm->defers, oldCap, vm->deferCapacity);
     if (!resized) {
       vm->deferCapacity = oldCap;
@@ -58,7 +105,7 @@ static bool ensureDeferCapacity(VM* vm) {
 
 static bool deferPush(VM* vm, int frameIndex, int scopeDepth,
                       Value callee, int argCount, Value* args) {
-  if (!ensureDeferCapacity(vm)) return false;
+  if (!ensureDeferCapacity(vm, 1)) return false;
   DeferEntry* entry = &vm->defers[vm->deferCount++];
   entry->frameIndex = frameIndex;
   entry->scopeDepth = scopeDepth;
@@ -165,27 +212,76 @@ static Value wrapErrorValue(VM* vm, Value value) {
   return OBJ_VAL(map);
 }
 
-static bool unwindToHandler(VM* vm, CallFrame** frame, Value error) {
+typedef enum {
+  UNWIND_HANDLED,
+  UNWIND_OUTER,
+  UNWIND_UNCAUGHT
+} UnwindResult;
+
+// Raises `error` from a native. The dispatch loop that owns the nearest
+// handler catches it; see runWithTarget. Returns false for the native to
+// pass on.
+bool vmThrowValue(VM* vm, Value error) {
+  vm->pendingThrow = error;
+  vm->throwPending = true;
+  vm->hadError = true;
+  return false;
+}
+
+void uncaughtThrowError(VM* vm, Token token, const char* prefix, Value error) {
+  push(vm, error);
+  ObjString* message = errorMessageForValue(vm, error);
+  char buffer[256];
+  const char* messageText = (message && stringChars(message)) ? stringChars(message) : "<error>";
+  snprintf(buffer, sizeof(buffer), "%s: %s", prefix, messageText);
+  pop(vm);
+  runtimeError(vm, token, buffer);
+}
+
+// Moves execution to the innermost try handler. A handler below
+// `targetFrameCount` belongs to an outer dispatch loop: the throw is left
+// pending for that loop, and this one must stop without touching its frames.
+static UnwindResult unwindToHandler(VM* vm, CallFrame** frame, Value error,
+                                    int targetFrameCount) {
   while (vm->tryCount > 0) {
     TryFrame handler = vm->tryFrames[vm->tryCount - 1];
     if (handler.frameIndex < 0 || handler.frameIndex >= vm->frameCount) {
       vm->tryCount--;
       continue;
     }
+    // A throw does not cross out of a task into whoever happened to run it.
+    if (vm->currentFiber && handler.frameIndex < vm->currentFiber->baseFrame) break;
+    if (handler.frameIndex < targetFrameCount) {
+      vmThrowValue(vm, error);
+      return UNWIND_OUTER;
+    }
     vm->tryCount--;
     if (!runDefersUntil(vm, handler.frameIndex, handler.scopeDepth)) {
-      return false;
+      return UNWIND_UNCAUGHT;
+    }
+    // A generator whose frame is unwound past cannot be resumed again.
+    for (int i = vm->frameCount - 1; i > handler.frameIndex; i--) {
+      if (vm->frames[i].generator) generatorRelease(vm->frames[i].generator);
     }
     vm->frameCount = handler.frameIndex + 1;
     vm->env = handler.env;
+    closeUpvalues(vm, handler.stackTop);
     vm->stackTop = handler.stackTop;
     *frame = &vm->frames[handler.frameIndex];
     vm->currentProgram = (*frame)->function->program;
     push(vm, error);
     (*frame)->ip = handler.handler;
-    return true;
+    return UNWIND_HANDLED;
   }
-  return false;
+  // Nothing in the task catches it, so the task fails and await() rethrows
+  // the error. The task's own run finishes its defers first.
+  ObjFiber* fiber = vm->currentFiber;
+  if (!fiber) return UNWIND_UNCAUGHT;
+  if (fiber->baseFrame >= targetFrameCount && !runDefersUntil(vm, fiber->baseFrame, -1)) {
+    return UNWIND_UNCAUGHT;
+  }
+  vmThrowValue(vm, error);
+  return UNWIND_OUTER;
 }
 
 static Token currentToken(CallFrame* frame) {
@@ -198,6 +294,14 @@ static Token currentToken(CallFrame* frame) {
   return token;
 }
 
+// Superinstructions keep each fused part's token on its own operand bytes. On
+// an error, ip moves back onto the failing part so the message and the stack
+// trace both point at it.
+static Token rewindToPart(CallFrame* frame, int back) {
+  frame->ip -= back - 1;
+  return currentToken(frame);
+}
+
 static void debugTraceInstruction(VM* vm, CallFrame* frame, uint8_t instruction) {
   if (!vm->debugTrace || !frame || !frame->function || !frame->function->chunk) return;
   Token token = currentToken(frame);
@@ -222,7 +326,26 @@ static bool updateBestSuggestionFromMap(ObjMap* map, const char* target, int tar
     int maxDist = *bestDist - 1;
     if (maxDist < 0) return true;
     if (maxDist > ERKAO_DIAG_MAX_DISTANCE) maxDist = ERKAO_DIAG_MAX_DISTANCE;
-    int dist = diag_edit_distance_limited(target, targetLen, key->chars, key->length,
+    int dist = diag_edit_distance_limited(target, targetLen, stringChars(key), key->length,
+                                          maxDist);
+    if (dist < *bestDist) {
+      *bestDist = dist;
+      *best = key;
+      if (dist == 0) return true;
+    }
+  }
+  return *best != NULL;
+}
+
+static bool updateBestSuggestionFromShape(ObjShape* shape, const char* target, int targetLen,
+                                          ObjString** best, int* bestDist) {
+  if (!target || targetLen <= 0) return false;
+  for (ObjShape* current = shape; current && current->name; current = current->parent) {
+    ObjString* key = current->name;
+    int maxDist = *bestDist - 1;
+    if (maxDist < 0) return true;
+    if (maxDist > ERKAO_DIAG_MAX_DISTANCE) maxDist = ERKAO_DIAG_MAX_DISTANCE;
+    int dist = diag_edit_distance_limited(target, targetLen, stringChars(key), key->length,
                                           maxDist);
     if (dist < *bestDist) {
       *bestDist = dist;
@@ -242,7 +365,7 @@ static bool suggestNameFromEnv(Env* env, const char* target, int targetLen,
     updateBestSuggestionFromMap(current->values, target, targetLen, &best, &bestDist);
   }
   if (!best || bestDist > ERKAO_DIAG_MAX_DISTANCE) return false;
-  snprintf(out, outSize, "%.*s", best->length, best->chars);
+  snprintf(out, outSize, "%.*s", best->length, stringChars(best));
   return true;
 }
 
@@ -252,10 +375,11 @@ static bool suggestNameFromInstance(ObjInstance* instance, const char* target, i
   ObjString* best = NULL;
   int bestDist = ERKAO_DIAG_MAX_DISTANCE + 1;
   updateBestSuggestionFromMap(instance->fields, target, targetLen, &best, &bestDist);
+  updateBestSuggestionFromShape(instance->shape, target, targetLen, &best, &bestDist);
   updateBestSuggestionFromMap(instance->klass ? instance->klass->methods : NULL,
                               target, targetLen, &best, &bestDist);
   if (!best || bestDist > ERKAO_DIAG_MAX_DISTANCE) return false;
-  snprintf(out, outSize, "%.*s", best->length, best->chars);
+  snprintf(out, outSize, "%.*s", best->length, stringChars(best));
   return true;
 }
 
@@ -272,6 +396,12 @@ static bool ensureNumberOperands(VM* vm, Token op, Value left, Value right) {
 }
 
 static bool valueIsInteger(Value value, int* out) {
+  if (IS_INT(value)) {
+    // Out-of-range indexes clamp, so they fail the bounds check instead.
+    int64_t integer = AS_INT(value);
+    *out = integer > INT_MAX ? INT_MAX : integer < INT_MIN ? INT_MIN : (int)integer;
+    return true;
+  }
   if (!IS_NUMBER(value)) return false;
   double number = AS_NUMBER(value);
   double truncated = floor(number);
@@ -281,16 +411,8 @@ static bool valueIsInteger(Value value, int* out) {
 }
 
 static Value concatenateStrings(VM* vm, ObjString* a, ObjString* b) {
-  int length = a->length + b->length;
-  char* buffer = (char*)malloc((size_t)length + 1);
-  if (!buffer) {
-    runtimeOutOfMemory(vm, "Out of memory while concatenating strings.");
-    return NULL_VAL;
-  }
-  memcpy(buffer, a->chars, (size_t)a->length);
-  memcpy(buffer + a->length, b->chars, (size_t)b->length);
-  buffer[length] = '\0';
-  ObjString* result = takeStringWithLength(vm, buffer, length);
+  ObjString* result = concatStrings(vm, a, b);
+  if (!result) return NULL_VAL;
   return OBJ_VAL(result);
 }
 
@@ -305,16 +427,30 @@ static ObjString* moduleNameFromPath(VM* vm, const char* path) {
   return copyStringWithLength(vm, base, length);
 }
 
+static bool reserveFrameSlots(VM* vm, Value* slots, int slotCount) {
+  Value* frameEnd = slots + slotCount;
+  if (frameEnd > vm->stack + STACK_MAX) {
+    Token token;
+    memset(&token, 0, sizeof(Token));
+    runtimeError(vm, token, "Stack overflow.");
+    return false;
+  }
+  while (vm->stackTop < frameEnd) {
+    *vm->stackTop++ = NULL_VAL;
+  }
+  return true;
+}
+
 static bool beginModuleImport(VM* vm, CallFrame** frame, ObjString* pathString,
                               ObjString* alias, bool hasAlias, bool pushResult) {
   char* resolvedPath = resolveImportPath(
       vm, vm->currentProgram ? vm->currentProgram->path : NULL,
-      pathString->chars);
+      stringChars(pathString));
   if (!resolvedPath) {
     Value builtin;
     if (envGetByName(vm->globals, pathString, &builtin) &&
         isObjType(builtin, OBJ_INSTANCE)) {
-      ObjString* key = copyStringWithLength(vm, pathString->chars, pathString->length);
+      ObjString* key = copyStringWithLength(vm, stringChars(pathString), pathString->length);
       mapSet(vm->modules, key, builtin);
       if (pushResult) {
         push(vm, builtin);
@@ -382,11 +518,16 @@ static bool beginModuleImport(VM* vm, CallFrame** frame, ObjString* pathString,
     free(resolvedPath);
     return false;
   }
+  Value* moduleSlots = vm->stackTop - 1;
+  if (!reserveFrameSlots(vm, moduleSlots, moduleFunction->slotCount)) {
+    free(resolvedPath);
+    return false;
+  }
 
   CallFrame* moduleFrame = &vm->frames[vm->frameCount++];
   moduleFrame->function = moduleFunction;
   moduleFrame->ip = moduleFunction->chunk->code;
-  moduleFrame->slots = vm->stackTop - 1;
+  moduleFrame->slots = moduleSlots;
   moduleFrame->previousEnv = previousEnv;
   moduleFrame->previousProgram = vm->currentProgram;
   moduleFrame->receiver = NULL_VAL;
@@ -400,6 +541,7 @@ static bool beginModuleImport(VM* vm, CallFrame** frame, ObjString* pathString,
   moduleFrame->moduleHasAlias = hasAlias;
   moduleFrame->modulePushResult = pushResult;
   moduleFrame->modulePrivate = NULL;
+  moduleFrame->generator = NULL;
 
   vm->env = moduleEnv;
   vm->currentProgram = moduleFunction->program;
@@ -420,6 +562,170 @@ static bool findMethodByName(ObjClass* klass, ObjString* name, ObjFunction** out
   return false;
 }
 
+static inline InlineCacheEntry* cacheFindShape(InlineCache* cache, InlineCacheKind kind,
+                                                ObjShape* shape) {
+  if (!cache) return NULL;
+  for (int i = 0; i < cache->count; i++) {
+    InlineCacheEntry* entry = &cache->entries[i];
+    if (entry->shape == shape && entry->kind == kind) {
+      cache->hits++;
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Map entries are revalidated on use because a rehash moves them.
+static inline bool cacheFindMapEntry(InlineCache* cache, InlineCacheKind kind, ObjMap* map,
+                                     ObjString* key, int* outIndex) {
+  if (!cache) return false;
+  for (int i = 0; i < cache->count; i++) {
+    InlineCacheEntry* entry = &cache->entries[i];
+    if (entry->map != map || entry->kind != kind) continue;
+    int index = entry->index;
+    if (index >= 0 && index < map->capacity && map->entries[index].key == key) {
+      cache->hits++;
+      *outIndex = index;
+      return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+static inline void cacheAddMapEntry(InlineCache* cache, InlineCacheKind kind, ObjMap* map,
+                                    int index) {
+  if (!cache || index < 0) return;
+  InlineCacheEntry* entry = inlineCacheAdd(cache, kind, NULL, map, NULL);
+  if (entry) entry->index = index;
+}
+
+static inline bool getCachedMapEntry(ObjMap* map, ObjString* key, InlineCacheKind kind,
+                                     InlineCache* cache, Value* out) {
+  int index = -1;
+  if (cacheFindMapEntry(cache, kind, map, key, &index)) {
+    *out = map->entries[index].value;
+    return true;
+  }
+  if (!mapGetIndex(map, key, out, &index)) return false;
+  cacheAddMapEntry(cache, kind, map, index);
+  return true;
+}
+
+static inline void setCachedMapEntry(VM* vm, ObjMap* map, ObjString* key, Value value,
+                                     InlineCacheKind kind, InlineCache* cache) {
+  int index = -1;
+  if (cacheFindMapEntry(cache, kind, map, key, &index)) {
+    map->entries[index].value = value;
+    gcWriteBarrier(vm, (Obj*)map, value);
+    return;
+  }
+  cacheAddMapEntry(cache, kind, map, mapSetIndex(map, key, value));
+}
+
+// Reads an own field through the site's cache. Shaped instances hit on a shape
+// compare; modules and other dictionary instances cache their field map entry.
+static inline bool getInstanceField(ObjInstance* instance, ObjString* name,
+                                    InlineCache* cache, Value* out) {
+  ObjShape* shape = instance->shape;
+  if (!shape) {
+    return getCachedMapEntry(instance->fields, name, IC_FIELD, cache, out);
+  }
+  InlineCacheEntry* entry = cacheFindShape(cache, IC_SHAPE, shape);
+  if (entry) {
+    *out = instance->slots[entry->index];
+    return true;
+  }
+  int slot = shapeFindSlot(shape, name);
+  if (slot < 0) return false;
+  if (cache) {
+    entry = inlineCacheAdd(cache, IC_SHAPE, shape, NULL, NULL);
+    if (entry) entry->index = slot;
+  }
+  *out = instance->slots[slot];
+  return true;
+}
+
+static bool setInstanceField(VM* vm, ObjInstance* instance, ObjString* name, Value value,
+                             InlineCache* cache) {
+  ObjShape* shape = instance->shape;
+  if (!shape) {
+    setCachedMapEntry(vm, instance->fields, name, value, IC_FIELD, cache);
+    return true;
+  }
+
+  InlineCacheEntry* entry = cacheFindShape(cache, IC_SHAPE, shape);
+  if (entry) {
+    instance->slots[entry->index] = value;
+    gcWriteBarrier(vm, (Obj*)instance, value);
+    return true;
+  }
+  entry = cacheFindShape(cache, IC_SHAPE_ADD, shape);
+  if (entry && instanceReserveSlots(vm, instance, entry->nextShape->fieldCount)) {
+    instance->shape = entry->nextShape;
+    instance->slots[entry->index] = value;
+    gcWriteBarrier(vm, (Obj*)instance, value);
+    return true;
+  }
+
+  if (!instanceSetField(vm, instance, name, value)) return false;
+  if (cache && instance->shape) {
+    bool added = instance->shape != shape;
+    entry = inlineCacheAdd(cache, added ? IC_SHAPE_ADD : IC_SHAPE, shape, NULL, NULL);
+    if (entry) {
+      entry->nextShape = added ? instance->shape : NULL;
+      entry->index = added ? instance->shape->slot : shapeFindSlot(shape, name);
+    }
+  }
+  return true;
+}
+
+static bool findInstanceMethod(ObjInstance* instance, ObjString* name, InlineCache* cache,
+                               ObjFunction** out) {
+  for (int i = 0; cache && i < cache->count; i++) {
+    InlineCacheEntry* entry = &cache->entries[i];
+    if (entry->kind == IC_METHOD && entry->klass == instance->klass &&
+        entry->shape == instance->shape) {
+      cache->hits++;
+      *out = entry->method;
+      return true;
+    }
+  }
+  if (!findMethodByName(instance->klass, name, out)) return false;
+  if (cache) {
+    InlineCacheEntry* entry = inlineCacheAdd(cache, IC_METHOD, instance->shape, NULL,
+                                             instance->klass);
+    if (entry) entry->method = *out;
+  }
+  return true;
+}
+
+// Resolves a property for get and invoke sites: an own field first, then a
+// method. For shaped receivers one pass over the site's ways finds either, since
+// a method entry is only recorded for shapes without a shadowing field.
+static inline bool getInstanceProperty(ObjInstance* instance, ObjString* name,
+                                       InlineCache* cache, Value* outField,
+                                       ObjFunction** outMethod) {
+  *outMethod = NULL;
+  ObjShape* shape = instance->shape;
+  for (int i = 0; shape && cache && i < cache->count; i++) {
+    InlineCacheEntry* entry = &cache->entries[i];
+    if (entry->shape != shape) continue;
+    if (entry->kind == IC_SHAPE) {
+      cache->hits++;
+      *outField = instance->slots[entry->index];
+      return true;
+    }
+    if (entry->kind == IC_METHOD) {
+      cache->hits++;
+      *outMethod = entry->method;
+      return true;
+    }
+  }
+  if (getInstanceField(instance, name, cache, outField)) return true;
+  return findInstanceMethod(instance, name, cache, outMethod);
+}
+
 static Value evaluateIndex(VM* vm, Token token, Value object, Value index) {
   if (isObjType(object, OBJ_ARRAY)) {
     int i = 0;
@@ -447,7 +753,35 @@ static Value evaluateIndex(VM* vm, Token token, Value object, Value index) {
     return NULL_VAL;
   }
 
-  runtimeError(vm, token, "Only arrays and maps can be indexed.");
+  if (isObjType(object, OBJ_TYPED_ARRAY)) {
+    ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(object);
+    int i = 0;
+    if (!valueIsInteger(index, &i)) {
+      runtimeError(vm, token, "Typed array index must be an integer.");
+      return NULL_VAL;
+    }
+    if (i < 0 || i >= array->length) {
+      runtimeError(vm, token, "Typed array index out of bounds.");
+      return NULL_VAL;
+    }
+    return typedArrayGet(array, i);
+  }
+
+  if (isObjType(object, OBJ_RANGE)) {
+    ObjRange* range = (ObjRange*)AS_OBJ(object);
+    int i = 0;
+    if (!valueIsInteger(index, &i)) {
+      runtimeError(vm, token, "Range index must be an integer.");
+      return NULL_VAL;
+    }
+    if (i < 0 || i >= rangeLength(range)) {
+      runtimeError(vm, token, "Range index out of bounds.");
+      return NULL_VAL;
+    }
+    return rangeElement(range->start + i * range->step);
+  }
+
+  runtimeError(vm, token, "Only arrays, typed arrays, maps and ranges can be indexed.");
   return NULL_VAL;
 }
 
@@ -474,10 +808,163 @@ static Value evaluateSetIndex(VM* vm, Token token, Value object, Value index, Va
     return value;
   }
 
-  runtimeError(vm, token, "Only arrays and maps can be indexed.");
+  if (isObjType(object, OBJ_TYPED_ARRAY)) {
+    ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(object);
+    int i = 0;
+    if (!valueIsInteger(index, &i)) {
+      runtimeError(vm, token, "Typed array index must be an integer.");
+      return NULL_VAL;
+    }
+    if (i < 0 || i >= array->length) {
+      runtimeError(vm, token, "Typed array index out of bounds.");
+      return NULL_VAL;
+    }
+    if (!IS_NUMBER(value)) {
+      runtimeError(vm, token, "Typed array elements must be numbers.");
+      return NULL_VAL;
+    }
+    typedArraySet(array, i, value);
+    return value;
+  }
+
+  runtimeError(vm, token, "Only arrays, typed arrays and maps can be indexed.");
   return NULL_VAL;
 }
 
+static bool growSuspendArray(VM* vm, void** items, int* capacity, int needed,
+                             size_t itemSize) {
+  if (*capacity >= needed) return true;
+  int grown = *capacity;
+  while (grown < needed) grown = GROW_CAPACITY(grown);
+  void* resized = realloc(*items, itemSize * (size_t)grown);
+  if (!resized) return runtimeOutOfMemory(vm, "Out of memory while suspending frames.");
+  *items = resized;
+  *capacity = grown;
+  return true;
+}
+
+// Closes the upvalues open at or above `base` and remembers each with its slot
+// offset, so the segment can be resumed at another address.
+static bool keepSegmentUpvalues(VM* vm, Value* base, ObjUpvalue*** upvalues, int** slots,
+                                int* count, int* capacity) {
+  *count = 0;
+  while (vm->openUpvalues && vm->openUpvalues->location >= base) {
+    ObjUpvalue* upvalue = vm->openUpvalues;
+    if (*count == *capacity) {
+      int grown = GROW_CAPACITY(*capacity);
+      ObjUpvalue** kept = GROW_ARRAY(ObjUpvalue*, *upvalues, *capacity, grown);
+      if (!kept) return runtimeOutOfMemory(vm, "Out of memory while suspending frames.");
+      *upvalues = kept;
+      int* keptSlots = GROW_ARRAY(int, *slots, *capacity, grown);
+      if (!keptSlots) return runtimeOutOfMemory(vm, "Out of memory while suspending frames.");
+      *slots = keptSlots;
+      *capacity = grown;
+    }
+    (*upvalues)[*count] = upvalue;
+    (*slots)[*count] = (int)(upvalue->location - base);
+    (*count)++;
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    gcWriteBarrier(vm, (Obj*)upvalue, upvalue->closed);
+    vm->openUpvalues = upvalue->nextOpen;
+  }
+  return true;
+}
+
+// Reopens upvalues kept by keepSegmentUpvalues on the segment now at `base`.
+// The segment sits above every open slot, so they go first in the list, still
+// ordered by descending address.
+static void reopenSegmentUpvalues(VM* vm, Value* base, ObjUpvalue** upvalues, int* slots,
+                                  int count) {
+  for (int i = count - 1; i >= 0; i--) {
+    ObjUpvalue* upvalue = upvalues[i];
+    Value* location = base + slots[i];
+    *location = upvalue->closed;
+    upvalue->location = location;
+    upvalue->closed = NULL_VAL;
+    upvalue->nextOpen = vm->openUpvalues;
+    vm->openUpvalues = upvalue;
+  }
+}
+
+// Moves the top frame, which must belong to a generator, off the VM: its stack
+// segment, its try handlers and defers, and the upvalues open on its slots.
+// The caller's env and program are restored as on return.
+static bool generatorSuspend(VM* vm, CallFrame* frame) {
+  ObjGenerator* generator = frame->generator;
+  int frameIndex = (int)(frame - vm->frames);
+  int count = (int)(vm->stackTop - frame->slots);
+  if (!growSuspendArray(vm, (void**)&generator->stack, &generator->stackCapacity, count,
+                        sizeof(Value))) {
+    return false;
+  }
+  memcpy(generator->stack, frame->slots, sizeof(Value) * (size_t)count);
+  generator->stackCount = count;
+
+  if (!keepSegmentUpvalues(vm, frame->slots, &generator->upvalues, &generator->upvalueSlots,
+                           &generator->upvalueCount, &generator->upvalueCapacity)) {
+    return false;
+  }
+
+  int firstTry = vm->tryCount;
+  while (firstTry > 0 && vm->tryFrames[firstTry - 1].frameIndex >= frameIndex) firstTry--;
+  if (!growSuspendArray(vm, (void**)&generator->tries, &generator->tryCapacity,
+                        vm->tryCount - firstTry, sizeof(GeneratorTry))) {
+    return false;
+  }
+  generator->tryCount = 0;
+  for (int i = firstTry; i < vm->tryCount; i++) {
+    GeneratorTry* saved = &generator->tries[generator->tryCount++];
+    saved->handler = vm->tryFrames[i].handler;
+    saved->stackOffset = (int)(vm->tryFrames[i].stackTop - frame->slots);
+    saved->env = vm->tryFrames[i].env;
+    saved->scopeDepth = vm->tryFrames[i].scopeDepth;
+  }
+  vm->tryCount = firstTry;
+
+  int firstDefer = vm->deferCount;
+  while (firstDefer > 0 && vm->defers[firstDefer - 1].frameIndex >= frameIndex) firstDefer--;
+  if (!growSuspendArray(vm, (void**)&generator->defers, &generator->deferCapacity,
+                        vm->deferCount - firstDefer, sizeof(GeneratorDefer))) {
+    return false;
+  }
+  generator->deferCount = 0;
+  for (int i = firstDefer; i < vm->deferCount; i++) {
+    GeneratorDefer* saved = &generator->defers[generator->deferCount++];
+    saved->scopeDepth = vm->defers[i].scopeDepth;
+    saved->argCount = vm->defers[i].argCount;
+    saved->callee = vm->defers[i].callee;
+    saved->args = vm->defers[i].args;
+  }
+  vm->deferCount = firstDefer;
+
+  generator->ip = frame->ip;
+  generator->receiver = frame->receiver;
+  generator->argCount = frame->argCount;
+  generator->scopeDepth = frame->scopeDepth;
+  generator->env = vm->env;
+  generator->state = GEN_SUSPENDED;
+  generator->loopExit = NULL;
+  gcRememberObjectIfYoungRefs(vm, (Obj*)generator);
+
+  vm->frameCount--;
+  vm->env = frame->previousEnv;
+  vm->currentProgram = frame->previousProgram;
+  vm->stackTop = frame->slots;
+  return true;
+}
+
+// Calling a generator function binds the arguments in a fresh frame, then
+// suspends it before the first instruction and returns the generator.
+static bool startGenerator(VM* vm, CallFrame* frame) {
+  ObjGenerator* generator = newGenerator(vm, frame->function);
+  if (!generator) return false;
+  frame->generator = generator;
+  if (!generatorSuspend(vm, frame)) return false;
+  push(vm, OBJ_VAL(generator));
+  return true;
+}
+
 static bool callFunction(VM* vm, ObjFunction* function, Value receiver,
                          bool hasReceiver, int argc) {
   if (argc < function->minArity || argc > function->arity) {
@@ -493,11 +980,15 @@ static bool callFunction(VM* vm, ObjFunction* function, Value receiver,
     runtimeError(vm, token, "Stack overflow.");
     return false;
   }
+  Value* slots = vm->stackTop - argc - 1;
+  if (!reserveFrameSlots(vm, slots, function->slotCount)) {
+    return false;
+  }
 
   CallFrame* frame = &vm->frames[vm->frameCount++];
   frame->function = function;
   frame->ip = function->chunk->code;
-  frame->slots = vm->stackTop - argc - 1;
+  frame->slots = slots;
   frame->previousEnv = vm->env;
     frame->previousProgram = vm->currentProgram;
     frame->receiver = hasReceiver ? receiver : NULL_VAL;
@@ -511,20 +1002,26 @@ static bool callFunction(VM* vm, ObjFunction* function, Value receiver,
   frame->moduleHasAlias = false;
   frame->modulePushResult = false;
   frame->modulePrivate = NULL;
+  frame->generator = NULL;
 
-  Env* env = newEnv(vm, function->closure);
-  if (!env) return false;
   if (hasReceiver) {
-    ObjString* thisName = copyString(vm, "this");
-    envDefine(env, thisName, receiver);
+    slots[0] = receiver;
   }
-  for (int i = 0; i < function->arity; i++) {
-    Value arg = i < argc ? frame->slots[i + 1] : NULL_VAL;
-    envDefine(env, function->params[i], arg);
-  }
-
-  vm->env = env;
   vm->currentProgram = function->program;
+  if (function->paramsInSlots) {
+    vm->env = function->closure;
+  } else {
+    Env* env = newEnv(vm, function->closure);
+    if (!env) return false;
+    for (int i = 0; i < function->arity; i++) {
+      Value arg = i < argc ? frame->slots[i + 1] : NULL_VAL;
+      envDefine(env, function->params[i], arg);
+    }
+    vm->env = env;
+  }
+  if (function->isGenerator) {
+    return startGenerator(vm, frame);
+  }
   return true;
 }
 
@@ -576,12 +1073,24 @@ static bool returnFromFrame(VM* vm, CallFrame** frame, Value result, int targetF
   if (finished->function->isInitializer) {
     result = finished->receiver;
   }
+  closeUpvalues(vm, finished->slots);
   vm->stackTop = finished->slots;
+  if (finished->generator) {
+    // A finished generator drops its result. A foreach driving it inline
+    // leaves the loop; a native resume sees the state change.
+    uint8_t* loopExit = finished->generator->loopExit;
+    generatorRelease(finished->generator);
+    if (loopExit) {
+      *frame = &vm->frames[vm->frameCount - 1];
+      (*frame)->ip = loopExit;
+      return false;
+    }
+  }
   if (!finished->discardResult) {
     push(vm, result);
   }
   if (vm->frameCount <= targetFrameCount) {
-    if (targetFrameCount == 0 && !finished->discardResult) {
+    if (targetFrameCount == 0 && !finished->discardResult && !vm->currentFiber) {
       pop(vm);
     }
     return true;
@@ -624,7 +1133,7 @@ static bool enumUnwrap(VM* vm, ObjMap* map, const char* enumName,
     return true;
   }
   ObjString* enumStr = (ObjString*)AS_OBJ(enumValue);
-  if (strcmp(enumStr->chars, enumName) != 0) {
+  if (strcmp(stringChars(enumStr), enumName) != 0) {
     return true;
   }
   *matched = true;
@@ -633,12 +1142,12 @@ static bool enumUnwrap(VM* vm, ObjMap* map, const char* enumName,
     return false;
   }
   ObjString* tagStr = (ObjString*)AS_OBJ(tagValue);
-  if (strcmp(tagStr->chars, errTag) == 0) {
+  if (strcmp(stringChars(tagStr), errTag) == 0) {
     *shouldReturn = true;
     *out = OBJ_VAL(map);
     return true;
   }
-  if (strcmp(tagStr->chars, okTag) == 0) {
+  if (strcmp(stringChars(tagStr), okTag) == 0) {
     ObjString* valuesKey = copyString(vm, "_values");
     Value valuesValue;
     if (!mapGet(map, valuesKey, &valuesValue) || !isObjType(valuesValue, OBJ_ARRAY)) {
@@ -673,10 +1182,15 @@ static bool callValue(VM* vm, Value callee, int argc) {
       runtimeError(vm, token, "Wrong number of arguments.");
       return false;
     }
+    vm->callDepth++;
     Value result = native->function(vm, argc, vm->stackTop - argc);
+    vm->callDepth--;
     if (vm->hadError) return false;
     vm->stackTop -= argc + 1;
     push(vm, result);
+    // A native that parked the running task leaves a placeholder result and
+    // stops the dispatch loop; vmRunFiber suspends the task's frames.
+    if (vm->fiberParking) return false;
     return true;
   }
 
@@ -715,7 +1229,6 @@ static bool callValue(VM* vm, Value callee, int argc) {
         }
         provided = (ObjMap*)AS_OBJ(arg);
       }
-      ObjMap* fields = newMap(vm);
       if (provided) {
         for (int i = 0; i < provided->capacity; i++) {
           ObjString* key = provided->entries[i].key;
@@ -727,18 +1240,18 @@ static bool callValue(VM* vm, Value callee, int argc) {
             runtimeError(vm, token, "Unknown struct field.");
             return false;
           }
-          mapSet(fields, key, provided->entries[i].value);
         }
       }
+      // Declared-field order keeps every value of this struct on one shape.
+      ObjInstance* instance = newInstance(vm, klass);
       if (klass->structFields) {
         for (int i = 0; i < klass->structFields->capacity; i++) {
           ObjString* key = klass->structFields->entries[i].key;
           if (!key) continue;
-          Value existing;
-          if (mapGet(fields, key, &existing)) continue;
-          Value defaultValue;
-          if (klass->structDefaults && mapGet(klass->structDefaults, key, &defaultValue)) {
-            mapSet(fields, key, defaultValue);
+          Value value;
+          if ((provided && mapGet(provided, key, &value)) ||
+              (klass->structDefaults && mapGet(klass->structDefaults, key, &value))) {
+            instanceSetField(vm, instance, key, value);
             continue;
           }
           Token token;
@@ -747,7 +1260,6 @@ static bool callValue(VM* vm, Value callee, int argc) {
           return false;
         }
       }
-      ObjInstance* instance = newInstanceWithFields(vm, klass, fields);
       Value instanceValue = OBJ_VAL(instance);
       vm->stackTop -= argc + 1;
       push(vm, instanceValue);
@@ -785,7 +1297,7 @@ static bool run(VM* vm);
 
 static bool runWithTarget(VM* vm, int targetFrameCount);
 
-bool vmCallValue(VM* vm, Value callee, int argc, Value* args, Value* out) {
+static bool callValueNested(VM* vm, Value callee, int argc, Value* args, Value* out) {
   if (isObjType(callee, OBJ_NATIVE)) {
     ObjNative* native = (ObjNative*)AS_OBJ(callee);
     if (native->arity >= 0 && argc != native->arity) {
@@ -825,14 +1337,18 @@ bool vmCallValue(VM* vm, Value callee, int argc, Value* args, Value* out) {
   }
 
   if (!callValue(vm, callee, argc)) {
+    closeUpvalues(vm, savedStackTop);
     vm->stackTop = savedStackTop;
     vm->env = savedEnv;
     vm->currentProgram = savedProgram;
     return false;
   }
 
-  if (!runWithTarget(vm, savedFrameCount)) {
+  // Struct constructors and generator functions finish inside callValue and
+  // leave no frame to run.
+  if (vm->frameCount > savedFrameCount && !runWithTarget(vm, savedFrameCount)) {
     vm->frameCount = savedFrameCount;
+    closeUpvalues(vm, savedStackTop);
     vm->stackTop = savedStackTop;
     vm->env = savedEnv;
     vm->currentProgram = savedProgram;
@@ -852,112 +1368,920 @@ bool vmCallValue(VM* vm, Value callee, int argc, Value* args, Value* out) {
   return true;
 }
 
-static bool run(VM* vm) {
-  return runWithTarget(vm, 0);
+// Calls from C count towards callDepth: a task can only park from a native
+// its own dispatch loop called, never across one of these.
+bool vmCallValue(VM* vm, Value callee, int argc, Value* args, Value* out) {
+  vm->callDepth++;
+  bool ok = callValueNested(vm, callee, argc, args, out);
+  vm->callDepth--;
+  return ok;
 }
 
-static inline uint16_t readShort(CallFrame* frame) {
-  frame->ip += 2;
-  return (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]);
+// Copies a suspended generator back onto the stack as the top frame, with the
+// try handlers, defers and upvalues it had registered. The caller runs it.
+static bool generatorEnter(VM* vm, ObjGenerator* generator) {
+  Token token;
+  memset(&token, 0, sizeof(Token));
+  if (generator->state == GEN_RUNNING) {
+    runtimeError(vm, token, "Generator is already running.");
+    return false;
+  }
+  if (vm->frameCount == vm->maxFrames ||
+      vm->stackTop + generator->stackCount > vm->stack + STACK_MAX) {
+    runtimeError(vm, token, "Stack overflow.");
+    return false;
+  }
+  if (vm->tryCount + generator->tryCount > TRY_MAX) {
+    runtimeError(vm, token, "Too many nested try blocks.");
+    return false;
+  }
+  if (!ensureDeferCapacity(vm, generator->deferCount)) return false;
+
+  int frameIndex = vm->frameCount;
+  Value* slots = vm->stackTop;
+  memcpy(slots, generator->stack, sizeof(Value) * (size_t)generator->stackCount);
+  vm->stackTop += generator->stackCount;
+  generator->stackCount = 0;
+
+  CallFrame* frame = &vm->frames[vm->frameCount++];
+  frame->function = generator->function;
+  frame->ip = generator->ip;
+  frame->slots = slots;
+  frame->previousEnv = vm->env;
+  frame->previousProgram = vm->currentProgram;
+  frame->receiver = generator->receiver;
+  frame->argCount = generator->argCount;
+  frame->scopeDepth = generator->scopeDepth;
+  frame->isModule = false;
+  frame->discardResult = false;
+  frame->moduleInstance = NULL;
+  frame->moduleAlias = NULL;
+  frame->moduleKey = NULL;
+  frame->moduleHasAlias = false;
+  frame->modulePushResult = false;
+  frame->modulePrivate = NULL;
+  frame->generator = generator;
+
+  reopenSegmentUpvalues(vm, slots, generator->upvalues, generator->upvalueSlots,
+                        generator->upvalueCount);
+  generator->upvalueCount = 0;
+
+  for (int i = 0; i < generator->tryCount; i++) {
+    TryFrame* tryFrame = &vm->tryFrames[vm->tryCount++];
+    tryFrame->frameIndex = frameIndex;
+    tryFrame->handler = generator->tries[i].handler;
+    tryFrame->stackTop = slots + generator->tries[i].stackOffset;
+    tryFrame->env = generator->tries[i].env;
+    tryFrame->scopeDepth = generator->tries[i].scopeDepth;
+  }
+  generator->tryCount = 0;
+
+  for (int i = 0; i < generator->deferCount; i++) {
+    DeferEntry* entry = &vm->defers[vm->deferCount++];
+    entry->frameIndex = frameIndex;
+    entry->scopeDepth = generator->defers[i].scopeDepth;
+    entry->argCount = generator->defers[i].argCount;
+    entry->callee = generator->defers[i].callee;
+    entry->args = generator->defers[i].args;
+  }
+  generator->deferCount = 0;
+
+  vm->env = generator->env;
+  vm->currentProgram = generator->function->program;
+  generator->state = GEN_RUNNING;
+  return true;
 }
 
-static inline Value readConstant(CallFrame* frame) {
-  return frame->function->chunk->constants[readShort(frame)];
+// Runs a generator to its next yield from native code. *done is set instead
+// once the body finishes; its return value is dropped. *key counts the values
+// yielded so far.
+bool vmResumeGenerator(VM* vm, ObjGenerator* generator, bool* done, Value* key, Value* value) {
+  *done = false;
+  if (generator->state == GEN_DONE) {
+    *done = true;
+    return true;
+  }
+  int savedFrameCount = vm->frameCount;
+  Value* savedStackTop = vm->stackTop;
+  Env* savedEnv = vm->env;
+  Program* savedProgram = vm->currentProgram;
+  if (!generatorEnter(vm, generator)) return false;
+
+  vm->callDepth++;
+  bool ok = runWithTarget(vm, savedFrameCount);
+  vm->callDepth--;
+  if (!ok) {
+    generatorRelease(generator);
+    vm->frameCount = savedFrameCount;
+    closeUpvalues(vm, savedStackTop);
+    vm->stackTop = savedStackTop;
+    vm->env = savedEnv;
+    vm->currentProgram = savedProgram;
+    return false;
+  }
+
+  if (generator->state == GEN_SUSPENDED) {
+    *key = INT_VAL(generator->index++);
+    *value = vm->stackTop[-1];
+  } else {
+    *done = true;
+  }
+  vm->stackTop = savedStackTop;
+  vm->env = savedEnv;
+  vm->currentProgram = savedProgram;
+  return true;
 }
 
-static bool runWithTarget(VM* vm, int targetFrameCount) {
-  CallFrame* frame = &vm->frames[vm->frameCount - 1];
+// Moves a parked task's frames above baseFrame off the VM, with their stack
+// segment, try handlers, defers and open upvalues. The stack is left as it
+// was before the task ran.
+static bool fiberSuspend(VM* vm, ObjFiber* fiber, int baseFrame, Value* base) {
+  int count = (int)(vm->stackTop - base);
+  int frames = vm->frameCount - baseFrame;
+  int firstTry = vm->tryCount;
+  while (firstTry > 0 && vm->tryFrames[firstTry - 1].frameIndex >= baseFrame) firstTry--;
+  int firstDefer = vm->deferCount;
+  while (firstDefer > 0 && vm->defers[firstDefer - 1].frameIndex >= baseFrame) firstDefer--;
+  if (!growSuspendArray(vm, (void**)&fiber->stack, &fiber->stackCapacity, count,
+                        sizeof(Value)) ||
+      !growSuspendArray(vm, (void**)&fiber->frames, &fiber->frameCapacity, frames,
+                        sizeof(CallFrame)) ||
+      !growSuspendArray(vm, (void**)&fiber->tries, &fiber->tryCapacity,
+                        vm->tryCount - firstTry, sizeof(TryFrame)) ||
+      !growSuspendArray(vm, (void**)&fiber->defers, &fiber->deferCapacity,
+                        vm->deferCount - firstDefer, sizeof(DeferEntry))) {
+    return false;
+  }
+  if (!keepSegmentUpvalues(vm, base, &fiber->upvalues, &fiber->upvalueSlots,
+                           &fiber->upvalueCount, &fiber->upvalueCapacity)) {
+    return false;
+  }
 
-#define READ_BYTE() (*frame->ip++)
-#define READ_SHORT() readShort(frame)
-#define READ_CONSTANT() readConstant(frame)
+  memcpy(fiber->stack, base, sizeof(Value) * (size_t)count);
+  fiber->stackCount = count;
+  for (int i = 0; i < frames; i++) {
+    fiber->frames[i] = vm->frames[baseFrame + i];
+    fiber->frames[i].slots = fiber->stack + (vm->frames[baseFrame + i].slots - base);
+  }
+  fiber->frameCount = frames;
+  fiber->tryCount = 0;
+  for (int i = firstTry; i < vm->tryCount; i++) {
+    TryFrame* saved = &fiber->tries[fiber->tryCount++];
+    *saved = vm->tryFrames[i];
+    saved->frameIndex -= baseFrame;
+    saved->stackTop = fiber->stack + (vm->tryFrames[i].stackTop - base);
+  }
+  vm->tryCount = firstTry;
+  fiber->deferCount = 0;
+  for (int i = firstDefer; i < vm->deferCount; i++) {
+    DeferEntry* saved = &fiber->defers[fiber->deferCount++];
+    *saved = vm->defers[i];
+    saved->frameIndex -= baseFrame;
+  }
+  vm->deferCount = firstDefer;
+
+  fiber->env = vm->env;
+  fiber->program = vm->currentProgram;
+  gcRememberObjectIfYoungRefs(vm, (Obj*)fiber);
+  vm->frameCount = baseFrame;
+  vm->stackTop = base;
+  return true;
+}
 
-  for (;;) {
-    uint8_t instruction = READ_BYTE();
-    debugTraceInstruction(vm, frame, instruction);
-    vm->instructionCount++;
-    if (vm->instructionBudget > 0 && vm->instructionCount > vm->instructionBudget) {
-      runtimeError(vm, currentToken(frame), "Instruction budget exceeded.");
-      return false;
-    }
-    size_t instructionOffset = (size_t)(frame->ip - frame->function->chunk->code - 1);
-    InlineCache* cache = NULL;
-    if (frame->function->chunk->caches &&
-        instructionOffset < (size_t)frame->function->chunk->count) {
-      cache = &frame->function->chunk->caches[instructionOffset];
-    }
-    switch (instruction) {
-      case OP_CONSTANT: {
-        Value constant = READ_CONSTANT();
-        push(vm, constant);
-        break;
-      }
-      case OP_NULL:
-        push(vm, NULL_VAL);
-        break;
-      case OP_TRUE:
-        push(vm, BOOL_VAL(true));
-        break;
-      case OP_FALSE:
-        push(vm, BOOL_VAL(false));
-        break;
-      case OP_POP:
-        pop(vm);
-        break;
-      case OP_GET_VAR: {
-        ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
-        Value value;
-        if (!envGetByName(vm->env, name, &value)) {
-          char suggestion[64];
-          char message[256];
-          if (suggestNameFromEnv(vm->env, name->chars, name->length,
-                                 suggestion, sizeof(suggestion))) {
-            snprintf(message, sizeof(message),
-                     "Undefined variable. Did you mean '%s'?", suggestion);
-            runtimeError(vm, currentToken(frame), message);
-          } else {
-            runtimeError(vm, currentToken(frame), "Undefined variable.");
-          }
+// Copies a parked task back on top of the stack. Its first frame returns into
+// whatever is running it now.
+static bool fiberEnter(VM* vm, ObjFiber* fiber) {
+  Token token;
+  memset(&token, 0, sizeof(Token));
+  if (vm->frameCount + fiber->frameCount > vm->maxFrames ||
+      vm->stackTop + fiber->stackCount > vm->stack + STACK_MAX) {
+    runtimeError(vm, token, "Stack overflow.");
+    return false;
+  }
+  if (vm->tryCount + fiber->tryCount > TRY_MAX) {
+    runtimeError(vm, token, "Too many nested try blocks.");
+    return false;
+  }
+  if (!ensureDeferCapacity(vm, fiber->deferCount)) return false;
+
+  int baseFrame = vm->frameCount;
+  Value* base = vm->stackTop;
+  memcpy(base, fiber->stack, sizeof(Value) * (size_t)fiber->stackCount);
+  vm->stackTop += fiber->stackCount;
+  for (int i = 0; i < fiber->frameCount; i++) {
+    CallFrame* frame = &vm->frames[vm->frameCount++];
+    *frame = fiber->frames[i];
+    frame->slots = base + (fiber->frames[i].slots - fiber->stack);
+  }
+  vm->frames[baseFrame].previousEnv = vm->env;
+  vm->frames[baseFrame].previousProgram = vm->currentProgram;
+  reopenSegmentUpvalues(vm, base, fiber->upvalues, fiber->upvalueSlots, fiber->upvalueCount);
+  for (int i = 0; i < fiber->tryCount; i++) {
+    TryFrame* tryFrame = &vm->tryFrames[vm->tryCount++];
+    *tryFrame = fiber->tries[i];
+    tryFrame->frameIndex += baseFrame;
+    tryFrame->stackTop = base + (fiber->tries[i].stackTop - fiber->stack);
+  }
+  for (int i = 0; i < fiber->deferCount; i++) {
+    DeferEntry* entry = &vm->defers[vm->deferCount++];
+    *entry = fiber->defers[i];
+    entry->frameIndex += baseFrame;
+  }
+  vm->env = fiber->env;
+  vm->currentProgram = fiber->program;
+  fiber->stackCount = 0;
+  fiber->frameCount = 0;
+  fiber->upvalueCount = 0;
+  fiber->tryCount = 0;
+  fiber->deferCount = 0;
+  return true;
+}
+
+// A task that has not started holds its callee and arguments.
+static bool fiberStart(VM* vm, ObjFiber* fiber) {
+  if (vm->stackTop + fiber->stackCount > vm->stack + STACK_MAX) {
+    Token token;
+    memset(&token, 0, sizeof(Token));
+    runtimeError(vm, token, "Stack overflow.");
+    return false;
+  }
+  memcpy(vm->stackTop, fiber->stack, sizeof(Value) * (size_t)fiber->stackCount);
+  vm->stackTop += fiber->stackCount;
+  int argc = fiber->stackCount - 1;
+  fiber->stackCount = 0;
+  return callValue(vm, vm->stackTop[-argc - 1], argc);
+}
+
+// Runs a task on top of the current stack until it returns, parks in a native
+// such as await() or sleep(), or fails. The caller's stack, env and program are
+// restored in every case; a finished task keeps its return value in `result`.
+FiberRunResult vmRunFiber(VM* vm, ObjFiber* fiber) {
+  int baseFrame = vm->frameCount;
+  Value* base = vm->stackTop;
+  Env* savedEnv = vm->env;
+  Program* savedProgram = vm->currentProgram;
+  fiber->resumer = vm->currentFiber;
+  fiber->baseFrame = baseFrame;
+  fiber->callDepth = vm->callDepth;
+  vm->currentFiber = fiber;
+
+  bool ok = fiber->state == FIBER_NEW ? fiberStart(vm, fiber) : fiberEnter(vm, fiber);
+  if (ok) {
+    fiber->state = FIBER_RUNNING;
+    if (fiber->wakeThrows) {
+      // Woken by a failed task it awaited: the error surfaces at the await.
+      fiber->wakeThrows = false;
+      vmThrowValue(vm, vm->stackTop[-1]);
+    }
+    if (vm->frameCount > baseFrame) ok = runWithTarget(vm, baseFrame);
+  }
+
+  FiberRunResult outcome = FIBER_RUN_DONE;
+  if (!ok && vm->fiberParking) {
+    vm->fiberParking = false;
+    outcome = fiberSuspend(vm, fiber, baseFrame, base) ? FIBER_RUN_PARKED : FIBER_RUN_ERROR;
+  } else if (!ok && vm->throwPending) {
+    // Nothing in the task caught the throw; the task keeps the error.
+    fiber->result = vm->pendingThrow;
+    vm->pendingThrow = NULL_VAL;
+    vm->throwPending = false;
+    vm->hadError = false;
+    outcome = FIBER_RUN_FAILED;
+  } else if (!ok) {
+    outcome = FIBER_RUN_ERROR;
+  } else {
+    fiber->result = vm->stackTop > base ? vm->stackTop[-1] : NULL_VAL;
+  }
+  if (outcome != FIBER_RUN_PARKED) {
+    vm->frameCount = baseFrame;
+    closeUpvalues(vm, base);
+    fiberRelease(fiber);
+    if (outcome == FIBER_RUN_FAILED) fiber->state = FIBER_FAILED;
+    gcRememberObjectIfYoungRefs(vm, (Obj*)fiber);
+  }
+  vm->stackTop = base;
+  vm->env = savedEnv;
+  vm->currentProgram = savedProgram;
+  vm->currentFiber = fiber->resumer;
+  fiber->resumer = NULL;
+  return outcome;
+}
+
+static bool run(VM* vm) {
+  return runWithTarget(vm, 0);
+}
+
+static inline uint16_t readShort(CallFrame* frame) {
+  frame->ip += 2;
+  return (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]);
+}
+
+static inline Value readConstant(CallFrame* frame) {
+  return frame->function->chunk->constants[readShort(frame)];
+}
+
+static inline InlineCache* instructionCache(CallFrame* frame) {
+  Chunk* chunk = frame->function->chunk;
+  size_t offset = (size_t)(frame->ip - chunk->code - 1);
+  if (!chunk->caches || offset >= (size_t)chunk->count) return NULL;
+  return &chunk->caches[offset];
+}
+
+// A site whose quickened form keeps failing its guard stays generic.
+#define QUICKEN_MAX_DEOPTS 4
+
+static inline void quickenInstruction(CallFrame* frame, OpCode op) {
+  InlineCache* cache = instructionCache(frame);
+  if (cache && cache->deopts < QUICKEN_MAX_DEOPTS) {
+    frame->ip[-1] = (uint8_t)op;
+  }
+}
+
+static inline void deoptimizeInstruction(CallFrame* frame, OpCode op) {
+  InlineCache* cache = instructionCache(frame);
+  if (cache && cache->deopts < UINT8_MAX) {
+    cache->deopts++;
+  }
+  frame->ip[-1] = (uint8_t)op;
+}
+
+static void undefinedVariableError(VM* vm, Token token, ObjString* name) {
+  char suggestion[64];
+  char message[256];
+  if (suggestNameFromEnv(vm->env, stringChars(name), name->length,
+                         suggestion, sizeof(suggestion))) {
+    snprintf(message, sizeof(message),
+             "Undefined variable. Did you mean '%s'?", suggestion);
+    runtimeError(vm, token, message);
+  } else {
+    runtimeError(vm, token, "Undefined variable.");
+  }
+}
+
+// Calls the iter()/next() function visible from the current scope, the same
+// lookup the foreach lowering did before OP_ITER_INIT existed.
+static bool callIterProtocol(VM* vm, Token token, const char* name, Value arg, Value* out) {
+  ObjString* fnName = copyString(vm, name);
+  Value fn;
+  if (!envGetByName(vm->env, fnName, &fn)) {
+    undefinedVariableError(vm, token, fnName);
+    return false;
+  }
+  return vmCallValue(vm, fn, 1, &arg, out);
+}
+
+static bool mapGetNumber(VM* vm, ObjMap* map, const char* name, double* out) {
+  Value value;
+  if (!mapGet(map, copyString(vm, name), &value) || !IS_NUMBER(value)) return false;
+  *out = AS_NUMBER(value);
+  return true;
+}
+
+// Arrays, typed arrays, plain maps, ranges and range cursors from iter() get
+// a cursor that advances in place. Anything else, including maps that define `iter` and the
+// array/map iterators returned by iter(), is driven through iter()/next().
+static ObjIterator* iteratorStart(VM* vm, Token token, Value iterable, bool withKey) {
+  if (isObjType(iterable, OBJ_ARRAY)) {
+    return newIterator(vm, ITER_ARRAY, iterable, withKey);
+  }
+  if (isObjType(iterable, OBJ_TYPED_ARRAY)) {
+    return newIterator(vm, ITER_TYPED, iterable, withKey);
+  }
+  if (isObjType(iterable, OBJ_RANGE)) {
+    ObjRange* range = (ObjRange*)AS_OBJ(iterable);
+    ObjIterator* iterator = newIterator(vm, ITER_RANGE, iterable, withKey);
+    iterator->current = range->start;
+    iterator->end = range->end;
+    iterator->step = range->step;
+    return iterator;
+  }
+  if (isObjType(iterable, OBJ_GENERATOR)) {
+    return newIterator(vm, ITER_GENERATOR, iterable, withKey);
+  }
+  if (isObjType(iterable, OBJ_MAP)) {
+    ObjMap* map = (ObjMap*)AS_OBJ(iterable);
+    Value type;
+    Value iterFn;
+    if (!mapGet(map, copyString(vm, "_iter_type"), &type)) {
+      if (!mapGet(map, copyString(vm, "iter"), &iterFn)) {
+        ObjIterator* iterator = newIterator(vm, ITER_MAP, iterable, withKey);
+        iterator->keys = newArrayWithCapacity(vm, map->count);
+        for (int i = 0; i < map->capacity; i++) {
+          if (!map->entries[i].key) continue;
+          arrayWrite(iterator->keys, OBJ_VAL(map->entries[i].key));
+        }
+        return iterator;
+      }
+    } else if (isString(type) && asString(type)->length == 5 &&
+               memcmp(stringChars(asString(type)), "range", 5) == 0) {
+      double current, end, step;
+      if (mapGetNumber(vm, map, "current", &current) && mapGetNumber(vm, map, "end", &end) &&
+          mapGetNumber(vm, map, "step", &step)) {
+        ObjIterator* iterator = newIterator(vm, ITER_RANGE, iterable, withKey);
+        iterator->cursorName = copyString(vm, "current");
+        iterator->current = current;
+        iterator->end = end;
+        iterator->step = step;
+        return iterator;
+      }
+    }
+  }
+
+  Value source;
+  if (!callIterProtocol(vm, token, "iter", iterable, &source)) return NULL;
+  if (isObjType(source, OBJ_GENERATOR)) {
+    return newIterator(vm, ITER_GENERATOR, source, withKey);
+  }
+  return newIterator(vm, ITER_PROTOCOL, source, withKey);
+}
+
+// Produces the next key/value pair, or sets *done. Only the protocol path
+// allocates: next() returns a fresh result map per step.
+static bool iteratorNext(VM* vm, Token token, ObjIterator* iterator, bool* done,
+                         Value* key, Value* value) {
+  *done = false;
+  switch (iterator->kind) {
+    case ITER_ARRAY: {
+      ObjArray* array = (ObjArray*)AS_OBJ(iterator->source);
+      if (iterator->index >= array->count) {
+        *done = true;
+        return true;
+      }
+      *key = INT_VAL(iterator->index);
+      *value = array->items[iterator->index++];
+      return true;
+    }
+    case ITER_TYPED: {
+      ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(iterator->source);
+      if (iterator->index >= array->length) {
+        *done = true;
+        return true;
+      }
+      *key = INT_VAL(iterator->index);
+      *value = typedArrayGet(array, iterator->index++);
+      return true;
+    }
+    case ITER_MAP: {
+      if (iterator->index >= iterator->keys->count) {
+        *done = true;
+        return true;
+      }
+      *key = iterator->keys->items[iterator->index++];
+      *value = NULL_VAL;
+      mapGet((ObjMap*)AS_OBJ(iterator->source), asString(*key), value);
+      return true;
+    }
+    case ITER_RANGE: {
+      double current = iterator->current;
+      double step = iterator->step;
+      if (step == 0 || !(step > 0 ? current <= iterator->end : current >= iterator->end)) {
+        *done = true;
+        return true;
+      }
+      iterator->current = current + step;
+      // A range map from iter() is its own cursor, as it is for next().
+      if (iterator->cursorName) {
+        mapSet((ObjMap*)AS_OBJ(iterator->source), iterator->cursorName,
+               rangeElement(iterator->current));
+      }
+      *key = rangeElement(current);
+      *value = *key;
+      return true;
+    }
+    case ITER_GENERATOR:
+      return vmResumeGenerator(vm, (ObjGenerator*)AS_OBJ(iterator->source), done, key, value);
+    case ITER_PROTOCOL:
+      break;
+  }
+
+  Value result;
+  if (!callIterProtocol(vm, token, "next", iterator->source, &result)) return false;
+  if (!isObjType(result, OBJ_MAP)) {
+    runtimeError(vm, token, "next() must return a map for foreach.");
+    return false;
+  }
+  ObjMap* step = (ObjMap*)AS_OBJ(result);
+  Value doneValue = NULL_VAL;
+  mapGet(step, copyString(vm, "done"), &doneValue);
+  if (isTruthy(doneValue)) {
+    *done = true;
+    return true;
+  }
+  *key = NULL_VAL;
+  *value = NULL_VAL;
+  mapGet(step, copyString(vm, "key"), key);
+  mapGet(step, copyString(vm, "value"), value);
+  return true;
+}
+
+// tokenBack says which byte of the instruction holds the assignment's token.
+static bool assignVariable(VM* vm, CallFrame* frame, int tokenBack,
+                           ObjString* name, Value value) {
+  if (envIsConst(vm->env, name)) {
+    runtimeError(vm, rewindToPart(frame, tokenBack), "Cannot assign to const variable.");
+    return false;
+  }
+  if (!envAssignByName(vm->env, name, value)) {
+    undefinedVariableError(vm, rewindToPart(frame, tokenBack), name);
+    return false;
+  }
+  return true;
+}
+
+static inline bool getProperty(VM* vm, CallFrame* frame, Value object, ObjString* name,
+                               InlineCache* cache, Value* out) {
+  if (isObjType(object, OBJ_INSTANCE)) {
+    ObjInstance* instance = (ObjInstance*)AS_OBJ(object);
+    ObjFunction* method = NULL;
+    if (getInstanceProperty(instance, name, cache, out, &method)) {
+      if (method) *out = OBJ_VAL(newBoundMethod(vm, object, method));
+      return true;
+    }
+
+    char suggestion[64];
+    char message[256];
+    if (suggestNameFromInstance(instance, stringChars(name), name->length,
+                                suggestion, sizeof(suggestion))) {
+      snprintf(message, sizeof(message),
+               "Undefined property. Did you mean '%s'?", suggestion);
+      runtimeError(vm, currentToken(frame), message);
+    } else {
+      runtimeError(vm, currentToken(frame), "Undefined property.");
+    }
+    return false;
+  }
+  if (isObjType(object, OBJ_MAP)) {
+    ObjMap* map = (ObjMap*)AS_OBJ(object);
+    if (!getCachedMapEntry(map, name, IC_MAP, cache, out)) *out = NULL_VAL;
+    return true;
+  }
+  runtimeError(vm, currentToken(frame), "Only instances have properties.");
+  return false;
+}
+
+static bool runNeedsInstrumentation(VM* vm) {
+  return vm->debugTrace || vm->profileOpcodePairs || vm->instructionBudget > 0 ||
+         vm->maxHeapBytes > 0 || (vm->maxStackSlots > 0 && vm->maxStackSlots < STACK_MAX);
+}
+
+static void profileOpcodePair(VM* vm, uint8_t instruction) {
+  if (!vm->opcodePairCounts) {
+    vm->opcodePairCounts = (uint64_t*)calloc(256 * 256, sizeof(uint64_t));
+    if (!vm->opcodePairCounts) {
+      vm->profileOpcodePairs = false;
+      return;
+    }
+  }
+  if (vm->lastOpcode >= 0) {
+    vm->opcodePairCounts[(vm->lastOpcode << 8) | instruction]++;
+  }
+  vm->lastOpcode = instruction;
+}
+
+static bool instrumentInstruction(VM* vm, CallFrame* frame, uint8_t instruction) {
+  debugTraceInstruction(vm, frame, instruction);
+  if (vm->profileOpcodePairs) profileOpcodePair(vm, instruction);
+  vm->instructionCount++;
+  if (vm->instructionBudget > 0 && vm->instructionCount > vm->instructionBudget) {
+    runtimeError(vm, currentToken(frame), "Instruction budget exceeded.");
+    return false;
+  }
+  if (vm->maxStackSlots > 0) {
+    size_t stackUsed = (size_t)(vm->stackTop - vm->stack);
+    if (stackUsed > (size_t)vm->maxStackSlots) {
+      runtimeError(vm, currentToken(frame), "Stack limit exceeded.");
+      return false;
+    }
+  }
+  if (vm->maxHeapBytes > 0) {
+    size_t heapUsed = gcTotalHeapBytes(vm);
+    if (heapUsed > vm->maxHeapBytes) {
+      gcCollect(vm);
+      heapUsed = gcTotalHeapBytes(vm);
+      if (heapUsed > vm->maxHeapBytes) {
+        runtimeError(vm, currentToken(frame), "Heap limit exceeded.");
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool dispatchWithTarget(VM* vm, int targetFrameCount);
+
+// Runs frames until the frame count drops back to `targetFrameCount`. A throw
+// inside a nested run, such as a generator resumed by next(), may be caught
+// by a handler in this run's frames. The nested run stops with the throw
+// pending, the natives between return failure, and this loop resumes at the
+// handler. A throw can also be pending on entry, when a task resumes from
+// await() of a task that failed.
+static bool runWithTarget(VM* vm, int targetFrameCount) {
+  for (;;) {
+    if (!vm->throwPending && dispatchWithTarget(vm, targetFrameCount)) return true;
+    if (!vm->throwPending) return false;
+    // pendingThrow keeps the error rooted while the defers it passes run.
+    vm->throwPending = false;
+    vm->hadError = false;
+    CallFrame* frame = NULL;
+    Value error = vm->pendingThrow;
+    UnwindResult unwound = unwindToHandler(vm, &frame, error, targetFrameCount);
+    if (unwound == UNWIND_OUTER) return false;
+    if (unwound == UNWIND_HANDLED) {
+      vm->pendingThrow = NULL_VAL;
+      continue;
+    }
+    if (!vm->hadError) {
+      Token token;
+      memset(&token, 0, sizeof(Token));
+      if (vm->frameCount > 0) token = currentToken(&vm->frames[vm->frameCount - 1]);
+      uncaughtThrowError(vm, token, "Uncaught throw", error);
+    }
+    vm->pendingThrow = NULL_VAL;
+    return false;
+  }
+}
+
+static bool dispatchWithTarget(VM* vm, int targetFrameCount) {
+  CallFrame* frame = &vm->frames[vm->frameCount - 1];
+  bool instrumented = runNeedsInstrumentation(vm);
+  uint8_t instruction;
+
+#define READ_BYTE() (*frame->ip++)
+#define READ_SHORT() readShort(frame)
+#define READ_CONSTANT() readConstant(frame)
+
+#if ERKAO_COMPUTED_GOTO
+  // Tracing and sandbox limits swap in a table whose every entry runs the hooks
+  // first, so the production handlers chain straight into each other.
+  static void* const handlers[] = {
+    [OP_CONSTANT] = &&op_OP_CONSTANT,
+    [OP_NULL] = &&op_OP_NULL,
+    [OP_TRUE] = &&op_OP_TRUE,
+    [OP_FALSE] = &&op_OP_FALSE,
+    [OP_POP] = &&op_OP_POP,
+    [OP_GET_VAR] = &&op_OP_GET_VAR,
+    [OP_SET_VAR] = &&op_OP_SET_VAR,
+    [OP_DEFINE_VAR] = &&op_OP_DEFINE_VAR,
+    [OP_DEFINE_CONST] = &&op_OP_DEFINE_CONST,
+    [OP_GET_LOCAL] = &&op_OP_GET_LOCAL,
+    [OP_SET_LOCAL] = &&op_OP_SET_LOCAL,
+    [OP_DEFINE_LOCAL] = &&op_OP_DEFINE_LOCAL,
+    [OP_UNSET_LOCAL] = &&op_OP_UNSET_LOCAL,
+    [OP_GET_UPVALUE] = &&op_OP_GET_UPVALUE,
+    [OP_SET_UPVALUE] = &&op_OP_SET_UPVALUE,
+    [OP_CLOSE_UPVALUES] = &&op_OP_CLOSE_UPVALUES,
+    [OP_GET_PROPERTY] = &&op_OP_GET_PROPERTY,
+    [OP_GET_PROPERTY_OPTIONAL] = &&op_OP_GET_PROPERTY_OPTIONAL,
+    [OP_SET_PROPERTY] = &&op_OP_SET_PROPERTY,
+    [OP_GET_THIS] = &&op_OP_GET_THIS,
+    [OP_GET_INDEX] = &&op_OP_GET_INDEX,
+    [OP_GET_INDEX_OPTIONAL] = &&op_OP_GET_INDEX_OPTIONAL,
+    [OP_SET_INDEX] = &&op_OP_SET_INDEX,
+    [OP_MATCH_ENUM] = &&op_OP_MATCH_ENUM,
+    [OP_IS_ARRAY] = &&op_OP_IS_ARRAY,
+    [OP_IS_MAP] = &&op_OP_IS_MAP,
+    [OP_LEN] = &&op_OP_LEN,
+    [OP_MAP_HAS] = &&op_OP_MAP_HAS,
+    [OP_EQUAL] = &&op_OP_EQUAL,
+    [OP_GREATER] = &&op_OP_GREATER,
+    [OP_GREATER_EQUAL] = &&op_OP_GREATER_EQUAL,
+    [OP_LESS] = &&op_OP_LESS,
+    [OP_LESS_EQUAL] = &&op_OP_LESS_EQUAL,
+    [OP_ADD] = &&op_OP_ADD,
+    [OP_SUBTRACT] = &&op_OP_SUBTRACT,
+    [OP_MULTIPLY] = &&op_OP_MULTIPLY,
+    [OP_DIVIDE] = &&op_OP_DIVIDE,
+    [OP_MODULO] = &&op_OP_MODULO,
+    [OP_NOT] = &&op_OP_NOT,
+    [OP_NEGATE] = &&op_OP_NEGATE,
+    [OP_STRINGIFY] = &&op_OP_STRINGIFY,
+    [OP_JUMP] = &&op_OP_JUMP,
+    [OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE,
+    [OP_LOOP] = &&op_OP_LOOP,
+    [OP_TRY] = &&op_OP_TRY,
+    [OP_END_TRY] = &&op_OP_END_TRY,
+    [OP_THROW] = &&op_OP_THROW,
+    [OP_DEFER] = &&op_OP_DEFER,
+    [OP_CALL] = &&op_OP_CALL,
+    [OP_CALL_OPTIONAL] = &&op_OP_CALL_OPTIONAL,
+    [OP_INVOKE] = &&op_OP_INVOKE,
+    [OP_ARG_COUNT] = &&op_OP_ARG_COUNT,
+    [OP_CLOSURE] = &&op_OP_CLOSURE,
+    [OP_RETURN] = &&op_OP_RETURN,
+    [OP_YIELD] = &&op_OP_YIELD,
+    [OP_TRY_UNWRAP] = &&op_OP_TRY_UNWRAP,
+    [OP_BEGIN_SCOPE] = &&op_OP_BEGIN_SCOPE,
+    [OP_END_SCOPE] = &&op_OP_END_SCOPE,
+    [OP_CLASS] = &&op_OP_CLASS,
+    [OP_STRUCT] = &&op_OP_STRUCT,
+    [OP_IMPORT] = &&op_OP_IMPORT,
+    [OP_IMPORT_MODULE] = &&op_OP_IMPORT_MODULE,
+    [OP_EXPORT] = &&op_OP_EXPORT,
+    [OP_PRIVATE] = &&op_OP_PRIVATE,
+    [OP_EXPORT_VALUE] = &&op_OP_EXPORT_VALUE,
+    [OP_EXPORT_FROM] = &&op_OP_EXPORT_FROM,
+    [OP_ARRAY] = &&op_OP_ARRAY,
+    [OP_ARRAY_APPEND] = &&op_OP_ARRAY_APPEND,
+    [OP_MAP] = &&op_OP_MAP,
+    [OP_MAP_SET] = &&op_OP_MAP_SET,
+    [OP_GC] = &&op_OP_GC,
+    [OP_ITER_INIT] = &&op_OP_ITER_INIT,
+    [OP_ITER_NEXT] = &&op_OP_ITER_NEXT,
+    [OP_RANGE] = &&op_OP_RANGE,
+    [OP_RANGE_INIT] = &&op_OP_RANGE_INIT,
+    [OP_RANGE_NEXT] = &&op_OP_RANGE_NEXT,
+    [OP_ADD_NUM] = &&op_OP_ADD_NUM,
+    [OP_ADD_STR] = &&op_OP_ADD_STR,
+    [OP_EQUAL_NUM] = &&op_OP_EQUAL_NUM,
+    [OP_GET_INDEX_ARRAY_NUM] = &&op_OP_GET_INDEX_ARRAY_NUM,
+    [OP_SET_INDEX_ARRAY_NUM] = &&op_OP_SET_INDEX_ARRAY_NUM,
+    [OP_GET_INDEX_TYPED] = &&op_OP_GET_INDEX_TYPED,
+    [OP_SET_INDEX_TYPED] = &&op_OP_SET_INDEX_TYPED,
+    [OP_GET_LOCAL_GET_LOCAL] = &&op_OP_GET_LOCAL_GET_LOCAL,
+    [OP_GET_LOCAL_GET_PROPERTY] = &&op_OP_GET_LOCAL_GET_PROPERTY,
+    [OP_INC_LOCAL] = &&op_OP_INC_LOCAL,
+    [OP_INC_VAR] = &&op_OP_INC_VAR,
+    [OP_SET_VAR_POP] = &&op_OP_SET_VAR_POP,
+    [OP_LESS_JUMP_IF_FALSE] = &&op_OP_LESS_JUMP_IF_FALSE,
+    [OP_CALL0] = &&op_OP_CALL0,
+    [OP_CALL1] = &&op_OP_CALL1,
+    [OP_CALL2] = &&op_OP_CALL2,
+  };
+  static void* const instrumentedHandlers[256] = {
+    [0 ... 255] = &&op_instrumented,
+  };
+  void* const* dispatchTable = instrumented ? instrumentedHandlers : handlers;
+#define CASE(op) case op: op_##op
+#define DISPATCH() \
+  do { \
+    if (vm->hadError) return false; \
+    instruction = READ_BYTE(); \
+    goto *dispatchTable[instruction]; \
+  } while (0)
+// Runs the generic handler for the current instruction without instrumenting
+// it a second time. Quickened handlers only peek, so the operands are intact.
+#define REDISPATCH(op) goto *handlers[op]
+#else
+#define CASE(op) case op
+#define DISPATCH() break
+#define REDISPATCH(op) \
+  do { \
+    instruction = (op); \
+    goto dispatchSwitch; \
+  } while (0)
+#endif
+
+  for (;;) {
+    instruction = READ_BYTE();
+#if ERKAO_COMPUTED_GOTO
+    goto *dispatchTable[instruction];
+  op_instrumented:
+    if (!instrumentInstruction(vm, frame, instruction)) return false;
+    goto *handlers[instruction];
+#else
+    if (instrumented && !instrumentInstruction(vm, frame, instruction)) return false;
+  dispatchSwitch:
+#endif
+    switch (instruction) {
+      CASE(OP_CONSTANT): {
+        Value constant = READ_CONSTANT();
+        push(vm, constant);
+        DISPATCH();
+      }
+      CASE(OP_NULL):
+        push(vm, NULL_VAL);
+        DISPATCH();
+      CASE(OP_TRUE):
+        push(vm, BOOL_VAL(true));
+        DISPATCH();
+      CASE(OP_FALSE):
+        push(vm, BOOL_VAL(false));
+        DISPATCH();
+      CASE(OP_POP):
+        pop(vm);
+        DISPATCH();
+      CASE(OP_GET_VAR): {
+        ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
+        Value value;
+        if (!envGetByName(vm->env, name, &value)) {
+          undefinedVariableError(vm, currentToken(frame), name);
           return false;
         }
         push(vm, value);
-        break;
+        DISPATCH();
       }
-      case OP_SET_VAR: {
+      CASE(OP_SET_VAR): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
-        Value value = peek(vm, 0);
-        if (envIsConst(vm->env, name)) {
-          runtimeError(vm, currentToken(frame), "Cannot assign to const variable.");
+        if (!assignVariable(vm, frame, 1, name, peek(vm, 0))) return false;
+        DISPATCH();
+      }
+      CASE(OP_SET_VAR_POP): {
+        ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
+        if (!assignVariable(vm, frame, 1, name, peek(vm, 0))) return false;
+        pop(vm);
+        DISPATCH();
+      }
+      CASE(OP_INC_VAR): {
+        ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
+        Value step = READ_CONSTANT();
+        Value value;
+        if (!envGetByName(vm->env, name, &value)) {
+          undefinedVariableError(vm, rewindToPart(frame, 5), name);
           return false;
         }
-        if (!envAssignByName(vm->env, name, value)) {
-          char suggestion[64];
-          char message[256];
-          if (suggestNameFromEnv(vm->env, name->chars, name->length,
-                                 suggestion, sizeof(suggestion))) {
-            snprintf(message, sizeof(message),
-                     "Undefined variable. Did you mean '%s'?", suggestion);
-            runtimeError(vm, currentToken(frame), message);
-          } else {
-            runtimeError(vm, currentToken(frame), "Undefined variable.");
-          }
+        if (!IS_NUMBER(value)) {
+          runtimeError(vm, currentToken(frame), "Operands must be two numbers or two strings.");
           return false;
         }
-        break;
+        value = numberAdd(value, step);
+        if (!assignVariable(vm, frame, 4, name, value)) return false;
+        DISPATCH();
       }
-      case OP_DEFINE_VAR: {
+      CASE(OP_DEFINE_VAR): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         Value value = pop(vm);
         envDefine(vm->env, name, value);
-        break;
+        DISPATCH();
       }
-      case OP_DEFINE_CONST: {
+      CASE(OP_DEFINE_CONST): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         Value value = pop(vm);
         envDefineConst(vm->env, name, value);
-        break;
+        DISPATCH();
+      }
+      CASE(OP_GET_LOCAL): {
+        uint8_t slot = READ_BYTE();
+        push(vm, frame->slots[slot]);
+        DISPATCH();
+      }
+      CASE(OP_GET_LOCAL_GET_LOCAL): {
+        uint8_t first = READ_BYTE();
+        uint8_t second = READ_BYTE();
+        push(vm, frame->slots[first]);
+        push(vm, frame->slots[second]);
+        DISPATCH();
+      }
+      CASE(OP_INC_LOCAL): {
+        uint8_t slot = READ_BYTE();
+        Value step = READ_CONSTANT();
+        Value value = frame->slots[slot];
+        if (!IS_NUMBER(value)) {
+          runtimeError(vm, currentToken(frame), "Operands must be two numbers or two strings.");
+          return false;
+        }
+        frame->slots[slot] = numberAdd(value, step);
+        DISPATCH();
+      }
+      CASE(OP_SET_LOCAL): {
+        uint8_t slot = READ_BYTE();
+        frame->slots[slot] = peek(vm, 0);
+        DISPATCH();
+      }
+      CASE(OP_DEFINE_LOCAL): {
+        uint8_t slot = READ_BYTE();
+        frame->slots[slot] = pop(vm);
+        DISPATCH();
+      }
+      CASE(OP_UNSET_LOCAL): {
+        uint8_t slot = READ_BYTE();
+        frame->slots[slot] = UNSET_VAL;
+        DISPATCH();
+      }
+      CASE(OP_GET_UPVALUE): {
+        uint8_t slot = READ_BYTE();
+        Value value = *frame->function->upvalues[slot]->location;
+        if (IS_UNSET(value)) {
+          // The block's declaration has not run, so the name still means
+          // whatever it meant outside the block.
+          ObjString* name = frame->function->upvalueDescs[slot].name;
+          if (!envGetByName(vm->env, name, &value)) {
+            undefinedVariableError(vm, currentToken(frame), name);
+            return false;
+          }
+        }
+        push(vm, value);
+        DISPATCH();
+      }
+      CASE(OP_SET_UPVALUE): {
+        uint8_t slot = READ_BYTE();
+        ObjUpvalue* upvalue = frame->function->upvalues[slot];
+        if (IS_UNSET(*upvalue->location)) {
+          ObjString* name = frame->function->upvalueDescs[slot].name;
+          if (!assignVariable(vm, frame, 1, name, peek(vm, 0))) return false;
+          DISPATCH();
+        }
+        *upvalue->location = peek(vm, 0);
+        if (upvalue->location == &upvalue->closed) {
+          gcWriteBarrier(vm, (Obj*)upvalue, upvalue->closed);
+        }
+        DISPATCH();
+      }
+      CASE(OP_CLOSE_UPVALUES): {
+        uint8_t slot = READ_BYTE();
+        closeUpvalues(vm, frame->slots + slot);
+        DISPATCH();
       }
-      case OP_GET_THIS: {
+      CASE(OP_GET_THIS): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         Value value;
         if (!envGetByName(vm->env, name, &value)) {
@@ -965,167 +2289,46 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
           return false;
         }
         push(vm, value);
-        break;
+        DISPATCH();
       }
-      case OP_GET_PROPERTY: {
+      CASE(OP_GET_PROPERTY): {
+        InlineCache* cache = instructionCache(frame);
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
-        Value object = pop(vm);
-        if (isObjType(object, OBJ_INSTANCE)) {
-          ObjInstance* instance = (ObjInstance*)AS_OBJ(object);
-          ObjMap* fields = instance->fields;
-          if (cache && cache->kind == IC_FIELD && cache->map == fields) {
-            int index = cache->index;
-            if (index >= 0 && index < fields->capacity &&
-                fields->entries[index].key == name) {
-              push(vm, fields->entries[index].value);
-              break;
-            }
-          }
-
-          Value value;
-          int index = -1;
-          if (mapGetIndex(fields, name, &value, &index)) {
-            if (cache) {
-              cache->kind = IC_FIELD;
-              cache->map = fields;
-              cache->key = name;
-              cache->index = index;
-              cache->klass = NULL;
-              cache->method = NULL;
-            }
-            push(vm, value);
-            break;
-          }
-
-          if (cache && cache->kind == IC_METHOD &&
-              cache->klass == instance->klass &&
-              cache->key == name && cache->method) {
-            ObjBoundMethod* bound = newBoundMethod(vm, object, cache->method);
-            push(vm, OBJ_VAL(bound));
-            break;
-          }
-
-          ObjFunction* method = NULL;
-          if (findMethodByName(instance->klass, name, &method)) {
-            if (cache) {
-              cache->kind = IC_METHOD;
-              cache->klass = instance->klass;
-              cache->key = name;
-              cache->method = method;
-              cache->map = NULL;
-              cache->index = -1;
-            }
-            ObjBoundMethod* bound = newBoundMethod(vm, object, method);
-            push(vm, OBJ_VAL(bound));
-            break;
-          }
-
-          {
-            char suggestion[64];
-            char message[256];
-            if (suggestNameFromInstance(instance, name->chars, name->length,
-                                        suggestion, sizeof(suggestion))) {
-              snprintf(message, sizeof(message),
-                       "Undefined property. Did you mean '%s'?", suggestion);
-              runtimeError(vm, currentToken(frame), message);
-            } else {
-              runtimeError(vm, currentToken(frame), "Undefined property.");
-            }
-          }
-          return false;
-        }
-        if (isObjType(object, OBJ_MAP)) {
-          ObjMap* map = (ObjMap*)AS_OBJ(object);
-          if (cache && cache->kind == IC_MAP && cache->map == map) {
-            int entryIndex = cache->index;
-            if (entryIndex >= 0 && entryIndex < map->capacity &&
-                map->entries[entryIndex].key == name) {
-              push(vm, map->entries[entryIndex].value);
-              break;
-            }
-          }
-
-          Value out;
-          int entryIndex = -1;
-          if (mapGetIndex(map, name, &out, &entryIndex)) {
-            if (cache) {
-              cache->kind = IC_MAP;
-              cache->map = map;
-              cache->key = name;
-              cache->index = entryIndex;
-              cache->klass = NULL;
-              cache->method = NULL;
-            }
-            push(vm, out);
-          } else {
-            push(vm, NULL_VAL);
-          }
-          break;
-        }
-        runtimeError(vm, currentToken(frame), "Only instances have properties.");
-        return false;
+        Value value;
+        if (!getProperty(vm, frame, peek(vm, 0), name, cache, &value)) return false;
+        vm->stackTop[-1] = value;
+        DISPATCH();
       }
-      case OP_GET_PROPERTY_OPTIONAL: {
+      CASE(OP_GET_LOCAL_GET_PROPERTY): {
+        InlineCache* cache = instructionCache(frame);
+        uint8_t slot = READ_BYTE();
+        ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
+        Value value;
+        if (!getProperty(vm, frame, frame->slots[slot], name, cache, &value)) return false;
+        push(vm, value);
+        DISPATCH();
+      }
+      CASE(OP_GET_PROPERTY_OPTIONAL): {
+        InlineCache* cache = instructionCache(frame);
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         Value object = pop(vm);
         if (IS_NULL(object)) {
           push(vm, NULL_VAL);
-          break;
+          DISPATCH();
         }
         if (isObjType(object, OBJ_INSTANCE)) {
           ObjInstance* instance = (ObjInstance*)AS_OBJ(object);
-          ObjMap* fields = instance->fields;
-          if (cache && cache->kind == IC_FIELD && cache->map == fields) {
-            int index = cache->index;
-            if (index >= 0 && index < fields->capacity &&
-                fields->entries[index].key == name) {
-              push(vm, fields->entries[index].value);
-              break;
-            }
-          }
-
-          Value value;
-          int index = -1;
-          if (mapGetIndex(fields, name, &value, &index)) {
-            if (cache) {
-              cache->kind = IC_FIELD;
-              cache->map = fields;
-              cache->key = name;
-              cache->index = index;
-              cache->klass = NULL;
-              cache->method = NULL;
-            }
-            push(vm, value);
-            break;
-          }
-
-          if (cache && cache->kind == IC_METHOD &&
-              cache->klass == instance->klass &&
-              cache->key == name && cache->method) {
-            ObjBoundMethod* bound = newBoundMethod(vm, object, cache->method);
-            push(vm, OBJ_VAL(bound));
-            break;
-          }
-
           ObjFunction* method = NULL;
-          if (findMethodByName(instance->klass, name, &method)) {
-            if (cache) {
-              cache->kind = IC_METHOD;
-              cache->klass = instance->klass;
-              cache->key = name;
-              cache->method = method;
-              cache->map = NULL;
-              cache->index = -1;
-            }
-            ObjBoundMethod* bound = newBoundMethod(vm, object, method);
-            push(vm, OBJ_VAL(bound));
-            break;
+          Value value;
+          if (getInstanceProperty(instance, name, cache, &value, &method)) {
+            push(vm, method ? OBJ_VAL(newBoundMethod(vm, object, method)) : value);
+            DISPATCH();
           }
 
           {
             char suggestion[64];
             char message[256];
-            if (suggestNameFromInstance(instance, name->chars, name->length,
+            if (suggestNameFromInstance(instance, stringChars(name), name->length,
                                         suggestion, sizeof(suggestion))) {
               snprintf(message, sizeof(message),
                        "Undefined property. Did you mean '%s'?", suggestion);
@@ -1138,36 +2341,15 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         }
         if (isObjType(object, OBJ_MAP)) {
           ObjMap* map = (ObjMap*)AS_OBJ(object);
-          if (cache && cache->kind == IC_MAP && cache->map == map) {
-            int entryIndex = cache->index;
-            if (entryIndex >= 0 && entryIndex < map->capacity &&
-                map->entries[entryIndex].key == name) {
-              push(vm, map->entries[entryIndex].value);
-              break;
-            }
-          }
-
           Value out;
-          int entryIndex = -1;
-          if (mapGetIndex(map, name, &out, &entryIndex)) {
-            if (cache) {
-              cache->kind = IC_MAP;
-              cache->map = map;
-              cache->key = name;
-              cache->index = entryIndex;
-              cache->klass = NULL;
-              cache->method = NULL;
-            }
-            push(vm, out);
-          } else {
-            push(vm, NULL_VAL);
-          }
-          break;
+          push(vm, getCachedMapEntry(map, name, IC_MAP, cache, &out) ? out : NULL_VAL);
+          DISPATCH();
         }
         runtimeError(vm, currentToken(frame), "Only instances have properties.");
         return false;
       }
-      case OP_SET_PROPERTY: {
+      CASE(OP_SET_PROPERTY): {
+        InlineCache* cache = instructionCache(frame);
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         Value value = pop(vm);
         Value object = pop(vm);
@@ -1181,318 +2363,385 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
               return false;
             }
           }
-          int index = mapSetIndex(instance->fields, name, value);
-          if (cache) {
-            cache->kind = IC_FIELD;
-            cache->map = instance->fields;
-            cache->key = name;
-            cache->index = index;
-            cache->klass = NULL;
-            cache->method = NULL;
-          }
+          if (!setInstanceField(vm, instance, name, value, cache)) return false;
           push(vm, value);
-          break;
+          DISPATCH();
         }
         if (isObjType(object, OBJ_MAP)) {
           ObjMap* map = (ObjMap*)AS_OBJ(object);
-          int entryIndex = mapSetIndex(map, name, value);
-          if (cache) {
-            cache->kind = IC_MAP;
-            cache->map = map;
-            cache->key = name;
-            cache->index = entryIndex;
-            cache->klass = NULL;
-            cache->method = NULL;
-          }
+          setCachedMapEntry(vm, map, name, value, IC_MAP, cache);
           push(vm, value);
-          break;
+          DISPATCH();
         }
         runtimeError(vm, currentToken(frame), "Only instances have fields.");
         return false;
       }
-      case OP_GET_INDEX: {
+      CASE(OP_GET_INDEX): {
+        InlineCache* cache = instructionCache(frame);
         Value index = pop(vm);
         Value object = pop(vm);
         if (isObjType(object, OBJ_MAP) && isString(index)) {
           ObjMap* map = (ObjMap*)AS_OBJ(object);
           ObjString* key = asString(index);
-          if (cache && cache->kind == IC_MAP && cache->map == map) {
-            int entryIndex = cache->index;
-            if (entryIndex >= 0 && entryIndex < map->capacity &&
-                map->entries[entryIndex].key == key) {
-              push(vm, map->entries[entryIndex].value);
-              break;
-            }
-          }
-
           Value out;
-          int entryIndex = -1;
-          if (mapGetIndex(map, key, &out, &entryIndex)) {
-            if (cache) {
-              cache->kind = IC_MAP;
-              cache->map = map;
-              cache->key = key;
-              cache->index = entryIndex;
-              cache->klass = NULL;
-              cache->method = NULL;
-            }
-            push(vm, out);
-          } else {
-            push(vm, NULL_VAL);
-          }
-          break;
+          push(vm, getCachedMapEntry(map, key, IC_MAP, cache, &out) ? out : NULL_VAL);
+          DISPATCH();
         }
         Value result = evaluateIndex(vm, currentToken(frame), object, index);
         if (vm->hadError) return false;
+        if (isObjType(object, OBJ_ARRAY)) {
+          quickenInstruction(frame, OP_GET_INDEX_ARRAY_NUM);
+        } else if (isObjType(object, OBJ_TYPED_ARRAY)) {
+          quickenInstruction(frame, OP_GET_INDEX_TYPED);
+        }
         push(vm, result);
-        break;
+        DISPATCH();
+      }
+      CASE(OP_GET_INDEX_ARRAY_NUM): {
+        Value index = peek(vm, 0);
+        Value object = peek(vm, 1);
+        int i = 0;
+        if (isObjType(object, OBJ_ARRAY) && valueIsInteger(index, &i)) {
+          ObjArray* array = (ObjArray*)AS_OBJ(object);
+          if (i >= 0 && i < array->count) {
+            vm->stackTop--;
+            vm->stackTop[-1] = array->items[i];
+            DISPATCH();
+          }
+        }
+        deoptimizeInstruction(frame, OP_GET_INDEX);
+        REDISPATCH(OP_GET_INDEX);
+      }
+      CASE(OP_GET_INDEX_TYPED): {
+        Value index = peek(vm, 0);
+        Value object = peek(vm, 1);
+        int i = 0;
+        if (isObjType(object, OBJ_TYPED_ARRAY) && valueIsInteger(index, &i)) {
+          ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(object);
+          if (i >= 0 && i < array->length) {
+            vm->stackTop--;
+            vm->stackTop[-1] = typedArrayGet(array, i);
+            DISPATCH();
+          }
+        }
+        deoptimizeInstruction(frame, OP_GET_INDEX);
+        REDISPATCH(OP_GET_INDEX);
       }
-      case OP_GET_INDEX_OPTIONAL: {
+      CASE(OP_GET_INDEX_OPTIONAL): {
+        InlineCache* cache = instructionCache(frame);
         Value index = pop(vm);
         Value object = pop(vm);
         if (IS_NULL(object)) {
           push(vm, NULL_VAL);
-          break;
+          DISPATCH();
         }
         if (isObjType(object, OBJ_MAP) && isString(index)) {
           ObjMap* map = (ObjMap*)AS_OBJ(object);
           ObjString* key = asString(index);
-          if (cache && cache->kind == IC_MAP && cache->map == map) {
-            int entryIndex = cache->index;
-            if (entryIndex >= 0 && entryIndex < map->capacity &&
-                map->entries[entryIndex].key == key) {
-              push(vm, map->entries[entryIndex].value);
-              break;
-            }
-          }
-
           Value out;
-          int entryIndex = -1;
-          if (mapGetIndex(map, key, &out, &entryIndex)) {
-            if (cache) {
-              cache->kind = IC_MAP;
-              cache->map = map;
-              cache->key = key;
-              cache->index = entryIndex;
-              cache->klass = NULL;
-              cache->method = NULL;
-            }
-            push(vm, out);
-          } else {
-            push(vm, NULL_VAL);
-          }
-          break;
+          push(vm, getCachedMapEntry(map, key, IC_MAP, cache, &out) ? out : NULL_VAL);
+          DISPATCH();
         }
         Value result = evaluateIndex(vm, currentToken(frame), object, index);
         if (vm->hadError) return false;
         push(vm, result);
-        break;
+        DISPATCH();
       }
-      case OP_SET_INDEX: {
+      CASE(OP_SET_INDEX): {
+        InlineCache* cache = instructionCache(frame);
         Value value = pop(vm);
         Value index = pop(vm);
         Value object = pop(vm);
         if (isObjType(object, OBJ_MAP) && isString(index)) {
           ObjMap* map = (ObjMap*)AS_OBJ(object);
           ObjString* key = asString(index);
-          if (cache && cache->kind == IC_MAP && cache->map == map) {
-            int entryIndex = cache->index;
-            if (entryIndex >= 0 && entryIndex < map->capacity &&
-                map->entries[entryIndex].key == key) {
-              map->entries[entryIndex].value = value;
-              gcWriteBarrier(vm, (Obj*)map, value);
-              push(vm, value);
-              break;
-            }
-          }
-
-          int entryIndex = mapSetIndex(map, key, value);
-          if (cache) {
-            cache->kind = IC_MAP;
-            cache->map = map;
-            cache->key = key;
-            cache->index = entryIndex;
-            cache->klass = NULL;
-            cache->method = NULL;
-          }
+          setCachedMapEntry(vm, map, key, value, IC_MAP, cache);
           push(vm, value);
-          break;
+          DISPATCH();
         }
         Value result = evaluateSetIndex(vm, currentToken(frame), object, index, value);
         if (vm->hadError) return false;
+        if (isObjType(object, OBJ_ARRAY)) {
+          quickenInstruction(frame, OP_SET_INDEX_ARRAY_NUM);
+        } else if (isObjType(object, OBJ_TYPED_ARRAY)) {
+          quickenInstruction(frame, OP_SET_INDEX_TYPED);
+        }
         push(vm, result);
-        break;
+        DISPATCH();
+      }
+      CASE(OP_SET_INDEX_ARRAY_NUM): {
+        Value value = peek(vm, 0);
+        Value index = peek(vm, 1);
+        Value object = peek(vm, 2);
+        int i = 0;
+        if (isObjType(object, OBJ_ARRAY) && valueIsInteger(index, &i)) {
+          ObjArray* array = (ObjArray*)AS_OBJ(object);
+          if (i >= 0 && i <= array->count && arraySet(array, i, value)) {
+            vm->stackTop -= 2;
+            vm->stackTop[-1] = value;
+            DISPATCH();
+          }
+        }
+        deoptimizeInstruction(frame, OP_SET_INDEX);
+        REDISPATCH(OP_SET_INDEX);
+      }
+      CASE(OP_SET_INDEX_TYPED): {
+        Value value = peek(vm, 0);
+        Value index = peek(vm, 1);
+        Value object = peek(vm, 2);
+        int i = 0;
+        if (isObjType(object, OBJ_TYPED_ARRAY) && valueIsInteger(index, &i) && IS_NUMBER(value)) {
+          ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(object);
+          if (i >= 0 && i < array->length) {
+            typedArraySet(array, i, value);
+            vm->stackTop -= 2;
+            vm->stackTop[-1] = value;
+            DISPATCH();
+          }
+        }
+        deoptimizeInstruction(frame, OP_SET_INDEX);
+        REDISPATCH(OP_SET_INDEX);
       }
-      case OP_MATCH_ENUM: {
+      CASE(OP_MATCH_ENUM): {
         ObjString* enumName = (ObjString*)AS_OBJ(READ_CONSTANT());
         ObjString* variantName = (ObjString*)AS_OBJ(READ_CONSTANT());
         Value value = pop(vm);
         push(vm, BOOL_VAL(enumValueMatches(vm, value, enumName, variantName)));
-        break;
+        DISPATCH();
       }
-      case OP_IS_ARRAY: {
+      CASE(OP_IS_ARRAY): {
         Value value = pop(vm);
         push(vm, BOOL_VAL(isObjType(value, OBJ_ARRAY)));
-        break;
+        DISPATCH();
       }
-      case OP_IS_MAP: {
+      CASE(OP_IS_MAP): {
         Value value = pop(vm);
         push(vm, BOOL_VAL(isObjType(value, OBJ_MAP)));
-        break;
+        DISPATCH();
       }
-      case OP_LEN: {
+      CASE(OP_LEN): {
         Value value = pop(vm);
         if (isObjType(value, OBJ_STRING)) {
           ObjString* string = (ObjString*)AS_OBJ(value);
-          push(vm, NUMBER_VAL(string->length));
-          break;
+          push(vm, INT_VAL(string->length));
+          DISPATCH();
         }
         if (isObjType(value, OBJ_ARRAY)) {
           ObjArray* array = (ObjArray*)AS_OBJ(value);
-          push(vm, NUMBER_VAL(array->count));
-          break;
+          push(vm, INT_VAL(array->count));
+          DISPATCH();
         }
         if (isObjType(value, OBJ_MAP)) {
           ObjMap* map = (ObjMap*)AS_OBJ(value);
-          push(vm, NUMBER_VAL(mapCount(map)));
-          break;
+          push(vm, INT_VAL(mapCount(map)));
+          DISPATCH();
+        }
+        if (isObjType(value, OBJ_TYPED_ARRAY)) {
+          push(vm, INT_VAL(((ObjTypedArray*)AS_OBJ(value))->length));
+          DISPATCH();
+        }
+        if (isObjType(value, OBJ_RANGE)) {
+          push(vm, INT_VAL(rangeLength((ObjRange*)AS_OBJ(value))));
+          DISPATCH();
         }
-        runtimeError(vm, currentToken(frame), "len() expects a string, array, or map.");
+        runtimeError(vm, currentToken(frame), "len() expects a string, array, typed array, map, or range.");
         return false;
       }
-      case OP_MAP_HAS: {
+      CASE(OP_MAP_HAS): {
         Value key = pop(vm);
         Value object = pop(vm);
         if (isObjType(object, OBJ_MAP) && isString(key)) {
           ObjMap* map = (ObjMap*)AS_OBJ(object);
           Value ignored;
           push(vm, BOOL_VAL(mapGet(map, asString(key), &ignored)));
-          break;
+          DISPATCH();
         }
         push(vm, BOOL_VAL(false));
-        break;
+        DISPATCH();
       }
-      case OP_EQUAL: {
+      CASE(OP_EQUAL): {
         Value b = pop(vm);
         Value a = pop(vm);
+        if (IS_NUMBER(a) && IS_NUMBER(b)) {
+          quickenInstruction(frame, OP_EQUAL_NUM);
+        }
         push(vm, BOOL_VAL(valuesEqual(a, b)));
-        break;
+        DISPATCH();
       }
-      case OP_GREATER: {
+      CASE(OP_EQUAL_NUM): {
+        Value b = peek(vm, 0);
+        Value a = peek(vm, 1);
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+          deoptimizeInstruction(frame, OP_EQUAL);
+          REDISPATCH(OP_EQUAL);
+        }
+        vm->stackTop--;
+        vm->stackTop[-1] = BOOL_VAL(numbersEqual(a, b));
+        DISPATCH();
+      }
+      CASE(OP_GREATER): {
         Value b = pop(vm);
         Value a = pop(vm);
         Token token = currentToken(frame);
         if (!ensureNumberOperands(vm, token, a, b)) return false;
-        push(vm, BOOL_VAL(AS_NUMBER(a) > AS_NUMBER(b)));
-        break;
+        push(vm, BOOL_VAL(numberLess(b, a)));
+        DISPATCH();
       }
-      case OP_GREATER_EQUAL: {
+      CASE(OP_GREATER_EQUAL): {
         Value b = pop(vm);
         Value a = pop(vm);
         Token token = currentToken(frame);
         if (!ensureNumberOperands(vm, token, a, b)) return false;
-        push(vm, BOOL_VAL(AS_NUMBER(a) >= AS_NUMBER(b)));
-        break;
+        push(vm, BOOL_VAL(numberLessEqual(b, a)));
+        DISPATCH();
       }
-      case OP_LESS: {
+      CASE(OP_LESS): {
         Value b = pop(vm);
         Value a = pop(vm);
+        if (IS_INT(a) && IS_INT(b)) {
+          push(vm, BOOL_VAL(AS_INT(a) < AS_INT(b)));
+          DISPATCH();
+        }
         Token token = currentToken(frame);
         if (!ensureNumberOperands(vm, token, a, b)) return false;
-        push(vm, BOOL_VAL(AS_NUMBER(a) < AS_NUMBER(b)));
-        break;
+        push(vm, BOOL_VAL(numberLess(a, b)));
+        DISPATCH();
+      }
+      CASE(OP_LESS_JUMP_IF_FALSE): {
+        Value b = pop(vm);
+        Value a = pop(vm);
+        uint16_t offset = READ_SHORT();
+        if (IS_INT(a) && IS_INT(b)) {
+          if (!(AS_INT(a) < AS_INT(b))) frame->ip += offset;
+          DISPATCH();
+        }
+        if (!ensureNumberOperands(vm, currentToken(frame), a, b)) return false;
+        if (!(AS_NUMBER(a) < AS_NUMBER(b))) frame->ip += offset;
+        DISPATCH();
       }
-      case OP_LESS_EQUAL: {
+      CASE(OP_LESS_EQUAL): {
         Value b = pop(vm);
         Value a = pop(vm);
         Token token = currentToken(frame);
         if (!ensureNumberOperands(vm, token, a, b)) return false;
-        push(vm, BOOL_VAL(AS_NUMBER(a) <= AS_NUMBER(b)));
-        break;
+        push(vm, BOOL_VAL(numberLessEqual(a, b)));
+        DISPATCH();
       }
-      case OP_ADD: {
+      CASE(OP_ADD): {
         Value b = pop(vm);
         Value a = pop(vm);
         if (IS_NUMBER(a) && IS_NUMBER(b)) {
-          push(vm, NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
-          break;
+          quickenInstruction(frame, OP_ADD_NUM);
+          push(vm, numberAdd(a, b));
+          DISPATCH();
         }
         if (isString(a) && isString(b)) {
           Value concatenated = concatenateStrings(vm, asString(a), asString(b));
           if (vm->hadError) return false;
+          quickenInstruction(frame, OP_ADD_STR);
           push(vm, concatenated);
-          break;
+          DISPATCH();
         }
         runtimeError(vm, currentToken(frame), "Operands must be two numbers or two strings.");
         return false;
       }
-      case OP_SUBTRACT: {
+      CASE(OP_ADD_NUM): {
+        Value b = peek(vm, 0);
+        Value a = peek(vm, 1);
+        int64_t sum;
+        if (IS_INT(a) && IS_INT(b) && !intAddOverflows(AS_INT(a), AS_INT(b), &sum)) {
+          vm->stackTop--;
+          vm->stackTop[-1] = INT_VAL(sum);
+          DISPATCH();
+        }
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+          deoptimizeInstruction(frame, OP_ADD);
+          REDISPATCH(OP_ADD);
+        }
+        vm->stackTop--;
+        vm->stackTop[-1] = numberAdd(a, b);
+        DISPATCH();
+      }
+      CASE(OP_ADD_STR): {
+        Value b = peek(vm, 0);
+        Value a = peek(vm, 1);
+        if (!isString(a) || !isString(b)) {
+          deoptimizeInstruction(frame, OP_ADD);
+          REDISPATCH(OP_ADD);
+        }
+        Value concatenated = concatenateStrings(vm, asString(a), asString(b));
+        if (vm->hadError) return false;
+        vm->stackTop--;
+        vm->stackTop[-1] = concatenated;
+        DISPATCH();
+      }
+      CASE(OP_SUBTRACT): {
         Value b = pop(vm);
         Value a = pop(vm);
         Token token = currentToken(frame);
         if (!ensureNumberOperands(vm, token, a, b)) return false;
-        push(vm, NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b)));
-        break;
+        push(vm, numberSubtract(a, b));
+        DISPATCH();
       }
-      case OP_MULTIPLY: {
+      CASE(OP_MULTIPLY): {
         Value b = pop(vm);
         Value a = pop(vm);
         Token token = currentToken(frame);
         if (!ensureNumberOperands(vm, token, a, b)) return false;
-        push(vm, NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b)));
-        break;
+        push(vm, numberMultiply(a, b));
+        DISPATCH();
       }
-      case OP_DIVIDE: {
+      CASE(OP_DIVIDE): {
         Value b = pop(vm);
         Value a = pop(vm);
         Token token = currentToken(frame);
         if (!ensureNumberOperands(vm, token, a, b)) return false;
-        push(vm, NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b)));
-        break;
+        push(vm, numberDivide(a, b));
+        DISPATCH();
       }
-      case OP_MODULO: {
+      CASE(OP_MODULO): {
         Value b = pop(vm);
         Value a = pop(vm);
         Token token = currentToken(frame);
         if (!ensureNumberOperands(vm, token, a, b)) return false;
-        push(vm, NUMBER_VAL(fmod(AS_NUMBER(a), AS_NUMBER(b))));
-        break;
+        push(vm, numberModulo(a, b));
+        DISPATCH();
       }
-      case OP_NOT: {
+      CASE(OP_NOT): {
         Value value = pop(vm);
         push(vm, BOOL_VAL(!isTruthy(value)));
-        break;
+        DISPATCH();
       }
-      case OP_NEGATE: {
+      CASE(OP_NEGATE): {
         Value value = pop(vm);
         Token token = currentToken(frame);
         if (!ensureNumberOperand(vm, token, value)) return false;
-        push(vm, NUMBER_VAL(-AS_NUMBER(value)));
-        break;
+        push(vm, numberNegate(value));
+        DISPATCH();
       }
-      case OP_STRINGIFY: {
+      CASE(OP_STRINGIFY): {
         Value value = pop(vm);
         ObjString* string = stringifyValue(vm, value);
         if (!string) return false;
         push(vm, OBJ_VAL(string));
-        break;
+        DISPATCH();
       }
-      case OP_JUMP: {
+      CASE(OP_JUMP): {
         uint16_t offset = READ_SHORT();
         frame->ip += offset;
-        break;
+        DISPATCH();
       }
-      case OP_JUMP_IF_FALSE: {
+      CASE(OP_JUMP_IF_FALSE): {
         uint16_t offset = READ_SHORT();
         if (!isTruthy(peek(vm, 0))) frame->ip += offset;
-        break;
+        DISPATCH();
       }
-      case OP_LOOP: {
+      CASE(OP_LOOP): {
         uint16_t offset = READ_SHORT();
         frame->ip -= offset;
-        break;
+        DISPATCH();
       }
-      case OP_TRY: {
+      CASE(OP_TRY): {
         uint16_t offset = READ_SHORT();
         if (vm->tryCount >= TRY_MAX) {
           runtimeError(vm, currentToken(frame), "Too many nested try blocks.");
@@ -1504,34 +2753,28 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         tryFrame->stackTop = vm->stackTop;
         tryFrame->env = vm->env;
         tryFrame->scopeDepth = frame->scopeDepth;
-        break;
+        DISPATCH();
       }
-      case OP_END_TRY: {
+      CASE(OP_END_TRY): {
         if (vm->tryCount > 0 &&
             vm->tryFrames[vm->tryCount - 1].frameIndex == vm->frameCount - 1) {
           vm->tryCount--;
         }
-        break;
+        DISPATCH();
       }
-      case OP_THROW: {
+      CASE(OP_THROW): {
         Value thrown = pop(vm);
         push(vm, thrown);
         Value errorValue = wrapErrorValue(vm, thrown);
         pop(vm);
-        if (unwindToHandler(vm, &frame, errorValue)) {
-          break;
-        }
-        Token token = currentToken(frame);
-        push(vm, errorValue);
-        ObjString* message = errorMessageForValue(vm, errorValue);
-        char buffer[256];
-        const char* messageText = (message && message->chars) ? message->chars : "<error>";
-        snprintf(buffer, sizeof(buffer), "Uncaught throw: %s", messageText);
-        pop(vm);
-        runtimeError(vm, token, buffer);
+        UnwindResult unwound = unwindToHandler(vm, &frame, errorValue, targetFrameCount);
+        if (unwound == UNWIND_HANDLED) DISPATCH();
+        if (unwound == UNWIND_OUTER) return false;
+        if (vm->hadError) return false;
+        uncaughtThrowError(vm, currentToken(frame), "Uncaught throw", errorValue);
         return false;
       }
-      case OP_TRY_UNWRAP: {
+      CASE(OP_TRY_UNWRAP): {
         Value value = pop(vm);
         if (!isObjType(value, OBJ_MAP)) {
           runtimeError(vm, currentToken(frame), "Cannot use '?' on this value.");
@@ -1557,12 +2800,12 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
           if (returnFromFrame(vm, &frame, out, targetFrameCount)) {
             return true;
           }
-          break;
+          DISPATCH();
         }
         push(vm, out);
-        break;
+        DISPATCH();
       }
-      case OP_DEFER: {
+      CASE(OP_DEFER): {
         int argCount = READ_BYTE();
         Value args[ERK_MAX_ARGS];
         for (int i = argCount - 1; i >= 0; i--) {
@@ -1572,60 +2815,49 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         if (!deferPush(vm, vm->frameCount - 1, frame->scopeDepth, callee, argCount, args)) {
           return false;
         }
-        break;
+        DISPATCH();
       }
-      case OP_CALL: {
+      CASE(OP_CALL): {
         int argCount = READ_BYTE();
         Value callee = peek(vm, argCount);
         if (!callValue(vm, callee, argCount)) return false;
         frame = &vm->frames[vm->frameCount - 1];
-        break;
+        DISPATCH();
+      }
+      CASE(OP_CALL0):
+      CASE(OP_CALL1):
+      CASE(OP_CALL2): {
+        int argCount = instruction - OP_CALL0;
+        Value callee = peek(vm, argCount);
+        if (!callValue(vm, callee, argCount)) return false;
+        frame = &vm->frames[vm->frameCount - 1];
+        DISPATCH();
       }
-      case OP_CALL_OPTIONAL: {
+      CASE(OP_CALL_OPTIONAL): {
         int argCount = READ_BYTE();
         Value callee = peek(vm, argCount);
         if (IS_NULL(callee)) {
           vm->stackTop -= argCount + 1;
           push(vm, NULL_VAL);
-          break;
+          DISPATCH();
         }
         if (!callValue(vm, callee, argCount)) return false;
         frame = &vm->frames[vm->frameCount - 1];
-        break;
+        DISPATCH();
       }
-      case OP_INVOKE: {
+      CASE(OP_INVOKE): {
+        InlineCache* cache = instructionCache(frame);
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         int argCount = READ_BYTE();
         Value receiver = peek(vm, argCount);
         if (isObjType(receiver, OBJ_MAP)) {
           ObjMap* map = (ObjMap*)AS_OBJ(receiver);
-          if (cache && cache->kind == IC_MAP && cache->map == map) {
-            int entryIndex = cache->index;
-            if (entryIndex >= 0 && entryIndex < map->capacity &&
-                map->entries[entryIndex].key == name) {
-              Value callee = map->entries[entryIndex].value;
-              vm->stackTop[-argCount - 1] = callee;
-              if (!callValue(vm, callee, argCount)) return false;
-              frame = &vm->frames[vm->frameCount - 1];
-              break;
-            }
-          }
-
           Value value;
-          int entryIndex = -1;
-          if (mapGetIndex(map, name, &value, &entryIndex)) {
-            if (cache) {
-              cache->kind = IC_MAP;
-              cache->map = map;
-              cache->key = name;
-              cache->index = entryIndex;
-              cache->klass = NULL;
-              cache->method = NULL;
-            }
+          if (getCachedMapEntry(map, name, IC_MAP, cache, &value)) {
             vm->stackTop[-argCount - 1] = value;
             if (!callValue(vm, value, argCount)) return false;
             frame = &vm->frames[vm->frameCount - 1];
-            break;
+            DISPATCH();
           }
           runtimeError(vm, currentToken(frame), "Undefined property.");
           return false;
@@ -1636,66 +2868,24 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         }
 
         ObjInstance* instance = (ObjInstance*)AS_OBJ(receiver);
-        ObjMap* fields = instance->fields;
-        if (cache && cache->kind == IC_FIELD && cache->map == fields) {
-          int index = cache->index;
-          if (index >= 0 && index < fields->capacity &&
-              fields->entries[index].key == name) {
-            Value callee = fields->entries[index].value;
-            vm->stackTop[-argCount - 1] = callee;
-            if (!callValue(vm, callee, argCount)) return false;
-            frame = &vm->frames[vm->frameCount - 1];
-            break;
-          }
-        }
-
-        Value value;
-        int index = -1;
-        if (mapGetIndex(fields, name, &value, &index)) {
-          if (cache) {
-            cache->kind = IC_FIELD;
-            cache->map = fields;
-            cache->key = name;
-            cache->index = index;
-            cache->klass = NULL;
-            cache->method = NULL;
-          }
-          vm->stackTop[-argCount - 1] = value;
-          if (!callValue(vm, value, argCount)) return false;
-          frame = &vm->frames[vm->frameCount - 1];
-          break;
-        }
-
-        if (cache && cache->kind == IC_METHOD &&
-            cache->klass == instance->klass &&
-            cache->key == name && cache->method) {
-          ObjFunction* method = cache->method;
-          vm->stackTop[-argCount - 1] = OBJ_VAL(method);
-          if (!callFunction(vm, method, receiver, true, argCount)) return false;
-          frame = &vm->frames[vm->frameCount - 1];
-          break;
-        }
-
         ObjFunction* method = NULL;
-        if (findMethodByName(instance->klass, name, &method)) {
-          if (cache) {
-            cache->kind = IC_METHOD;
-            cache->klass = instance->klass;
-            cache->key = name;
-            cache->method = method;
-            cache->map = NULL;
-            cache->index = -1;
+        Value value;
+        if (getInstanceProperty(instance, name, cache, &value, &method)) {
+          if (method) {
+            vm->stackTop[-argCount - 1] = OBJ_VAL(method);
+            if (!callFunction(vm, method, receiver, true, argCount)) return false;
+          } else {
+            vm->stackTop[-argCount - 1] = value;
+            if (!callValue(vm, value, argCount)) return false;
           }
-          vm->stackTop[-argCount - 1] = OBJ_VAL(method);
-          if (!callFunction(vm, method, receiver, true, argCount)) return false;
           frame = &vm->frames[vm->frameCount - 1];
-          break;
+          DISPATCH();
         }
 
         {
           char suggestion[64];
           char message[256];
-          if (suggestNameFromInstance(instance, name->chars, name->length,
+          if (suggestNameFromInstance(instance, stringChars(name), name->length,
                                       suggestion, sizeof(suggestion))) {
             snprintf(message, sizeof(message),
                      "Undefined property. Did you mean '%s'?", suggestion);
@@ -1706,28 +2896,54 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         }
         return false;
       }
-      case OP_ARG_COUNT:
-        push(vm, NUMBER_VAL((double)frame->argCount));
-        break;
-      case OP_CLOSURE: {
+      CASE(OP_ARG_COUNT):
+        push(vm, INT_VAL(frame->argCount));
+        DISPATCH();
+      CASE(OP_CLOSURE): {
         ObjFunction* proto = (ObjFunction*)AS_OBJ(READ_CONSTANT());
         ObjFunction* function = cloneFunction(vm, proto, vm->env);
+        if (!function) return false;
         push(vm, OBJ_VAL(function));
-        break;
+        for (int i = 0; i < function->upvalueCount; i++) {
+          UpvalueDesc* desc = &function->upvalueDescs[i];
+          ObjUpvalue* upvalue = desc->isLocal
+                                    ? captureUpvalue(vm, frame->slots + desc->index)
+                                    : frame->function->upvalues[desc->index];
+          if (!upvalue) return false;
+          function->upvalues[i] = upvalue;
+        }
+        DISPATCH();
       }
-      case OP_RETURN: {
+      CASE(OP_YIELD): {
+        Value value = pop(vm);
+        ObjGenerator* generator = frame->generator;
+        uint8_t* loopExit = generator->loopExit;
+        if (!generatorSuspend(vm, frame)) return false;
+        push(vm, value);
+        if (loopExit) {
+          // Resumed by OP_ITER_NEXT: hand the step straight to the loop.
+          Value key = INT_VAL(generator->index++);
+          if (generator->loopWithKey) push(vm, key);
+          frame = &vm->frames[vm->frameCount - 1];
+          DISPATCH();
+        }
+        if (vm->frameCount <= targetFrameCount) return true;
+        frame = &vm->frames[vm->frameCount - 1];
+        DISPATCH();
+      }
+      CASE(OP_RETURN): {
         Value result = pop(vm);
         if (returnFromFrame(vm, &frame, result, targetFrameCount)) {
           return true;
         }
-        break;
+        DISPATCH();
       }
-      case OP_BEGIN_SCOPE:
+      CASE(OP_BEGIN_SCOPE):
         vm->env = newEnv(vm, vm->env);
         if (!vm->env) return false;
         frame->scopeDepth++;
-        break;
-      case OP_END_SCOPE:
+        DISPATCH();
+      CASE(OP_END_SCOPE):
         if (!runDefersForScope(vm, vm->frameCount - 1, frame->scopeDepth)) {
           return false;
         }
@@ -1737,8 +2953,8 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         if (frame->scopeDepth > 0) {
           frame->scopeDepth--;
         }
-        break;
-      case OP_CLASS: {
+        DISPATCH();
+      CASE(OP_CLASS): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         uint16_t methodCount = READ_SHORT();
         ObjMap* methods = newMap(vm);
@@ -1751,9 +2967,9 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         if (!envAssignByName(vm->env, name, OBJ_VAL(klass))) {
           envDefine(vm->env, name, OBJ_VAL(klass));
         }
-        break;
+        DISPATCH();
       }
-      case OP_STRUCT: {
+      CASE(OP_STRUCT): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         Value readonlyValue = pop(vm);
         Value defaultsValue = pop(vm);
@@ -1776,9 +2992,9 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         if (!envAssignByName(vm->env, name, OBJ_VAL(klass))) {
           envDefine(vm->env, name, OBJ_VAL(klass));
         }
-        break;
+        DISPATCH();
       }
-      case OP_IMPORT: {
+      CASE(OP_IMPORT): {
         uint8_t hasAlias = READ_BYTE();
         uint16_t aliasIndex = READ_SHORT();
         ObjString* alias = NULL;
@@ -1796,9 +3012,9 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         if (!beginModuleImport(vm, &frame, pathString, alias, hasAlias != 0, false)) {
           return false;
         }
-        break;
+        DISPATCH();
       }
-      case OP_IMPORT_MODULE: {
+      CASE(OP_IMPORT_MODULE): {
         Value pathValue = pop(vm);
         if (!isString(pathValue)) {
           runtimeError(vm, currentToken(frame), "Import path must be a string.");
@@ -1808,12 +3024,12 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         if (!beginModuleImport(vm, &frame, pathString, NULL, false, true)) {
           return false;
         }
-        break;
+        DISPATCH();
       }
-      case OP_EXPORT: {
+      CASE(OP_EXPORT): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         if (!frame->isModule || !frame->moduleInstance) {
-          break;
+          DISPATCH();
         }
         Value value;
         if (!envGetByName(vm->env, name, &value)) {
@@ -1821,33 +3037,33 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
           return false;
         }
         mapSet(frame->moduleInstance->fields, name, value);
-        break;
+        DISPATCH();
       }
-      case OP_PRIVATE: {
+      CASE(OP_PRIVATE): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         if (!frame->isModule) {
-          break;
+          DISPATCH();
         }
         if (!frame->modulePrivate) {
           frame->modulePrivate = newMap(vm);
         }
         mapSet(frame->modulePrivate, name, BOOL_VAL(true));
-        break;
+        DISPATCH();
       }
-      case OP_EXPORT_VALUE: {
+      CASE(OP_EXPORT_VALUE): {
         ObjString* name = (ObjString*)AS_OBJ(READ_CONSTANT());
         Value value = pop(vm);
         if (!frame->isModule || !frame->moduleInstance) {
-          break;
+          DISPATCH();
         }
         mapSet(frame->moduleInstance->fields, name, value);
-        break;
+        DISPATCH();
       }
-      case OP_EXPORT_FROM: {
+      CASE(OP_EXPORT_FROM): {
         uint16_t count = READ_SHORT();
         Value moduleValue = pop(vm);
         if (!frame->isModule || !frame->moduleInstance) {
-          break;
+          DISPATCH();
         }
         if (!isObjType(moduleValue, OBJ_INSTANCE)) {
           runtimeError(vm, currentToken(frame), "Export source must be a module.");
@@ -1861,7 +3077,7 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
             if (!entry->key) continue;
             mapSet(frame->moduleInstance->fields, entry->key, entry->value);
           }
-          break;
+          DISPATCH();
         }
         for (uint16_t i = 0; i < count; i++) {
           ObjString* from = (ObjString*)AS_OBJ(READ_CONSTANT());
@@ -1873,27 +3089,27 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
           }
           mapSet(frame->moduleInstance->fields, to, value);
         }
-        break;
+        DISPATCH();
       }
-      case OP_ARRAY: {
+      CASE(OP_ARRAY): {
         uint16_t capacity = READ_SHORT();
         ObjArray* array = newArrayWithCapacity(vm, (int)capacity);
         push(vm, OBJ_VAL(array));
-        break;
+        DISPATCH();
       }
-      case OP_ARRAY_APPEND: {
+      CASE(OP_ARRAY_APPEND): {
         Value value = pop(vm);
         ObjArray* array = (ObjArray*)AS_OBJ(peek(vm, 0));
         arrayWrite(array, value);
-        break;
+        DISPATCH();
       }
-      case OP_MAP: {
+      CASE(OP_MAP): {
         uint16_t capacity = READ_SHORT();
         ObjMap* map = newMapWithCapacity(vm, (int)capacity);
         push(vm, OBJ_VAL(map));
-        break;
+        DISPATCH();
       }
-      case OP_MAP_SET: {
+      CASE(OP_MAP_SET): {
         Value value = pop(vm);
         Value key = pop(vm);
         if (!isString(key)) {
@@ -1902,37 +3118,100 @@ static bool runWithTarget(VM* vm, int targetFrameCount) {
         }
         ObjMap* map = (ObjMap*)AS_OBJ(peek(vm, 0));
         mapSet(map, asString(key), value);
-        break;
+        DISPATCH();
       }
-      case OP_GC:
+      CASE(OP_GC):
         gcMaybe(vm);
-        break;
-    }
-
-    if (vm->hadError) return false;
-    if (vm->maxStackSlots > 0) {
-      size_t stackUsed = (size_t)(vm->stackTop - vm->stack);
-      if (stackUsed > (size_t)vm->maxStackSlots) {
-        runtimeError(vm, currentToken(frame), "Stack limit exceeded.");
-        return false;
+        if (vm->workerParent && workerInterrupted(vm)) {
+          vm->hadError = true;
+          return false;
+        }
+        DISPATCH();
+      CASE(OP_ITER_INIT): {
+        bool withKey = READ_BYTE() != 0;
+        ObjIterator* iterator = iteratorStart(vm, currentToken(frame), peek(vm, 0), withKey);
+        if (!iterator) return false;
+        vm->stackTop[-1] = OBJ_VAL(iterator);
+        DISPATCH();
       }
-    }
-    if (vm->maxHeapBytes > 0) {
-      size_t heapUsed = gcTotalHeapBytes(vm);
-      if (heapUsed > vm->maxHeapBytes) {
-        gcCollect(vm);
-        heapUsed = gcTotalHeapBytes(vm);
-        if (heapUsed > vm->maxHeapBytes) {
-          runtimeError(vm, currentToken(frame), "Heap limit exceeded.");
+      CASE(OP_ITER_NEXT): {
+        uint16_t offset = READ_SHORT();
+        // The iterator stays on the stack while next() runs so it is rooted.
+        ObjIterator* iterator = (ObjIterator*)AS_OBJ(peek(vm, 0));
+        if (iterator->kind == ITER_GENERATOR) {
+          // Run the body in this loop; OP_YIELD or the return comes back here.
+          ObjGenerator* generator = (ObjGenerator*)AS_OBJ(iterator->source);
+          if (generator->state == GEN_SUSPENDED) {
+            pop(vm);
+            if (!generatorEnter(vm, generator)) return false;
+            generator->loopExit = frame->ip + offset;
+            generator->loopWithKey = iterator->withKey;
+            frame = &vm->frames[vm->frameCount - 1];
+            DISPATCH();
+          }
+        }
+        bool done = false;
+        Value key = NULL_VAL;
+        Value value = NULL_VAL;
+        if (!iteratorNext(vm, currentToken(frame), iterator, &done, &key, &value)) {
+          return false;
+        }
+        pop(vm);
+        if (done) {
+          frame->ip += offset;
+          DISPATCH();
+        }
+        push(vm, value);
+        if (iterator->withKey) push(vm, key);
+        DISPATCH();
+      }
+      CASE(OP_RANGE): {
+        Value end = pop(vm);
+        Value start = pop(vm);
+        if (!IS_NUMBER(start) || !IS_NUMBER(end)) {
+          runtimeError(vm, currentToken(frame), "range() expects (start, end) numbers.");
+          return false;
+        }
+        push(vm, OBJ_VAL(newRange(vm, AS_NUMBER(start), AS_NUMBER(end))));
+        DISPATCH();
+      }
+      CASE(OP_RANGE_INIT): {
+        // Slots hold the cursor, the end and the step of a counting foreach.
+        uint8_t slot = READ_BYTE();
+        Value end = pop(vm);
+        Value start = pop(vm);
+        if (!IS_NUMBER(start) || !IS_NUMBER(end)) {
+          runtimeError(vm, currentToken(frame), "range() expects (start, end) numbers.");
           return false;
         }
+        frame->slots[slot] = start;
+        frame->slots[slot + 1] = end;
+        frame->slots[slot + 2] = INT_VAL(numberLessEqual(start, end) ? 1 : -1);
+        DISPATCH();
+      }
+      CASE(OP_RANGE_NEXT): {
+        Value* cursor = &frame->slots[READ_BYTE()];
+        uint16_t offset = READ_SHORT();
+        bool more = AS_INT(cursor[2]) > 0 ? numberLessEqual(cursor[0], cursor[1])
+                                          : numberLessEqual(cursor[1], cursor[0]);
+        if (!more) {
+          frame->ip += offset;
+          DISPATCH();
+        }
+        push(vm, cursor[0]);
+        cursor[0] = numberAdd(cursor[0], cursor[2]);
+        DISPATCH();
       }
     }
+
+    if (vm->hadError) return false;
   }
 
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_CONSTANT
+#undef CASE
+#undef DISPATCH
 }
 
 static bool callScript(VM* vm, ObjFunction* function) {
@@ -1942,11 +3221,15 @@ static bool callScript(VM* vm, ObjFunction* function) {
     runtimeError(vm, token, "Stack overflow.");
     return false;
   }
+  Value* slots = vm->stackTop - 1;
+  if (!reserveFrameSlots(vm, slots, function->slotCount)) {
+    return false;
+  }
 
   CallFrame* frame = &vm->frames[vm->frameCount++];
   frame->function = function;
   frame->ip = function->chunk->code;
-  frame->slots = vm->stackTop - 1;
+  frame->slots = slots;
   frame->previousEnv = vm->env;
   frame->previousProgram = vm->currentProgram;
   frame->receiver = NULL_VAL;
@@ -1960,6 +3243,7 @@ static bool callScript(VM* vm, ObjFunction* function) {
   frame->moduleHasAlias = false;
   frame->modulePushResult = false;
   frame->modulePrivate = NULL;
+  frame->generator = NULL;
 
   vm->currentProgram = function->program;
   return true;
@@ -1991,6 +3275,8 @@ bool interpret(VM* vm, Program* program) {
   }
 
   bool ok = run(vm);
+  // Tasks still runnable when the script ends get to finish.
+  if (ok && !vm->hadError) ok = schedulerDrain(vm) && schedulerCheckFailedTasks(vm);
   programRunEnd(vm, program);
   vm->currentProgram = previousProgram;
   return ok && !vm->hadError;
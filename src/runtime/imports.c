@@ -1231,6 +1231,7 @@ ObjFunction* loadModuleFunction(VM* vm, Token keyword, const char* path) {
     return NULL;
   }
   function->program = program;
+  programRetain(program);
   
   return function;
 }
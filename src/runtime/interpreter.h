@@ -26,6 +26,7 @@ typedef struct {
   bool moduleHasAlias;
   bool modulePushResult;
   ObjMap* modulePrivate;
+  ObjGenerator* generator;
 } CallFrame;
 
 typedef struct {
@@ -44,6 +45,89 @@ typedef struct {
   Value* args;
 } DeferEntry;
 
+typedef enum {
+  FIBER_NEW,
+  FIBER_READY,
+  FIBER_PARKED,
+  FIBER_RUNNING,
+  FIBER_DONE,
+  FIBER_FAILED
+} FiberState;
+
+// A task created by spawn(). While it runs, its frames sit on the VM stack
+// above baseFrame. While it is parked they are copied out here: frame slots
+// and try stack tops then point into `stack`, and try and defer frame indexes
+// are relative to the fiber's first frame. A task that has not started keeps
+// its callee and arguments in `stack`. A task parked in recv() or select()
+// lists the channels it is registered on in `waitChannels`. A failed task
+// keeps the error it threw in `result`; an awaiter woken with `wakeThrows`
+// raises the value it was woken with.
+struct ObjFiber {
+  Obj obj;
+  FiberState state;
+  Value result;
+  Value* stack;
+  int stackCount;
+  int stackCapacity;
+  CallFrame* frames;
+  int frameCount;
+  int frameCapacity;
+  TryFrame* tries;
+  int tryCount;
+  int tryCapacity;
+  DeferEntry* defers;
+  int deferCount;
+  int deferCapacity;
+  ObjUpvalue** upvalues;
+  int* upvalueSlots;
+  int upvalueCount;
+  int upvalueCapacity;
+  Env* env;
+  Program* program;
+  int baseFrame;
+  int callDepth;
+  ObjFiber* resumer;
+  bool wakeThrows;
+  ObjFiber** waiters;
+  int waiterCount;
+  int waiterCapacity;
+  ObjChannel** waitChannels;
+  int waitChannelCount;
+  int waitChannelCapacity;
+};
+
+typedef struct {
+  double deadline;
+  uint64_t sequence;
+  ObjFiber* fiber;
+} FiberTimer;
+
+typedef struct EventLoop EventLoop;
+
+// Computes the result a parked task resumes with once its descriptor is
+// ready; `events` holds the PLATFORM_POLL_* flags that fired.
+typedef Value (*IoReadyFn)(VM* vm, intptr_t fd, intptr_t data, int events);
+
+// A wait on a file descriptor. A parked task has `fiber` set; a native
+// blocking in place has none, and the loop stores the fired events in
+// `fired` instead.
+typedef struct {
+  intptr_t fd;
+  int events;
+  ObjFiber* fiber;
+  IoReadyFn ready;
+  intptr_t data;
+  int* fired;
+} IoWait;
+
+// A task parked on a worker: for its result in await(), or for its next
+// message in worker.recv().
+typedef struct {
+  ObjWorker* worker;
+  ObjFiber* fiber;
+  bool result;
+} WorkerWait;
+
 typedef struct {
   void* handle;
   bool owns;
@@ -73,18 +157,50 @@ struct VM {
   Obj* oldObjects;
   ObjArray* args;
   ObjMap* modules;
-  ObjMap* strings;
+  StringTable strings;
   Program* programs;
   Program* currentProgram;
   CallFrame frames[FRAMES_MAX];
   int frameCount;
   Value stack[STACK_MAX];
   Value* stackTop;
+  ObjUpvalue* openUpvalues;
   TryFrame tryFrames[TRY_MAX];
   int tryCount;
+  // A throw whose handler belongs to an outer dispatch loop. It travels down
+  // through natives with `hadError` set; see runWithTarget.
+  Value pendingThrow;
+  bool throwPending;
   DeferEntry* defers;
   int deferCount;
   int deferCapacity;
+  ObjFiber* currentFiber;
+  int callDepth;
+  bool fiberParking;
+  ObjFiber** readyFibers;
+  int readyHead;
+  int readyCount;
+  int readyCapacity;
+  // Failed tasks that no await() has seen yet. They are reported when the
+  // script ends.
+  ObjFiber** failedTasks;
+  int failedTaskCount;
+  int failedTaskCapacity;
+  FiberTimer* fiberTimers;
+  int fiberTimerCount;
+  int fiberTimerCapacity;
+  uint64_t fiberTimerSequence;
+  EventLoop* eventLoop;
+  IoWait* ioWaits;
+  int ioWaitCount;
+  int ioWaitCapacity;
+  WorkerLink* workerParent;
+  WorkerLink** workers;
+  int workerCount;
+  int workerCapacity;
+  WorkerWait* workerWaits;
+  int workerWaitCount;
+  int workerWaitCapacity;
   void** pluginHandles;
   int pluginCount;
   int pluginCapacity;
@@ -124,6 +240,10 @@ struct VM {
   bool hadError;
   bool debugBytecode;
   bool debugTrace;
+  bool dumpInlineCaches;
+  bool profileOpcodePairs;
+  uint64_t* opcodePairCounts;
+  int lastOpcode;
   int debugTraceLine;
   int debugTraceColumn;
   bool typecheck;
@@ -149,4 +269,8 @@ void defineGlobal(VM* vm, const char* name, Value value);
 
 bool interpret(VM* vm, Program* program);
 
+ObjFiber* newFiber(VM* vm, Value callee, int argc, Value* args);
+void fiberRelease(ObjFiber* fiber);
+void workerRelease(ObjWorker* worker);
+
 #endif
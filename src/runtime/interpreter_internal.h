@@ -11,6 +11,7 @@ void envDefineConst(Env* env, ObjString* name, Value value);
 bool envIsConst(Env* env, ObjString* name);
 
 void runtimeError(VM* vm, Token token, const char* message);
+void printThrownTrace(VM* vm, Value error);
 bool runtimeOutOfMemory(VM* vm, const char* context);
 ObjArray* captureStackTrace(VM* vm, const char* fallbackPath);
 bool isTruthy(Value value);
@@ -21,5 +22,57 @@ char* resolveImportPath(VM* vm, const char* currentPath, const char* importPath)
 bool hasExtension(const char* path);
 ObjFunction* loadModuleFunction(VM* vm, Token keyword, const char* path);
 bool vmCallValue(VM* vm, Value callee, int argc, Value* args, Value* out);
+bool vmResumeGenerator(VM* vm, ObjGenerator* generator, bool* done, Value* key, Value* value);
+bool vmThrowValue(VM* vm, Value error);
+void uncaughtThrowError(VM* vm, Token token, const char* prefix, Value error);
+
+typedef enum {
+  FIBER_RUN_DONE,
+  FIBER_RUN_PARKED,
+  FIBER_RUN_FAILED,
+  FIBER_RUN_ERROR
+} FiberRunResult;
+
+typedef enum {
+  SCHEDULER_RAN,
+  SCHEDULER_IDLE,
+  SCHEDULER_ERROR
+} SchedulerStep;
+
+FiberRunResult vmRunFiber(VM* vm, ObjFiber* fiber);
+void schedulerFree(VM* vm);
+double schedulerNow(void);
+SchedulerStep schedulerStep(VM* vm, double until);
+bool schedulerDrain(VM* vm);
+bool schedulerCheckFailedTasks(VM* vm);
+ObjFiber* fiberSpawn(VM* vm, Value callee, int argc, Value* args);
+bool fiberCanPark(VM* vm);
+bool fiberAwait(VM* vm, ObjFiber* task, Value* out);
+bool fiberSleep(VM* vm, double seconds);
+bool fiberWake(VM* vm, ObjFiber* fiber, Value value);
+void fiberPark(VM* vm, FiberState state);
+bool channelSend(VM* vm, ObjChannel* channel, Value value, bool* sent);
+bool channelRecv(VM* vm, ObjChannel* channel, Value* out);
+bool channelSelect(VM* vm, ObjArray* channels, Value* out);
+bool channelClose(VM* vm, ObjChannel* channel);
+EventLoop* eventLoopCreate(void);
+EventLoop* vmEventLoop(VM* vm);
+void eventLoopRetain(EventLoop* loop);
+void eventLoopRelease(EventLoop* loop);
+void eventLoopWake(EventLoop* loop);
+bool eventLoopWait(VM* vm, double until);
+void eventLoopFree(VM* vm);
+bool ioPark(VM* vm, intptr_t fd, int events, IoReadyFn ready, intptr_t data);
+bool ioBlock(VM* vm, intptr_t fd, int events, double timeout, int* outEvents);
+void workerFreeAll(VM* vm);
+bool workerPoll(VM* vm);
+ObjWorker* workerSpawn(VM* vm, Value target, int argc, Value* args);
+ObjWorker* workerParentHandle(VM* vm);
+bool workerSend(VM* vm, ObjWorker* worker, Value value, bool* sent);
+bool workerRecv(VM* vm, ObjWorker* worker, Value* out);
+void workerClose(ObjWorker* worker);
+void workerTerminate(ObjWorker* worker);
+bool workerInterrupted(VM* vm);
+bool workerAwait(VM* vm, ObjWorker* worker, Value* out);
 
 #endif
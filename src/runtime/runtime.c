@@ -130,6 +130,14 @@ ERKAO_FFI_EXPORT double erkao_ffi_add(double a, double b) {
   return a + b;
 }
 
+ERKAO_FFI_EXPORT double erkao_ffi_sum(const double* values, int64_t count) {
+  double sum = 0.0;
+  for (int64_t i = 0; i < count; i++) {
+    sum += values[i];
+  }
+  return sum;
+}
+
 void runtimeError(VM* vm, Token token, const char* message) {
   const char* displayPath = "<repl>";
   if (vm->currentProgram && vm->currentProgram->path) {
@@ -160,6 +168,24 @@ void runtimeError(VM* vm, Token token, const char* message) {
   vm->hadError = true;
 }
 
+// Prints the trace a thrown error captured, for an error reported after the
+// frames it was thrown from are gone.
+void printThrownTrace(VM* vm, Value error) {
+  if (!stackTraceEnabled() || !isObjType(error, OBJ_MAP)) return;
+  Value trace;
+  if (!mapGet((ObjMap*)AS_OBJ(error), copyString(vm, "trace"), &trace) ||
+      !isObjType(trace, OBJ_ARRAY)) {
+    return;
+  }
+  ObjArray* frames = (ObjArray*)AS_OBJ(trace);
+  if (frames->count == 0) return;
+  fprintf(stderr, "Stack trace (most recent call last):\n");
+  for (int i = 0; i < frames->count; i++) {
+    if (!isString(frames->items[i])) continue;
+    fprintf(stderr, "  %s\n", stringChars(asString(frames->items[i])));
+  }
+}
+
 bool runtimeOutOfMemory(VM* vm, const char* context) {
   const char* message = context && context[0] != '\0'
       ? context
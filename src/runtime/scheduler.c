@@ -0,0 +1,559 @@
+#include "interpreter_internal.h"
+#include "gc.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+// Tasks are cooperative and all run on the VM's one stack. A task runs until
+// it returns or parks in await(), send(), recv(), select(), sleep() or a
+// native waiting on a descriptor; parked tasks wait on the task they await,
+// on a channel, in the timer heap or in the event loop, and are moved to the
+// ready queue when woken. The main script never parks: when it blocks, it
+// runs ready tasks from inside the native until its condition holds.
+
+double schedulerNow(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+#endif
+}
+
+static void sleepSeconds(double seconds) {
+  if (!(seconds > 0)) return;
+#ifdef _WIN32
+  Sleep((DWORD)(seconds * 1000.0));
+#else
+  struct timespec ts;
+  ts.tv_sec = (time_t)seconds;
+  ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1000000000.0);
+  if (ts.tv_nsec < 0) ts.tv_nsec = 0;
+  nanosleep(&ts, NULL);
+#endif
+}
+
+void schedulerFree(VM* vm) {
+  FREE_ARRAY(ObjFiber*, vm->readyFibers, vm->readyCapacity);
+  FREE_ARRAY(ObjFiber*, vm->failedTasks, vm->failedTaskCapacity);
+  FREE_ARRAY(FiberTimer, vm->fiberTimers, vm->fiberTimerCapacity);
+  vm->readyFibers = NULL;
+  vm->readyHead = 0;
+  vm->readyCount = 0;
+  vm->readyCapacity = 0;
+  vm->failedTasks = NULL;
+  vm->failedTaskCount = 0;
+  vm->failedTaskCapacity = 0;
+  vm->fiberTimers = NULL;
+  vm->fiberTimerCount = 0;
+  vm->fiberTimerCapacity = 0;
+  workerFreeAll(vm);
+  eventLoopFree(vm);
+}
+
+static bool readyPush(VM* vm, ObjFiber* fiber) {
+  if (vm->readyCount == vm->readyCapacity) {
+    int capacity = GROW_CAPACITY(vm->readyCapacity);
+    ObjFiber** ready = (ObjFiber**)malloc(sizeof(ObjFiber*) * (size_t)capacity);
+    if (!ready) return runtimeOutOfMemory(vm, "Out of memory while scheduling task.");
+    for (int i = 0; i < vm->readyCount; i++) {
+      ready[i] = vm->readyFibers[(vm->readyHead + i) % vm->readyCapacity];
+    }
+    FREE_ARRAY(ObjFiber*, vm->readyFibers, vm->readyCapacity);
+    vm->readyFibers = ready;
+    vm->readyHead = 0;
+    vm->readyCapacity = capacity;
+  }
+  vm->readyFibers[(vm->readyHead + vm->readyCount) % vm->readyCapacity] = fiber;
+  vm->readyCount++;
+  return true;
+}
+
+static ObjFiber* readyPop(VM* vm) {
+  ObjFiber* fiber = vm->readyFibers[vm->readyHead];
+  vm->readyHead = (vm->readyHead + 1) % vm->readyCapacity;
+  vm->readyCount--;
+  return fiber;
+}
+
+static bool timerBefore(const FiberTimer* a, const FiberTimer* b) {
+  if (a->deadline != b->deadline) return a->deadline < b->deadline;
+  return a->sequence < b->sequence;
+}
+
+// The timers form a binary min-heap on (deadline, sequence), so tasks due at
+// the same time wake in the order they went to sleep.
+static bool timerPush(VM* vm, double deadline, ObjFiber* fiber) {
+  if (vm->fiberTimerCount == vm->fiberTimerCapacity) {
+    int capacity = GROW_CAPACITY(vm->fiberTimerCapacity);
+    FiberTimer* timers = GROW_ARRAY(FiberTimer, vm->fiberTimers, vm->fiberTimerCapacity,
+                                    capacity);
+    if (!timers) return runtimeOutOfMemory(vm, "Out of memory while scheduling task.");
+    vm->fiberTimers = timers;
+    vm->fiberTimerCapacity = capacity;
+  }
+  FiberTimer timer = {deadline, vm->fiberTimerSequence++, fiber};
+  int index = vm->fiberTimerCount++;
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+    if (!timerBefore(&timer, &vm->fiberTimers[parent])) break;
+    vm->fiberTimers[index] = vm->fiberTimers[parent];
+    index = parent;
+  }
+  vm->fiberTimers[index] = timer;
+  return true;
+}
+
+static ObjFiber* timerPop(VM* vm) {
+  ObjFiber* fiber = vm->fiberTimers[0].fiber;
+  FiberTimer last = vm->fiberTimers[--vm->fiberTimerCount];
+  int index = 0;
+  for (;;) {
+    int child = index * 2 + 1;
+    if (child >= vm->fiberTimerCount) break;
+    if (child + 1 < vm->fiberTimerCount &&
+        timerBefore(&vm->fiberTimers[child + 1], &vm->fiberTimers[child])) {
+      child++;
+    }
+    if (!timerBefore(&vm->fiberTimers[child], &last)) break;
+    vm->fiberTimers[index] = vm->fiberTimers[child];
+    index = child;
+  }
+  if (vm->fiberTimerCount > 0) vm->fiberTimers[index] = last;
+  return fiber;
+}
+
+// A parked task resumes with `value` as the result of the native it parked in.
+bool fiberWake(VM* vm, ObjFiber* fiber, Value value) {
+  fiber->stack[fiber->stackCount - 1] = value;
+  fiber->state = FIBER_READY;
+  gcRememberObjectIfYoungRefs(vm, (Obj*)fiber);
+  return readyPush(vm, fiber);
+}
+
+static bool wakeDueTimers(VM* vm, double now) {
+  while (vm->fiberTimerCount > 0 && vm->fiberTimers[0].deadline <= now) {
+    if (!fiberWake(vm, timerPop(vm), NULL_VAL)) return false;
+  }
+  return true;
+}
+
+// Each awaiter resumes with the task's result, or rethrows its error.
+static bool wakeAwaiters(VM* vm, ObjFiber* task) {
+  for (int i = 0; i < task->waiterCount; i++) {
+    task->waiters[i]->wakeThrows = task->state == FIBER_FAILED;
+    if (!fiberWake(vm, task->waiters[i], task->result)) return false;
+  }
+  FREE_ARRAY(ObjFiber*, task->waiters, task->waiterCapacity);
+  task->waiters = NULL;
+  task->waiterCount = 0;
+  task->waiterCapacity = 0;
+  return true;
+}
+
+// A failed task nobody awaits yet waits here for an await() to see its
+// error, or to be reported when the script ends.
+static bool failedTaskAdd(VM* vm, ObjFiber* task) {
+  if (vm->failedTaskCount == vm->failedTaskCapacity) {
+    int capacity = GROW_CAPACITY(vm->failedTaskCapacity);
+    ObjFiber** tasks = GROW_ARRAY(ObjFiber*, vm->failedTasks, vm->failedTaskCapacity, capacity);
+    if (!tasks) return runtimeOutOfMemory(vm, "Out of memory while recording a failed task.");
+    vm->failedTasks = tasks;
+    vm->failedTaskCapacity = capacity;
+  }
+  vm->failedTasks[vm->failedTaskCount++] = task;
+  return true;
+}
+
+static void failedTaskRemove(VM* vm, ObjFiber* task) {
+  for (int i = 0; i < vm->failedTaskCount; i++) {
+    if (vm->failedTasks[i] != task) continue;
+    vm->failedTasks[i] = vm->failedTasks[--vm->failedTaskCount];
+    return;
+  }
+}
+
+// Reports the first failed task whose error no await() saw.
+bool schedulerCheckFailedTasks(VM* vm) {
+  if (vm->failedTaskCount == 0) return true;
+  Token token;
+  memset(&token, 0, sizeof(Token));
+  Value error = vm->failedTasks[0]->result;
+  uncaughtThrowError(vm, token, "Uncaught throw in task", error);
+  printThrownTrace(vm, error);
+  return false;
+}
+
+static bool fiberFinished(ObjFiber* task) {
+  return task->state == FIBER_DONE || task->state == FIBER_FAILED;
+}
+
+// A finished task gives its result, or rethrows its error in the awaiter.
+static bool awaitFinished(VM* vm, ObjFiber* task, Value* out) {
+  if (task->state == FIBER_FAILED) {
+    failedTaskRemove(vm, task);
+    return vmThrowValue(vm, task->result);
+  }
+  *out = task->result;
+  return true;
+}
+
+// Runs the next ready task. With none ready, waits for the earliest timer
+// instead, unless it is due after `until`: then nothing can happen in time
+// and the step is idle. Tasks parked on a worker or a descriptor keep the
+// step from going idle; it waits for them in the event loop, which also
+// wakes when a worker posts or ends.
+SchedulerStep schedulerStep(VM* vm, double until) {
+  if (!wakeDueTimers(vm, schedulerNow())) return SCHEDULER_ERROR;
+  if (!workerPoll(vm)) return SCHEDULER_ERROR;
+  if (vm->readyCount == 0) {
+    double deadline = vm->fiberTimerCount > 0 ? vm->fiberTimers[0].deadline : INFINITY;
+    if (vm->workerWaitCount > 0 || vm->ioWaitCount > 0) {
+      if (!eventLoopWait(vm, deadline < until ? deadline : until)) return SCHEDULER_ERROR;
+      if (!wakeDueTimers(vm, schedulerNow())) return SCHEDULER_ERROR;
+      return workerPoll(vm) ? SCHEDULER_RAN : SCHEDULER_ERROR;
+    }
+    if (vm->fiberTimerCount == 0 || deadline > until) return SCHEDULER_IDLE;
+    sleepSeconds(deadline - schedulerNow());
+    return wakeDueTimers(vm, schedulerNow()) ? SCHEDULER_RAN : SCHEDULER_ERROR;
+  }
+
+  ObjFiber* fiber = readyPop(vm);
+  switch (vmRunFiber(vm, fiber)) {
+    case FIBER_RUN_DONE:
+      return wakeAwaiters(vm, fiber) ? SCHEDULER_RAN : SCHEDULER_ERROR;
+    case FIBER_RUN_FAILED:
+      if (fiber->waiterCount == 0) {
+        return failedTaskAdd(vm, fiber) ? SCHEDULER_RAN : SCHEDULER_ERROR;
+      }
+      return wakeAwaiters(vm, fiber) ? SCHEDULER_RAN : SCHEDULER_ERROR;
+    case FIBER_RUN_PARKED:
+      return SCHEDULER_RAN;
+    case FIBER_RUN_ERROR:
+      break;
+  }
+  return SCHEDULER_ERROR;
+}
+
+// Runs tasks until none is ready or sleeping. Tasks still waiting on a
+// channel or on each other at that point never wake.
+bool schedulerDrain(VM* vm) {
+  for (;;) {
+    SchedulerStep step = schedulerStep(vm, INFINITY);
+    if (step == SCHEDULER_ERROR) return false;
+    if (step == SCHEDULER_IDLE) return true;
+  }
+}
+
+ObjFiber* fiberSpawn(VM* vm, Value callee, int argc, Value* args) {
+  ObjFiber* fiber = newFiber(vm, callee, argc, args);
+  if (!fiber) return NULL;
+  if (!readyPush(vm, fiber)) return NULL;
+  return fiber;
+}
+
+// Only a task's own dispatch loop can be suspended: the native must have been
+// called straight from it, with no other native or nested run in between.
+bool fiberCanPark(VM* vm) {
+  ObjFiber* fiber = vm->currentFiber;
+  return fiber && vm->callDepth == fiber->callDepth + 1 &&
+         vm->frameCount > fiber->baseFrame;
+}
+
+void fiberPark(VM* vm, FiberState state) {
+  vm->currentFiber->state = state;
+  vm->fiberParking = true;
+}
+
+bool fiberAwait(VM* vm, ObjFiber* task, Value* out) {
+  *out = NULL_VAL;
+  Token token;
+  memset(&token, 0, sizeof(Token));
+  if (task == vm->currentFiber) {
+    runtimeError(vm, token, "A task cannot await itself.");
+    return false;
+  }
+  if (fiberFinished(task)) return awaitFinished(vm, task, out);
+  if (fiberCanPark(vm)) {
+    if (task->waiterCount == task->waiterCapacity) {
+      int capacity = GROW_CAPACITY(task->waiterCapacity);
+      ObjFiber** waiters = GROW_ARRAY(ObjFiber*, task->waiters, task->waiterCapacity, capacity);
+      if (!waiters) return runtimeOutOfMemory(vm, "Out of memory while awaiting task.");
+      task->waiters = waiters;
+      task->waiterCapacity = capacity;
+    }
+    task->waiters[task->waiterCount++] = vm->currentFiber;
+    gcRememberObjectIfYoungRefs(vm, (Obj*)task);
+    fiberPark(vm, FIBER_PARKED);
+    return true;
+  }
+  while (!fiberFinished(task)) {
+    SchedulerStep step = schedulerStep(vm, INFINITY);
+    if (step == SCHEDULER_ERROR) return false;
+    if (step == SCHEDULER_IDLE) {
+      runtimeError(vm, token, "await() would block forever: no task can make progress.");
+      return false;
+    }
+  }
+  return awaitFinished(vm, task, out);
+}
+
+// A task parks until the deadline; sleep(0) just yields to the other ready
+// tasks. The main script runs tasks until the deadline and sleeps for real
+// only when none is ready.
+bool fiberSleep(VM* vm, double seconds) {
+  double deadline = schedulerNow() + seconds;
+  if (fiberCanPark(vm)) {
+    if (seconds <= 0) {
+      if (!readyPush(vm, vm->currentFiber)) return false;
+      fiberPark(vm, FIBER_READY);
+      return true;
+    }
+    if (!timerPush(vm, deadline, vm->currentFiber)) return false;
+    fiberPark(vm, FIBER_PARKED);
+    return true;
+  }
+  for (;;) {
+    SchedulerStep step = schedulerStep(vm, deadline);
+    if (step == SCHEDULER_ERROR) return false;
+    double now = schedulerNow();
+    if (now >= deadline) return true;
+    if (step == SCHEDULER_IDLE) {
+      sleepSeconds(deadline - now);
+      return true;
+    }
+  }
+}
+
+static bool receiverAdd(VM* vm, ObjChannel* channel, ObjFiber* fiber, int index) {
+  if (channel->receiverCount == channel->receiverCapacity) {
+    int capacity = GROW_CAPACITY(channel->receiverCapacity);
+    ChannelReceiver* receivers = GROW_ARRAY(ChannelReceiver, channel->receivers,
+                                            channel->receiverCapacity, capacity);
+    if (!receivers) return runtimeOutOfMemory(vm, "Out of memory while waiting on channel.");
+    channel->receivers = receivers;
+    channel->receiverCapacity = capacity;
+  }
+  if (fiber->waitChannelCount == fiber->waitChannelCapacity) {
+    int capacity = GROW_CAPACITY(fiber->waitChannelCapacity);
+    ObjChannel** channels = GROW_ARRAY(ObjChannel*, fiber->waitChannels,
+                                       fiber->waitChannelCapacity, capacity);
+    if (!channels) return runtimeOutOfMemory(vm, "Out of memory while waiting on channel.");
+    fiber->waitChannels = channels;
+    fiber->waitChannelCapacity = capacity;
+  }
+  ChannelReceiver* receiver = &channel->receivers[channel->receiverCount++];
+  receiver->fiber = fiber;
+  receiver->index = index;
+  fiber->waitChannels[fiber->waitChannelCount++] = channel;
+  gcRememberObjectIfYoungRefs(vm, (Obj*)channel);
+  gcRememberObjectIfYoungRefs(vm, (Obj*)fiber);
+  return true;
+}
+
+static void receiverRemove(ObjChannel* channel, ObjFiber* fiber) {
+  int kept = 0;
+  for (int i = 0; i < channel->receiverCount; i++) {
+    if (channel->receivers[i].fiber != fiber) {
+      channel->receivers[kept++] = channel->receivers[i];
+    }
+  }
+  channel->receiverCount = kept;
+}
+
+// Drops every registration of a task parked in recv() or select().
+static void fiberLeaveChannels(ObjFiber* fiber) {
+  for (int i = 0; i < fiber->waitChannelCount; i++) {
+    receiverRemove(fiber->waitChannels[i], fiber);
+  }
+  fiber->waitChannelCount = 0;
+}
+
+static bool fiberChannelsClosed(ObjFiber* fiber) {
+  for (int i = 0; i < fiber->waitChannelCount; i++) {
+    if (!fiber->waitChannels[i]->closed) return false;
+  }
+  return true;
+}
+
+static Value selectResult(VM* vm, int index, Value value) {
+  ObjMap* result = newMap(vm);
+  if (!result) return NULL_VAL;
+  mapSet(result, copyString(vm, "index"), INT_VAL(index));
+  mapSet(result, copyString(vm, "value"), value);
+  return OBJ_VAL(result);
+}
+
+// Hands `value` to the task that has waited longest in recv() or select().
+static bool receiverWake(VM* vm, ObjChannel* channel, Value value) {
+  ChannelReceiver receiver = channel->receivers[0];
+  fiberLeaveChannels(receiver.fiber);
+  if (receiver.index >= 0) value = selectResult(vm, receiver.index, value);
+  return fiberWake(vm, receiver.fiber, value);
+}
+
+static bool senderAdd(VM* vm, ObjChannel* channel, ObjFiber* fiber, Value value) {
+  if (channel->senderCount == channel->senderCapacity) {
+    int capacity = GROW_CAPACITY(channel->senderCapacity);
+    ChannelSender* senders = GROW_ARRAY(ChannelSender, channel->senders,
+                                        channel->senderCapacity, capacity);
+    if (!senders) return runtimeOutOfMemory(vm, "Out of memory while sending on channel.");
+    channel->senders = senders;
+    channel->senderCapacity = capacity;
+  }
+  ChannelSender* sender = &channel->senders[channel->senderCount++];
+  sender->fiber = fiber;
+  sender->value = value;
+  gcRememberObjectIfYoungRefs(vm, (Obj*)channel);
+  return true;
+}
+
+static ChannelSender senderShift(ObjChannel* channel) {
+  ChannelSender sender = channel->senders[0];
+  memmove(&channel->senders[0], &channel->senders[1],
+          sizeof(ChannelSender) * (size_t)(channel->senderCount - 1));
+  channel->senderCount--;
+  return sender;
+}
+
+// Takes the oldest buffered value. Senders only wait while the buffer is
+// full, so the first of them moves its value into the freed slot.
+static bool channelTake(VM* vm, ObjChannel* channel, Value* out) {
+  if (channel->count == 0) return false;
+  *out = channelShift(channel);
+  if (channel->senderCount > 0) {
+    ChannelSender sender = senderShift(channel);
+    if (channelPush(vm, channel, sender.value)) {
+      fiberWake(vm, sender.fiber, BOOL_VAL(true));
+    }
+  }
+  return true;
+}
+
+// Delivers straight to a waiting receiver, else buffers the value. A task
+// parks while the buffer is full; the main script runs the ready tasks until
+// there is room. `sent` is false once the channel is closed.
+bool channelSend(VM* vm, ObjChannel* channel, Value value, bool* sent) {
+  Token token;
+  memset(&token, 0, sizeof(Token));
+  *sent = false;
+  for (;;) {
+    if (channel->closed) return true;
+    if (channel->receiverCount > 0) {
+      *sent = true;
+      return receiverWake(vm, channel, value);
+    }
+    if (channel->limit == 0 || channel->count < channel->limit) {
+      *sent = true;
+      return channelPush(vm, channel, value);
+    }
+    if (fiberCanPark(vm)) {
+      if (!senderAdd(vm, channel, vm->currentFiber, value)) return false;
+      fiberPark(vm, FIBER_PARKED);
+      return true;
+    }
+    SchedulerStep step = schedulerStep(vm, INFINITY);
+    if (step == SCHEDULER_ERROR) return false;
+    if (step == SCHEDULER_IDLE) {
+      runtimeError(vm, token, "send() would block forever: the channel is full.");
+      return false;
+    }
+  }
+}
+
+// On an empty channel a task parks until a value is sent or the channel is
+// closed. The main script runs the ready tasks instead, and gets null once
+// none of them can send any more.
+bool channelRecv(VM* vm, ObjChannel* channel, Value* out) {
+  *out = NULL_VAL;
+  for (;;) {
+    if (channelTake(vm, channel, out)) return !vm->hadError;
+    if (channel->closed) return true;
+    if (fiberCanPark(vm)) {
+      if (!receiverAdd(vm, channel, vm->currentFiber, -1)) return false;
+      fiberPark(vm, FIBER_PARKED);
+      return true;
+    }
+    SchedulerStep step = schedulerStep(vm, INFINITY);
+    if (step == SCHEDULER_ERROR) return false;
+    if (step == SCHEDULER_IDLE) return true;
+  }
+}
+
+// Receives from the first of `channels` with a value and returns
+// {index, value}, or null once every channel is closed and drained. A task
+// with nothing to receive registers on each open channel and parks; the
+// first send to any of them wakes it.
+bool channelSelect(VM* vm, ObjArray* channels, Value* out) {
+  *out = NULL_VAL;
+  for (;;) {
+    bool open = false;
+    for (int i = 0; i < channels->count; i++) {
+      if (!isObjType(channels->items[i], OBJ_CHANNEL)) continue;
+      ObjChannel* channel = (ObjChannel*)AS_OBJ(channels->items[i]);
+      Value value;
+      if (channelTake(vm, channel, &value)) {
+        if (vm->hadError) return false;
+        *out = selectResult(vm, i, value);
+        return true;
+      }
+      if (!channel->closed) open = true;
+    }
+    if (!open) return true;
+    if (fiberCanPark(vm)) {
+      for (int i = 0; i < channels->count; i++) {
+        if (!isObjType(channels->items[i], OBJ_CHANNEL)) continue;
+        ObjChannel* channel = (ObjChannel*)AS_OBJ(channels->items[i]);
+        if (channel->closed) continue;
+        if (!receiverAdd(vm, channel, vm->currentFiber, i)) return false;
+      }
+      fiberPark(vm, FIBER_PARKED);
+      return true;
+    }
+    SchedulerStep step = schedulerStep(vm, INFINITY);
+    if (step == SCHEDULER_ERROR) return false;
+    if (step == SCHEDULER_IDLE) return true;
+  }
+}
+
+// Buffered values stay receivable. Waiting senders get false, and waiting
+// receivers get null unless a select() of theirs still has an open channel.
+bool channelClose(VM* vm, ObjChannel* channel) {
+  if (channel->closed) return true;
+  channel->closed = true;
+  while (channel->senderCount > 0) {
+    ChannelSender sender = senderShift(channel);
+    if (!fiberWake(vm, sender.fiber, BOOL_VAL(false))) return false;
+  }
+  while (channel->receiverCount > 0) {
+    ObjFiber* fiber = channel->receivers[0].fiber;
+    if (fiberChannelsClosed(fiber)) {
+      fiberLeaveChannels(fiber);
+      if (!fiberWake(vm, fiber, NULL_VAL)) return false;
+      continue;
+    }
+    receiverRemove(channel, fiber);
+    int kept = 0;
+    for (int i = 0; i < fiber->waitChannelCount; i++) {
+      if (fiber->waitChannels[i] != channel) {
+        fiber->waitChannels[kept++] = fiber->waitChannels[i];
+      }
+    }
+    fiber->waitChannelCount = kept;
+  }
+  return true;
+}
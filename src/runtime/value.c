@@ -4,32 +4,145 @@
 #include "gc.h"
 #include "program.h"
 
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+
+// Never returns 0, which marks a string whose hash is not computed yet.
 static uint32_t hashBytes(const char* chars, int length) {
   uint32_t hash = 2166136261u;
   for (int i = 0; i < length; i++) {
     hash ^= (uint8_t)chars[i];
     hash *= 16777619u;
   }
-  return hash;
+  return hash ? hash : 1;
 }
 
-static ObjString* findInternedString(VM* vm, const char* chars, int length) {
-  if (!vm || !vm->strings) return NULL;
-  if (!chars && length > 0) return NULL;
-  Token token;
-  memset(&token, 0, sizeof(Token));
-  token.start = chars ? chars : "";
-  token.length = length;
-  Value value;
-  if (mapGetByToken(vm->strings, token, &value)) {
-    if (isObjType(value, OBJ_STRING)) {
-      return (ObjString*)AS_OBJ(value);
+uint32_t stringHash(ObjString* string) {
+  if (string->hash == 0) {
+    string->hash = hashBytes(stringData(string), string->length);
+  }
+  return string->hash;
+}
+
+#define STRING_TABLE_MAX_LOAD 0.75
+
+// Marks a slot whose string was removed, so probes for strings that collided
+// with it keep walking.
+static ObjString stringTableTombstone;
+#define STRING_TOMBSTONE (&stringTableTombstone)
+
+void initStringTable(StringTable* table) {
+  table->entries = NULL;
+  table->count = 0;
+  table->tombstones = 0;
+  table->capacity = 0;
+  table->maxLength = STRING_INTERN_MAX_LENGTH;
+}
+
+void freeStringTable(StringTable* table) {
+  free(table->entries);
+  initStringTable(table);
+}
+
+static ObjString** stringTableFindSlot(StringTable* table, const char* chars, int length,
+                                       uint32_t hash) {
+  uint32_t mask = (uint32_t)table->capacity - 1;
+  uint32_t index = hash & mask;
+  ObjString** tombstone = NULL;
+  for (;;) {
+    ObjString** slot = &table->entries[index];
+    ObjString* entry = *slot;
+    if (!entry) return tombstone ? tombstone : slot;
+    if (entry == STRING_TOMBSTONE) {
+      if (!tombstone) tombstone = slot;
+    } else if (entry->hash == hash && entry->length == length &&
+               memcmp(entry->chars, chars, (size_t)length) == 0) {
+      return slot;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+static bool stringTableResize(StringTable* table, int capacity) {
+  ObjString** entries = (ObjString**)calloc((size_t)capacity, sizeof(ObjString*));
+  if (!entries) return false;
+  uint32_t mask = (uint32_t)capacity - 1;
+  for (int i = 0; i < table->capacity; i++) {
+    ObjString* entry = table->entries[i];
+    if (!entry || entry == STRING_TOMBSTONE) continue;
+    uint32_t index = entry->hash & mask;
+    while (entries[index]) {
+      index = (index + 1) & mask;
     }
+    entries[index] = entry;
+  }
+  free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+  table->tombstones = 0;
+  return true;
+}
+
+static bool shouldIntern(VM* vm, int length) {
+  return vm && length <= vm->strings.maxLength;
+}
+
+static ObjString* findInternedString(VM* vm, const char* chars, int length, uint32_t hash) {
+  if (!vm || vm->strings.count == 0) return NULL;
+  ObjString* entry = *stringTableFindSlot(&vm->strings, chars, length, hash);
+  return entry == STRING_TOMBSTONE ? NULL : entry;
+}
+
+// Interning is a cache: when the table cannot grow the string simply stays
+// uninterned, and equality falls back to comparing bytes.
+static void internString(VM* vm, ObjString* string) {
+  if (!vm) return;
+  StringTable* table = &vm->strings;
+  if (table->count + table->tombstones + 1 > (int)(table->capacity * STRING_TABLE_MAX_LOAD)) {
+    int capacity = table->capacity < 8 ? 8 : table->capacity;
+    while ((int)(capacity * STRING_TABLE_MAX_LOAD) < (table->count + 1) * 2) {
+      capacity *= 2;
+    }
+    if (!stringTableResize(table, capacity)) return;
+  }
+  ObjString** slot = stringTableFindSlot(table, string->chars, string->length, string->hash);
+  if (*slot == STRING_TOMBSTONE) table->tombstones--;
+  *slot = string;
+  table->count++;
+}
+
+void stringTableRemove(StringTable* table, ObjString* string) {
+  // Interning computes the hash, so a string without one is not in the table.
+  if (table->count == 0 || string->hash == 0) return;
+  uint32_t mask = (uint32_t)table->capacity - 1;
+  uint32_t index = string->hash & mask;
+  for (;;) {
+    ObjString* entry = table->entries[index];
+    if (!entry) return;
+    if (entry == string) {
+      table->entries[index] = STRING_TOMBSTONE;
+      table->count--;
+      table->tombstones++;
+      return;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+void stringTableRemoveUnmarked(StringTable* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    ObjString* entry = table->entries[i];
+    if (!entry || entry == STRING_TOMBSTONE || entry->obj.marked) continue;
+    table->entries[i] = STRING_TOMBSTONE;
+    table->count--;
+    table->tombstones++;
   }
-  return NULL;
 }
 
 static bool stringsEqual(ObjString* a, ObjString* b);
+static ObjShape* newShape(VM* vm, ObjShape* parent, ObjString* name);
 static MapEntryValue* mapFindEntry(MapEntryValue* entries, int capacity, ObjString* key);
 static MapEntryValue* mapFindEntryByToken(MapEntryValue* entries, int capacity,
                                           Token key, uint32_t keyHash);
@@ -63,59 +176,366 @@ static Obj* allocateObject(VM* vm, size_t size, ObjType type, ObjGen generation)
   return object;
 }
 
-static ObjString* allocateString(VM* vm, char* chars, int length) {
+typedef struct {
+  StringReleaseFn release;
+  void* context;
+} StringExternal;
+
+static void releasePayload(StringReleaseFn release, void* context, char* chars, int length) {
+  if (release) {
+    release(context, chars, length);
+  } else {
+    free(chars);
+  }
+}
+
+// Strings start young like every other short-lived object; the ones that
+// survive are promoted with the rest.
+static ObjString* allocateInlineString(VM* vm, int length) {
   size_t size = sizeof(ObjString) + (size_t)length + 1;
-  ObjString* string = (ObjString*)allocateObject(vm, size, OBJ_STRING, OBJ_GEN_OLD);
+  ObjString* string = (ObjString*)allocateObject(vm, size, OBJ_STRING, OBJ_GEN_YOUNG);
+  if (!string) return NULL;
+  string->length = length;
+  string->hash = 0;
+  string->chars = string->bytes;
+  string->bytes[length] = '\0';
+  return string;
+}
+
+// The release hook lives in the inline area an external string does not use
+// for bytes.
+static ObjString* allocateExternalString(VM* vm, char* chars, int length, uint32_t hash,
+                                         StringReleaseFn release, void* context) {
+  size_t size = sizeof(ObjString) + sizeof(StringExternal);
+  ObjString* string = (ObjString*)allocateObject(vm, size, OBJ_STRING, OBJ_GEN_YOUNG);
   if (!string) {
-    free(chars);
+    releasePayload(release, context, chars, length);
     return NULL;
   }
+  StringExternal external = {release, context};
+  memcpy(string->bytes, &external, sizeof(external));
   string->length = length;
+  string->hash = hash;
   string->chars = chars;
-  string->hash = hashBytes(chars, length);
+  if (!release) {
+    // An adopted buffer is VM memory and counts toward the next collection.
+    size_t grown = size + (size_t)length + 1;
+    string->obj.size = grown;
+    gcTrackResize(vm, (Obj*)string, size, grown);
+  }
   return string;
 }
 
-ObjString* copyStringWithLength(VM* vm, const char* chars, int length) {
-  if (length < 0) length = 0;
-  if (!chars) chars = "";
-  ObjString* interned = findInternedString(vm, chars, length);
-  if (interned) return interned;
+void releaseExternalString(ObjString* string) {
+  StringExternal external;
+  memcpy(&external, string->bytes, sizeof(external));
+  releasePayload(external.release, external.context, string->chars, string->length);
+}
+
+// Concatenations shorter than this are copied; copying a few cache lines is
+// cheaper than a rope node and the flatten it will need later.
+#define ROPE_MIN_LENGTH 256
+
+// A rope keeps its VM so flattening, which can happen anywhere `chars` is
+// read, can account for the buffer it allocates.
+typedef struct {
+  ObjString* left;
+  ObjString* right;
+  VM* vm;
+} StringRope;
+
+typedef struct {
+  ObjString** items;
+  int count;
+  int capacity;
+  ObjString* inlineItems[32];
+} RopeStack;
+
+static void ropeStackInit(RopeStack* stack) {
+  stack->items = stack->inlineItems;
+  stack->count = 0;
+  stack->capacity = (int)(sizeof(stack->inlineItems) / sizeof(stack->inlineItems[0]));
+}
+
+static void ropeStackPush(RopeStack* stack, ObjString* string) {
+  if (stack->count == stack->capacity) {
+    int capacity = stack->capacity * 2;
+    ObjString** items = stack->items == stack->inlineItems
+        ? (ObjString**)malloc(sizeof(ObjString*) * (size_t)capacity)
+        : (ObjString**)realloc(stack->items, sizeof(ObjString*) * (size_t)capacity);
+    if (!items) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(1);
+    }
+    if (stack->items == stack->inlineItems) {
+      memcpy(items, stack->inlineItems, sizeof(stack->inlineItems));
+    }
+    stack->items = items;
+    stack->capacity = capacity;
+  }
+  stack->items[stack->count++] = string;
+}
+
+static void ropeStackFree(RopeStack* stack) {
+  if (stack->items != stack->inlineItems) free(stack->items);
+}
+
+void stringRopeChildren(ObjString* rope, ObjString** left, ObjString** right) {
+  StringRope parts;
+  memcpy(&parts, rope->bytes, sizeof(parts));
+  *left = parts.left;
+  *right = parts.right;
+}
+
+// Builds the bytes from the right end so the usual left-leaning rope from
+// `s = s + piece` keeps the explicit stack shallow. Child ropes are read but
+// left as they are; other strings may still share them.
+char* stringFlatten(ObjString* string) {
+  if (string->chars) return string->chars;
+  StringRope rope;
+  memcpy(&rope, string->bytes, sizeof(rope));
+  char* buffer = (char*)malloc((size_t)string->length + 1);
+  if (!buffer) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+
+  RopeStack stack;
+  ropeStackInit(&stack);
+  ropeStackPush(&stack, string);
+  int end = string->length;
+  while (stack.count > 0) {
+    ObjString* node = stack.items[--stack.count];
+    if (node->chars) {
+      end -= node->length;
+      memcpy(buffer + end, node->chars, (size_t)node->length);
+      continue;
+    }
+    ObjString* left;
+    ObjString* right;
+    stringRopeChildren(node, &left, &right);
+    ropeStackPush(&stack, left);
+    ropeStackPush(&stack, right);
+  }
+  ropeStackFree(&stack);
+  buffer[string->length] = '\0';
+
+  StringExternal external = {NULL, NULL};
+  memcpy(string->bytes, &external, sizeof(external));
+  string->chars = buffer;
+  size_t oldSize = string->obj.size;
+  string->obj.size = oldSize + (size_t)string->length + 1;
+  gcTrackResize(rope.vm, (Obj*)string, oldSize, string->obj.size);
+  return buffer;
+}
+
+bool stringForEachPiece(ObjString* string, StringPieceFn visit, void* context) {
+  if (string->chars) return visit(context, string->chars, string->length);
+  RopeStack stack;
+  ropeStackInit(&stack);
+  ropeStackPush(&stack, string);
+  bool ok = true;
+  while (ok && stack.count > 0) {
+    ObjString* node = stack.items[--stack.count];
+    if (node->chars) {
+      ok = visit(context, node->chars, node->length);
+      continue;
+    }
+    ObjString* left;
+    ObjString* right;
+    stringRopeChildren(node, &left, &right);
+    ropeStackPush(&stack, right);
+    ropeStackPush(&stack, left);
+  }
+  ropeStackFree(&stack);
+  return ok;
+}
+
+// A view's inline area starts like an external string's, so the sweep goes
+// through releaseExternalString; the hook does nothing because the bytes
+// belong to the parent.
+typedef struct {
+  StringReleaseFn release;
+  ObjString* parent;
+  VM* vm;
+} StringView;
+
+static void releaseView(void* context, char* chars, int length) {
+  (void)context;
+  (void)chars;
+  (void)length;
+}
+
+// Views this many times shorter than their parent are detached when the
+// collector finds them.
+#define STRING_VIEW_DETACH_RATIO 8
+
+ObjString* newStringView(VM* vm, ObjString* parent, int start, int length) {
+  if (start == 0 && length == parent->length) return parent;
+  const char* data = stringData(parent);
+  if (shouldIntern(vm, length)) return copyStringWithLength(vm, data + start, length);
+
+  // A view of a view shares the original parent, so chains never form.
+  ObjString* owner = stringViewParent(parent);
+  if (owner) parent = owner;
+  size_t size = sizeof(ObjString) + sizeof(StringView);
+  ObjString* string = (ObjString*)allocateObject(vm, size, OBJ_STRING, OBJ_GEN_YOUNG);
+  if (!string) return NULL;
+  StringView view = {releaseView, parent, vm};
+  memcpy(string->bytes, &view, sizeof(view));
+  string->length = length;
+  string->hash = 0;
+  string->chars = (char*)data + start;
+  return string;
+}
+
+ObjString* stringViewParent(ObjString* string) {
+  if (!string->chars || string->chars == string->bytes) return NULL;
+  StringExternal external;
+  memcpy(&external, string->bytes, sizeof(external));
+  if (external.release != releaseView) return NULL;
+  return (ObjString*)external.context;
+}
 
-  char* heap = (char*)malloc((size_t)length + 1);
-  if (!heap) {
-    reportOutOfMemory(vm, "Out of memory while allocating string bytes.");
+// Turns the view into an owned external string in place, so every reference
+// to it sees the copy.
+static bool detachView(ObjString* string) {
+  StringView view;
+  memcpy(&view, string->bytes, sizeof(view));
+  char* buffer = (char*)malloc((size_t)string->length + 1);
+  if (!buffer) return false;
+  memcpy(buffer, string->chars, (size_t)string->length);
+  buffer[string->length] = '\0';
+  StringExternal external = {NULL, NULL};
+  memcpy(string->bytes, &external, sizeof(external));
+  string->chars = buffer;
+  size_t oldSize = string->obj.size;
+  string->obj.size = oldSize + (size_t)string->length + 1;
+  gcTrackResize(view.vm, (Obj*)string, oldSize, string->obj.size);
+  return true;
+}
+
+void stringDetach(ObjString* string) {
+  if (!stringViewParent(string)) return;
+  if (!detachView(string)) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+}
+
+char* stringTerminate(ObjString* string) {
+  if (!string->chars) return stringFlatten(string);
+  // A view that ends where its parent does is already terminated.
+  if (string->chars[string->length] != '\0') stringDetach(string);
+  return string->chars;
+}
+
+ObjString* stringViewTrace(ObjString* string) {
+  ObjString* parent = stringViewParent(string);
+  if (!parent) return NULL;
+  if ((int64_t)string->length * STRING_VIEW_DETACH_RATIO < (int64_t)parent->length &&
+      detachView(string)) {
     return NULL;
   }
-  if (length > 0) {
-    memcpy(heap, chars, (size_t)length);
+  return parent;
+}
+
+ObjString* concatStrings(VM* vm, ObjString* a, ObjString* b) {
+  if (a->length == 0) return b;
+  if (b->length == 0) return a;
+  if (a->length > INT_MAX - b->length) {
+    reportOutOfMemory(vm, "String is too long.");
+    return NULL;
+  }
+  int length = a->length + b->length;
+  if (length < ROPE_MIN_LENGTH) {
+    ObjString* result = newStringBuffer(vm, length);
+    if (!result) return NULL;
+    memcpy(result->bytes, stringData(a), (size_t)a->length);
+    memcpy(result->bytes + a->length, stringData(b), (size_t)b->length);
+    return finishString(vm, result);
+  }
+
+  // Ropes are not interned: finding an equal string would mean flattening.
+  size_t size = sizeof(ObjString) + sizeof(StringRope);
+  ObjString* rope = (ObjString*)allocateObject(vm, size, OBJ_STRING, OBJ_GEN_YOUNG);
+  if (!rope) return NULL;
+  StringRope parts = {a, b, vm};
+  memcpy(rope->bytes, &parts, sizeof(parts));
+  rope->length = length;
+  rope->hash = 0;
+  rope->chars = NULL;
+  return rope;
+}
+
+ObjString* newStringBuffer(VM* vm, int length) {
+  if (length < 0) length = 0;
+  return allocateInlineString(vm, length);
+}
+
+ObjString* finishString(VM* vm, ObjString* string) {
+  if (!string || !shouldIntern(vm, string->length)) return string;
+  string->hash = hashBytes(string->chars, string->length);
+  ObjString* interned = findInternedString(vm, string->chars, string->length, string->hash);
+  // The unused buffer is unreachable and goes with the next minor collection.
+  if (interned) return interned;
+  internString(vm, string);
+  return string;
+}
+
+static ObjString* copyChars(VM* vm, const char* chars, int length, bool intern) {
+  if (length < 0) length = 0;
+  if (!chars) chars = "";
+  uint32_t hash = 0;
+  if (intern) {
+    hash = hashBytes(chars, length);
+    ObjString* interned = findInternedString(vm, chars, length, hash);
+    if (interned) return interned;
   }
-  heap[length] = '\0';
-  ObjString* string = allocateString(vm, heap, length);
+
+  ObjString* string = allocateInlineString(vm, length);
   if (!string) return NULL;
-  if (vm && vm->strings) {
-    mapSet(vm->strings, string, OBJ_VAL(string));
+  if (length > 0) {
+    memcpy(string->bytes, chars, (size_t)length);
   }
+  string->hash = hash;
+  if (intern) internString(vm, string);
   return string;
 }
 
+ObjString* copyStringWithLength(VM* vm, const char* chars, int length) {
+  return copyChars(vm, chars, length, shouldIntern(vm, length));
+}
+
 ObjString* takeStringWithLength(VM* vm, char* chars, int length) {
   if (length < 0) length = 0;
   if (!chars) {
     return copyStringWithLength(vm, "", 0);
   }
 
-  ObjString* interned = findInternedString(vm, chars, length);
-  if (interned) {
+  if (length < STRING_EXTERNAL_MIN_BYTES) {
+    ObjString* string = copyStringWithLength(vm, chars, length);
     free(chars);
-    return interned;
+    return string;
   }
   chars[length] = '\0';
-  ObjString* string = allocateString(vm, chars, length);
-  if (!string) return NULL;
-  if (vm && vm->strings) {
-    mapSet(vm->strings, string, OBJ_VAL(string));
+  return newExternalString(vm, chars, length, NULL, NULL);
+}
+
+ObjString* newExternalString(VM* vm, char* chars, int length, StringReleaseFn release,
+                             void* context) {
+  if (length < 0) length = 0;
+  if (!shouldIntern(vm, length)) {
+    return allocateExternalString(vm, chars, length, 0, release, context);
+  }
+  uint32_t hash = hashBytes(chars, length);
+  ObjString* interned = findInternedString(vm, chars, length, hash);
+  if (interned) {
+    releasePayload(release, context, chars, length);
+    return interned;
   }
+  ObjString* string = allocateExternalString(vm, chars, length, hash, release, context);
+  if (string) internString(vm, string);
   return string;
 }
 
@@ -124,7 +544,20 @@ ObjString* copyString(VM* vm, const char* chars) {
 }
 
 ObjString* stringFromToken(VM* vm, Token token) {
-  return copyStringWithLength(vm, token.start, token.length);
+  return copyChars(vm, token.start, token.length, vm != NULL);
+}
+
+// The table holds only strings that own their bytes, so a view is detached
+// before it is interned.
+ObjString* stringIntern(VM* vm, ObjString* string) {
+  if (!vm || !string) return string;
+  stringDetach(string);
+  const char* chars = stringData(string);
+  uint32_t hash = stringHash(string);
+  ObjString* interned = findInternedString(vm, chars, string->length, hash);
+  if (interned) return interned;
+  internString(vm, string);
+  return string;
 }
 
 ObjFunction* newFunction(VM* vm, ObjString* name, int arity, int minArity,
@@ -136,34 +569,51 @@ ObjFunction* newFunction(VM* vm, ObjString* name, int arity, int minArity,
   function->arity = arity;
   function->minArity = minArity;
   function->isInitializer = isInitializer;
+  function->isGenerator = false;
+  function->paramsInSlots = false;
+  function->slotCount = 0;
+  function->upvalueCount = 0;
   function->name = name;
   function->chunk = chunk;
   function->params = params;
   function->closure = closure;
   function->program = program;
+  function->proto = NULL;
+  function->upvalueDescs = NULL;
+  function->upvalues = NULL;
   programRetain(program);
   gcRememberObjectIfYoungRefs(vm, (Obj*)function);
   return function;
 }
 
+void functionFinishChunk(VM* vm, ObjFunction* function) {
+  gcRememberObjectIfYoungRefs(vm, (Obj*)function);
+}
+
 ObjFunction* cloneFunction(VM* vm, ObjFunction* proto, Env* closure) {
-  Chunk* chunk = cloneChunk(proto->chunk);
-  if (!chunk) return NULL;
-  ObjString** params = NULL;
-  if (proto->arity > 0) {
-    params = (ObjString**)malloc(sizeof(ObjString*) * (size_t)proto->arity);
-    if (!params) {
-      freeChunk(chunk);
-      free(chunk);
-      reportOutOfMemory(vm, "Out of memory while cloning function parameters.");
+  ObjUpvalue** upvalues = NULL;
+  if (proto->upvalueCount > 0) {
+    upvalues = (ObjUpvalue**)calloc((size_t)proto->upvalueCount, sizeof(ObjUpvalue*));
+    if (!upvalues) {
+      reportOutOfMemory(vm, "Out of memory while allocating closure upvalues.");
       return NULL;
     }
-    for (int i = 0; i < proto->arity; i++) {
-      params[i] = proto->params[i];
-    }
   }
-  return newFunction(vm, proto->name, proto->arity, proto->minArity, proto->isInitializer,
-                     params, chunk, closure, proto->program);
+  ObjFunction* function = newFunction(vm, proto->name, proto->arity, proto->minArity,
+                                      proto->isInitializer, proto->params, proto->chunk,
+                                      closure, proto->program);
+  if (!function) {
+    free(upvalues);
+    return NULL;
+  }
+  function->isGenerator = proto->isGenerator;
+  function->paramsInSlots = proto->paramsInSlots;
+  function->slotCount = proto->slotCount;
+  function->upvalueCount = proto->upvalueCount;
+  function->upvalueDescs = proto->upvalueDescs;
+  function->upvalues = upvalues;
+  function->proto = proto;
+  return function;
 }
 
 ObjNative* newNative(VM* vm, NativeFn function, int arity, ObjString* name) {
@@ -212,6 +662,8 @@ ObjClass* newClass(VM* vm, ObjString* name, ObjMap* methods) {
   klass->structFields = NULL;
   klass->structDefaults = NULL;
   klass->structReadonly = NULL;
+  klass->slotHint = 0;
+  klass->rootShape = newShape(vm, NULL, NULL);
   gcRememberObjectIfYoungRefs(vm, (Obj*)klass);
   return klass;
 }
@@ -221,7 +673,13 @@ ObjInstance* newInstance(VM* vm, ObjClass* klass) {
                                                        OBJ_GEN_YOUNG);
   if (!instance) return NULL;
   instance->klass = klass;
-  instance->fields = newMap(vm);
+  instance->shape = klass ? klass->rootShape : NULL;
+  instance->slots = NULL;
+  instance->slotCapacity = 0;
+  instance->fields = instance->shape ? NULL : newMap(vm);
+  if (instance->shape && klass->slotHint > 0) {
+    instanceReserveSlots(vm, instance, klass->slotHint);
+  }
   return instance;
 }
 
@@ -230,6 +688,9 @@ ObjInstance* newInstanceWithFields(VM* vm, ObjClass* klass, ObjMap* fields) {
                                                        OBJ_GEN_YOUNG);
   if (!instance) return NULL;
   instance->klass = klass;
+  instance->shape = NULL;
+  instance->slots = NULL;
+  instance->slotCapacity = 0;
   instance->fields = fields;
   return instance;
 }
@@ -289,6 +750,462 @@ ObjBoundMethod* newBoundMethod(VM* vm, Value receiver, ObjFunction* method) {
   return bound;
 }
 
+ObjIterator* newIterator(VM* vm, IterKind kind, Value source, bool withKey) {
+  ObjIterator* iterator = (ObjIterator*)allocateObject(vm, sizeof(ObjIterator),
+                                                      OBJ_ITERATOR, OBJ_GEN_YOUNG);
+  if (!iterator) return NULL;
+  iterator->kind = kind;
+  iterator->withKey = withKey;
+  iterator->source = source;
+  iterator->keys = NULL;
+  iterator->cursorName = NULL;
+  iterator->index = 0;
+  iterator->current = 0;
+  iterator->end = 0;
+  iterator->step = 0;
+  return iterator;
+}
+
+ObjRange* newRange(VM* vm, double start, double end) {
+  ObjRange* range = (ObjRange*)allocateObject(vm, sizeof(ObjRange), OBJ_RANGE, OBJ_GEN_YOUNG);
+  if (!range) return NULL;
+  range->start = start;
+  range->end = end;
+  range->step = start <= end ? 1.0 : -1.0;
+  return range;
+}
+
+int rangeLength(const ObjRange* range) {
+  double span = (range->end - range->start) * range->step;
+  if (!(span >= 0)) return 0;
+  if (span >= (double)INT_MAX) return INT_MAX;
+  return (int)floor(span) + 1;
+}
+
+// Ranges count in doubles, but a whole-numbered element is an integer.
+Value rangeElement(double number) {
+  if (number == floor(number) && fabs(number) <= 9007199254740992.0) {
+    return INT_VAL((int64_t)number);
+  }
+  return NUMBER_VAL(number);
+}
+
+ObjGenerator* newGenerator(VM* vm, ObjFunction* function) {
+  ObjGenerator* generator = (ObjGenerator*)allocateObject(vm, sizeof(ObjGenerator),
+                                                         OBJ_GENERATOR, OBJ_GEN_YOUNG);
+  if (!generator) return NULL;
+  generator->state = GEN_SUSPENDED;
+  generator->function = function;
+  generator->receiver = NULL_VAL;
+  generator->ip = function->chunk->code;
+  generator->argCount = 0;
+  generator->scopeDepth = 0;
+  generator->index = 0;
+  generator->env = NULL;
+  generator->stack = NULL;
+  generator->stackCount = 0;
+  generator->stackCapacity = 0;
+  generator->upvalues = NULL;
+  generator->upvalueSlots = NULL;
+  generator->upvalueCount = 0;
+  generator->upvalueCapacity = 0;
+  generator->tries = NULL;
+  generator->tryCount = 0;
+  generator->tryCapacity = 0;
+  generator->defers = NULL;
+  generator->deferCount = 0;
+  generator->deferCapacity = 0;
+  generator->loopExit = NULL;
+  generator->loopWithKey = false;
+  return generator;
+}
+
+// Drops everything a finished generator kept for resuming. Defers that never
+// ran are discarded with it, like those of a frame unwound by an error.
+void generatorRelease(ObjGenerator* generator) {
+  for (int i = 0; i < generator->deferCount; i++) {
+    free(generator->defers[i].args);
+  }
+  FREE_ARRAY(Value, generator->stack, generator->stackCapacity);
+  FREE_ARRAY(ObjUpvalue*, generator->upvalues, generator->upvalueCapacity);
+  FREE_ARRAY(int, generator->upvalueSlots, generator->upvalueCapacity);
+  FREE_ARRAY(GeneratorTry, generator->tries, generator->tryCapacity);
+  FREE_ARRAY(GeneratorDefer, generator->defers, generator->deferCapacity);
+  generator->state = GEN_DONE;
+  generator->receiver = NULL_VAL;
+  generator->env = NULL;
+  generator->stack = NULL;
+  generator->stackCount = 0;
+  generator->stackCapacity = 0;
+  generator->upvalues = NULL;
+  generator->upvalueSlots = NULL;
+  generator->upvalueCount = 0;
+  generator->upvalueCapacity = 0;
+  generator->tries = NULL;
+  generator->tryCount = 0;
+  generator->tryCapacity = 0;
+  generator->defers = NULL;
+  generator->deferCount = 0;
+  generator->deferCapacity = 0;
+  generator->loopExit = NULL;
+}
+
+ObjFiber* newFiber(VM* vm, Value callee, int argc, Value* args) {
+  ObjFiber* fiber = (ObjFiber*)allocateObject(vm, sizeof(ObjFiber), OBJ_FIBER, OBJ_GEN_YOUNG);
+  if (!fiber) return NULL;
+  fiber->state = FIBER_NEW;
+  fiber->result = NULL_VAL;
+  fiber->stack = NULL;
+  fiber->stackCount = 0;
+  fiber->stackCapacity = 0;
+  fiber->frames = NULL;
+  fiber->frameCount = 0;
+  fiber->frameCapacity = 0;
+  fiber->tries = NULL;
+  fiber->tryCount = 0;
+  fiber->tryCapacity = 0;
+  fiber->defers = NULL;
+  fiber->deferCount = 0;
+  fiber->deferCapacity = 0;
+  fiber->upvalues = NULL;
+  fiber->upvalueSlots = NULL;
+  fiber->upvalueCount = 0;
+  fiber->upvalueCapacity = 0;
+  fiber->env = NULL;
+  fiber->program = NULL;
+  fiber->baseFrame = 0;
+  fiber->callDepth = 0;
+  fiber->resumer = NULL;
+  fiber->wakeThrows = false;
+  fiber->waiters = NULL;
+  fiber->waiterCount = 0;
+  fiber->waiterCapacity = 0;
+  fiber->waitChannels = NULL;
+  fiber->waitChannelCount = 0;
+  fiber->waitChannelCapacity = 0;
+
+  fiber->stack = (Value*)malloc(sizeof(Value) * (size_t)(argc + 1));
+  if (!fiber->stack) {
+    reportOutOfMemory(vm, "Out of memory while spawning task.");
+    return NULL;
+  }
+  fiber->stackCapacity = argc + 1;
+  fiber->stackCount = argc + 1;
+  fiber->stack[0] = callee;
+  for (int i = 0; i < argc; i++) {
+    fiber->stack[i + 1] = args[i];
+  }
+  return fiber;
+}
+
+// Drops the saved frames of a finished task. Defers that never ran are
+// discarded, as for a generator. Waiters are woken by the scheduler first.
+void fiberRelease(ObjFiber* fiber) {
+  for (int i = 0; i < fiber->deferCount; i++) {
+    free(fiber->defers[i].args);
+  }
+  FREE_ARRAY(Value, fiber->stack, fiber->stackCapacity);
+  FREE_ARRAY(CallFrame, fiber->frames, fiber->frameCapacity);
+  FREE_ARRAY(TryFrame, fiber->tries, fiber->tryCapacity);
+  FREE_ARRAY(DeferEntry, fiber->defers, fiber->deferCapacity);
+  FREE_ARRAY(ObjUpvalue*, fiber->upvalues, fiber->upvalueCapacity);
+  FREE_ARRAY(int, fiber->upvalueSlots, fiber->upvalueCapacity);
+  fiber->state = FIBER_DONE;
+  fiber->stack = NULL;
+  fiber->stackCount = 0;
+  fiber->stackCapacity = 0;
+  fiber->frames = NULL;
+  fiber->frameCount = 0;
+  fiber->frameCapacity = 0;
+  fiber->tries = NULL;
+  fiber->tryCount = 0;
+  fiber->tryCapacity = 0;
+  fiber->defers = NULL;
+  fiber->deferCount = 0;
+  fiber->deferCapacity = 0;
+  fiber->upvalues = NULL;
+  fiber->upvalueSlots = NULL;
+  fiber->upvalueCount = 0;
+  fiber->upvalueCapacity = 0;
+  fiber->env = NULL;
+  fiber->program = NULL;
+}
+
+ObjChannel* newChannel(VM* vm, int limit) {
+  ObjChannel* channel = (ObjChannel*)allocateObject(vm, sizeof(ObjChannel), OBJ_CHANNEL,
+                                                   OBJ_GEN_YOUNG);
+  if (!channel) return NULL;
+  channel->items = NULL;
+  channel->head = 0;
+  channel->count = 0;
+  channel->capacity = 0;
+  channel->limit = limit;
+  channel->closed = false;
+  channel->receivers = NULL;
+  channel->receiverCount = 0;
+  channel->receiverCapacity = 0;
+  channel->senders = NULL;
+  channel->senderCount = 0;
+  channel->senderCapacity = 0;
+  return channel;
+}
+
+// Appends to the ring, growing it when full. The caller checks `limit`.
+bool channelPush(VM* vm, ObjChannel* channel, Value value) {
+  if (channel->count == channel->capacity) {
+    int capacity = GROW_CAPACITY(channel->capacity);
+    Value* items = (Value*)malloc(sizeof(Value) * (size_t)capacity);
+    if (!items) {
+      reportOutOfMemory(vm, "Out of memory while growing channel.");
+      return false;
+    }
+    for (int i = 0; i < channel->count; i++) {
+      items[i] = channel->items[(channel->head + i) % channel->capacity];
+    }
+    free(channel->items);
+    size_t oldSize = channel->obj.size;
+    channel->obj.size = oldSize + sizeof(Value) * (size_t)(capacity - channel->capacity);
+    gcTrackResize(vm, (Obj*)channel, oldSize, channel->obj.size);
+    channel->items = items;
+    channel->head = 0;
+    channel->capacity = capacity;
+  }
+  channel->items[(channel->head + channel->count) % channel->capacity] = value;
+  channel->count++;
+  gcWriteBarrier(vm, (Obj*)channel, value);
+  return true;
+}
+
+Value channelShift(ObjChannel* channel) {
+  Value value = channel->items[channel->head];
+  channel->items[channel->head] = NULL_VAL;
+  channel->head = (channel->head + 1) % channel->capacity;
+  channel->count--;
+  return value;
+}
+
+ObjWorker* newWorker(VM* vm, WorkerLink* link, bool child) {
+  ObjWorker* worker = (ObjWorker*)allocateObject(vm, sizeof(ObjWorker), OBJ_WORKER,
+                                                 OBJ_GEN_YOUNG);
+  if (!worker) return NULL;
+  worker->link = link;
+  worker->child = child;
+  return worker;
+}
+
+size_t typedKindSize(TypedKind kind) {
+  switch (kind) {
+    case TYPED_F64: return sizeof(double);
+    case TYPED_I32: return sizeof(int32_t);
+    case TYPED_U8: break;
+  }
+  return sizeof(uint8_t);
+}
+
+const char* typedKindName(TypedKind kind) {
+  switch (kind) {
+    case TYPED_F64: return "f64";
+    case TYPED_I32: return "i32";
+    case TYPED_U8: break;
+  }
+  return "u8";
+}
+
+// The elements follow the struct in the same allocation, zeroed.
+ObjTypedArray* newTypedArray(VM* vm, TypedKind kind, int length) {
+  size_t bytes = 0;
+  if (length < 0 || !erkaoMulSize((size_t)length, typedKindSize(kind), &bytes)) {
+    reportOutOfMemory(vm, "Typed array is too large.");
+    return NULL;
+  }
+  ObjTypedArray* array = (ObjTypedArray*)allocateObject(vm, sizeof(ObjTypedArray) + bytes,
+                                                        OBJ_TYPED_ARRAY, OBJ_GEN_YOUNG);
+  if (!array) return NULL;
+  array->kind = kind;
+  array->length = length;
+  array->data = (uint8_t*)(array + 1);
+  array->owner = NULL;
+  memset(array->data, 0, bytes);
+  return array;
+}
+
+// A view of a view shares the original owner, so chains never form.
+ObjTypedArray* newTypedView(VM* vm, ObjTypedArray* source, int start, int length) {
+  ObjTypedArray* view = (ObjTypedArray*)allocateObject(vm, sizeof(ObjTypedArray),
+                                                       OBJ_TYPED_ARRAY, OBJ_GEN_YOUNG);
+  if (!view) return NULL;
+  view->kind = source->kind;
+  view->length = length;
+  view->data = source->data + (size_t)start * typedKindSize(source->kind);
+  view->owner = source->owner ? source->owner : source;
+  return view;
+}
+
+ObjStringBuilder* newStringBuilder(VM* vm) {
+  ObjStringBuilder* builder = (ObjStringBuilder*)allocateObject(
+      vm, sizeof(ObjStringBuilder), OBJ_STRING_BUILDER, OBJ_GEN_YOUNG);
+  if (!builder) return NULL;
+  builder->vm = vm;
+  builder->data = NULL;
+  builder->length = 0;
+  builder->capacity = 0;
+  builder->ends = NULL;
+  builder->count = 0;
+  builder->endsCapacity = 0;
+  return builder;
+}
+
+ObjUpvalue* newUpvalue(VM* vm, Value* slot) {
+  ObjUpvalue* upvalue = (ObjUpvalue*)allocateObject(vm, sizeof(ObjUpvalue), OBJ_UPVALUE,
+                                                   OBJ_GEN_OLD);
+  if (!upvalue) return NULL;
+  upvalue->location = slot;
+  upvalue->closed = NULL_VAL;
+  upvalue->nextOpen = NULL;
+  return upvalue;
+}
+
+static ObjShape* newShape(VM* vm, ObjShape* parent, ObjString* name) {
+  ObjShape* shape = (ObjShape*)allocateObject(vm, sizeof(ObjShape), OBJ_SHAPE, OBJ_GEN_OLD);
+  if (!shape) return NULL;
+  shape->parent = parent;
+  if (name) stringDetach(name);
+  shape->name = name;
+  shape->slot = parent ? parent->fieldCount : -1;
+  shape->fieldCount = parent ? parent->fieldCount + 1 : 0;
+  shape->transitions = NULL;
+  shape->transitionCount = 0;
+  shape->transitionCapacity = 0;
+  shape->treeSize = 0;
+  if (name) {
+    gcWriteBarrier(vm, (Obj*)shape, OBJ_VAL(name));
+  }
+  return shape;
+}
+
+int shapeFindSlot(ObjShape* shape, ObjString* name) {
+  for (ObjShape* current = shape; current && current->name; current = current->parent) {
+    if (current->name == name || stringsEqual(current->name, name)) {
+      return current->slot;
+    }
+  }
+  return -1;
+}
+
+static ObjShape* shapeRoot(ObjShape* shape) {
+  while (shape->parent) shape = shape->parent;
+  return shape;
+}
+
+// False when adding `name` would need a new shape in a tree that is full.
+static bool shapeCanAdd(ObjShape* shape, ObjString* name) {
+  for (int i = 0; i < shape->transitionCount; i++) {
+    ObjShape* next = shape->transitions[i];
+    if (next->name == name || stringsEqual(next->name, name)) return true;
+  }
+  return shapeRoot(shape)->treeSize < SHAPE_MAX_TREE;
+}
+
+ObjShape* shapeTransition(VM* vm, ObjShape* shape, ObjString* name) {
+  if (!shape || !name) return NULL;
+  for (int i = 0; i < shape->transitionCount; i++) {
+    ObjShape* next = shape->transitions[i];
+    if (next->name == name || stringsEqual(next->name, name)) return next;
+  }
+  if (shape->transitionCount == shape->transitionCapacity) {
+    int oldCapacity = shape->transitionCapacity;
+    int capacity = oldCapacity < 4 ? 4 : oldCapacity * 2;
+    ObjShape** resized = (ObjShape**)erkaoReallocArray(shape->transitions, (size_t)capacity,
+                                                       sizeof(ObjShape*));
+    if (!resized) {
+      reportOutOfMemory(vm, "Out of memory while growing shape transitions.");
+      return NULL;
+    }
+    shape->transitions = resized;
+    shape->transitionCapacity = capacity;
+    size_t oldSize = shape->obj.size;
+    shape->obj.size = oldSize + sizeof(ObjShape*) * (size_t)(capacity - oldCapacity);
+    gcTrackResize(vm, (Obj*)shape, oldSize, shape->obj.size);
+  }
+  ObjShape* next = newShape(vm, shape, name);
+  if (!next) return NULL;
+  shape->transitions[shape->transitionCount++] = next;
+  shapeRoot(shape)->treeSize++;
+  return next;
+}
+
+bool instanceReserveSlots(VM* vm, ObjInstance* instance, int count) {
+  if (count <= instance->slotCapacity) return true;
+  int oldCapacity = instance->slotCapacity;
+  int capacity = oldCapacity < 4 ? 4 : oldCapacity;
+  while (capacity < count) capacity *= 2;
+  Value* resized = (Value*)erkaoReallocArray(instance->slots, (size_t)capacity, sizeof(Value));
+  if (!resized) {
+    reportOutOfMemory(vm, "Out of memory while growing instance fields.");
+    return false;
+  }
+  instance->slots = resized;
+  instance->slotCapacity = capacity;
+  size_t oldSize = instance->obj.size;
+  instance->obj.size = oldSize + sizeof(Value) * (size_t)(capacity - oldCapacity);
+  gcTrackResize(vm, (Obj*)instance, oldSize, instance->obj.size);
+  return true;
+}
+
+static bool instanceToDictionary(VM* vm, ObjInstance* instance) {
+  ObjMap* fields = newMapWithCapacity(vm, instance->shape->fieldCount + 1);
+  if (!fields) return false;
+  for (ObjShape* shape = instance->shape; shape && shape->name; shape = shape->parent) {
+    mapSet(fields, shape->name, instance->slots[shape->slot]);
+  }
+  size_t oldSize = instance->obj.size;
+  instance->obj.size = oldSize - sizeof(Value) * (size_t)instance->slotCapacity;
+  gcTrackResize(vm, (Obj*)instance, oldSize, instance->obj.size);
+  free(instance->slots);
+  instance->slots = NULL;
+  instance->slotCapacity = 0;
+  instance->shape = NULL;
+  instance->fields = fields;
+  gcWriteBarrier(vm, (Obj*)instance, OBJ_VAL(fields));
+  return true;
+}
+
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* out) {
+  if (!instance || !name) return false;
+  if (!instance->shape) return mapGet(instance->fields, name, out);
+  int slot = shapeFindSlot(instance->shape, name);
+  if (slot < 0) return false;
+  if (out) *out = instance->slots[slot];
+  return true;
+}
+
+bool instanceSetField(VM* vm, ObjInstance* instance, ObjString* name, Value value) {
+  if (!instance || !name) return false;
+  if (!instance->shape) {
+    mapSet(instance->fields, name, value);
+    return true;
+  }
+  int slot = shapeFindSlot(instance->shape, name);
+  if (slot < 0) {
+    if (instance->shape->fieldCount >= SHAPE_MAX_FIELDS ||
+        !shapeCanAdd(instance->shape, name)) {
+      if (!instanceToDictionary(vm, instance)) return false;
+      mapSet(instance->fields, name, value);
+      return true;
+    }
+    ObjShape* next = shapeTransition(vm, instance->shape, name);
+    if (!next || !instanceReserveSlots(vm, instance, next->fieldCount)) return false;
+    instance->shape = next;
+    slot = next->slot;
+    if (instance->klass && instance->klass->slotHint < next->fieldCount) {
+      instance->klass->slotHint = next->fieldCount;
+    }
+  }
+  instance->slots[slot] = value;
+  gcWriteBarrier(vm, (Obj*)instance, value);
+  return true;
+}
+
 void arrayWrite(ObjArray* array, Value value) {
   if (!array) return;
   if (array->capacity < array->count + 1) {
@@ -339,17 +1256,21 @@ bool arraySet(ObjArray* array, int index, Value value) {
   return false;
 }
 
+// Hashes are compared only when both are already known; otherwise comparing
+// the bytes is cheaper than hashing them first.
 static bool stringsEqual(ObjString* a, ObjString* b) {
   if (a == b) return true;
   if (a->length != b->length) return false;
-  if (a->hash != b->hash) return false;
-  return memcmp(a->chars, b->chars, (size_t)a->length) == 0;
+  if (a->hash && b->hash && a->hash != b->hash) return false;
+  return memcmp(stringData(a), stringData(b), (size_t)a->length) == 0;
 }
 
 #define MAP_MAX_LOAD 0.75
 
 static MapEntryValue* mapFindEntry(MapEntryValue* entries, int capacity, ObjString* key) {
-  uint32_t index = key->hash & (uint32_t)(capacity - 1);
+  // Hashing a rope key flattens it, so keys stored in a map are always flat
+  // and always hashed.
+  uint32_t index = stringHash(key) & (uint32_t)(capacity - 1);
   for (;;) {
     MapEntryValue* entry = &entries[index];
     if (!entry->key || entry->key == key || stringsEqual(entry->key, key)) {
@@ -467,6 +1388,7 @@ int mapSetIndex(ObjMap* map, ObjString* key, Value value) {
   bool isNewKey = entry->key == NULL;
   if (isNewKey) {
     map->count++;
+    stringDetach(key);
   }
   entry->key = key;
   entry->value = value;
@@ -521,15 +1443,27 @@ static const char* objTypeName(ObjType type) {
     case OBJ_ARRAY: return "array";
     case OBJ_MAP: return "map";
     case OBJ_BOUND_METHOD: return "bound_method";
+    case OBJ_UPVALUE: return "upvalue";
+    case OBJ_SHAPE: return "shape";
+    case OBJ_ITERATOR: return "iterator";
+    case OBJ_RANGE: return "range";
+    case OBJ_GENERATOR: return "generator";
+    case OBJ_FIBER: return "task";
+    case OBJ_CHANNEL: return "channel";
+    case OBJ_WORKER: return "worker";
+    case OBJ_TYPED_ARRAY: return "typedarray";
+    case OBJ_STRING_BUILDER: return "stringbuilder";
+    case OBJ_BOXED_INT: return "number";
     default: return "object";
   }
 }
 
 const char* valueTypeName(Value value) {
-  switch (value.type) {
+  switch (valueType(value)) {
     case VAL_NULL: return "null";
     case VAL_BOOL: return "bool";
-    case VAL_NUMBER: return "number";
+    case VAL_NUMBER:
+    case VAL_INT: return "number";
     case VAL_OBJ:
       if (!AS_OBJ(value)) return "object";
       return objTypeName(AS_OBJ(value)->type);
@@ -539,11 +1473,12 @@ const char* valueTypeName(Value value) {
 }
 
 bool valuesEqual(Value a, Value b) {
-  if (a.type != b.type) return false;
-  switch (a.type) {
+  // 1 and 1.0 are the same number.
+  if (IS_NUMBER(a) && IS_NUMBER(b)) return numbersEqual(a, b);
+  if (valueType(a) != valueType(b)) return false;
+  switch (valueType(a)) {
     case VAL_NULL: return true;
     case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
-    case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
     case VAL_OBJ: {
       Obj* objA = AS_OBJ(a);
       Obj* objB = AS_OBJ(b);
@@ -559,286 +1494,57 @@ bool valuesEqual(Value a, Value b) {
   }
 }
 
-static void printObject(Value value);
+// INT_VAL has no VM to allocate from, so wide integers are boxed on the heap
+// of the VM that owns this thread. Each isolate runs its VM on its own
+// thread.
+static ERKAO_THREAD_LOCAL VM* gBoxedIntHeap = NULL;
 
-void printValue(Value value) {
-  switch (value.type) {
-    case VAL_NULL:
-      printf("null");
-      break;
-    case VAL_BOOL:
-      printf(AS_BOOL(value) ? "true" : "false");
-      break;
-    case VAL_NUMBER:
-      printf("%g", AS_NUMBER(value));
-      break;
-    case VAL_OBJ:
-      if (!AS_OBJ(value)) {
-        printf("<null-obj>");
-      } else {
-        printObject(value);
-      }
-      break;
-  }
-}
-
-static void printArray(ObjArray* array) {
-  printf("[");
-  for (int i = 0; i < array->count; i++) {
-    if (i > 0) printf(", ");
-    printValue(array->items[i]);
-  }
-  printf("]");
-}
-
-static void printMap(ObjMap* map) {
-  printf("{");
-  int printed = 0;
-  for (int i = 0; i < map->capacity; i++) {
-    if (!map->entries[i].key) continue;
-    if (printed > 0) printf(", ");
-    printf("%s: ", map->entries[i].key->chars);
-    printValue(map->entries[i].value);
-    printed++;
-  }
-  printf("}");
-}
-
-static void printObject(Value value) {
-  switch (AS_OBJ(value)->type) {
-    case OBJ_STRING:
-      printf("%s", ((ObjString*)AS_OBJ(value))->chars);
-      break;
-    case OBJ_FUNCTION: {
-      ObjFunction* function = (ObjFunction*)AS_OBJ(value);
-      if (function->name) {
-        printf("<fun %s>", function->name->chars);
-      } else {
-        printf("<fun>");
-      }
-      break;
-    }
-    case OBJ_NATIVE: {
-      ObjNative* native = (ObjNative*)AS_OBJ(value);
-      if (native->name) {
-        printf("<native %s>", native->name->chars);
-      } else {
-        printf("<native>");
-      }
-      break;
-    }
-    case OBJ_ENUM_CTOR: {
-      ObjEnumCtor* ctor = (ObjEnumCtor*)AS_OBJ(value);
-      const char* enumName = ctor->enumName ? ctor->enumName->chars : "enum";
-      const char* variantName = ctor->variantName ? ctor->variantName->chars : "variant";
-      printf("<enum %s.%s>", enumName, variantName);
-      break;
-    }
-    case OBJ_CLASS: {
-      ObjClass* klass = (ObjClass*)AS_OBJ(value);
-      printf("<class %s>", klass->name->chars);
-      break;
-    }
-    case OBJ_INSTANCE: {
-      ObjInstance* instance = (ObjInstance*)AS_OBJ(value);
-      printf("<%s instance>", instance->klass->name->chars);
-      break;
-    }
-    case OBJ_ARRAY:
-      printArray((ObjArray*)AS_OBJ(value));
-      break;
-    case OBJ_MAP:
-      printMap((ObjMap*)AS_OBJ(value));
-      break;
-    case OBJ_BOUND_METHOD:
-      printf("<bound method>");
-      break;
-  }
-}
-
-typedef struct {
-  char* data;
-  int length;
-  int capacity;
-  bool failed;
-} StringBuilder;
-
-static void sbInit(StringBuilder* sb) {
-  sb->data = NULL;
-  sb->length = 0;
-  sb->capacity = 0;
-  sb->failed = false;
-}
-
-static void sbEnsure(StringBuilder* sb, int needed) {
-  if (sb->failed || sb->capacity >= needed) return;
-  int newCap = sb->capacity == 0 ? 64 : sb->capacity;
-  while (newCap < needed) {
-    newCap *= 2;
-  }
-  char* next = (char*)realloc(sb->data, (size_t)newCap);
-  if (!next) {
-    sb->failed = true;
-    return;
-  }
-  sb->data = next;
-  sb->capacity = newCap;
-}
-
-static void sbAppendN(StringBuilder* sb, const char* text, int length) {
-  if (sb->failed || length <= 0) return;
-  sbEnsure(sb, sb->length + length + 1);
-  if (sb->failed) return;
-  memcpy(sb->data + sb->length, text, (size_t)length);
-  sb->length += length;
-  sb->data[sb->length] = '\0';
-}
-
-static void sbAppendChar(StringBuilder* sb, char c) {
-  if (sb->failed) return;
-  sbEnsure(sb, sb->length + 2);
-  if (sb->failed) return;
-  sb->data[sb->length++] = c;
-  sb->data[sb->length] = '\0';
-}
-
-static void appendValue(StringBuilder* sb, Value value);
-
-static void appendArray(StringBuilder* sb, ObjArray* array) {
-  sbAppendChar(sb, '[');
-  for (int i = 0; i < array->count; i++) {
-    if (i > 0) sbAppendN(sb, ", ", 2);
-    appendValue(sb, array->items[i]);
+void setBoxedIntHeap(VM* vm, bool active) {
+  if (active) {
+    gBoxedIntHeap = vm;
+  } else if (gBoxedIntHeap == vm) {
+    gBoxedIntHeap = NULL;
   }
-  sbAppendChar(sb, ']');
 }
 
-static void appendMap(StringBuilder* sb, ObjMap* map) {
-  sbAppendChar(sb, '{');
-  int printed = 0;
-  for (int i = 0; i < map->capacity; i++) {
-    if (!map->entries[i].key) continue;
-    if (printed > 0) sbAppendN(sb, ", ", 2);
-    sbAppendN(sb, map->entries[i].key->chars, map->entries[i].key->length);
-    sbAppendN(sb, ": ", 2);
-    appendValue(sb, map->entries[i].value);
-    printed++;
-  }
-  sbAppendChar(sb, '}');
-}
-
-static void appendObject(StringBuilder* sb, Obj* obj) {
-  if (!obj) {
-    sbAppendN(sb, "<null-obj>", 10);
-    return;
-  }
-  switch (obj->type) {
-    case OBJ_STRING: {
-      ObjString* string = (ObjString*)obj;
-      sbAppendN(sb, string->chars, string->length);
-      break;
-    }
-    case OBJ_FUNCTION: {
-      ObjFunction* function = (ObjFunction*)obj;
-      if (function->name && function->name->chars) {
-        sbAppendN(sb, "<fun ", 5);
-        sbAppendN(sb, function->name->chars, function->name->length);
-        sbAppendChar(sb, '>');
-      } else {
-        sbAppendN(sb, "<fun>", 5);
-      }
-      break;
-    }
-    case OBJ_NATIVE: {
-      ObjNative* native = (ObjNative*)obj;
-      if (native->name && native->name->chars) {
-        sbAppendN(sb, "<native ", 8);
-        sbAppendN(sb, native->name->chars, native->name->length);
-        sbAppendChar(sb, '>');
-      } else {
-        sbAppendN(sb, "<native>", 8);
-      }
-      break;
-    }
-    case OBJ_ENUM_CTOR: {
-      ObjEnumCtor* ctor = (ObjEnumCtor*)obj;
-      sbAppendN(sb, "<enum ", 6);
-      if (ctor->enumName && ctor->enumName->chars) {
-        sbAppendN(sb, ctor->enumName->chars, ctor->enumName->length);
-      } else {
-        sbAppendN(sb, "enum", 4);
-      }
-      sbAppendChar(sb, '.');
-      if (ctor->variantName && ctor->variantName->chars) {
-        sbAppendN(sb, ctor->variantName->chars, ctor->variantName->length);
-      } else {
-        sbAppendN(sb, "variant", 7);
-      }
-      sbAppendChar(sb, '>');
-      break;
-    }
-    case OBJ_CLASS: {
-      ObjClass* klass = (ObjClass*)obj;
-      sbAppendN(sb, "<class ", 7);
-      sbAppendN(sb, klass->name->chars, klass->name->length);
-      sbAppendChar(sb, '>');
-      break;
-    }
-    case OBJ_INSTANCE: {
-      ObjInstance* instance = (ObjInstance*)obj;
-      sbAppendChar(sb, '<');
-      sbAppendN(sb, instance->klass->name->chars, instance->klass->name->length);
-      sbAppendN(sb, " instance>", 10);
-      break;
-    }
-    case OBJ_ARRAY:
-      appendArray(sb, (ObjArray*)obj);
-      break;
-    case OBJ_MAP:
-      appendMap(sb, (ObjMap*)obj);
-      break;
-    case OBJ_BOUND_METHOD:
-      sbAppendN(sb, "<bound method>", 14);
-      break;
+#if ERKAO_NAN_BOXING
+Value boxedIntToValue(int64_t integer) {
+  ObjBoxedInt* box = NULL;
+  if (gBoxedIntHeap) {
+    box = (ObjBoxedInt*)allocateObject(gBoxedIntHeap, sizeof(ObjBoxedInt), OBJ_BOXED_INT,
+                                       OBJ_GEN_YOUNG);
   }
+  if (!box) return NUMBER_VAL((double)integer);
+  box->value = integer;
+  return VALUE_SIGN_BIT | VALUE_QNAN | VALUE_INT_TAG | (uint64_t)(uintptr_t)box;
 }
-
-static void appendValue(StringBuilder* sb, Value value) {
-  switch (value.type) {
-    case VAL_NULL:
-      sbAppendN(sb, "null", 4);
-      break;
-    case VAL_BOOL:
-      if (AS_BOOL(value)) {
-        sbAppendN(sb, "true", 4);
-      } else {
-        sbAppendN(sb, "false", 5);
-      }
-      break;
-    case VAL_NUMBER: {
-      char buffer[64];
-      int length = snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
-      if (length < 0) length = 0;
-      if (length >= (int)sizeof(buffer)) {
-        length = (int)sizeof(buffer) - 1;
-      }
-      sbAppendN(sb, buffer, length);
+#endif
+
+// Parses decimal text already known to be a valid number. Text without a
+// fraction or exponent that fits in 64 bits is an integer.
+Value numberFromText(const char* text, int length) {
+  char buffer[64];
+  char* copy = length < (int)sizeof(buffer) ? buffer : (char*)malloc((size_t)length + 1);
+  if (!copy) return NUMBER_VAL(0);
+  memcpy(copy, text, (size_t)length);
+  copy[length] = '\0';
+
+  bool integral = length > 0;
+  for (int i = 0; i < length; i++) {
+    if (!isdigit((unsigned char)copy[i]) && !(i == 0 && copy[i] == '-')) {
+      integral = false;
       break;
     }
-    case VAL_OBJ:
-      appendObject(sb, AS_OBJ(value));
-      break;
   }
-}
 
-ObjString* stringifyValue(VM* vm, Value value) {
-  StringBuilder sb;
-  sbInit(&sb);
-  appendValue(&sb, value);
-  if (sb.failed) {
-    free(sb.data);
-    reportOutOfMemory(vm, "Out of memory while stringifying value.");
-    return NULL;
+  Value value;
+  errno = 0;
+  long long integer = integral ? strtoll(copy, NULL, 10) : 0;
+  if (integral && errno != ERANGE) {
+    value = INT_VAL((int64_t)integer);
+  } else {
+    value = NUMBER_VAL(strtod(copy, NULL));
   }
-  return takeStringWithLength(vm, sb.data, sb.length);
+  if (copy != buffer) free(copy);
+  return value;
 }
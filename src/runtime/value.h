@@ -4,6 +4,8 @@
 #include "common.h"
 #include "lexer.h"
 
+#include <math.h>
+
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 typedef struct ObjFunction ObjFunction;
@@ -14,6 +16,18 @@ typedef struct ObjInstance ObjInstance;
 typedef struct ObjArray ObjArray;
 typedef struct ObjMap ObjMap;
 typedef struct ObjBoundMethod ObjBoundMethod;
+typedef struct ObjIterator ObjIterator;
+typedef struct ObjRange ObjRange;
+typedef struct ObjGenerator ObjGenerator;
+typedef struct ObjFiber ObjFiber;
+typedef struct ObjChannel ObjChannel;
+typedef struct ObjWorker ObjWorker;
+typedef struct ObjTypedArray ObjTypedArray;
+typedef struct ObjStringBuilder ObjStringBuilder;
+typedef struct ObjBoxedInt ObjBoxedInt;
+typedef struct WorkerLink WorkerLink;
+typedef struct ObjUpvalue ObjUpvalue;
+typedef struct ObjShape ObjShape;
 typedef struct Chunk Chunk;
 
 typedef struct VM VM;
@@ -24,32 +38,268 @@ typedef enum {
   VAL_NULL,
   VAL_BOOL,
   VAL_NUMBER,
+  VAL_INT,
   VAL_OBJ
 } ValueType;
 
+#ifndef ERKAO_NAN_BOXING
+#define ERKAO_NAN_BOXING 0
+#endif
+
+#if ERKAO_NAN_BOXING
+
+// Values are IEEE doubles. Anything else lives in the payload of a quiet NaN:
+// object pointers set the sign bit, null/false/true use small tags, and
+// integers set VALUE_INT_TAG above a 48-bit two's complement payload. Wider
+// integers set both, over a pointer to the ObjBoxedInt that holds them.
+typedef uint64_t Value;
+
+#define VALUE_SIGN_BIT ((uint64_t)0x8000000000000000)
+#define VALUE_QNAN ((uint64_t)0x7ffc000000000000)
+#define VALUE_TAG_NULL 1
+#define VALUE_TAG_FALSE 2
+#define VALUE_TAG_TRUE 3
+// UNSET is NULL plus one flag bit, so IS_NULL accepts both with one mask, the
+// way the struct layout files UNSET under VAL_NULL.
+#define VALUE_TAG_UNSET_FLAG 4
+#define VALUE_TAG_UNSET (VALUE_TAG_NULL | VALUE_TAG_UNSET_FLAG)
+#define VALUE_CANONICAL_NAN ((uint64_t)0x7ff8000000000000)
+#define VALUE_INT_TAG ((uint64_t)0x0002000000000000)
+#define VALUE_INT_PAYLOAD ((uint64_t)0x0000ffffffffffff)
+#define VALUE_INT_SIGN ((int64_t)0x0000800000000000)
+
+#define VALUE_NULL_BITS (VALUE_QNAN | VALUE_TAG_NULL)
+#define VALUE_FALSE_BITS (VALUE_QNAN | VALUE_TAG_FALSE)
+#define VALUE_TRUE_BITS (VALUE_QNAN | VALUE_TAG_TRUE)
+
+static inline Value numberToValue(double number) {
+  Value value;
+  memcpy(&value, &number, sizeof(Value));
+  // A NaN whose payload overlaps the tag bits would decode as a non-number.
+  if ((value & VALUE_QNAN) == VALUE_QNAN) {
+    value = (value & VALUE_SIGN_BIT) | VALUE_CANONICAL_NAN;
+  }
+  return value;
+}
+
+static inline double valueToNumber(Value value) {
+  double number;
+  memcpy(&number, &value, sizeof(double));
+  return number;
+}
+
+// Integers outside the 48-bit payload live in an ObjBoxedInt. Its pointer
+// takes the payload and the sign bit marks the value as boxed.
+Value boxedIntToValue(int64_t integer);
+static inline int64_t boxedIntValue(Value value);
+
+static inline Value intToValue(int64_t integer) {
+  if (integer < -VALUE_INT_SIGN || integer >= VALUE_INT_SIGN) {
+    return boxedIntToValue(integer);
+  }
+  return VALUE_QNAN | VALUE_INT_TAG | ((uint64_t)integer & VALUE_INT_PAYLOAD);
+}
+
+static inline int64_t valueToInt(Value value) {
+  if (value & VALUE_SIGN_BIT) return boxedIntValue(value);
+  int64_t integer = (int64_t)(value & VALUE_INT_PAYLOAD);
+  return (integer & VALUE_INT_SIGN) ? integer - 2 * VALUE_INT_SIGN : integer;
+}
+
+#define BOOL_VAL(value) ((value) ? VALUE_TRUE_BITS : VALUE_FALSE_BITS)
+#define NUMBER_VAL(value) numberToValue(value)
+#define INT_VAL(value) intToValue(value)
+#define NULL_VAL ((Value)VALUE_NULL_BITS)
+// Fills a frame slot whose `let` or `fun` has not run yet. Only upvalue
+// reads and writes can see it, and they fall back to the name instead.
+#define UNSET_VAL ((Value)(VALUE_QNAN | VALUE_TAG_UNSET))
+#define OBJ_VAL(object) \
+  ((Value)(VALUE_SIGN_BIT | VALUE_QNAN | (uint64_t)(uintptr_t)(object)))
+
+#define IS_BOOL(value) (((value) | 1) == VALUE_TRUE_BITS)
+#define IS_DOUBLE(value) (((value) & VALUE_QNAN) != VALUE_QNAN)
+#define IS_INT(value) (((value) & (VALUE_QNAN | VALUE_INT_TAG)) == (VALUE_QNAN | VALUE_INT_TAG))
+#define IS_BOXED_INT(value) \
+  (((value) & (VALUE_SIGN_BIT | VALUE_QNAN | VALUE_INT_TAG)) == \
+   (VALUE_SIGN_BIT | VALUE_QNAN | VALUE_INT_TAG))
+#define IS_NULL(value) (((value) & ~(uint64_t)VALUE_TAG_UNSET_FLAG) == VALUE_NULL_BITS)
+#define IS_UNSET(value) ((value) == UNSET_VAL)
+#define IS_OBJ(value) \
+  (((value) & (VALUE_SIGN_BIT | VALUE_QNAN | VALUE_INT_TAG)) == (VALUE_SIGN_BIT | VALUE_QNAN))
+
+#define AS_BOOL(value) ((value) == VALUE_TRUE_BITS)
+#define AS_DOUBLE(value) valueToNumber(value)
+#define AS_INT(value) valueToInt(value)
+#define AS_OBJ(value) \
+  ((Obj*)(uintptr_t)((value) & ~(VALUE_SIGN_BIT | VALUE_QNAN)))
+#define AS_BOXED_INT(value) ((ObjBoxedInt*)(uintptr_t)((value) & VALUE_INT_PAYLOAD))
+
+#else
+
 typedef struct {
   ValueType type;
   union {
     bool boolean;
     double number;
+    int64_t integer;
     Obj* obj;
   } as;
 } Value;
 
 #define BOOL_VAL(value) ((Value){ VAL_BOOL, { .boolean = (value) } })
 #define NUMBER_VAL(value) ((Value){ VAL_NUMBER, { .number = (value) } })
+#define INT_VAL(value) ((Value){ VAL_INT, { .integer = (value) } })
 #define NULL_VAL ((Value){ VAL_NULL, { .number = 0 } })
+// A null that only IS_UNSET tells apart, as in the NaN-boxed layout.
+#define UNSET_VAL ((Value){ VAL_NULL, { .integer = 1 } })
 #define OBJ_VAL(object) ((Value){ VAL_OBJ, { .obj = (Obj*)(object) } })
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
-#define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_DOUBLE(value) ((value).type == VAL_NUMBER)
+#define IS_INT(value) ((value).type == VAL_INT)
 #define IS_NULL(value) ((value).type == VAL_NULL)
+#define IS_UNSET(value) ((value).type == VAL_NULL && (value).as.integer == 1)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
+// Every int64 fits this layout, so no integer is boxed.
+#define IS_BOXED_INT(value) ((void)(value), false)
+#define AS_BOXED_INT(value) ((void)(value), (ObjBoxedInt*)NULL)
 
 #define AS_BOOL(value) ((value).as.boolean)
-#define AS_NUMBER(value) ((value).as.number)
+#define AS_DOUBLE(value) ((value).as.number)
+#define AS_INT(value) ((value).as.integer)
 #define AS_OBJ(value) ((value).as.obj)
 
+#endif
+
+// A number is either an exact integer or a double. AS_NUMBER reads both as a
+// double, so code that only needs the magnitude never checks which it is.
+static inline bool valueIsNumber(Value value) {
+  return IS_DOUBLE(value) || IS_INT(value);
+}
+
+static inline double valueAsNumber(Value value) {
+  return IS_INT(value) ? (double)AS_INT(value) : AS_DOUBLE(value);
+}
+
+#define IS_NUMBER(value) valueIsNumber(value)
+#define AS_NUMBER(value) valueAsNumber(value)
+
+static inline ValueType valueType(Value value) {
+#if ERKAO_NAN_BOXING
+  if (IS_DOUBLE(value)) return VAL_NUMBER;
+  if (IS_INT(value)) return VAL_INT;
+  if (IS_OBJ(value)) return VAL_OBJ;
+  if (IS_NULL(value)) return VAL_NULL;
+  return VAL_BOOL;
+#else
+  return value.type;
+#endif
+}
+
+// Integer arithmetic stays exact. A result that overflows int64, a division
+// that leaves a remainder and any mix with a double are computed as doubles.
+// Every operand must already satisfy IS_NUMBER.
+#if defined(__GNUC__) || defined(__clang__)
+#define intAddOverflows(a, b, out) __builtin_add_overflow(a, b, out)
+#define intSubOverflows(a, b, out) __builtin_sub_overflow(a, b, out)
+#define intMulOverflows(a, b, out) __builtin_mul_overflow(a, b, out)
+#else
+static inline bool intAddOverflows(int64_t a, int64_t b, int64_t* out) {
+  if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) return true;
+  *out = a + b;
+  return false;
+}
+
+static inline bool intSubOverflows(int64_t a, int64_t b, int64_t* out) {
+  if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) return true;
+  *out = a - b;
+  return false;
+}
+
+static inline bool intMulOverflows(int64_t a, int64_t b, int64_t* out) {
+  if (a == 0 || b == 0) {
+    *out = 0;
+    return false;
+  }
+  if ((a == -1 && b == INT64_MIN) || (b == -1 && a == INT64_MIN)) return true;
+  int64_t result = (int64_t)((uint64_t)a * (uint64_t)b);
+  if (result / b != a) return true;
+  *out = result;
+  return false;
+}
+#endif
+
+static inline Value numberAdd(Value a, Value b) {
+  int64_t result;
+  if (IS_INT(a) && IS_INT(b) && !intAddOverflows(AS_INT(a), AS_INT(b), &result)) {
+    return INT_VAL(result);
+  }
+  return NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+}
+
+static inline Value numberSubtract(Value a, Value b) {
+  int64_t result;
+  if (IS_INT(a) && IS_INT(b) && !intSubOverflows(AS_INT(a), AS_INT(b), &result)) {
+    return INT_VAL(result);
+  }
+  return NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+}
+
+static inline Value numberMultiply(Value a, Value b) {
+  int64_t result;
+  if (IS_INT(a) && IS_INT(b) && !intMulOverflows(AS_INT(a), AS_INT(b), &result)) {
+    return INT_VAL(result);
+  }
+  return NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+}
+
+static inline Value numberDivide(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) {
+    int64_t x = AS_INT(a);
+    int64_t y = AS_INT(b);
+    if (y != 0 && !(y == -1 && x == INT64_MIN) && x % y == 0) return INT_VAL(x / y);
+  }
+  return NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b));
+}
+
+// Truncating integer division, the quotient that pairs with `%`.
+static inline Value numberIntDivide(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) {
+    int64_t x = AS_INT(a);
+    int64_t y = AS_INT(b);
+    if (y != 0 && !(y == -1 && x == INT64_MIN)) return INT_VAL(x / y);
+  }
+  double quotient = AS_NUMBER(a) / AS_NUMBER(b);
+  return NUMBER_VAL(quotient < 0 ? ceil(quotient) : floor(quotient));
+}
+
+static inline Value numberModulo(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b) && AS_INT(b) != 0) {
+    return INT_VAL(AS_INT(b) == -1 ? 0 : AS_INT(a) % AS_INT(b));
+  }
+  return NUMBER_VAL(fmod(AS_NUMBER(a), AS_NUMBER(b)));
+}
+
+static inline Value numberNegate(Value a) {
+  if (IS_INT(a) && AS_INT(a) != INT64_MIN) return INT_VAL(-AS_INT(a));
+  return NUMBER_VAL(-AS_NUMBER(a));
+}
+
+static inline bool numberLess(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) return AS_INT(a) < AS_INT(b);
+  return AS_NUMBER(a) < AS_NUMBER(b);
+}
+
+static inline bool numberLessEqual(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) return AS_INT(a) <= AS_INT(b);
+  return AS_NUMBER(a) <= AS_NUMBER(b);
+}
+
+static inline bool numbersEqual(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) return AS_INT(a) == AS_INT(b);
+  return AS_NUMBER(a) == AS_NUMBER(b);
+}
+
 typedef Value (*NativeFn)(VM* vm, int argc, Value* args);
 
 typedef enum {
@@ -61,7 +311,18 @@ typedef enum {
   OBJ_INSTANCE,
   OBJ_ARRAY,
   OBJ_MAP,
-  OBJ_BOUND_METHOD
+  OBJ_BOUND_METHOD,
+  OBJ_UPVALUE,
+  OBJ_SHAPE,
+  OBJ_ITERATOR,
+  OBJ_RANGE,
+  OBJ_GENERATOR,
+  OBJ_FIBER,
+  OBJ_CHANNEL,
+  OBJ_WORKER,
+  OBJ_TYPED_ARRAY,
+  OBJ_STRING_BUILDER,
+  OBJ_BOXED_INT
 } ObjType;
 
 typedef enum {
@@ -79,23 +340,91 @@ struct Obj {
   size_t size;
 };
 
+// Frees a borrowed payload once its string is collected.
+typedef void (*StringReleaseFn)(void* context, char* chars, int length);
+
+// The bytes normally follow the header in the same allocation and `chars`
+// points at `bytes`. An external string points `chars` at a payload it does
+// not hold inline: a large buffer adopted by takeStringWithLength, or one
+// borrowed through newExternalString. Either way `chars[length]` is NUL.
+//
+// A rope is a pending concatenation of two strings. Its `chars` is NULL until
+// stringFlatten builds the bytes, after which it is an external string like
+// any other.
+//
+// A view points `chars` into a longer parent string and keeps the parent
+// alive, so its bytes need not end in NUL. stringChars() copies them out the
+// first time a caller needs a C string; stringData() never copies. Read
+// `chars` through one of the two unless the string is known to be flat and
+// owned, like a map key or a name.
+//
+// `hash` is 0 until something needs it. Only short strings are hashed and
+// interned when they are created; read the hash through stringHash().
 struct ObjString {
   Obj obj;
   int length;
-  char* chars;
   uint32_t hash;
+  char* chars;
+  char bytes[];
 };
 
+char* stringFlatten(ObjString* string);
+char* stringTerminate(ObjString* string);
+uint32_t stringHash(ObjString* string);
+
+static inline bool stringIsRope(const ObjString* string) {
+  return string->chars == NULL;
+}
+
+// The bytes followed by a NUL.
+static inline char* stringChars(ObjString* string) {
+  return string->chars == string->bytes ? string->chars : stringTerminate(string);
+}
+
+// The bytes, for callers that stop at `length` themselves.
+static inline char* stringData(ObjString* string) {
+  return string->chars ? string->chars : stringFlatten(string);
+}
+
+// Strings up to this many bytes are interned when they are created. Longer
+// ones are interned only by stringIntern(), which the compiler uses for
+// constants. ERKAO_INTERN_MAX overrides it.
+#define STRING_INTERN_MAX_LENGTH 64
+
+// The intern table. It is not a GC object and holds its strings weakly: the
+// collector drops entries for strings it is about to free, so an interned
+// string lives only as long as something else references it.
+typedef struct {
+  ObjString** entries;
+  int count;
+  int tombstones;
+  int capacity;
+  int maxLength;
+} StringTable;
+
+typedef struct {
+  uint8_t index;
+  bool isLocal;
+  ObjString* name;
+} UpvalueDesc;
+
 struct ObjFunction {
   Obj obj;
   int arity;
   int minArity;
   bool isInitializer;
+  bool isGenerator;
+  bool paramsInSlots;
+  int slotCount;
+  int upvalueCount;
   ObjString* name;
   Chunk* chunk;
   ObjString** params;
   Env* closure;
   Program* program;
+  ObjFunction* proto;
+  UpvalueDesc* upvalueDescs;
+  ObjUpvalue** upvalues;
 };
 
 struct ObjNative {
@@ -133,11 +462,39 @@ struct ObjClass {
   ObjMap* structFields;
   ObjMap* structDefaults;
   ObjMap* structReadonly;
+  ObjShape* rootShape;
+  int slotHint;
+};
+
+// Instances of one class share a tree of shapes. Each shape adds one field to
+// its parent and records the slot that field lives in. A tree holds at most
+// SHAPE_MAX_TREE shapes, so objects used as dictionaries with dynamic keys do
+// not grow it without bound.
+#define SHAPE_MAX_FIELDS 64
+#define SHAPE_MAX_TREE 1024
+
+struct ObjShape {
+  Obj obj;
+  ObjShape* parent;
+  ObjString* name;
+  int slot;
+  int fieldCount;
+  ObjShape** transitions;
+  int transitionCount;
+  int transitionCapacity;
+  // The number of shapes below this one; only kept up to date on the root.
+  int treeSize;
 };
 
+// Class instances keep their fields in `slots`, laid out by `shape`. Modules
+// and instances that outgrow SHAPE_MAX_FIELDS or SHAPE_MAX_TREE have no shape
+// and use `fields`.
 struct ObjInstance {
   Obj obj;
   ObjClass* klass;
+  ObjShape* shape;
+  Value* slots;
+  int slotCapacity;
   ObjMap* fields;
 };
 
@@ -155,14 +512,281 @@ struct ObjBoundMethod {
   ObjFunction* method;
 };
 
+struct ObjUpvalue {
+  Obj obj;
+  Value* location;
+  Value closed;
+  ObjUpvalue* nextOpen;
+};
+
+// Inclusive numeric range built by `a..b` and range(). Immutable; iteration
+// keeps its own cursor, so a range can be looped over any number of times.
+struct ObjRange {
+  Obj obj;
+  double start;
+  double end;
+  double step;
+};
+
+typedef enum {
+  TYPED_F64,
+  TYPED_I32,
+  TYPED_U8
+} TypedKind;
+
+// Fixed-length numbers in contiguous native storage. An owner keeps its
+// elements inline after the struct; a view from typed.slice() points into
+// its owner's storage and keeps the owner alive instead of copying.
+struct ObjTypedArray {
+  Obj obj;
+  TypedKind kind;
+  int length;
+  uint8_t* data;
+  ObjTypedArray* owner;
+};
+
+// Stores convert like C: i32 and u8 keep the low bits of the truncated
+// number, so 256 stored in a u8 array reads back as 0.
+static inline int64_t typedTruncate(Value value) {
+  if (IS_INT(value)) return AS_INT(value);
+  double number = AS_DOUBLE(value);
+  if (!(number > -9.2e18 && number < 9.2e18)) return 0;
+  return (int64_t)number;
+}
+
+static inline Value typedArrayGet(const ObjTypedArray* array, int index) {
+  switch (array->kind) {
+    case TYPED_F64: return NUMBER_VAL(((const double*)array->data)[index]);
+    case TYPED_I32: return INT_VAL(((const int32_t*)array->data)[index]);
+    case TYPED_U8: break;
+  }
+  return INT_VAL(array->data[index]);
+}
+
+// The caller checks the bounds and that `value` is a number.
+static inline void typedArraySet(ObjTypedArray* array, int index, Value value) {
+  switch (array->kind) {
+    case TYPED_F64:
+      ((double*)array->data)[index] = AS_NUMBER(value);
+      return;
+    case TYPED_I32:
+      ((int32_t*)array->data)[index] = (int32_t)(uint32_t)typedTruncate(value);
+      return;
+    case TYPED_U8:
+      array->data[index] = (uint8_t)typedTruncate(value);
+      return;
+  }
+}
+
+// Bytes for str.builder(), appended in place. `ends` records where each
+// append stopped so build() can put a separator between the pieces.
+struct ObjStringBuilder {
+  Obj obj;
+  VM* vm;
+  char* data;
+  int length;
+  int capacity;
+  int* ends;
+  int count;
+  int endsCapacity;
+};
+
+// An integer too wide for the NaN-boxed payload. Scripts never see the box:
+// IS_OBJ is false for it and AS_INT reads through it.
+struct ObjBoxedInt {
+  Obj obj;
+  int64_t value;
+};
+
+#if ERKAO_NAN_BOXING
+static inline int64_t boxedIntValue(Value value) {
+  return AS_BOXED_INT(value)->value;
+}
+#endif
+
+// The heap object a value keeps alive, including an integer's box.
+static inline Obj* valueHeapObject(Value value) {
+  if (IS_OBJ(value)) return AS_OBJ(value);
+  if (IS_BOXED_INT(value)) return &AS_BOXED_INT(value)->obj;
+  return NULL;
+}
+
+typedef enum {
+  ITER_ARRAY,
+  ITER_TYPED,
+  ITER_MAP,
+  ITER_RANGE,
+  ITER_GENERATOR,
+  ITER_PROTOCOL
+} IterKind;
+
+// Cursor for one foreach loop. Arrays, typed arrays, maps and ranges advance
+// in place; any other iterable is driven through the iter()/next() protocol
+// in `source`.
+struct ObjIterator {
+  Obj obj;
+  IterKind kind;
+  bool withKey;
+  Value source;
+  ObjArray* keys;
+  ObjString* cursorName;
+  int index;
+  double current;
+  double end;
+  double step;
+};
+
+typedef enum {
+  GEN_SUSPENDED,
+  GEN_RUNNING,
+  GEN_DONE
+} GeneratorState;
+
+// try handler of a suspended generator frame; stackOffset is relative to the
+// frame's first slot.
+typedef struct {
+  uint8_t* handler;
+  int stackOffset;
+  Env* env;
+  int scopeDepth;
+} GeneratorTry;
+
+typedef struct {
+  int scopeDepth;
+  int argCount;
+  Value callee;
+  Value* args;
+} GeneratorDefer;
+
+// A call to a function containing `yield`. While suspended, the frame's stack
+// segment, try handlers, defers and captured slots live here; each resume
+// copies them back onto the VM stack and continues from `ip`. Captured slots
+// are closed on suspend and re-opened on resume, so closures never point into
+// `stack`.
+struct ObjGenerator {
+  Obj obj;
+  GeneratorState state;
+  ObjFunction* function;
+  Value receiver;
+  uint8_t* ip;
+  int argCount;
+  int scopeDepth;
+  int index;
+  Env* env;
+  Value* stack;
+  int stackCount;
+  int stackCapacity;
+  ObjUpvalue** upvalues;
+  int* upvalueSlots;
+  int upvalueCount;
+  int upvalueCapacity;
+  GeneratorTry* tries;
+  int tryCount;
+  int tryCapacity;
+  GeneratorDefer* defers;
+  int deferCount;
+  int deferCapacity;
+  // Set while a foreach runs the body in its own dispatch loop: where the
+  // loop exits once the body finishes, and whether each step pushes a key.
+  uint8_t* loopExit;
+  bool loopWithKey;
+};
+
+// A task parked in recv() or select(). `index` is its position in the select
+// list, or -1 for a plain recv().
+typedef struct {
+  ObjFiber* fiber;
+  int index;
+} ChannelReceiver;
+
+// A task parked in send() on a full channel, with the value it is sending.
+typedef struct {
+  ObjFiber* fiber;
+  Value value;
+} ChannelSender;
+
+// A FIFO of values between tasks. Buffered values sit in a ring of
+// `capacity` slots starting at `head`. `limit` bounds the number of buffered
+// values, or is 0 when the channel only grows. Tasks blocked on the channel
+// wait in `receivers` or `senders`, oldest first.
+struct ObjChannel {
+  Obj obj;
+  Value* items;
+  int head;
+  int count;
+  int capacity;
+  int limit;
+  bool closed;
+  ChannelReceiver* receivers;
+  int receiverCount;
+  int receiverCapacity;
+  ChannelSender* senders;
+  int senderCount;
+  int senderCapacity;
+};
+
+// A handle on the link between two isolates. The VM that spawned a worker
+// holds a `child` handle; inside the worker, worker.parent() returns one on
+// the same link with `child` false.
+struct ObjWorker {
+  Obj obj;
+  WorkerLink* link;
+  bool child;
+};
+
 ObjString* copyString(VM* vm, const char* chars);
 ObjString* copyStringWithLength(VM* vm, const char* chars, int length);
+// Buffers handed to takeStringWithLength below this size are copied inline
+// so the string is one allocation; larger ones are adopted as they are.
+#define STRING_EXTERNAL_MIN_BYTES 4096
 ObjString* takeStringWithLength(VM* vm, char* chars, int length);
+// Identifiers are interned whatever their length.
 ObjString* stringFromToken(VM* vm, Token token);
+// Returns the interned string equal to `string`, interning it if there is
+// none yet.
+ObjString* stringIntern(VM* vm, ObjString* string);
+// A string whose `length` bytes the caller writes in place. It must not be
+// used until finishString has hashed and interned it; the result may be an
+// existing equal string instead.
+ObjString* newStringBuffer(VM* vm, int length);
+ObjString* finishString(VM* vm, ObjString* string);
+// Wraps a NUL-terminated payload without copying it. `release` runs when the
+// string is collected, or at once if an equal string already exists; NULL
+// means the payload came from malloc and is freed.
+ObjString* newExternalString(VM* vm, char* chars, int length, StringReleaseFn release,
+                             void* context);
+void releaseExternalString(ObjString* string);
+// Joins two strings without copying them when the result is long enough for
+// copying to matter.
+ObjString* concatStrings(VM* vm, ObjString* a, ObjString* b);
+void stringRopeChildren(ObjString* rope, ObjString** left, ObjString** right);
+// `length` bytes of `parent` from `start`, sharing its buffer. Substrings
+// short enough to be interned are copied instead.
+ObjString* newStringView(VM* vm, ObjString* parent, int start, int length);
+ObjString* stringViewParent(ObjString* string);
+// Gives a view its own copy of its bytes and lets go of the parent. Map keys
+// and field names are detached when they are stored.
+void stringDetach(ObjString* string);
+// The parent the collector must keep alive for a view, or NULL. A view much
+// shorter than its parent is detached instead, so a few fields cut from a
+// large input do not pin all of it.
+ObjString* stringViewTrace(ObjString* string);
+// Visits the bytes of a string in order, piece by piece, without flattening
+// a rope. Stops early and returns false when `visit` does.
+typedef bool (*StringPieceFn)(void* context, const char* chars, int length);
+bool stringForEachPiece(ObjString* string, StringPieceFn visit, void* context);
+void initStringTable(StringTable* table);
+void freeStringTable(StringTable* table);
+void stringTableRemove(StringTable* table, ObjString* string);
+void stringTableRemoveUnmarked(StringTable* table);
 
 ObjFunction* newFunction(VM* vm, ObjString* name, int arity, int minArity,
                          bool isInitializer, ObjString** params, Chunk* chunk,
                          Env* closure, Program* program);
+// The compiler allocates a function before compiling its body, so constants
+// it adds afterwards skip the write barrier. It calls this once the chunk is
+// complete.
+void functionFinishChunk(VM* vm, ObjFunction* function);
 ObjFunction* cloneFunction(VM* vm, ObjFunction* proto, Env* closure);
 ObjNative* newNative(VM* vm, NativeFn function, int arity, ObjString* name);
 ObjEnumCtor* newEnumCtor(VM* vm, ObjString* enumName, ObjString* variantName, int arity);
@@ -175,6 +799,36 @@ ObjArray* newArrayWithCapacity(VM* vm, int capacity);
 ObjMap* newMap(VM* vm);
 ObjMap* newMapWithCapacity(VM* vm, int capacity);
 ObjBoundMethod* newBoundMethod(VM* vm, Value receiver, ObjFunction* method);
+ObjUpvalue* newUpvalue(VM* vm, Value* slot);
+ObjIterator* newIterator(VM* vm, IterKind kind, Value source, bool withKey);
+ObjRange* newRange(VM* vm, double start, double end);
+int rangeLength(const ObjRange* range);
+Value rangeElement(double number);
+ObjGenerator* newGenerator(VM* vm, ObjFunction* function);
+void generatorRelease(ObjGenerator* generator);
+ObjChannel* newChannel(VM* vm, int limit);
+bool channelPush(VM* vm, ObjChannel* channel, Value value);
+Value channelShift(ObjChannel* channel);
+ObjWorker* newWorker(VM* vm, WorkerLink* link, bool child);
+ObjTypedArray* newTypedArray(VM* vm, TypedKind kind, int length);
+ObjTypedArray* newTypedView(VM* vm, ObjTypedArray* source, int start, int length);
+size_t typedKindSize(TypedKind kind);
+const char* typedKindName(TypedKind kind);
+ObjStringBuilder* newStringBuilder(VM* vm);
+// Appends strings piece by piece and formats any other value the way
+// printing does, without creating a string for it.
+bool stringBuilderAppend(ObjStringBuilder* builder, Value value);
+bool stringBuilderAppendChar(ObjStringBuilder* builder, uint32_t codePoint);
+// Returns the contents and leaves the builder empty. Without a separator the
+// buffer itself becomes the string.
+ObjString* stringBuilderTake(VM* vm, ObjStringBuilder* builder, ObjString* separator);
+void stringBuilderRelease(ObjStringBuilder* builder);
+
+int shapeFindSlot(ObjShape* shape, ObjString* name);
+ObjShape* shapeTransition(VM* vm, ObjShape* shape, ObjString* name);
+bool instanceReserveSlots(VM* vm, ObjInstance* instance, int count);
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* out);
+bool instanceSetField(VM* vm, ObjInstance* instance, ObjString* name, Value value);
 
 void arrayWrite(ObjArray* array, Value value);
 bool arrayGet(ObjArray* array, int index, Value* out);
@@ -192,6 +846,8 @@ int mapCount(ObjMap* map);
 bool isObjType(Value value, ObjType type);
 const char* valueTypeName(Value value);
 bool valuesEqual(Value a, Value b);
+Value numberFromText(const char* text, int length);
+void setBoxedIntHeap(VM* vm, bool active);
 void printValue(Value value);
 ObjString* stringifyValue(VM* vm, Value value);
 
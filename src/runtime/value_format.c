@@ -0,0 +1,543 @@
+#include "value.h"
+#include "interpreter_internal.h"
+#include "gc.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void printObject(Value value);
+
+void printValue(Value value) {
+  switch (valueType(value)) {
+    case VAL_NULL:
+      printf("null");
+      break;
+    case VAL_BOOL:
+      printf(AS_BOOL(value) ? "true" : "false");
+      break;
+    case VAL_NUMBER:
+      printf("%g", AS_NUMBER(value));
+      break;
+    case VAL_INT:
+      printf("%" PRId64, AS_INT(value));
+      break;
+    case VAL_OBJ:
+      if (!AS_OBJ(value)) {
+        printf("<null-obj>");
+      } else {
+        printObject(value);
+      }
+      break;
+  }
+}
+
+static void printArray(ObjArray* array) {
+  printf("[");
+  for (int i = 0; i < array->count; i++) {
+    if (i > 0) printf(", ");
+    printValue(array->items[i]);
+  }
+  printf("]");
+}
+
+static void printMap(ObjMap* map) {
+  printf("{");
+  int printed = 0;
+  for (int i = 0; i < map->capacity; i++) {
+    if (!map->entries[i].key) continue;
+    if (printed > 0) printf(", ");
+    printf("%s: ", map->entries[i].key->chars);
+    printValue(map->entries[i].value);
+    printed++;
+  }
+  printf("}");
+}
+
+static void printTypedArray(ObjTypedArray* array) {
+  printf("%s[", typedKindName(array->kind));
+  for (int i = 0; i < array->length; i++) {
+    if (i > 0) printf(", ");
+    printValue(typedArrayGet(array, i));
+  }
+  printf("]");
+}
+
+static bool printPiece(void* context, const char* chars, int length) {
+  (void)context;
+  fwrite(chars, 1, (size_t)length, stdout);
+  return true;
+}
+
+static void printObject(Value value) {
+  switch (AS_OBJ(value)->type) {
+    case OBJ_STRING:
+      stringForEachPiece((ObjString*)AS_OBJ(value), printPiece, NULL);
+      break;
+    case OBJ_FUNCTION: {
+      ObjFunction* function = (ObjFunction*)AS_OBJ(value);
+      if (function->name) {
+        printf("<fun %s>", function->name->chars);
+      } else {
+        printf("<fun>");
+      }
+      break;
+    }
+    case OBJ_NATIVE: {
+      ObjNative* native = (ObjNative*)AS_OBJ(value);
+      if (native->name) {
+        printf("<native %s>", native->name->chars);
+      } else {
+        printf("<native>");
+      }
+      break;
+    }
+    case OBJ_ENUM_CTOR: {
+      ObjEnumCtor* ctor = (ObjEnumCtor*)AS_OBJ(value);
+      const char* enumName = ctor->enumName ? ctor->enumName->chars : "enum";
+      const char* variantName = ctor->variantName ? ctor->variantName->chars : "variant";
+      printf("<enum %s.%s>", enumName, variantName);
+      break;
+    }
+    case OBJ_CLASS: {
+      ObjClass* klass = (ObjClass*)AS_OBJ(value);
+      printf("<class %s>", klass->name->chars);
+      break;
+    }
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)AS_OBJ(value);
+      printf("<%s instance>", instance->klass->name->chars);
+      break;
+    }
+    case OBJ_ARRAY:
+      printArray((ObjArray*)AS_OBJ(value));
+      break;
+    case OBJ_MAP:
+      printMap((ObjMap*)AS_OBJ(value));
+      break;
+    case OBJ_BOUND_METHOD:
+      printf("<bound method>");
+      break;
+    case OBJ_UPVALUE:
+      printf("<upvalue>");
+      break;
+    case OBJ_SHAPE:
+      printf("<shape>");
+      break;
+    case OBJ_ITERATOR:
+      printf("<iterator>");
+      break;
+    case OBJ_GENERATOR:
+      printf("<generator>");
+      break;
+    case OBJ_FIBER:
+      printf("<task>");
+      break;
+    case OBJ_CHANNEL:
+      printf("<channel>");
+      break;
+    case OBJ_WORKER:
+      printf("<worker>");
+      break;
+    case OBJ_TYPED_ARRAY:
+      printTypedArray((ObjTypedArray*)AS_OBJ(value));
+      break;
+    case OBJ_STRING_BUILDER:
+      printf("<stringbuilder>");
+      break;
+    case OBJ_BOXED_INT:
+      printf("%" PRId64, ((ObjBoxedInt*)AS_OBJ(value))->value);
+      break;
+    case OBJ_RANGE: {
+      ObjRange* range = (ObjRange*)AS_OBJ(value);
+      printf("%g..%g", range->start, range->end);
+      break;
+    }
+  }
+}
+
+typedef struct {
+  char* data;
+  int length;
+  int capacity;
+  bool failed;
+} StringBuilder;
+
+static void sbInit(StringBuilder* sb) {
+  sb->data = NULL;
+  sb->length = 0;
+  sb->capacity = 0;
+  sb->failed = false;
+}
+
+static void sbEnsure(StringBuilder* sb, int needed) {
+  if (sb->failed || sb->capacity >= needed) return;
+  int newCap = sb->capacity == 0 ? 64 : sb->capacity;
+  while (newCap < needed) {
+    if (newCap > INT_MAX / 2) {
+      newCap = needed;
+      break;
+    }
+    newCap *= 2;
+  }
+  char* next = (char*)realloc(sb->data, (size_t)newCap);
+  if (!next) {
+    sb->failed = true;
+    return;
+  }
+  sb->data = next;
+  sb->capacity = newCap;
+}
+
+static void sbAppendN(StringBuilder* sb, const char* text, int length) {
+  if (sb->failed || length <= 0) return;
+  if (length > INT_MAX - 1 - sb->length) {
+    sb->failed = true;
+    return;
+  }
+  sbEnsure(sb, sb->length + length + 1);
+  if (sb->failed) return;
+  memcpy(sb->data + sb->length, text, (size_t)length);
+  sb->length += length;
+  sb->data[sb->length] = '\0';
+}
+
+static bool sbAppendPiece(void* context, const char* chars, int length) {
+  sbAppendN((StringBuilder*)context, chars, length);
+  return true;
+}
+
+static void sbAppendChar(StringBuilder* sb, char c) {
+  if (sb->failed) return;
+  sbEnsure(sb, sb->length + 2);
+  if (sb->failed) return;
+  sb->data[sb->length++] = c;
+  sb->data[sb->length] = '\0';
+}
+
+static void appendValue(StringBuilder* sb, Value value);
+
+static void appendArray(StringBuilder* sb, ObjArray* array) {
+  sbAppendChar(sb, '[');
+  for (int i = 0; i < array->count; i++) {
+    if (i > 0) sbAppendN(sb, ", ", 2);
+    appendValue(sb, array->items[i]);
+  }
+  sbAppendChar(sb, ']');
+}
+
+static void appendTypedArray(StringBuilder* sb, ObjTypedArray* array) {
+  const char* kind = typedKindName(array->kind);
+  sbAppendN(sb, kind, (int)strlen(kind));
+  sbAppendChar(sb, '[');
+  for (int i = 0; i < array->length; i++) {
+    if (i > 0) sbAppendN(sb, ", ", 2);
+    appendValue(sb, typedArrayGet(array, i));
+  }
+  sbAppendChar(sb, ']');
+}
+
+static void appendMap(StringBuilder* sb, ObjMap* map) {
+  sbAppendChar(sb, '{');
+  int printed = 0;
+  for (int i = 0; i < map->capacity; i++) {
+    if (!map->entries[i].key) continue;
+    if (printed > 0) sbAppendN(sb, ", ", 2);
+    sbAppendN(sb, map->entries[i].key->chars, map->entries[i].key->length);
+    sbAppendN(sb, ": ", 2);
+    appendValue(sb, map->entries[i].value);
+    printed++;
+  }
+  sbAppendChar(sb, '}');
+}
+
+static void appendObject(StringBuilder* sb, Obj* obj) {
+  if (!obj) {
+    sbAppendN(sb, "<null-obj>", 10);
+    return;
+  }
+  switch (obj->type) {
+    case OBJ_STRING: {
+      stringForEachPiece((ObjString*)obj, sbAppendPiece, sb);
+      break;
+    }
+    case OBJ_FUNCTION: {
+      ObjFunction* function = (ObjFunction*)obj;
+      if (function->name && function->name->chars) {
+        sbAppendN(sb, "<fun ", 5);
+        sbAppendN(sb, function->name->chars, function->name->length);
+        sbAppendChar(sb, '>');
+      } else {
+        sbAppendN(sb, "<fun>", 5);
+      }
+      break;
+    }
+    case OBJ_NATIVE: {
+      ObjNative* native = (ObjNative*)obj;
+      if (native->name && native->name->chars) {
+        sbAppendN(sb, "<native ", 8);
+        sbAppendN(sb, native->name->chars, native->name->length);
+        sbAppendChar(sb, '>');
+      } else {
+        sbAppendN(sb, "<native>", 8);
+      }
+      break;
+    }
+    case OBJ_ENUM_CTOR: {
+      ObjEnumCtor* ctor = (ObjEnumCtor*)obj;
+      sbAppendN(sb, "<enum ", 6);
+      if (ctor->enumName && ctor->enumName->chars) {
+        sbAppendN(sb, ctor->enumName->chars, ctor->enumName->length);
+      } else {
+        sbAppendN(sb, "enum", 4);
+      }
+      sbAppendChar(sb, '.');
+      if (ctor->variantName && ctor->variantName->chars) {
+        sbAppendN(sb, ctor->variantName->chars, ctor->variantName->length);
+      } else {
+        sbAppendN(sb, "variant", 7);
+      }
+      sbAppendChar(sb, '>');
+      break;
+    }
+    case OBJ_CLASS: {
+      ObjClass* klass = (ObjClass*)obj;
+      sbAppendN(sb, "<class ", 7);
+      sbAppendN(sb, klass->name->chars, klass->name->length);
+      sbAppendChar(sb, '>');
+      break;
+    }
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)obj;
+      sbAppendChar(sb, '<');
+      sbAppendN(sb, instance->klass->name->chars, instance->klass->name->length);
+      sbAppendN(sb, " instance>", 10);
+      break;
+    }
+    case OBJ_ARRAY:
+      appendArray(sb, (ObjArray*)obj);
+      break;
+    case OBJ_MAP:
+      appendMap(sb, (ObjMap*)obj);
+      break;
+    case OBJ_BOUND_METHOD:
+      sbAppendN(sb, "<bound method>", 14);
+      break;
+    case OBJ_UPVALUE:
+      sbAppendN(sb, "<upvalue>", 9);
+      break;
+    case OBJ_SHAPE:
+      sbAppendN(sb, "<shape>", 7);
+      break;
+    case OBJ_ITERATOR:
+      sbAppendN(sb, "<iterator>", 10);
+      break;
+    case OBJ_GENERATOR:
+      sbAppendN(sb, "<generator>", 11);
+      break;
+    case OBJ_FIBER:
+      sbAppendN(sb, "<task>", 6);
+      break;
+    case OBJ_CHANNEL:
+      sbAppendN(sb, "<channel>", 9);
+      break;
+    case OBJ_WORKER:
+      sbAppendN(sb, "<worker>", 8);
+      break;
+    case OBJ_TYPED_ARRAY:
+      appendTypedArray(sb, (ObjTypedArray*)obj);
+      break;
+    case OBJ_STRING_BUILDER:
+      sbAppendN(sb, "<stringbuilder>", 15);
+      break;
+    case OBJ_BOXED_INT: {
+      char buffer[32];
+      int length = snprintf(buffer, sizeof(buffer), "%" PRId64, ((ObjBoxedInt*)obj)->value);
+      sbAppendN(sb, buffer, length < 0 ? 0 : length);
+      break;
+    }
+    case OBJ_RANGE: {
+      ObjRange* range = (ObjRange*)obj;
+      char buffer[64];
+      int length = snprintf(buffer, sizeof(buffer), "%g..%g", range->start, range->end);
+      if (length < 0) length = 0;
+      if (length >= (int)sizeof(buffer)) {
+        length = (int)sizeof(buffer) - 1;
+      }
+      sbAppendN(sb, buffer, length);
+      break;
+    }
+  }
+}
+
+static void appendValue(StringBuilder* sb, Value value) {
+  switch (valueType(value)) {
+    case VAL_NULL:
+      sbAppendN(sb, "null", 4);
+      break;
+    case VAL_BOOL:
+      if (AS_BOOL(value)) {
+        sbAppendN(sb, "true", 4);
+      } else {
+        sbAppendN(sb, "false", 5);
+      }
+      break;
+    case VAL_NUMBER: {
+      char buffer[64];
+      int length = snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
+      if (length < 0) length = 0;
+      if (length >= (int)sizeof(buffer)) {
+        length = (int)sizeof(buffer) - 1;
+      }
+      sbAppendN(sb, buffer, length);
+      break;
+    }
+    case VAL_INT: {
+      char buffer[32];
+      int length = snprintf(buffer, sizeof(buffer), "%" PRId64, AS_INT(value));
+      sbAppendN(sb, buffer, length < 0 ? 0 : length);
+      break;
+    }
+    case VAL_OBJ:
+      appendObject(sb, AS_OBJ(value));
+      break;
+  }
+}
+
+ObjString* stringifyValue(VM* vm, Value value) {
+  StringBuilder sb;
+  sbInit(&sb);
+  appendValue(&sb, value);
+  if (sb.failed) {
+    free(sb.data);
+    runtimeOutOfMemory(vm, "Out of memory while stringifying value.");
+    return NULL;
+  }
+  return takeStringWithLength(vm, sb.data, sb.length);
+}
+
+// The buffers are VM memory, so a growing builder counts toward the next
+// collection like a growing array does.
+static void builderTrackSize(ObjStringBuilder* builder) {
+  size_t oldSize = builder->obj.size;
+  size_t newSize = sizeof(ObjStringBuilder) + (size_t)builder->capacity +
+                   sizeof(int) * (size_t)builder->endsCapacity;
+  builder->obj.size = newSize;
+  gcTrackResize(builder->vm, (Obj*)builder, oldSize, newSize);
+}
+
+static bool builderRecordEnd(ObjStringBuilder* builder) {
+  if (builder->count == builder->endsCapacity) {
+    if (builder->endsCapacity > INT_MAX / 2) return false;
+    int newCap = builder->endsCapacity == 0 ? 8 : builder->endsCapacity * 2;
+    int* ends = (int*)realloc(builder->ends, sizeof(int) * (size_t)newCap);
+    if (!ends) return false;
+    builder->ends = ends;
+    builder->endsCapacity = newCap;
+  }
+  builder->ends[builder->count++] = builder->length;
+  return true;
+}
+
+// The builder lends its buffer to the same formatter stringifyValue uses, so
+// the value is written straight into it.
+static bool builderAppendWith(ObjStringBuilder* builder, Value value, const char* raw,
+                              int rawLength) {
+  StringBuilder sb = {builder->data, builder->length, builder->capacity, false};
+  if (raw) {
+    sbAppendN(&sb, raw, rawLength);
+  } else {
+    appendValue(&sb, value);
+  }
+  builder->data = sb.data;
+  builder->length = sb.length;
+  builder->capacity = sb.capacity;
+  bool ok = !sb.failed && builderRecordEnd(builder);
+  builderTrackSize(builder);
+  return ok;
+}
+
+bool stringBuilderAppend(ObjStringBuilder* builder, Value value) {
+  return builderAppendWith(builder, value, NULL, 0);
+}
+
+bool stringBuilderAppendChar(ObjStringBuilder* builder, uint32_t codePoint) {
+  char bytes[4];
+  int length = 0;
+  if (codePoint <= 0x7f) {
+    bytes[length++] = (char)codePoint;
+  } else if (codePoint <= 0x7ff) {
+    bytes[length++] = (char)(0xc0 | ((codePoint >> 6) & 0x1f));
+    bytes[length++] = (char)(0x80 | (codePoint & 0x3f));
+  } else if (codePoint <= 0xffff) {
+    bytes[length++] = (char)(0xe0 | ((codePoint >> 12) & 0x0f));
+    bytes[length++] = (char)(0x80 | ((codePoint >> 6) & 0x3f));
+    bytes[length++] = (char)(0x80 | (codePoint & 0x3f));
+  } else {
+    bytes[length++] = (char)(0xf0 | ((codePoint >> 18) & 0x07));
+    bytes[length++] = (char)(0x80 | ((codePoint >> 12) & 0x3f));
+    bytes[length++] = (char)(0x80 | ((codePoint >> 6) & 0x3f));
+    bytes[length++] = (char)(0x80 | (codePoint & 0x3f));
+  }
+  return builderAppendWith(builder, NULL_VAL, bytes, length);
+}
+
+void stringBuilderRelease(ObjStringBuilder* builder) {
+  free(builder->data);
+  free(builder->ends);
+  builder->data = NULL;
+  builder->ends = NULL;
+  builder->length = 0;
+  builder->capacity = 0;
+  builder->count = 0;
+  builder->endsCapacity = 0;
+}
+
+static ObjString* builderJoin(VM* vm, ObjStringBuilder* builder, ObjString* separator) {
+  int gaps = builder->count - 1;
+  if (separator->length > 0 && gaps > (INT_MAX - builder->length) / separator->length) {
+    runtimeOutOfMemory(vm, "String is too long.");
+    return NULL;
+  }
+  ObjString* result = newStringBuffer(vm, builder->length + gaps * separator->length);
+  if (!result) return NULL;
+  const char* sep = stringChars(separator);
+  char* cursor = result->bytes;
+  int start = 0;
+  for (int i = 0; i < builder->count; i++) {
+    if (i > 0) {
+      memcpy(cursor, sep, (size_t)separator->length);
+      cursor += separator->length;
+    }
+    int end = builder->ends[i];
+    memcpy(cursor, builder->data + start, (size_t)(end - start));
+    cursor += end - start;
+    start = end;
+  }
+  return finishString(vm, result);
+}
+
+ObjString* stringBuilderTake(VM* vm, ObjStringBuilder* builder, ObjString* separator) {
+  ObjString* result = NULL;
+  if (separator && separator->length > 0 && builder->count > 1) {
+    result = builderJoin(vm, builder, separator);
+    stringBuilderRelease(builder);
+  } else {
+    char* data = builder->data;
+    int length = builder->length;
+    // An adopted buffer can be up to half unused after doubling; shrinking it
+    // usually happens in place, unlike the copy it replaces.
+    if (data && length >= STRING_EXTERNAL_MIN_BYTES &&
+        builder->capacity - length > length / 4 + 1) {
+      char* shrunk = (char*)realloc(data, (size_t)length + 1);
+      if (shrunk) data = shrunk;
+    }
+    builder->data = NULL;
+    stringBuilderRelease(builder);
+    result = takeStringWithLength(vm, data, length);
+  }
+  builderTrackSize(builder);
+  return result;
+}
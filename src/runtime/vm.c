@@ -1,6 +1,7 @@
 #include "interpreter_internal.h"
 #include "erkao_stdlib.h"
 #include "db.h"
+#include "disasm.h"
 #include "gc.h"
 #include "plugin.h"
 #include "program.h"
@@ -283,6 +284,15 @@ void vmInit(VM* vm) {
   vm->youngObjects = NULL;
   vm->oldObjects = NULL;
   vm->envs = NULL;
+  setBoxedIntHeap(vm, true);
+  initStringTable(&vm->strings);
+  {
+    const char* value = getenv("ERKAO_INTERN_MAX");
+    int limit = 0;
+    if (parseIntValue(value, &limit)) {
+      vm->strings.maxLength = limit;
+    }
+  }
   vm->programs = NULL;
   vm->currentProgram = NULL;
   vm->pluginHandles = NULL;
@@ -294,6 +304,31 @@ void vmInit(VM* vm) {
   vm->defers = NULL;
   vm->deferCount = 0;
   vm->deferCapacity = 0;
+  vm->currentFiber = NULL;
+  vm->callDepth = 0;
+  vm->fiberParking = false;
+  vm->readyFibers = NULL;
+  vm->readyHead = 0;
+  vm->readyCount = 0;
+  vm->readyCapacity = 0;
+  vm->failedTasks = NULL;
+  vm->failedTaskCount = 0;
+  vm->failedTaskCapacity = 0;
+  vm->fiberTimers = NULL;
+  vm->fiberTimerCount = 0;
+  vm->fiberTimerCapacity = 0;
+  vm->fiberTimerSequence = 0;
+  vm->eventLoop = NULL;
+  vm->ioWaits = NULL;
+  vm->ioWaitCount = 0;
+  vm->ioWaitCapacity = 0;
+  vm->workerParent = NULL;
+  vm->workers = NULL;
+  vm->workerCount = 0;
+  vm->workerCapacity = 0;
+  vm->workerWaits = NULL;
+  vm->workerWaitCount = 0;
+  vm->workerWaitCapacity = 0;
   vm->gcYoungBytes = 0;
   vm->gcOldBytes = 0;
   vm->gcEnvBytes = 0;
@@ -327,6 +362,10 @@ void vmInit(VM* vm) {
   vm->hadError = false;
   vm->debugBytecode = false;
   vm->debugTrace = envFlagEnabled("ERKAO_DEBUG_TRACE");
+  vm->dumpInlineCaches = false;
+  vm->profileOpcodePairs = false;
+  vm->opcodePairCounts = NULL;
+  vm->lastOpcode = -1;
   vm->debugTraceLine = -1;
   vm->debugTraceColumn = -1;
   vm->typecheck = false;
@@ -344,7 +383,10 @@ void vmInit(VM* vm) {
   vm->dbState = NULL;
   vm->frameCount = 0;
   vm->stackTop = vm->stack;
+  vm->openUpvalues = NULL;
   vm->tryCount = 0;
+  vm->pendingThrow = NULL_VAL;
+  vm->throwPending = false;
   vm->globals = newEnv(vm, NULL);
   if (!vm->globals) return;
   vm->env = vm->globals;
@@ -352,8 +394,6 @@ void vmInit(VM* vm) {
   if (!vm->args) return;
   vm->modules = newMap(vm);
   if (!vm->modules) return;
-  vm->strings = newMap(vm);
-  if (!vm->strings) return;
 
   {
     const char* value = getenv("ERKAO_INSTR_BUDGET");
@@ -392,6 +432,7 @@ void vmInit(VM* vm) {
 }
 
 void vmFree(VM* vm) {
+  setBoxedIntHeap(vm, false);
   dbShutdown(vm);
   pluginUnloadAll(vm);
   for (int i = 0; i < vm->ffiCount; i++) {
@@ -414,6 +455,7 @@ void vmFree(VM* vm) {
   vm->defers = NULL;
   vm->deferCount = 0;
   vm->deferCapacity = 0;
+  schedulerFree(vm);
 
   for (int i = 0; i < vm->modulePathCount; i++) {
     free(vm->modulePaths[i]);
@@ -440,6 +482,14 @@ void vmFree(VM* vm) {
   vm->gcRememberedCount = 0;
   vm->gcRememberedCapacity = 0;
 
+  if (vm->dumpInlineCaches) {
+    gcDumpInlineCaches(vm, false);
+  }
+  if (vm->opcodePairCounts) {
+    dumpOpcodePairs(vm->opcodePairCounts, stderr);
+    free(vm->opcodePairCounts);
+    vm->opcodePairCounts = NULL;
+  }
   Obj* object = vm->youngObjects;
   while (object) {
     Obj* next = object->next;
@@ -455,6 +505,7 @@ void vmFree(VM* vm) {
     object = next;
   }
   vm->oldObjects = NULL;
+  freeStringTable(&vm->strings);
 
   Env* env = vm->envs;
   while (env) {
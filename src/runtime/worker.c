@@ -0,0 +1,879 @@
+#include "interpreter_internal.h"
+#include "gc.h"
+#include "platform.h"
+#include "program.h"
+#include "singlepass.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A worker is a separate VM with its own heap, running on its own thread.
+// The two sides share only a WorkerLink: a queue of serialized messages in
+// each direction and, once the worker ends, its serialized result. Values
+// are copied by serializing them in the sender's heap and rebuilding them in
+// the receiver's, so neither VM ever reads the other's objects.
+//
+// A VM waiting on any of its links sleeps in its event loop, which the other
+// side wakes whenever it posts, closes a queue or finishes.
+
+#define WORKER_MESSAGE_DEPTH_MAX 128
+#define WORKER_PROTO_DEPTH_MAX 32
+
+typedef struct WorkerMessage {
+  struct WorkerMessage* next;
+  unsigned char* data;
+  size_t length;
+} WorkerMessage;
+
+typedef struct {
+  WorkerMessage* head;
+  WorkerMessage* tail;
+  bool closed;
+} WorkerQueue;
+
+// `lock` guards the queues, the result and `refCount`. The startup fields
+// are written before the thread starts and only read by the worker.
+// `terminate` is polled by the worker at every safepoint, so it is a flag
+// rather than a field under the lock.
+struct WorkerLink {
+  PlatformMutex* lock;
+  int refCount;
+  PlatformFlag terminate;
+  WorkerQueue toWorker;
+  WorkerQueue toParent;
+  EventLoop* parentLoop;
+  EventLoop* workerLoop;
+  bool done;
+  bool failed;
+  WorkerMessage* result;
+  PlatformThread* thread;
+  char* path;
+  char* source;
+  int protoPath[WORKER_PROTO_DEPTH_MAX];
+  int protoDepth;
+  WorkerMessage* args;
+  char** modulePaths;
+  int modulePathCount;
+  char* projectRoot;
+  bool unsafePolicyConfigured;
+  unsigned int unsafeFeatureMask;
+  bool typecheck;
+};
+
+static void messageFree(WorkerMessage* message) {
+  if (!message) return;
+  free(message->data);
+  free(message);
+}
+
+static void queueFree(WorkerQueue* queue) {
+  WorkerMessage* message = queue->head;
+  while (message) {
+    WorkerMessage* next = message->next;
+    messageFree(message);
+    message = next;
+  }
+  queue->head = NULL;
+  queue->tail = NULL;
+}
+
+static void queuePush(WorkerQueue* queue, WorkerMessage* message) {
+  message->next = NULL;
+  if (queue->tail) {
+    queue->tail->next = message;
+  } else {
+    queue->head = message;
+  }
+  queue->tail = message;
+}
+
+static WorkerMessage* queueShift(WorkerQueue* queue) {
+  WorkerMessage* message = queue->head;
+  if (!message) return NULL;
+  queue->head = message->next;
+  if (!queue->head) queue->tail = NULL;
+  return message;
+}
+
+static void linkRetain(WorkerLink* link) {
+  platform_mutex_lock(link->lock);
+  link->refCount++;
+  platform_mutex_unlock(link->lock);
+}
+
+static void linkRelease(WorkerLink* link) {
+  platform_mutex_lock(link->lock);
+  int refCount = --link->refCount;
+  platform_mutex_unlock(link->lock);
+  if (refCount > 0) return;
+  queueFree(&link->toWorker);
+  queueFree(&link->toParent);
+  messageFree(link->result);
+  messageFree(link->args);
+  eventLoopRelease(link->parentLoop);
+  eventLoopRelease(link->workerLoop);
+  free(link->path);
+  free(link->source);
+  for (int i = 0; i < link->modulePathCount; i++) {
+    free(link->modulePaths[i]);
+  }
+  free(link->modulePaths);
+  free(link->projectRoot);
+  platform_mutex_destroy(link->lock);
+  free(link);
+}
+
+typedef struct {
+  unsigned char* data;
+  size_t length;
+  size_t capacity;
+} MessageWriter;
+
+static bool writerAppend(VM* vm, MessageWriter* writer, const void* data, size_t length) {
+  if (writer->length + length > writer->capacity) {
+    size_t capacity = writer->capacity < 64 ? 64 : writer->capacity;
+    while (capacity < writer->length + length) capacity *= 2;
+    unsigned char* grown = (unsigned char*)realloc(writer->data, capacity);
+    if (!grown) return runtimeOutOfMemory(vm, "Out of memory while copying a worker message.");
+    writer->data = grown;
+    writer->capacity = capacity;
+  }
+  memcpy(writer->data + writer->length, data, length);
+  writer->length += length;
+  return true;
+}
+
+static bool writerTag(VM* vm, MessageWriter* writer, char tag) {
+  return writerAppend(vm, writer, &tag, 1);
+}
+
+static bool writerCount(VM* vm, MessageWriter* writer, int count) {
+  uint32_t value = (uint32_t)count;
+  return writerAppend(vm, writer, &value, sizeof(value));
+}
+
+static bool writerString(VM* vm, MessageWriter* writer, ObjString* string) {
+  return writerCount(vm, writer, string->length) &&
+         writerAppend(vm, writer, stringChars(string), (size_t)string->length);
+}
+
+static bool serializeValue(VM* vm, MessageWriter* writer, Value value, int depth) {
+  Token token;
+  memset(&token, 0, sizeof(Token));
+  if (depth > WORKER_MESSAGE_DEPTH_MAX) {
+    runtimeError(vm, token, "Value is nested too deeply to send to a worker.");
+    return false;
+  }
+  if (IS_NULL(value)) return writerTag(vm, writer, 'n');
+  if (IS_BOOL(value)) return writerTag(vm, writer, AS_BOOL(value) ? 't' : 'f');
+  if (IS_INT(value)) {
+    int64_t integer = AS_INT(value);
+    return writerTag(vm, writer, 'i') && writerAppend(vm, writer, &integer, sizeof(integer));
+  }
+  if (IS_NUMBER(value)) {
+    double number = AS_NUMBER(value);
+    return writerTag(vm, writer, 'd') && writerAppend(vm, writer, &number, sizeof(number));
+  }
+  if (isObjType(value, OBJ_STRING)) {
+    return writerTag(vm, writer, 's') && writerString(vm, writer, (ObjString*)AS_OBJ(value));
+  }
+  if (isObjType(value, OBJ_ARRAY)) {
+    ObjArray* array = (ObjArray*)AS_OBJ(value);
+    if (!writerTag(vm, writer, 'a') || !writerCount(vm, writer, array->count)) return false;
+    for (int i = 0; i < array->count; i++) {
+      if (!serializeValue(vm, writer, array->items[i], depth + 1)) return false;
+    }
+    return true;
+  }
+  if (isObjType(value, OBJ_TYPED_ARRAY)) {
+    ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(value);
+    char kind = (char)array->kind;
+    return writerTag(vm, writer, 'T') && writerAppend(vm, writer, &kind, 1) &&
+           writerCount(vm, writer, array->length) &&
+           writerAppend(vm, writer, array->data,
+                        (size_t)array->length * typedKindSize(array->kind));
+  }
+  if (isObjType(value, OBJ_MAP)) {
+    ObjMap* map = (ObjMap*)AS_OBJ(value);
+    if (!writerTag(vm, writer, 'm') || !writerCount(vm, writer, mapCount(map))) return false;
+    for (int i = 0; i < map->capacity; i++) {
+      if (!map->entries[i].key) continue;
+      if (!writerString(vm, writer, map->entries[i].key) ||
+          !serializeValue(vm, writer, map->entries[i].value, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  runtimeError(vm, token,
+               "Only null, booleans, numbers, strings, arrays, typed arrays and maps can be sent "
+               "to a worker.");
+  return false;
+}
+
+static WorkerMessage* messageFromValues(VM* vm, int count, Value* values, bool asArray) {
+  MessageWriter writer = {NULL, 0, 0};
+  bool ok = true;
+  if (asArray) ok = writerTag(vm, &writer, 'a') && writerCount(vm, &writer, count);
+  for (int i = 0; ok && i < count; i++) {
+    ok = serializeValue(vm, &writer, values[i], 0);
+  }
+  WorkerMessage* message = ok ? (WorkerMessage*)malloc(sizeof(WorkerMessage)) : NULL;
+  if (!message) {
+    if (ok) runtimeOutOfMemory(vm, "Out of memory while copying a worker message.");
+    free(writer.data);
+    return NULL;
+  }
+  message->next = NULL;
+  message->data = writer.data;
+  message->length = writer.length;
+  return message;
+}
+
+typedef struct {
+  const unsigned char* data;
+  size_t offset;
+} MessageReader;
+
+static uint32_t readerCount(MessageReader* reader) {
+  uint32_t value;
+  memcpy(&value, reader->data + reader->offset, sizeof(value));
+  reader->offset += sizeof(value);
+  return value;
+}
+
+static ObjString* readerString(VM* vm, MessageReader* reader) {
+  uint32_t length = readerCount(reader);
+  const char* chars = (const char*)reader->data + reader->offset;
+  reader->offset += length;
+  return copyStringWithLength(vm, chars, (int)length);
+}
+
+// Rebuilds a value in the receiving heap. Allocation never collects, so the
+// partly built value needs no rooting.
+static Value deserializeValue(VM* vm, MessageReader* reader) {
+  char tag = (char)reader->data[reader->offset++];
+  switch (tag) {
+    case 't': return BOOL_VAL(true);
+    case 'f': return BOOL_VAL(false);
+    case 'i': {
+      int64_t integer;
+      memcpy(&integer, reader->data + reader->offset, sizeof(integer));
+      reader->offset += sizeof(integer);
+      return INT_VAL(integer);
+    }
+    case 'd': {
+      double number;
+      memcpy(&number, reader->data + reader->offset, sizeof(number));
+      reader->offset += sizeof(number);
+      return NUMBER_VAL(number);
+    }
+    case 's': {
+      ObjString* string = readerString(vm, reader);
+      return string ? OBJ_VAL(string) : NULL_VAL;
+    }
+    case 'a': {
+      uint32_t count = readerCount(reader);
+      ObjArray* array = newArrayWithCapacity(vm, (int)count);
+      if (!array) return NULL_VAL;
+      for (uint32_t i = 0; i < count; i++) {
+        arrayWrite(array, deserializeValue(vm, reader));
+      }
+      return OBJ_VAL(array);
+    }
+    case 'T': {
+      TypedKind kind = (TypedKind)reader->data[reader->offset++];
+      uint32_t length = readerCount(reader);
+      size_t bytes = (size_t)length * typedKindSize(kind);
+      ObjTypedArray* array = newTypedArray(vm, kind, (int)length);
+      if (array) memcpy(array->data, reader->data + reader->offset, bytes);
+      reader->offset += bytes;
+      return array ? OBJ_VAL(array) : NULL_VAL;
+    }
+    case 'm': {
+      uint32_t count = readerCount(reader);
+      ObjMap* map = newMap(vm);
+      if (!map) return NULL_VAL;
+      for (uint32_t i = 0; i < count; i++) {
+        ObjString* key = readerString(vm, reader);
+        Value value = deserializeValue(vm, reader);
+        if (key) mapSet(map, key, value);
+      }
+      return OBJ_VAL(map);
+    }
+    default:
+      return NULL_VAL;
+  }
+}
+
+static Value messageValue(VM* vm, WorkerMessage* message) {
+  MessageReader reader = {message->data, 0};
+  return deserializeValue(vm, &reader);
+}
+
+// The queue a handle reads from and the one it writes to, and the event loop
+// of the VM at the other end.
+static WorkerQueue* handleInbox(ObjWorker* worker) {
+  return worker->child ? &worker->link->toParent : &worker->link->toWorker;
+}
+
+static WorkerQueue* handleOutbox(ObjWorker* worker) {
+  return worker->child ? &worker->link->toWorker : &worker->link->toParent;
+}
+
+static EventLoop* handlePeer(ObjWorker* worker) {
+  return worker->child ? worker->link->workerLoop : worker->link->parentLoop;
+}
+
+void workerRelease(ObjWorker* worker) {
+  if (!worker->link) return;
+  linkRelease(worker->link);
+  worker->link = NULL;
+}
+
+// Depth-first search for `proto` among the function constants under `root`,
+// recording the constant index taken at each level.
+static bool findProto(ObjFunction* root, ObjFunction* proto, int* path, int depth,
+                      int* outDepth) {
+  if (root == proto) {
+    *outDepth = depth;
+    return true;
+  }
+  if (depth == WORKER_PROTO_DEPTH_MAX || !root->chunk) return false;
+  for (int i = 0; i < root->chunk->constantsCount; i++) {
+    Value constant = root->chunk->constants[i];
+    if (!isObjType(constant, OBJ_FUNCTION)) continue;
+    path[depth] = i;
+    if (findProto((ObjFunction*)AS_OBJ(constant), proto, path, depth + 1, outDepth)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static char* copyText(const char* text) {
+  if (!text) return NULL;
+  size_t length = strlen(text);
+  char* copy = (char*)malloc(length + 1);
+  if (copy) memcpy(copy, text, length + 1);
+  return copy;
+}
+
+// Finds the program that compiled `function`, so the worker can compile the
+// same source and take the matching prototype from it.
+static bool linkSetFunction(VM* vm, WorkerLink* link, ObjFunction* function) {
+  ObjFunction* proto = function->proto ? function->proto : function;
+  for (Program* program = vm->programs; program; program = program->next) {
+    if (!program->source || !program->function) continue;
+    if (!findProto(program->function, proto, link->protoPath, 0, &link->protoDepth)) continue;
+    link->source = copyText(program->source);
+    link->path = copyText(program->path ? program->path : "<worker>");
+    return link->source && link->path;
+  }
+  return false;
+}
+
+static void workerMain(void* arg);
+
+static bool workersAdd(VM* vm, WorkerLink* link) {
+  if (vm->workerCount == vm->workerCapacity) {
+    int capacity = GROW_CAPACITY(vm->workerCapacity);
+    WorkerLink** workers = GROW_ARRAY(WorkerLink*, vm->workers, vm->workerCapacity, capacity);
+    if (!workers) return runtimeOutOfMemory(vm, "Out of memory while starting worker.");
+    vm->workers = workers;
+    vm->workerCapacity = capacity;
+  }
+  vm->workers[vm->workerCount++] = link;
+  return true;
+}
+
+// Starts `target`, a script path or a function, on a new thread. A script is
+// resolved like an import and sees `args` through args(); a function is
+// called with them. A function cannot capture local variables and does not
+// see the parent's globals, only the top-level declarations of its module.
+ObjWorker* workerSpawn(VM* vm, Value target, int argc, Value* args) {
+  Token token;
+  memset(&token, 0, sizeof(Token));
+  WorkerLink* link = (WorkerLink*)calloc(1, sizeof(WorkerLink));
+  if (!link) {
+    runtimeOutOfMemory(vm, "Out of memory while starting worker.");
+    return NULL;
+  }
+  link->lock = platform_mutex_create();
+  if (!link->lock) {
+    free(link);
+    runtimeOutOfMemory(vm, "Out of memory while starting worker.");
+    return NULL;
+  }
+  link->refCount = 1;
+  link->protoDepth = -1;
+
+  const char* error = NULL;
+  if (isString(target)) {
+    const char* currentPath = vm->currentProgram ? vm->currentProgram->path : NULL;
+    link->path = resolveImportPath(vm, currentPath, stringChars(asString(target)));
+    if (!link->path) error = "worker.spawn() could not resolve the script path.";
+  } else if (isObjType(target, OBJ_FUNCTION)) {
+    ObjFunction* function = (ObjFunction*)AS_OBJ(target);
+    if (function->upvalueCount > 0) {
+      error = "worker.spawn() cannot run a closure that captures local variables.";
+    } else if (!linkSetFunction(vm, link, function)) {
+      error = "worker.spawn() could not find the source of this function.";
+    }
+  } else {
+    error = "worker.spawn() expects a script path or a function.";
+  }
+  if (!error) {
+    link->args = messageFromValues(vm, argc, args, true);
+    if (!link->args) {
+      linkRelease(link);
+      return NULL;
+    }
+  }
+  if (error) {
+    runtimeError(vm, token, error);
+    linkRelease(link);
+    return NULL;
+  }
+
+  for (int i = 0; i < vm->modulePathCount; i++) {
+    char** paths = (char**)realloc(link->modulePaths, sizeof(char*) * (size_t)(i + 1));
+    if (!paths) break;
+    link->modulePaths = paths;
+    link->modulePaths[link->modulePathCount++] = copyText(vm->modulePaths[i]);
+  }
+  link->projectRoot = copyText(vm->projectRoot);
+  link->unsafePolicyConfigured = vm->unsafePolicyConfigured;
+  link->unsafeFeatureMask = vm->unsafeFeatureMask;
+  link->typecheck = vm->typecheck;
+  link->parentLoop = vmEventLoop(vm);
+  if (link->parentLoop) eventLoopRetain(link->parentLoop);
+  link->workerLoop = eventLoopCreate();
+  if (!link->parentLoop || !link->workerLoop || !workersAdd(vm, link)) {
+    if (!vm->hadError) runtimeOutOfMemory(vm, "Out of memory while starting worker.");
+    linkRelease(link);
+    return NULL;
+  }
+
+  // The VM's list keeps its reference; the thread takes another.
+  link->refCount = 2;
+  link->thread = platform_thread_start(workerMain, link);
+  if (!link->thread) {
+    link->refCount = 1;
+    link->done = true;
+    link->failed = true;
+    runtimeError(vm, token, "worker.spawn() could not start a thread.");
+    return NULL;
+  }
+  ObjWorker* worker = newWorker(vm, link, true);
+  if (!worker) return NULL;
+  linkRetain(link);
+  return worker;
+}
+
+ObjWorker* workerParentHandle(VM* vm) {
+  if (!vm->workerParent) return NULL;
+  ObjWorker* worker = newWorker(vm, vm->workerParent, false);
+  if (!worker) return NULL;
+  linkRetain(vm->workerParent);
+  return worker;
+}
+
+static bool workerCompile(VM* vm, WorkerLink* link, const char* text, Program** out) {
+  char* source = copyText(text);
+  if (!source) return runtimeOutOfMemory(vm, "Out of memory while starting worker.");
+  bool lexError = false;
+  TokenArray tokens = scanTokens(source, link->path, &lexError);
+  if (lexError) {
+    freeTokenArray(&tokens);
+    free(source);
+    return false;
+  }
+  bool compileError = false;
+  ObjFunction* function = compile(vm, &tokens, source, link->path, &compileError);
+  freeTokenArray(&tokens);
+  if (compileError || !function) {
+    free(source);
+    return false;
+  }
+  Program* program = programCreate(vm, source, link->path, function);
+  if (!program) {
+    free(source);
+    return false;
+  }
+  function->program = program;
+  programRetain(program);
+  *out = program;
+  return true;
+}
+
+static bool isDeclarationStart(const TokenArray* tokens, int i) {
+  switch (tokens->tokens[i].type) {
+    case TOKEN_CLASS:
+    case TOKEN_STRUCT:
+    case TOKEN_ENUM:
+    case TOKEN_INTERFACE:
+    case TOKEN_IMPORT:
+    case TOKEN_FROM:
+      return true;
+    case TOKEN_FUN:
+      return tokens->tokens[i + 1].type == TOKEN_IDENTIFIER;
+    case TOKEN_TYPE_KW:
+      return tokens->tokens[i + 1].type == TOKEN_IDENTIFIER &&
+             tokens->tokens[i + 2].type == TOKEN_EQUAL;
+    default:
+      return false;
+  }
+}
+
+// Returns the last token of the declaration at `start`: the '}' closing its
+// body, or the ';' ending an import or type alias.
+static int declarationEnd(const TokenArray* tokens, int start) {
+  ErkaoTokenType type = tokens->tokens[start].type;
+  bool braced = type != TOKEN_IMPORT && type != TOKEN_FROM && type != TOKEN_TYPE_KW;
+  int depth = 0;
+  for (int i = start + 1; i < tokens->count; i++) {
+    switch (tokens->tokens[i].type) {
+      case TOKEN_LEFT_BRACE:
+      case TOKEN_LEFT_PAREN:
+      case TOKEN_LEFT_BRACKET:
+        depth++;
+        break;
+      case TOKEN_RIGHT_BRACE:
+        if (--depth == 0 && braced) return i;
+        break;
+      case TOKEN_RIGHT_PAREN:
+      case TOKEN_RIGHT_BRACKET:
+        depth--;
+        break;
+      case TOKEN_SEMICOLON:
+        if (depth == 0 && !braced) return i;
+        break;
+      case TOKEN_EOF:
+        return i - 1;
+      default:
+        break;
+    }
+  }
+  return tokens->count - 1;
+}
+
+// The module's source with everything but its top-level declarations blanked
+// out. Newlines stay, so positions in errors match the file.
+static char* declarationSource(const char* source, const TokenArray* tokens) {
+  size_t length = strlen(source);
+  char* out = (char*)malloc(length + 1);
+  if (!out) return NULL;
+  for (size_t i = 0; i < length; i++) {
+    out[i] = source[i] == '\n' || source[i] == '\r' ? source[i] : ' ';
+  }
+  out[length] = '\0';
+  int depth = 0;
+  for (int i = 0; i < tokens->count - 2; i++) {
+    ErkaoTokenType type = tokens->tokens[i].type;
+    if (type == TOKEN_LEFT_BRACE || type == TOKEN_LEFT_PAREN || type == TOKEN_LEFT_BRACKET) {
+      depth++;
+      continue;
+    }
+    if (type == TOKEN_RIGHT_BRACE || type == TOKEN_RIGHT_PAREN || type == TOKEN_RIGHT_BRACKET) {
+      depth--;
+      continue;
+    }
+    if (depth != 0) continue;
+    int start = i;
+    if ((type == TOKEN_EXPORT || type == TOKEN_PRIVATE) && isDeclarationStart(tokens, i + 1)) {
+      i++;
+    } else if (!isDeclarationStart(tokens, i)) {
+      continue;
+    }
+    int end = declarationEnd(tokens, i);
+    const Token* first = &tokens->tokens[start];
+    const Token* last = &tokens->tokens[end];
+    size_t from = (size_t)(first->start - source);
+    size_t to = (size_t)(last->start - source) + (size_t)last->length;
+    memcpy(out + from, source + from, to - from);
+    i = end;
+  }
+  return out;
+}
+
+// Defines the module's top-level functions, classes, structs, enums,
+// interfaces and imports in the worker's globals, so the entry function can
+// call its siblings. The module's other top-level statements do not run.
+static bool workerDefineDeclarations(VM* vm, WorkerLink* link) {
+  bool lexError = false;
+  TokenArray tokens = scanTokens(link->source, link->path, &lexError);
+  char* text = lexError ? NULL : declarationSource(link->source, &tokens);
+  freeTokenArray(&tokens);
+  if (lexError) return false;
+  if (!text) return runtimeOutOfMemory(vm, "Out of memory while starting worker.");
+  Program* program = NULL;
+  bool ok = workerCompile(vm, link, text, &program);
+  free(text);
+  return ok && interpret(vm, program);
+}
+
+// Runs the worker's script, or its function as the first task, and returns
+// the function's result.
+static bool workerRun(VM* vm, WorkerLink* link, Value* result) {
+  *result = NULL_VAL;
+  for (int i = 0; i < vm->modulePathCount; i++) {
+    free(vm->modulePaths[i]);
+  }
+  vm->modulePathCount = 0;
+  for (int i = 0; i < link->modulePathCount; i++) {
+    vmAddModulePath(vm, link->modulePaths[i]);
+  }
+  if (link->projectRoot) vmSetProjectRoot(vm, link->projectRoot);
+  if (link->unsafePolicyConfigured) vmConfigureUnsafeFeatures(vm, link->unsafeFeatureMask);
+  vm->typecheck = link->typecheck;
+
+  Value args = messageValue(vm, link->args);
+  if (!isObjType(args, OBJ_ARRAY)) return false;
+  ObjArray* argArray = (ObjArray*)AS_OBJ(args);
+
+  if (link->protoDepth < 0) {
+    Token token;
+    memset(&token, 0, sizeof(Token));
+    ObjFunction* script = loadModuleFunction(vm, token, link->path);
+    if (!script) return false;
+    vm->args = argArray;
+    programRetain(script->program);
+    return interpret(vm, script->program);
+  }
+
+  if (!workerDefineDeclarations(vm, link)) return false;
+  Program* program = NULL;
+  if (!workerCompile(vm, link, link->source, &program)) return false;
+  ObjFunction* function = program->function;
+  for (int i = 0; i < link->protoDepth; i++) {
+    function = (ObjFunction*)AS_OBJ(function->chunk->constants[link->protoPath[i]]);
+  }
+  ObjFunction* callee = cloneFunction(vm, function, vm->globals);
+  if (!callee) return false;
+  vm->currentProgram = program;
+  programRunBegin(program);
+  ObjFiber* fiber = fiberSpawn(vm, OBJ_VAL(callee), argArray->count, argArray->items);
+  bool ok = false;
+  if (fiber) {
+    // The stack roots the task after it finishes, until its result is read.
+    *vm->stackTop++ = OBJ_VAL(fiber);
+    ok = schedulerDrain(vm) && schedulerCheckFailedTasks(vm) && !vm->hadError &&
+         fiber->state == FIBER_DONE;
+    *result = fiber->result;
+    vm->stackTop--;
+  }
+  programRunEnd(vm, program);
+  vm->currentProgram = NULL;
+  return ok;
+}
+
+static void workerMain(void* arg) {
+  WorkerLink* link = (WorkerLink*)arg;
+  WorkerMessage* result = NULL;
+  bool ok = false;
+  VM* vm = (VM*)malloc(sizeof(VM));
+  if (vm) {
+    vmInit(vm);
+    vm->workerParent = link;
+    eventLoopRetain(link->workerLoop);
+    vm->eventLoop = link->workerLoop;
+    Value value = NULL_VAL;
+    if (!vm->hadError && workerRun(vm, link, &value)) {
+      result = messageFromValues(vm, 1, &value, false);
+      ok = result != NULL;
+    }
+    vmFree(vm);
+    free(vm);
+  } else {
+    fprintf(stderr, "RuntimeError: Out of memory while starting worker.\n");
+  }
+
+  platform_mutex_lock(link->lock);
+  link->done = true;
+  link->failed = !ok;
+  link->result = result;
+  link->toParent.closed = true;
+  platform_mutex_unlock(link->lock);
+  eventLoopWake(link->parentLoop);
+  linkRelease(link);
+}
+
+// Asks the worker to stop at its next safepoint, and closes its inbox so a
+// worker waiting on a message wakes up to see the request.
+static void linkTerminate(WorkerLink* link) {
+  platform_flag_raise(&link->terminate);
+  platform_mutex_lock(link->lock);
+  link->toWorker.closed = true;
+  platform_mutex_unlock(link->lock);
+  eventLoopWake(link->workerLoop);
+}
+
+void workerTerminate(ObjWorker* worker) {
+  linkTerminate(worker->link);
+}
+
+// True once the parent has terminated this worker. The worker's VM then
+// stops as if it had failed, without reporting an error.
+bool workerInterrupted(VM* vm) {
+  return vm->workerParent && platform_flag_is_raised(&vm->workerParent->terminate);
+}
+
+// Terminates every worker this VM started and waits for the threads to
+// finish. Output is flushed first, so a worker that takes a while to reach a
+// safepoint does not hold back what the script already printed.
+void workerFreeAll(VM* vm) {
+  if (vm->workerCount > 0) fflush(stdout);
+  for (int i = 0; i < vm->workerCount; i++) {
+    linkTerminate(vm->workers[i]);
+  }
+  for (int i = 0; i < vm->workerCount; i++) {
+    platform_thread_join(vm->workers[i]->thread);
+    vm->workers[i]->thread = NULL;
+    linkRelease(vm->workers[i]);
+  }
+  FREE_ARRAY(WorkerLink*, vm->workers, vm->workerCapacity);
+  FREE_ARRAY(WorkerWait, vm->workerWaits, vm->workerWaitCapacity);
+  vm->workers = NULL;
+  vm->workerCount = 0;
+  vm->workerCapacity = 0;
+  vm->workerWaits = NULL;
+  vm->workerWaitCount = 0;
+  vm->workerWaitCapacity = 0;
+}
+
+typedef enum {
+  WORKER_PENDING,
+  WORKER_READY,
+  WORKER_FAILED
+} WorkerTake;
+
+// Takes what a wait is for, if it has arrived: the worker's result, or the
+// next message on the handle. A closed, empty queue yields null.
+static WorkerTake workerTake(VM* vm, ObjWorker* worker, bool result, Value* out) {
+  WorkerLink* link = worker->link;
+  WorkerMessage* message = NULL;
+  WorkerTake take = WORKER_PENDING;
+  *out = NULL_VAL;
+  platform_mutex_lock(link->lock);
+  if (result) {
+    if (link->done) take = link->failed ? WORKER_FAILED : WORKER_READY;
+    message = link->result;
+  } else {
+    WorkerQueue* inbox = handleInbox(worker);
+    message = queueShift(inbox);
+    if (message || inbox->closed) take = WORKER_READY;
+  }
+  platform_mutex_unlock(link->lock);
+  if (take != WORKER_READY || !message) return take;
+  *out = messageValue(vm, message);
+  if (!result) messageFree(message);
+  return take;
+}
+
+static bool workerWaitAdd(VM* vm, ObjWorker* worker, bool result) {
+  if (vm->workerWaitCount == vm->workerWaitCapacity) {
+    int capacity = GROW_CAPACITY(vm->workerWaitCapacity);
+    WorkerWait* waits = GROW_ARRAY(WorkerWait, vm->workerWaits, vm->workerWaitCapacity,
+                                   capacity);
+    if (!waits) return runtimeOutOfMemory(vm, "Out of memory while waiting on worker.");
+    vm->workerWaits = waits;
+    vm->workerWaitCapacity = capacity;
+  }
+  WorkerWait* wait = &vm->workerWaits[vm->workerWaitCount++];
+  wait->worker = worker;
+  wait->fiber = vm->currentFiber;
+  wait->result = result;
+  fiberPark(vm, FIBER_PARKED);
+  return true;
+}
+
+static void workerFailed(VM* vm) {
+  Token token;
+  memset(&token, 0, sizeof(Token));
+  runtimeError(vm, token, "await() on a worker that failed.");
+}
+
+// Wakes the tasks whose worker has posted or finished. A failed worker wakes
+// its awaiting tasks with null, since the error cannot be raised in them.
+bool workerPoll(VM* vm) {
+  int kept = 0;
+  for (int i = 0; i < vm->workerWaitCount; i++) {
+    WorkerWait wait = vm->workerWaits[i];
+    Value value;
+    WorkerTake take = workerTake(vm, wait.worker, wait.result, &value);
+    if (take == WORKER_PENDING) {
+      vm->workerWaits[kept++] = wait;
+      continue;
+    }
+    if (!fiberWake(vm, wait.fiber, value)) return false;
+  }
+  vm->workerWaitCount = kept;
+  return true;
+}
+
+// Blocks until `take` has something: a task parks, and the main script runs
+// the other tasks, sleeping in the event loop when none is ready. A wakeup
+// that arrives before the loop waits leaves it ready, so none is lost.
+static bool workerBlock(VM* vm, ObjWorker* worker, bool result, Value* out) {
+  for (;;) {
+    WorkerTake take = workerTake(vm, worker, result, out);
+    if (take == WORKER_READY) return true;
+    if (take == WORKER_FAILED) {
+      workerFailed(vm);
+      return false;
+    }
+    if (fiberCanPark(vm)) return workerWaitAdd(vm, worker, result);
+    SchedulerStep step = schedulerStep(vm, INFINITY);
+    if (step == SCHEDULER_ERROR) return false;
+    if (step == SCHEDULER_IDLE && !eventLoopWait(vm, INFINITY)) return false;
+  }
+}
+
+bool workerAwait(VM* vm, ObjWorker* worker, Value* out) {
+  *out = NULL_VAL;
+  if (!worker->child) {
+    Token token;
+    memset(&token, 0, sizeof(Token));
+    runtimeError(vm, token, "await() expects a worker started by this script.");
+    return false;
+  }
+  return workerBlock(vm, worker, true, out);
+}
+
+// Returns null once the other side has closed its queue or ended.
+bool workerRecv(VM* vm, ObjWorker* worker, Value* out) {
+  return workerBlock(vm, worker, false, out);
+}
+
+// Queues a copy of `value` for the other side. `sent` is false once that
+// side can no longer read it.
+bool workerSend(VM* vm, ObjWorker* worker, Value value, bool* sent) {
+  WorkerLink* link = worker->link;
+  *sent = false;
+  WorkerMessage* message = messageFromValues(vm, 1, &value, false);
+  if (!message) return false;
+  platform_mutex_lock(link->lock);
+  WorkerQueue* outbox = handleOutbox(worker);
+  bool open = !outbox->closed && !(worker->child && link->done);
+  if (open) queuePush(outbox, message);
+  platform_mutex_unlock(link->lock);
+  if (!open) {
+    messageFree(message);
+    return true;
+  }
+  *sent = true;
+  eventLoopWake(handlePeer(worker));
+  return true;
+}
+
+void workerClose(ObjWorker* worker) {
+  WorkerLink* link = worker->link;
+  platform_mutex_lock(link->lock);
+  WorkerQueue* outbox = handleOutbox(worker);
+  bool wasOpen = !outbox->closed;
+  outbox->closed = true;
+  platform_mutex_unlock(link->lock);
+  if (wasOpen) eventLoopWake(handlePeer(worker));
+}
@@ -0,0 +1,373 @@
+#include "bulk_kernels.h"
+
+#include <stdbool.h>
+
+#ifndef ERKAO_SIMD
+#define ERKAO_SIMD 1
+#endif
+
+#if ERKAO_SIMD && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define BULK_X86 1
+#define BULK_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif ERKAO_SIMD && defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define BULK_X86 1
+#define BULK_TARGET(isa)
+#include <immintrin.h>
+#include <intrin.h>
+#else
+#define BULK_X86 0
+#endif
+
+static inline double bulkMin(double a, double b) { return a < b ? a : b; }
+static inline double bulkMax(double a, double b) { return a > b ? a : b; }
+
+static void scalarAdd(const double* a, const double* b, double* out, size_t count) {
+  for (size_t i = 0; i < count; i++) out[i] = a[i] + b[i];
+}
+
+static void scalarSub(const double* a, const double* b, double* out, size_t count) {
+  for (size_t i = 0; i < count; i++) out[i] = a[i] - b[i];
+}
+
+static void scalarMul(const double* a, const double* b, double* out, size_t count) {
+  for (size_t i = 0; i < count; i++) out[i] = a[i] * b[i];
+}
+
+static void scalarScale(const double* a, double factor, double* out, size_t count) {
+  for (size_t i = 0; i < count; i++) out[i] = a[i] * factor;
+}
+
+static void scalarClamp(const double* a, double lo, double hi, double* out, size_t count) {
+  for (size_t i = 0; i < count; i++) out[i] = bulkMin(bulkMax(a[i], lo), hi);
+}
+
+static double scalarDot(const double* a, const double* b, size_t count) {
+  double sum = 0.0;
+  for (size_t i = 0; i < count; i++) sum += a[i] * b[i];
+  return sum;
+}
+
+static double scalarSum(const double* a, size_t count) {
+  double sum = 0.0;
+  for (size_t i = 0; i < count; i++) sum += a[i];
+  return sum;
+}
+
+static double scalarMinOf(const double* a, size_t count) {
+  double result = a[0];
+  for (size_t i = 1; i < count; i++) result = bulkMin(a[i], result);
+  return result;
+}
+
+static double scalarMaxOf(const double* a, size_t count) {
+  double result = a[0];
+  for (size_t i = 1; i < count; i++) result = bulkMax(a[i], result);
+  return result;
+}
+
+static double scalarDeviation(const double* a, double mean, size_t count) {
+  double sum = 0.0;
+  for (size_t i = 0; i < count; i++) {
+    double d = a[i] - mean;
+    sum += d * d;
+  }
+  return sum;
+}
+
+static const BulkKernels SCALAR_KERNELS = {
+  "scalar", scalarAdd, scalarSub, scalarMul, scalarScale, scalarClamp,
+  scalarDot, scalarSum, scalarMinOf, scalarMaxOf, scalarDeviation
+};
+
+void bulkCumsum(const double* a, double* out, size_t count) {
+  double sum = 0.0;
+  for (size_t i = 0; i < count; i++) {
+    sum += a[i];
+    out[i] = sum;
+  }
+}
+
+#if BULK_X86
+
+// SSE2 handles two doubles per instruction. Reductions keep two
+// accumulators so consecutive adds do not wait on each other.
+
+BULK_TARGET("sse2") static double sse2Total(__m128d v) {
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+BULK_TARGET("sse2") static void sse2Add(const double* a, const double* b, double* out,
+                                        size_t count) {
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  scalarAdd(a + i, b + i, out + i, count - i);
+}
+
+BULK_TARGET("sse2") static void sse2Sub(const double* a, const double* b, double* out,
+                                        size_t count) {
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(out + i, _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  scalarSub(a + i, b + i, out + i, count - i);
+}
+
+BULK_TARGET("sse2") static void sse2Mul(const double* a, const double* b, double* out,
+                                        size_t count) {
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  scalarMul(a + i, b + i, out + i, count - i);
+}
+
+BULK_TARGET("sse2") static void sse2Scale(const double* a, double factor, double* out,
+                                          size_t count) {
+  __m128d f = _mm_set1_pd(factor);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), f));
+  }
+  scalarScale(a + i, factor, out + i, count - i);
+}
+
+BULK_TARGET("sse2") static void sse2Clamp(const double* a, double lo, double hi, double* out,
+                                          size_t count) {
+  __m128d low = _mm_set1_pd(lo);
+  __m128d high = _mm_set1_pd(hi);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128d v = _mm_max_pd(_mm_loadu_pd(a + i), low);
+    _mm_storeu_pd(out + i, _mm_min_pd(v, high));
+  }
+  scalarClamp(a + i, lo, hi, out + i, count - i);
+}
+
+BULK_TARGET("sse2") static double sse2Dot(const double* a, const double* b, size_t count) {
+  __m128d s0 = _mm_setzero_pd();
+  __m128d s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+  }
+  return sse2Total(_mm_add_pd(s0, s1)) + scalarDot(a + i, b + i, count - i);
+}
+
+BULK_TARGET("sse2") static double sse2Sum(const double* a, size_t count) {
+  __m128d s0 = _mm_setzero_pd();
+  __m128d s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+  }
+  return sse2Total(_mm_add_pd(s0, s1)) + scalarSum(a + i, count - i);
+}
+
+BULK_TARGET("sse2") static double sse2MinOf(const double* a, size_t count) {
+  __m128d m = _mm_set1_pd(a[0]);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    m = _mm_min_pd(_mm_loadu_pd(a + i), m);
+  }
+  double result = bulkMin(_mm_cvtsd_f64(_mm_unpackhi_pd(m, m)), _mm_cvtsd_f64(m));
+  for (; i < count; i++) result = bulkMin(a[i], result);
+  return result;
+}
+
+BULK_TARGET("sse2") static double sse2MaxOf(const double* a, size_t count) {
+  __m128d m = _mm_set1_pd(a[0]);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    m = _mm_max_pd(_mm_loadu_pd(a + i), m);
+  }
+  double result = bulkMax(_mm_cvtsd_f64(_mm_unpackhi_pd(m, m)), _mm_cvtsd_f64(m));
+  for (; i < count; i++) result = bulkMax(a[i], result);
+  return result;
+}
+
+BULK_TARGET("sse2") static double sse2Deviation(const double* a, double mean, size_t count) {
+  __m128d center = _mm_set1_pd(mean);
+  __m128d s0 = _mm_setzero_pd();
+  __m128d s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128d d0 = _mm_sub_pd(_mm_loadu_pd(a + i), center);
+    __m128d d1 = _mm_sub_pd(_mm_loadu_pd(a + i + 2), center);
+    s0 = _mm_add_pd(s0, _mm_mul_pd(d0, d0));
+    s1 = _mm_add_pd(s1, _mm_mul_pd(d1, d1));
+  }
+  return sse2Total(_mm_add_pd(s0, s1)) + scalarDeviation(a + i, mean, count - i);
+}
+
+static const BulkKernels SSE2_KERNELS = {
+  "sse2", sse2Add, sse2Sub, sse2Mul, sse2Scale, sse2Clamp,
+  sse2Dot, sse2Sum, sse2MinOf, sse2MaxOf, sse2Deviation
+};
+
+// AVX2 handles four doubles per instruction. The kernels avoid FMA so
+// element-wise results match the other tables bit for bit.
+
+BULK_TARGET("avx2") static double avx2Total(__m256d v) {
+  __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+BULK_TARGET("avx2") static void avx2Add(const double* a, const double* b, double* out,
+                                        size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  scalarAdd(a + i, b + i, out + i, count - i);
+}
+
+BULK_TARGET("avx2") static void avx2Sub(const double* a, const double* b, double* out,
+                                        size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  scalarSub(a + i, b + i, out + i, count - i);
+}
+
+BULK_TARGET("avx2") static void avx2Mul(const double* a, const double* b, double* out,
+                                        size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  scalarMul(a + i, b + i, out + i, count - i);
+}
+
+BULK_TARGET("avx2") static void avx2Scale(const double* a, double factor, double* out,
+                                          size_t count) {
+  __m256d f = _mm256_set1_pd(factor);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), f));
+  }
+  scalarScale(a + i, factor, out + i, count - i);
+}
+
+BULK_TARGET("avx2") static void avx2Clamp(const double* a, double lo, double hi, double* out,
+                                          size_t count) {
+  __m256d low = _mm256_set1_pd(lo);
+  __m256d high = _mm256_set1_pd(hi);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d v = _mm256_max_pd(_mm256_loadu_pd(a + i), low);
+    _mm256_storeu_pd(out + i, _mm256_min_pd(v, high));
+  }
+  scalarClamp(a + i, lo, hi, out + i, count - i);
+}
+
+BULK_TARGET("avx2") static double avx2Dot(const double* a, const double* b, size_t count) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    s1 = _mm256_add_pd(s1,
+                       _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+  }
+  return avx2Total(_mm256_add_pd(s0, s1)) + scalarDot(a + i, b + i, count - i);
+}
+
+BULK_TARGET("avx2") static double avx2Sum(const double* a, size_t count) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+    s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+  }
+  return avx2Total(_mm256_add_pd(s0, s1)) + scalarSum(a + i, count - i);
+}
+
+BULK_TARGET("avx2") static double avx2MinOf(const double* a, size_t count) {
+  __m256d m = _mm256_set1_pd(a[0]);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    m = _mm256_min_pd(_mm256_loadu_pd(a + i), m);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double result = bulkMin(bulkMin(lanes[1], lanes[0]), bulkMin(lanes[3], lanes[2]));
+  for (; i < count; i++) result = bulkMin(a[i], result);
+  return result;
+}
+
+BULK_TARGET("avx2") static double avx2MaxOf(const double* a, size_t count) {
+  __m256d m = _mm256_set1_pd(a[0]);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    m = _mm256_max_pd(_mm256_loadu_pd(a + i), m);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double result = bulkMax(bulkMax(lanes[1], lanes[0]), bulkMax(lanes[3], lanes[2]));
+  for (; i < count; i++) result = bulkMax(a[i], result);
+  return result;
+}
+
+BULK_TARGET("avx2") static double avx2Deviation(const double* a, double mean, size_t count) {
+  __m256d center = _mm256_set1_pd(mean);
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), center);
+    __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(a + i + 4), center);
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(d0, d0));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(d1, d1));
+  }
+  return avx2Total(_mm256_add_pd(s0, s1)) + scalarDeviation(a + i, mean, count - i);
+}
+
+static const BulkKernels AVX2_KERNELS = {
+  "avx2", avx2Add, avx2Sub, avx2Mul, avx2Scale, avx2Clamp,
+  avx2Dot, avx2Sum, avx2MinOf, avx2MaxOf, avx2Deviation
+};
+
+#if defined(_MSC_VER) && !defined(__clang__)
+// AVX also needs the OS to save the upper register halves (XCR0 bits 1-2).
+static bool cpuHasAvx2(void) {
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+}
+
+static bool cpuHasSse2(void) {
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+}
+#else
+static bool cpuHasAvx2(void) { return __builtin_cpu_supports("avx2"); }
+static bool cpuHasSse2(void) { return __builtin_cpu_supports("sse2"); }
+#endif
+
+#endif
+
+// Checked on every call rather than cached, so worker threads share no state.
+// With GCC and Clang the check reads flags libgcc filled in at startup; with
+// MSVC it runs cpuid, which still costs less than a short bulk call.
+const BulkKernels* bulkKernels(void) {
+#if BULK_X86
+  if (cpuHasAvx2()) return &AVX2_KERNELS;
+  if (cpuHasSse2()) return &SSE2_KERNELS;
+#endif
+  return &SCALAR_KERNELS;
+}
@@ -0,0 +1,35 @@
+#ifndef ERKAO_BULK_KERNELS_H
+#define ERKAO_BULK_KERNELS_H
+
+#include <stddef.h>
+
+// Loops over contiguous doubles behind the bulk vec and math natives. Each
+// instruction set fills one table and bulkKernels() returns the widest one
+// the CPU supports. Element-wise kernels give the same bits on every table;
+// reductions add in a different order, so sums may differ in the last bits.
+//
+// min, max and clamp follow the SSE rule `a > b ? a : b`, so a NaN element
+// loses to the running value instead of poisoning it.
+typedef struct {
+  const char* name;
+  void (*add)(const double* a, const double* b, double* out, size_t count);
+  void (*sub)(const double* a, const double* b, double* out, size_t count);
+  void (*mul)(const double* a, const double* b, double* out, size_t count);
+  void (*scale)(const double* a, double factor, double* out, size_t count);
+  void (*clamp)(const double* a, double lo, double hi, double* out, size_t count);
+  double (*dot)(const double* a, const double* b, size_t count);
+  double (*sum)(const double* a, size_t count);
+  // min and max need count > 0.
+  double (*min)(const double* a, size_t count);
+  double (*max)(const double* a, size_t count);
+  // Sum of (a[i] - mean)^2, the numerator of the variance.
+  double (*deviation)(const double* a, double mean, size_t count);
+} BulkKernels;
+
+const BulkKernels* bulkKernels(void);
+
+// A prefix sum carries a dependency from each element to the next, so it
+// stays scalar.
+void bulkCumsum(const double* a, double* out, size_t count);
+
+#endif
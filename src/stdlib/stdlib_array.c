@@ -133,10 +133,10 @@ static Value nativeArrayIndexOf(VM* vm, int argc, Value* args) {
   ObjArray* array = (ObjArray*)AS_OBJ(args[0]);
   for (int i = 0; i < array->count; i++) {
     if (valuesEqual(array->items[i], args[1])) {
-      return NUMBER_VAL((double)i);
+      return INT_VAL(i);
     }
   }
-  return NUMBER_VAL(-1);
+  return INT_VAL(-1);
 }
 
 static Value nativeArrayConcat(VM* vm, int argc, Value* args) {
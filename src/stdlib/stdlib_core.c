@@ -1,11 +1,7 @@
 #include "stdlib_internal.h"
 
-#ifdef _WIN32
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#include <windows.h>
-#endif
+#include <limits.h>
+#include <math.h>
 
 static Value nativePrint(VM* vm, int argc, Value* args) {
   (void)vm;
@@ -27,9 +23,9 @@ static Value nativeFmt(VM* vm, int argc, Value* args) {
   int argIndex = 1;
 
   for (int i = 0; i < format->length; i++) {
-    char c = format->chars[i];
+    char c = stringChars(format)[i];
     if (c == '{') {
-      if (i + 1 < format->length && format->chars[i + 1] == '{') {
+      if (i + 1 < format->length && stringChars(format)[i + 1] == '{') {
         bufferAppendChar(&buffer, '{');
         if (buffer.failed) {
           bufferFree(&buffer);
@@ -38,7 +34,7 @@ static Value nativeFmt(VM* vm, int argc, Value* args) {
         i++;
         continue;
       }
-      if (i + 1 < format->length && format->chars[i + 1] == '}') {
+      if (i + 1 < format->length && stringChars(format)[i + 1] == '}') {
         if (argIndex >= argc) {
           bufferFree(&buffer);
           return runtimeErrorValue(vm, "fmt expects a value for '{}'.");
@@ -48,7 +44,7 @@ static Value nativeFmt(VM* vm, int argc, Value* args) {
           bufferFree(&buffer);
           return NULL_VAL;
         }
-        bufferAppendN(&buffer, text->chars, (size_t)text->length);
+        bufferAppendN(&buffer, stringChars(text), (size_t)text->length);
         if (buffer.failed) {
           bufferFree(&buffer);
           return runtimeErrorValue(vm, "fmt out of memory.");
@@ -60,7 +56,7 @@ static Value nativeFmt(VM* vm, int argc, Value* args) {
       return runtimeErrorValue(vm, "fmt expects '{}' or '{{'.");
     }
     if (c == '}') {
-      if (i + 1 < format->length && format->chars[i + 1] == '}') {
+      if (i + 1 < format->length && stringChars(format)[i + 1] == '}') {
         bufferAppendChar(&buffer, '}');
         if (buffer.failed) {
           bufferFree(&buffer);
@@ -104,17 +100,31 @@ static Value nativeLen(VM* vm, int argc, Value* args) {
   (void)argc;
   if (isObjType(args[0], OBJ_STRING)) {
     ObjString* string = (ObjString*)AS_OBJ(args[0]);
-    return NUMBER_VAL(string->length);
+    return INT_VAL(string->length);
   }
   if (isObjType(args[0], OBJ_ARRAY)) {
     ObjArray* array = (ObjArray*)AS_OBJ(args[0]);
-    return NUMBER_VAL(array->count);
+    return INT_VAL(array->count);
   }
   if (isObjType(args[0], OBJ_MAP)) {
     ObjMap* map = (ObjMap*)AS_OBJ(args[0]);
-    return NUMBER_VAL(mapCount(map));
+    return INT_VAL(mapCount(map));
   }
-  return runtimeErrorValue(vm, "len() expects a string, array, or map.");
+  if (isObjType(args[0], OBJ_RANGE)) {
+    return INT_VAL(rangeLength((ObjRange*)AS_OBJ(args[0])));
+  }
+  if (isObjType(args[0], OBJ_CHANNEL)) {
+    return INT_VAL(((ObjChannel*)AS_OBJ(args[0]))->count);
+  }
+  if (isObjType(args[0], OBJ_TYPED_ARRAY)) {
+    return INT_VAL(((ObjTypedArray*)AS_OBJ(args[0]))->length);
+  }
+  if (isObjType(args[0], OBJ_STRING_BUILDER)) {
+    return INT_VAL(((ObjStringBuilder*)AS_OBJ(args[0]))->length);
+  }
+  return runtimeErrorValue(vm,
+                           "len() expects a string, array, typed array, map, range, channel, or "
+                           "string builder.");
 }
 
 static Value nativeArgs(VM* vm, int argc, Value* args) {
@@ -130,7 +140,7 @@ static Value nativePush(VM* vm, int argc, Value* args) {
   }
   ObjArray* array = (ObjArray*)AS_OBJ(args[0]);
   arrayWrite(array, args[1]);
-  return NUMBER_VAL(array->count);
+  return INT_VAL(array->count);
 }
 
 static Value nativeKeys(VM* vm, int argc, Value* args) {
@@ -165,7 +175,7 @@ static bool stringEquals(ObjString* str, const char* text) {
   if (!str || !text) return false;
   size_t len = strlen(text);
   if ((size_t)str->length != len) return false;
-  return memcmp(str->chars, text, len) == 0;
+  return memcmp(stringChars(str), text, len) == 0;
 }
 
 static void mapSetField(VM* vm, ObjMap* map, const char* name, Value value) {
@@ -199,7 +209,7 @@ static Value makeIterResult(VM* vm, bool done, Value key, Value value) {
 
 static bool instanceGetCallable(VM* vm, ObjInstance* instance, const char* name, Value* out) {
   ObjString* key = copyString(vm, name);
-  if (mapGet(instance->fields, key, out)) {
+  if (instanceGetField(instance, key, out)) {
     return true;
   }
   Value methodValue;
@@ -221,26 +231,29 @@ static Value nativeRange(VM* vm, int argc, Value* args) {
   if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
     return runtimeErrorValue(vm, "range() expects (start, end) numbers.");
   }
-  double start = AS_NUMBER(args[0]);
-  double end = AS_NUMBER(args[1]);
-  double step = start <= end ? 1.0 : -1.0;
-
-  ObjMap* range = newMap(vm);
-  mapSetField(vm, range, "_iter_type", OBJ_VAL(copyString(vm, "range")));
-  mapSetField(vm, range, "current", NUMBER_VAL(start));
-  mapSetField(vm, range, "end", NUMBER_VAL(end));
-  mapSetField(vm, range, "step", NUMBER_VAL(step));
-  return OBJ_VAL(range);
+  return OBJ_VAL(newRange(vm, AS_NUMBER(args[0]), AS_NUMBER(args[1])));
 }
 
 static Value nativeIter(VM* vm, int argc, Value* args) {
   (void)argc;
   Value target = args[0];
+  if (isObjType(target, OBJ_GENERATOR)) {
+    return target;
+  }
   if (isObjType(target, OBJ_ARRAY)) {
     ObjMap* iter = newMap(vm);
     mapSetField(vm, iter, "_iter_type", OBJ_VAL(copyString(vm, "array")));
     mapSetField(vm, iter, "_array", target);
-    mapSetField(vm, iter, "_index", NUMBER_VAL(0));
+    mapSetField(vm, iter, "_index", INT_VAL(0));
+    return OBJ_VAL(iter);
+  }
+  if (isObjType(target, OBJ_RANGE)) {
+    ObjRange* range = (ObjRange*)AS_OBJ(target);
+    ObjMap* iter = newMap(vm);
+    mapSetField(vm, iter, "_iter_type", OBJ_VAL(copyString(vm, "range")));
+    mapSetField(vm, iter, "current", rangeElement(range->start));
+    mapSetField(vm, iter, "end", rangeElement(range->end));
+    mapSetField(vm, iter, "step", rangeElement(range->step));
     return OBJ_VAL(iter);
   }
   if (isObjType(target, OBJ_MAP)) {
@@ -260,7 +273,7 @@ static Value nativeIter(VM* vm, int argc, Value* args) {
     mapSetField(vm, iter, "_iter_type", OBJ_VAL(copyString(vm, "map")));
     mapSetField(vm, iter, "_map", target);
     mapSetField(vm, iter, "_keys", OBJ_VAL(keys));
-    mapSetField(vm, iter, "_index", NUMBER_VAL(0));
+    mapSetField(vm, iter, "_index", INT_VAL(0));
     return OBJ_VAL(iter);
   }
   if (isObjType(target, OBJ_INSTANCE)) {
@@ -277,6 +290,15 @@ static Value nativeIter(VM* vm, int argc, Value* args) {
 static Value nativeNext(VM* vm, int argc, Value* args) {
   (void)argc;
   Value target = args[0];
+  if (isObjType(target, OBJ_GENERATOR)) {
+    bool done = false;
+    Value key = NULL_VAL;
+    Value value = NULL_VAL;
+    if (!vmResumeGenerator(vm, (ObjGenerator*)AS_OBJ(target), &done, &key, &value)) {
+      return NULL_VAL;
+    }
+    return makeIterResult(vm, done, key, value);
+  }
   if (isObjType(target, OBJ_MAP)) {
     ObjMap* map = (ObjMap*)AS_OBJ(target);
     Value iterType;
@@ -296,8 +318,8 @@ static Value nativeNext(VM* vm, int argc, Value* args) {
           return makeIterResult(vm, true, NULL_VAL, NULL_VAL);
         }
         Value value = array->items[index];
-        mapSetField(vm, map, "_index", NUMBER_VAL(index + 1));
-        return makeIterResult(vm, false, NUMBER_VAL(index), value);
+        mapSetField(vm, map, "_index", INT_VAL(index + 1));
+        return makeIterResult(vm, false, INT_VAL(index), value);
       }
       if (stringEquals(type, "map")) {
         Value mapValue;
@@ -322,7 +344,7 @@ static Value nativeNext(VM* vm, int argc, Value* args) {
         if (isString(key)) {
           mapGet(source, asString(key), &value);
         }
-        mapSetField(vm, map, "_index", NUMBER_VAL(index + 1));
+        mapSetField(vm, map, "_index", INT_VAL(index + 1));
         return makeIterResult(vm, false, key, value);
       }
       if (stringEquals(type, "range")) {
@@ -344,8 +366,8 @@ static Value nativeNext(VM* vm, int argc, Value* args) {
         if ((step > 0 && current > end) || (step < 0 && current < end)) {
           return makeIterResult(vm, true, NULL_VAL, NULL_VAL);
         }
-        mapSetField(vm, map, "current", NUMBER_VAL(current + step));
-        return makeIterResult(vm, false, NUMBER_VAL(current), NUMBER_VAL(current));
+        mapSetField(vm, map, "current", rangeElement(current + step));
+        return makeIterResult(vm, false, rangeElement(current), rangeElement(current));
       }
     }
 
@@ -414,135 +436,90 @@ static Value nativeSpawn(VM* vm, int argc, Value* args) {
   if (argc < 1) {
     return runtimeErrorValue(vm, "spawn() expects a function.");
   }
-  ObjMap* task = newMap(vm);
-  ObjArray* taskArgs = newArrayWithCapacity(vm, argc > 1 ? argc - 1 : 0);
-  for (int i = 1; i < argc; i++) {
-    arrayWrite(taskArgs, args[i]);
-  }
-  mapSetField(vm, task, "done", BOOL_VAL(false));
-  mapSetField(vm, task, "value", NULL_VAL);
-  mapSetField(vm, task, "_fn", args[0]);
-  mapSetField(vm, task, "_args", OBJ_VAL(taskArgs));
+  ObjFiber* task = fiberSpawn(vm, args[0], argc - 1, args + 1);
+  if (!task) return NULL_VAL;
   return OBJ_VAL(task);
 }
 
 static Value nativeAwait(VM* vm, int argc, Value* args) {
   (void)argc;
-  if (!isObjType(args[0], OBJ_MAP)) {
-    return runtimeErrorValue(vm, "await() expects a task.");
-  }
-  ObjMap* task = (ObjMap*)AS_OBJ(args[0]);
-  Value done;
-  if (mapGetField(vm, task, "done", &done) && IS_BOOL(done) && AS_BOOL(done)) {
-    Value value;
-    if (mapGetField(vm, task, "value", &value)) {
-      return value;
-    }
-    return NULL_VAL;
-  }
-
-  Value fn;
-  Value taskArgs;
-  if (!mapGetField(vm, task, "_fn", &fn) ||
-      !mapGetField(vm, task, "_args", &taskArgs) ||
-      !isObjType(taskArgs, OBJ_ARRAY)) {
-    return runtimeErrorValue(vm, "await() expects a task created by spawn().");
-  }
-  ObjArray* argArray = (ObjArray*)AS_OBJ(taskArgs);
-  Value* callArgs = argArray->count > 0 ? argArray->items : NULL;
-
   Value value;
-  if (!vmCallValue(vm, fn, argArray->count, callArgs, &value)) {
-    return NULL_VAL;
+  if (isObjType(args[0], OBJ_WORKER)) {
+    if (!workerAwait(vm, (ObjWorker*)AS_OBJ(args[0]), &value)) return NULL_VAL;
+    return value;
+  }
+  if (!isObjType(args[0], OBJ_FIBER)) {
+    return runtimeErrorValue(vm, "await() expects a task or a worker.");
   }
-  mapSetField(vm, task, "value", value);
-  mapSetField(vm, task, "done", BOOL_VAL(true));
-  mapSetField(vm, task, "_fn", NULL_VAL);
-  mapSetField(vm, task, "_args", NULL_VAL);
+  if (!fiberAwait(vm, (ObjFiber*)AS_OBJ(args[0]), &value)) return NULL_VAL;
   return value;
 }
 
 static Value nativeChannel(VM* vm, int argc, Value* args) {
-  (void)argc;
-  (void)args;
-  ObjMap* channel = newMap(vm);
-  ObjArray* queue = newArray(vm);
-  mapSetField(vm, channel, "_queue", OBJ_VAL(queue));
-  mapSetField(vm, channel, "_head", NUMBER_VAL(0));
+  if (argc > 1) {
+    return runtimeErrorValue(vm, "channel() expects an optional capacity.");
+  }
+  int limit = 0;
+  if (argc == 1) {
+    if (!IS_NUMBER(args[0])) {
+      return runtimeErrorValue(vm, "channel() capacity must be a positive integer.");
+    }
+    double capacity = AS_NUMBER(args[0]);
+    if (capacity < 1 || capacity > INT_MAX || capacity != floor(capacity)) {
+      return runtimeErrorValue(vm, "channel() capacity must be a positive integer.");
+    }
+    limit = (int)capacity;
+  }
+  ObjChannel* channel = newChannel(vm, limit);
+  if (!channel) return NULL_VAL;
   return OBJ_VAL(channel);
 }
 
+// Returns false once the channel is closed. On a full channel a task parks
+// until a receiver makes room.
 static Value nativeSend(VM* vm, int argc, Value* args) {
   (void)argc;
-  if (!isObjType(args[0], OBJ_MAP)) {
+  if (!isObjType(args[0], OBJ_CHANNEL)) {
     return runtimeErrorValue(vm, "send() expects a channel.");
   }
-  ObjMap* channel = (ObjMap*)AS_OBJ(args[0]);
-  Value queueValue;
-  if (!mapGetField(vm, channel, "_queue", &queueValue) ||
-      !isObjType(queueValue, OBJ_ARRAY)) {
-    return runtimeErrorValue(vm, "send() expects a channel queue.");
-  }
-  Value headValue = NUMBER_VAL(0);
-  int head = 0;
-  if (mapGetField(vm, channel, "_head", &headValue) && IS_NUMBER(headValue)) {
-    head = (int)AS_NUMBER(headValue);
-    if (head < 0) head = 0;
-  }
-  ObjArray* queue = (ObjArray*)AS_OBJ(queueValue);
-  if (head >= queue->count) {
-    queue->count = 0;
-    head = 0;
-  } else if (head > 64 && head * 2 >= queue->count) {
-    int remaining = queue->count - head;
-    for (int i = 0; i < remaining; i++) {
-      queue->items[i] = queue->items[head + i];
-    }
-    queue->count = remaining;
-    head = 0;
-  }
-  arrayWrite(queue, args[1]);
-  mapSetField(vm, channel, "_head", NUMBER_VAL((double)head));
-  return NULL_VAL;
+  bool sent;
+  if (!channelSend(vm, (ObjChannel*)AS_OBJ(args[0]), args[1], &sent)) return NULL_VAL;
+  return BOOL_VAL(sent);
 }
 
 static Value nativeRecv(VM* vm, int argc, Value* args) {
   (void)argc;
-  if (!isObjType(args[0], OBJ_MAP)) {
+  if (!isObjType(args[0], OBJ_CHANNEL)) {
     return runtimeErrorValue(vm, "recv() expects a channel.");
   }
-  ObjMap* channel = (ObjMap*)AS_OBJ(args[0]);
-  Value queueValue;
-  if (!mapGetField(vm, channel, "_queue", &queueValue) ||
-      !isObjType(queueValue, OBJ_ARRAY)) {
-    return runtimeErrorValue(vm, "recv() expects a channel queue.");
-  }
-  Value headValue = NUMBER_VAL(0);
-  int head = 0;
-  if (mapGetField(vm, channel, "_head", &headValue) && IS_NUMBER(headValue)) {
-    head = (int)AS_NUMBER(headValue);
-    if (head < 0) head = 0;
-  }
-  ObjArray* queue = (ObjArray*)AS_OBJ(queueValue);
-  if (head >= queue->count) {
-    queue->count = 0;
-    mapSetField(vm, channel, "_head", NUMBER_VAL(0));
-    return NULL_VAL;
-  }
-  Value result = queue->items[head++];
-  if (head >= queue->count) {
-    queue->count = 0;
-    head = 0;
-  } else if (head > 64 && head * 2 >= queue->count) {
-    int remaining = queue->count - head;
-    for (int i = 0; i < remaining; i++) {
-      queue->items[i] = queue->items[head + i];
+  Value value;
+  if (!channelRecv(vm, (ObjChannel*)AS_OBJ(args[0]), &value)) return NULL_VAL;
+  return value;
+}
+
+static Value nativeClose(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_CHANNEL)) {
+    return runtimeErrorValue(vm, "close() expects a channel.");
+  }
+  channelClose(vm, (ObjChannel*)AS_OBJ(args[0]));
+  return NULL_VAL;
+}
+
+static Value nativeSelect(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_ARRAY)) {
+    return runtimeErrorValue(vm, "select() expects an array of channels.");
+  }
+  ObjArray* channels = (ObjArray*)AS_OBJ(args[0]);
+  for (int i = 0; i < channels->count; i++) {
+    if (!isObjType(channels->items[i], OBJ_CHANNEL)) {
+      return runtimeErrorValue(vm, "select() expects an array of channels.");
     }
-    queue->count = remaining;
-    head = 0;
   }
-  mapSetField(vm, channel, "_head", NUMBER_VAL((double)head));
-  return result;
+  Value value;
+  if (!channelSelect(vm, channels, &value)) return NULL_VAL;
+  return value;
 }
 
 static Value nativeSleep(VM* vm, int argc, Value* args) {
@@ -554,18 +531,7 @@ static Value nativeSleep(VM* vm, int argc, Value* args) {
   if (seconds < 0) {
     return runtimeErrorValue(vm, "sleep() expects a non-negative number.");
   }
-#ifdef _WIN32
-  DWORD ms = (DWORD)(seconds * 1000.0);
-  Sleep(ms);
-#else
-  struct timespec ts;
-  ts.tv_sec = (time_t)seconds;
-  ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1000000000.0);
-  if (ts.tv_nsec < 0) ts.tv_nsec = 0;
-  if (nanosleep(&ts, NULL) != 0) {
-    return runtimeErrorValue(vm, "sleep() failed.");
-  }
-#endif
+  fiberSleep(vm, seconds);
   return NULL_VAL;
 }
 
@@ -587,9 +553,11 @@ void stdlib_register_globals(VM* vm) {
   defineNative(vm, "mapRest", nativeMapRest, 2);
   defineNative(vm, "spawn", nativeSpawn, -1);
   defineNative(vm, "await", nativeAwait, 1);
-  defineNative(vm, "channel", nativeChannel, 0);
+  defineNative(vm, "channel", nativeChannel, -1);
   defineNative(vm, "send", nativeSend, 2);
   defineNative(vm, "recv", nativeRecv, 1);
+  defineNative(vm, "close", nativeClose, 1);
+  defineNative(vm, "select", nativeSelect, 1);
   defineNative(vm, "sleep", nativeSleep, 1);
 
   ObjMap* option = newMap(vm);
@@ -14,7 +14,7 @@ static Value nativeEnvGet(VM* vm, int argc, Value* args) {
   }
   ObjString* name = (ObjString*)AS_OBJ(args[0]);
 #ifdef _WIN32
-  DWORD length = GetEnvironmentVariableA(name->chars, NULL, 0);
+  DWORD length = GetEnvironmentVariableA(stringChars(name), NULL, 0);
   if (length == 0) {
     DWORD err = GetLastError();
     if (err == ERROR_ENVVAR_NOT_FOUND) {
@@ -29,7 +29,7 @@ static Value nativeEnvGet(VM* vm, int argc, Value* args) {
   if (!buffer) {
     return runtimeErrorValue(vm, "env.get out of memory.");
   }
-  DWORD written = GetEnvironmentVariableA(name->chars, buffer, length);
+  DWORD written = GetEnvironmentVariableA(stringChars(name), buffer, length);
   if (written == 0 && GetLastError() == ERROR_ENVVAR_NOT_FOUND) {
     free(buffer);
     return NULL_VAL;
@@ -38,7 +38,7 @@ static Value nativeEnvGet(VM* vm, int argc, Value* args) {
   free(buffer);
   return OBJ_VAL(result);
 #else
-  const char* value = getenv(name->chars);
+  const char* value = getenv(stringChars(name));
   if (!value) return NULL_VAL;
   return OBJ_VAL(copyString(vm, value));
 #endif
@@ -52,11 +52,11 @@ static Value nativeEnvSet(VM* vm, int argc, Value* args) {
   ObjString* name = (ObjString*)AS_OBJ(args[0]);
   ObjString* value = (ObjString*)AS_OBJ(args[1]);
 #ifdef _WIN32
-  if (!SetEnvironmentVariableA(name->chars, value->chars)) {
+  if (!SetEnvironmentVariableA(stringChars(name), stringChars(value))) {
     return runtimeErrorValue(vm, "env.set failed.");
   }
 #else
-  if (setenv(name->chars, value->chars, 1) != 0) {
+  if (setenv(stringChars(name), stringChars(value), 1) != 0) {
     return runtimeErrorValue(vm, "env.set failed.");
   }
 #endif
@@ -70,7 +70,7 @@ static Value nativeEnvHas(VM* vm, int argc, Value* args) {
   }
   ObjString* name = (ObjString*)AS_OBJ(args[0]);
 #ifdef _WIN32
-  DWORD length = GetEnvironmentVariableA(name->chars, NULL, 0);
+  DWORD length = GetEnvironmentVariableA(stringChars(name), NULL, 0);
   if (length == 0) {
     DWORD err = GetLastError();
     if (err == ERROR_ENVVAR_NOT_FOUND) return BOOL_VAL(false);
@@ -79,7 +79,7 @@ static Value nativeEnvHas(VM* vm, int argc, Value* args) {
   }
   return BOOL_VAL(true);
 #else
-  return BOOL_VAL(getenv(name->chars) != NULL);
+  return BOOL_VAL(getenv(stringChars(name)) != NULL);
 #endif
 }
 
@@ -90,11 +90,11 @@ static Value nativeEnvUnset(VM* vm, int argc, Value* args) {
   }
   ObjString* name = (ObjString*)AS_OBJ(args[0]);
 #ifdef _WIN32
-  if (!SetEnvironmentVariableA(name->chars, NULL)) {
+  if (!SetEnvironmentVariableA(stringChars(name), NULL)) {
     return runtimeErrorValue(vm, "env.unset failed.");
   }
 #else
-  if (unsetenv(name->chars) != 0) {
+  if (unsetenv(stringChars(name)) != 0) {
     return runtimeErrorValue(vm, "env.unset failed.");
   }
 #endif
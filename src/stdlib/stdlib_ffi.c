@@ -69,14 +69,14 @@ static Value nativeFfiOpen(VM* vm, int argc, Value* args) {
   } else {
     ObjString* path = (ObjString*)AS_OBJ(args[0]);
 #ifdef _WIN32
-    handle = (void*)LoadLibraryA(path->chars);
+    handle = (void*)LoadLibraryA(stringChars(path));
     if (!handle) {
       char buffer[128];
       snprintf(buffer, sizeof(buffer), "LoadLibrary failed (%lu).", (unsigned long)GetLastError());
       return runtimeErrorValue(vm, buffer);
     }
 #else
-    handle = dlopen(path->chars, RTLD_NOW);
+    handle = dlopen(stringChars(path), RTLD_NOW);
     if (!handle) {
       const char* error = dlerror();
       return runtimeErrorValue(vm, error ? error : "dlopen failed.");
@@ -100,7 +100,7 @@ static Value nativeFfiOpen(VM* vm, int argc, Value* args) {
   }
   ObjMap* out = newMap(vm);
   ObjString* key = copyString(vm, "_ffi");
-  mapSet(out, key, NUMBER_VAL((double)id));
+  mapSet(out, key, INT_VAL(id));
   return OBJ_VAL(out);
 }
 
@@ -125,6 +125,40 @@ static Value nativeFfiClose(VM* vm, int argc, Value* args) {
   return NULL_VAL;
 }
 
+// A typed array as the first argument is passed as its storage pointer and
+// element count, followed by up to two numbers:
+// double fn(void* data, int64_t length, double...). The callee may write
+// through the pointer; it must not keep it after returning.
+static Value ffiCallWithBuffer(VM* vm, void* symbol, ObjTypedArray* buffer, int argCount,
+                               Value* args) {
+  if (argCount > 2) {
+    return runtimeErrorValue(vm, "ffi.call supports up to 2 arguments after a typed array.");
+  }
+  double values[2] = {0};
+  for (int i = 0; i < argCount; i++) {
+    if (!IS_NUMBER(args[i])) {
+      return runtimeErrorValue(vm, "ffi.call expects number arguments.");
+    }
+    values[i] = AS_NUMBER(args[i]);
+  }
+  void* data = buffer->data;
+  int64_t length = buffer->length;
+  double result = 0.0;
+  switch (argCount) {
+    case 0:
+      result = ((double (*)(void*, int64_t))symbol)(data, length);
+      break;
+    case 1:
+      result = ((double (*)(void*, int64_t, double))symbol)(data, length, values[0]);
+      break;
+    default:
+      result = ((double (*)(void*, int64_t, double, double))symbol)(data, length, values[0],
+                                                                   values[1]);
+      break;
+  }
+  return NUMBER_VAL(result);
+}
+
 static Value nativeFfiCall(VM* vm, int argc, Value* args) {
   if (!stdlibUnsafeEnabled(vm, ERKAO_UNSAFE_FFI, "ERKAO_ALLOW_FFI")) {
     return runtimeErrorValue(vm,
@@ -142,7 +176,7 @@ static Value nativeFfiCall(VM* vm, int argc, Value* args) {
   }
   ObjString* name = (ObjString*)AS_OBJ(args[1]);
 #ifdef _WIN32
-  FARPROC proc = GetProcAddress((HMODULE)handle->handle, name->chars);
+  FARPROC proc = GetProcAddress((HMODULE)handle->handle, stringChars(name));
   if (!proc) {
     char buffer[128];
     snprintf(buffer, sizeof(buffer), "GetProcAddress failed (%lu).",
@@ -152,7 +186,7 @@ static Value nativeFfiCall(VM* vm, int argc, Value* args) {
   void* symbol = (void*)proc;
 #else
   dlerror();
-  void* symbol = dlsym(handle->handle, name->chars);
+  void* symbol = dlsym(handle->handle, stringChars(name));
   const char* error = dlerror();
   if (!symbol || error) {
     return runtimeErrorValue(vm, error ? error : "dlsym failed.");
@@ -160,6 +194,10 @@ static Value nativeFfiCall(VM* vm, int argc, Value* args) {
 #endif
 
   int argCount = argc - 2;
+  if (argCount > 0 && isObjType(args[2], OBJ_TYPED_ARRAY)) {
+    return ffiCallWithBuffer(vm, symbol, (ObjTypedArray*)AS_OBJ(args[2]), argCount - 1,
+                             args + 3);
+  }
   if (argCount > 4) {
     return runtimeErrorValue(vm, "ffi.call supports up to 4 arguments.");
   }
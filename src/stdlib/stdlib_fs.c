@@ -275,7 +275,7 @@ static Value nativeFsReadText(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "fs.readText expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  FILE* file = fopen(path->chars, "rb");
+  FILE* file = fopen(stringChars(path), "rb");
   if (!file) {
     return runtimeErrorValue(vm, "fs.readText failed to open file.");
   }
@@ -298,12 +298,15 @@ static Value nativeFsReadText(VM* vm, int argc, Value* args) {
   buffer[read] = '\0';
   fclose(file);
 
-  ObjString* result = copyStringWithLength(vm, buffer, (int)read);
-  free(buffer);
+  ObjString* result = takeStringWithLength(vm, buffer, (int)read);
   if (!result) return NULL_VAL;
   return OBJ_VAL(result);
 }
 
+static bool fsWritePiece(void* context, const char* chars, int length) {
+  return fwrite(chars, 1, (size_t)length, (FILE*)context) == (size_t)length;
+}
+
 static Value nativeFsWriteText(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!isObjType(args[0], OBJ_STRING) || !isObjType(args[1], OBJ_STRING)) {
@@ -312,19 +315,74 @@ static Value nativeFsWriteText(VM* vm, int argc, Value* args) {
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
   ObjString* text = (ObjString*)AS_OBJ(args[1]);
 
-  FILE* file = fopen(path->chars, "wb");
+  FILE* file = fopen(stringChars(path), "wb");
   if (!file) {
     return runtimeErrorValue(vm, "fs.writeText failed to open file.");
   }
 
-  size_t written = fwrite(text->chars, 1, (size_t)text->length, file);
+  // A rope is written piece by piece instead of being flattened first.
+  bool ok = stringForEachPiece(text, fsWritePiece, file);
   fclose(file);
-  if (written != (size_t)text->length) {
+  if (!ok) {
     return runtimeErrorValue(vm, "fs.writeText failed to write file.");
   }
   return BOOL_VAL(true);
 }
 
+static Value nativeFsReadBytes(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_STRING)) {
+    return runtimeErrorValue(vm, "fs.readBytes expects a path string.");
+  }
+  ObjString* path = (ObjString*)AS_OBJ(args[0]);
+  FILE* file = fopen(stringChars(path), "rb");
+  if (!file) {
+    return runtimeErrorValue(vm, "fs.readBytes failed to open file.");
+  }
+
+  fseek(file, 0L, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  if (size < 0 || size > INT32_MAX) {
+    fclose(file);
+    return runtimeErrorValue(vm, "fs.readBytes failed to read file size.");
+  }
+
+  ObjTypedArray* bytes = newTypedArray(vm, TYPED_U8, (int)size);
+  if (!bytes) {
+    fclose(file);
+    return NULL_VAL;
+  }
+  size_t read = fread(bytes->data, 1, (size_t)size, file);
+  fclose(file);
+  bytes->length = (int)read;
+  return OBJ_VAL(bytes);
+}
+
+// Writes the raw storage of a typed array, so f64 and i32 data lands in the
+// host's byte order.
+static Value nativeFsWriteBytes(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_STRING) || !isObjType(args[1], OBJ_TYPED_ARRAY)) {
+    return runtimeErrorValue(vm, "fs.writeBytes expects (path, typed array).");
+  }
+  ObjString* path = (ObjString*)AS_OBJ(args[0]);
+  ObjTypedArray* bytes = (ObjTypedArray*)AS_OBJ(args[1]);
+  size_t length = (size_t)bytes->length * typedKindSize(bytes->kind);
+
+  FILE* file = fopen(stringChars(path), "wb");
+  if (!file) {
+    return runtimeErrorValue(vm, "fs.writeBytes failed to open file.");
+  }
+
+  size_t written = fwrite(bytes->data, 1, length, file);
+  fclose(file);
+  if (written != length) {
+    return runtimeErrorValue(vm, "fs.writeBytes failed to write file.");
+  }
+  return BOOL_VAL(true);
+}
+
 static Value nativeFsExists(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!isObjType(args[0], OBJ_STRING)) {
@@ -332,11 +390,11 @@ static Value nativeFsExists(VM* vm, int argc, Value* args) {
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
 #ifdef _WIN32
-  DWORD attrs = GetFileAttributesA(path->chars);
+  DWORD attrs = GetFileAttributesA(stringChars(path));
   return BOOL_VAL(attrs != INVALID_FILE_ATTRIBUTES);
 #else
   struct stat st;
-  return BOOL_VAL(stat(path->chars, &st) == 0);
+  return BOOL_VAL(stat(stringChars(path), &st) == 0);
 #endif
 }
 
@@ -380,13 +438,13 @@ static Value nativeFsListDir(VM* vm, int argc, Value* args) {
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
 
 #ifdef _WIN32
-  size_t pathLength = strlen(path->chars);
+  size_t pathLength = strlen(stringChars(path));
   size_t patternLength = pathLength + 3;
   char* pattern = (char*)malloc(patternLength);
   if (!pattern) {
     return runtimeErrorValue(vm, "fs.listDir out of memory.");
   }
-  snprintf(pattern, patternLength, "%s\\*", path->chars);
+  snprintf(pattern, patternLength, "%s\\*", stringChars(path));
 
   WIN32_FIND_DATAA data;
   HANDLE handle = FindFirstFileA(pattern, &data);
@@ -410,7 +468,7 @@ static Value nativeFsListDir(VM* vm, int argc, Value* args) {
   FindClose(handle);
   return OBJ_VAL(array);
 #else
-  DIR* dir = opendir(path->chars);
+  DIR* dir = opendir(stringChars(path));
   if (!dir) {
     return runtimeErrorValue(vm, "fs.listDir failed to open directory.");
   }
@@ -438,7 +496,7 @@ static Value nativeFsIsFile(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "fs.isFile expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  return BOOL_VAL(pathIsFile(path->chars));
+  return BOOL_VAL(pathIsFile(stringChars(path)));
 }
 
 static Value nativeFsIsDir(VM* vm, int argc, Value* args) {
@@ -447,7 +505,7 @@ static Value nativeFsIsDir(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "fs.isDir expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  return BOOL_VAL(pathIsDir(path->chars));
+  return BOOL_VAL(pathIsDir(stringChars(path)));
 }
 
 static Value nativeFsSize(VM* vm, int argc, Value* args) {
@@ -456,7 +514,7 @@ static Value nativeFsSize(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "fs.size expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  FILE* file = fopen(path->chars, "rb");
+  FILE* file = fopen(stringChars(path), "rb");
   if (!file) {
     return runtimeErrorValue(vm, "fs.size failed to open file.");
   }
@@ -466,7 +524,18 @@ static Value nativeFsSize(VM* vm, int argc, Value* args) {
   if (size < 0) {
     return runtimeErrorValue(vm, "fs.size failed to read file size.");
   }
-  return NUMBER_VAL((double)size);
+  return INT_VAL((int64_t)size);
+}
+
+// Deletes a file, or an empty directory. Returns false when nothing was
+// removed, so cleanup code need not check fs.exists first.
+static Value nativeFsRemove(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_STRING)) {
+    return runtimeErrorValue(vm, "fs.remove expects a path string.");
+  }
+  ObjString* path = (ObjString*)AS_OBJ(args[0]);
+  return BOOL_VAL(remove(stringChars(path)) == 0);
 }
 
 static Value nativeFsGlob(VM* vm, int argc, Value* args) {
@@ -475,7 +544,7 @@ static Value nativeFsGlob(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "fs.glob expects a pattern string.");
   }
   ObjString* pattern = (ObjString*)AS_OBJ(args[0]);
-  const char* patternText = pattern->chars;
+  const char* patternText = stringChars(pattern);
   char sep = pickSeparator(patternText, NULL);
 
   bool hasWildcard = false;
@@ -536,11 +605,14 @@ static Value nativeFsGlob(VM* vm, int argc, Value* args) {
 void stdlib_register_fs(VM* vm, ObjInstance* module) {
   moduleAdd(vm, module, "readText", nativeFsReadText, 1);
   moduleAdd(vm, module, "writeText", nativeFsWriteText, 2);
+  moduleAdd(vm, module, "readBytes", nativeFsReadBytes, 1);
+  moduleAdd(vm, module, "writeBytes", nativeFsWriteBytes, 2);
   moduleAdd(vm, module, "exists", nativeFsExists, 1);
   moduleAdd(vm, module, "cwd", nativeFsCwd, 0);
   moduleAdd(vm, module, "listDir", nativeFsListDir, 1);
   moduleAdd(vm, module, "isFile", nativeFsIsFile, 1);
   moduleAdd(vm, module, "isDir", nativeFsIsDir, 1);
   moduleAdd(vm, module, "size", nativeFsSize, 1);
+  moduleAdd(vm, module, "remove", nativeFsRemove, 1);
   moduleAdd(vm, module, "glob", nativeFsGlob, 1);
 }
@@ -0,0 +1,25 @@
+#include "stdlib_internal.h"
+#include "gc.h"
+
+static Value nativeGcCollect(VM* vm, int argc, Value* args) {
+  (void)argc;
+  (void)args;
+  // Natives may run while C code holds unrooted objects, so the collection
+  // itself waits for the next safepoint (block end or loop back-edge).
+  vm->gcPendingFull = true;
+  return NULL_VAL;
+}
+
+static Value nativeGcStats(VM* vm, int argc, Value* args) {
+  (void)argc;
+  (void)args;
+  ObjMap* stats = newMap(vm);
+  mapSet(stats, copyString(vm, "heapBytes"), INT_VAL((int64_t)gcTotalHeapBytes(vm)));
+  mapSet(stats, copyString(vm, "internedStrings"), INT_VAL((int64_t)vm->strings.count));
+  return OBJ_VAL(stats);
+}
+
+void stdlib_register_gc(VM* vm, ObjInstance* module) {
+  moduleAdd(vm, module, "collect", nativeGcCollect, 0);
+  moduleAdd(vm, module, "stats", nativeGcStats, 0);
+}
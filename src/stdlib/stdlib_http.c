@@ -1,6 +1,7 @@
 #include "stdlib_internal.h"
 #include "gc.h"
 #include "http_internal.h"
+#include "platform.h"
 
 #include <errno.h>
 #include <math.h>
@@ -18,7 +19,7 @@
 #include <arpa/inet.h>
 #include <curl/curl.h>
 #include <netinet/in.h>
-#include <sys/select.h>
+#include <pthread.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -73,7 +74,7 @@ static Value httpRequest(VM* vm, const char* method, ObjString* url,
   bufferInit(&bodyBuffer);
   wchar_t* headerWide = NULL;
 
-  wchar_t* wideUrl = utf8ToWide(url->chars, -1);
+  wchar_t* wideUrl = utf8ToWide(stringChars(url), -1);
   if (!wideUrl) return runtimeErrorValue(vm, message);
 
   URL_COMPONENTS parts;
@@ -203,7 +204,7 @@ static Value httpRequest(VM* vm, const char* method, ObjString* url,
   if (!response) {
     goto request_cleanup;
   }
-  mapSet(response, copyString(vm, "status"), NUMBER_VAL((double)status));
+  mapSet(response, copyString(vm, "status"), INT_VAL(status));
   mapSet(response, copyString(vm, "body"),
          OBJ_VAL(copyStringWithLength(vm,
                                       bodyBuffer.data ? bodyBuffer.data : "",
@@ -264,7 +265,7 @@ static Value nativeHttpPost(VM* vm, int argc, Value* args) {
   }
   ObjString* body = (ObjString*)AS_OBJ(args[1]);
   return httpRequest(vm, "POST", (ObjString*)AS_OBJ(args[0]),
-                     body->chars, (size_t)body->length, "http.post failed.");
+                     stringChars(body), (size_t)body->length, "http.post failed.");
 }
 
 static Value nativeHttpRequest(VM* vm, int argc, Value* args) {
@@ -281,22 +282,26 @@ static Value nativeHttpRequest(VM* vm, int argc, Value* args) {
       return runtimeErrorValue(vm, "http.request expects body to be a string or null.");
     }
     ObjString* bodyString = (ObjString*)AS_OBJ(args[2]);
-    body = bodyString->chars;
+    body = stringChars(bodyString);
     bodyLength = (size_t)bodyString->length;
   }
   ObjString* method = (ObjString*)AS_OBJ(args[0]);
-  return httpRequest(vm, method->chars, (ObjString*)AS_OBJ(args[1]),
+  return httpRequest(vm, stringChars(method), (ObjString*)AS_OBJ(args[1]),
                      body, bodyLength, "http.request failed.");
 }
 #else
+static pthread_once_t httpCurlOnce = PTHREAD_ONCE_INIT;
+static bool httpCurlReady = false;
+
+static void httpCurlInit(void) {
+  httpCurlReady = curl_global_init(CURL_GLOBAL_DEFAULT) == CURLE_OK;
+}
+
+// Workers make requests from their own threads, and curl_global_init is not
+// thread-safe, so the first caller runs it and the others wait.
 static bool httpEnsureCurl(void) {
-  static bool initialized = false;
-  static bool ok = false;
-  if (!initialized) {
-    ok = (curl_global_init(CURL_GLOBAL_DEFAULT) == CURLE_OK);
-    initialized = true;
-  }
-  return ok;
+  pthread_once(&httpCurlOnce, httpCurlInit);
+  return httpCurlReady;
 }
 
 static size_t httpWriteCallback(char* contents, size_t size, size_t nmemb, void* userp) {
@@ -323,7 +328,7 @@ static Value httpRequest(VM* vm, const char* method, ObjString* url,
   bufferInit(&bodyBuffer);
   bufferInit(&headerBuffer);
 
-  curl_easy_setopt(curl, CURLOPT_URL, url->chars);
+  curl_easy_setopt(curl, CURLOPT_URL, stringChars(url));
   curl_easy_setopt(curl, CURLOPT_USERAGENT, "Erkao/1.0");
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, httpWriteCallback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &bodyBuffer);
@@ -365,7 +370,7 @@ static Value httpRequest(VM* vm, const char* method, ObjString* url,
     bufferFree(&headerBuffer);
     return runtimeErrorValue(vm, message);
   }
-  mapSet(response, copyString(vm, "status"), NUMBER_VAL((double)status));
+  mapSet(response, copyString(vm, "status"), INT_VAL(status));
   mapSet(response, copyString(vm, "body"),
          OBJ_VAL(copyStringWithLength(vm,
                                       bodyBuffer.data ? bodyBuffer.data : "",
@@ -396,7 +401,7 @@ static Value nativeHttpPost(VM* vm, int argc, Value* args) {
   }
   ObjString* body = (ObjString*)AS_OBJ(args[1]);
   return httpRequest(vm, "POST", (ObjString*)AS_OBJ(args[0]),
-                     body->chars, (size_t)body->length, "http.post failed.");
+                     stringChars(body), (size_t)body->length, "http.post failed.");
 }
 
 static Value nativeHttpRequest(VM* vm, int argc, Value* args) {
@@ -413,11 +418,11 @@ static Value nativeHttpRequest(VM* vm, int argc, Value* args) {
       return runtimeErrorValue(vm, "http.request expects body to be a string or null.");
     }
     ObjString* bodyString = (ObjString*)AS_OBJ(args[2]);
-    body = bodyString->chars;
+    body = stringChars(bodyString);
     bodyLength = (size_t)bodyString->length;
   }
   ObjString* method = (ObjString*)AS_OBJ(args[0]);
-  return httpRequest(vm, method->chars, (ObjString*)AS_OBJ(args[1]),
+  return httpRequest(vm, stringChars(method), (ObjString*)AS_OBJ(args[1]),
                      body, bodyLength, "http.request failed.");
 }
 #endif
@@ -465,41 +470,36 @@ static bool httpSetSocketTimeouts(ErkaoSocket socket, int timeoutMs) {
   return true;
 }
 
-static bool httpWaitForClient(ErkaoSocket server, int timeoutMs) {
-  fd_set readSet;
-  FD_ZERO(&readSet);
-  FD_SET(server, &readSet);
-
-  struct timeval timeout;
-  timeout.tv_sec = timeoutMs / 1000;
-  timeout.tv_usec = (timeoutMs % 1000) * 1000;
+// Waits through the event loop, so tasks and timers keep running while the
+// server is idle or a client is slow. False on a timeout, or on an error in a
+// task run meanwhile, which leaves vm->hadError set.
+static bool httpWaitReadable(VM* vm, ErkaoSocket socket, int timeoutMs) {
+  int events = 0;
+  if (!ioBlock(vm, (intptr_t)socket, PLATFORM_POLL_READ, timeoutMs / 1000.0, &events)) {
+    return false;
+  }
+  return events != 0;
+}
 
 #ifdef _WIN32
-  int ready = select(0, &readSet, NULL, NULL, &timeout);
-#else
-  int ready = select(server + 1, &readSet, NULL, NULL, &timeout);
-#endif
-  if (ready > 0) return true;
-  if (ready == 0) return false;
-
-#ifndef _WIN32
-  if (errno == EINTR) return false;
-#endif
-  return false;
+static INIT_ONCE httpWinsockOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK httpWinsockInit(PINIT_ONCE once, PVOID param, PVOID* context) {
+  (void)once;
+  (void)param;
+  (void)context;
+  WSADATA data;
+  return WSAStartup(MAKEWORD(2, 2), &data) == 0;
 }
+#endif
 
+// Called from every thread that serves; a failed startup is retried.
 static bool httpSocketStartup(void) {
 #ifdef _WIN32
-  static bool started = false;
-  if (!started) {
-    WSADATA data;
-    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
-      return false;
-    }
-    started = true;
-  }
-#endif
+  return InitOnceExecuteOnce(&httpWinsockOnce, httpWinsockInit, NULL, NULL) != FALSE;
+#else
   return true;
+#endif
 }
 
 static bool httpSocketAddrInUse(void) {
@@ -592,9 +592,10 @@ static bool httpPortFromValue(VM* vm, Value value, int* outPort) {
   return true;
 }
 
-static bool httpReadHeaders(ErkaoSocket client, ByteBuffer* buffer, size_t* headerEnd) {
+static bool httpReadHeaders(VM* vm, ErkaoSocket client, ByteBuffer* buffer, size_t* headerEnd) {
   char chunk[1024];
   while (buffer->length < HTTP_MAX_REQUEST_BYTES) {
+    if (!httpWaitReadable(vm, client, HTTP_CLIENT_TIMEOUT_MS)) return false;
     int received = recv(client, chunk, (int)sizeof(chunk), 0);
     if (received <= 0) {
       return false;
@@ -651,13 +652,13 @@ static bool httpAppendHeadersFromMap(ByteBuffer* buffer, ObjMap* headers, bool*
     if (!isObjType(entry->value, OBJ_STRING)) continue;
     ObjString* key = entry->key;
     ObjString* value = (ObjString*)AS_OBJ(entry->value);
-    if (!erkaoHttpHeaderNameSafe(key->chars) || !erkaoHttpHeaderValueSafe(value->chars)) {
+    if (!erkaoHttpHeaderNameSafe(stringChars(key)) || !erkaoHttpHeaderValueSafe(stringChars(value))) {
       continue;
     }
-    if (erkaoHttpStringEqualsIgnoreCaseN(key->chars, key->length, "Content-Type")) {
+    if (erkaoHttpStringEqualsIgnoreCaseN(stringChars(key), key->length, "Content-Type")) {
       if (hasContentType) *hasContentType = true;
     }
-    if (!httpAppendHeader(buffer, key->chars, value->chars)) return false;
+    if (!httpAppendHeader(buffer, stringChars(key), stringChars(value))) return false;
   }
   return true;
 }
@@ -673,8 +674,17 @@ static bool httpSendAll(ErkaoSocket client, const char* data, size_t length) {
   return true;
 }
 
-static bool httpSendResponse(ErkaoSocket client, int status, const char* body,
-                             size_t bodyLength, ObjMap* headers, ObjMap* corsConfig) {
+static bool httpAppendPiece(void* context, const char* chars, int length) {
+  ByteBuffer* buffer = (ByteBuffer*)context;
+  bufferAppendN(buffer, chars, (size_t)length);
+  return !buffer->failed;
+}
+
+// The body is either raw bytes or a string. A string body is copied into the
+// response piece by piece, so a rope built by the handler is never flattened.
+static bool httpSendResponseParts(ErkaoSocket client, int status, const char* body,
+                                  size_t bodyLength, ObjString* bodyString,
+                                  ObjMap* headers, ObjMap* corsConfig) {
   ByteBuffer response;
   bufferInit(&response);
 
@@ -706,21 +716,21 @@ static bool httpSendResponse(ErkaoSocket client, int status, const char* body,
     ObjString* originKey = copyString(corsConfig->vm, "origin");
     if (mapGet(corsConfig, originKey, &originVal) && isObjType(originVal, OBJ_STRING)) {
       ObjString* origin = (ObjString*)AS_OBJ(originVal);
-      (void)httpAppendHeader(&response, "Access-Control-Allow-Origin", origin->chars);
+      (void)httpAppendHeader(&response, "Access-Control-Allow-Origin", stringChars(origin));
     }
     
     Value methodsVal;
     ObjString* methodsKey = copyString(corsConfig->vm, "methods");
     if (mapGet(corsConfig, methodsKey, &methodsVal) && isObjType(methodsVal, OBJ_STRING)) {
       ObjString* methods = (ObjString*)AS_OBJ(methodsVal);
-      (void)httpAppendHeader(&response, "Access-Control-Allow-Methods", methods->chars);
+      (void)httpAppendHeader(&response, "Access-Control-Allow-Methods", stringChars(methods));
     }
     
     Value headersVal;
     ObjString* headersKey = copyString(corsConfig->vm, "headers");
     if (mapGet(corsConfig, headersKey, &headersVal) && isObjType(headersVal, OBJ_STRING)) {
       ObjString* hdrs = (ObjString*)AS_OBJ(headersVal);
-      (void)httpAppendHeader(&response, "Access-Control-Allow-Headers", hdrs->chars);
+      (void)httpAppendHeader(&response, "Access-Control-Allow-Headers", stringChars(hdrs));
     }
   }
 
@@ -741,7 +751,12 @@ static bool httpSendResponse(ErkaoSocket client, int status, const char* body,
     return false;
   }
 
-  if (bodyLength > 0 && body) {
+  if (bodyString) {
+    if (!stringForEachPiece(bodyString, httpAppendPiece, &response)) {
+      bufferFree(&response);
+      return false;
+    }
+  } else if (bodyLength > 0 && body) {
     bufferAppendN(&response, body, bodyLength);
     if (response.failed) {
       bufferFree(&response);
@@ -756,6 +771,11 @@ static bool httpSendResponse(ErkaoSocket client, int status, const char* body,
   return ok;
 }
 
+static bool httpSendResponse(ErkaoSocket client, int status, const char* body,
+                             size_t bodyLength, ObjMap* headers, ObjMap* corsConfig) {
+  return httpSendResponseParts(client, status, body, bodyLength, NULL, headers, corsConfig);
+}
+
 static void httpLogRequest(const struct sockaddr_in* addr,
                            const char* path, size_t pathLen) {
   char ip[INET_ADDRSTRLEN] = "unknown";
@@ -841,7 +861,8 @@ static ObjMap* httpParseHeaders(VM* vm, const char* data, size_t headerEnd) {
   return headers;
 }
 
-static bool httpReadBody(ErkaoSocket client, ByteBuffer* buffer, size_t headerEnd, long contentLength) {
+static bool httpReadBody(VM* vm, ErkaoSocket client, ByteBuffer* buffer, size_t headerEnd,
+                         long contentLength) {
   if (contentLength <= 0) return true;
   if (headerEnd >= HTTP_MAX_REQUEST_BYTES) return false;
   size_t maxBody = HTTP_MAX_REQUEST_BYTES - headerEnd;
@@ -856,6 +877,7 @@ static bool httpReadBody(ErkaoSocket client, ByteBuffer* buffer, size_t headerEn
       return false;
     }
     size_t toRead = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+    if (!httpWaitReadable(vm, client, HTTP_CLIENT_TIMEOUT_MS)) return false;
     int received = recv(client, chunk, (int)toRead, 0);
     if (received <= 0) return false;
     bufferAppendN(buffer, chunk, (size_t)received);
@@ -889,11 +911,10 @@ static ObjMap* httpCreateRequestObject(VM* vm, const char* method, size_t method
 }
 
 static bool httpResponseFromValue(VM* vm, Value value, int* statusOut,
-                                  const char** bodyOut, size_t* bodyLenOut,
-                                  ObjMap** headersOut, ObjMap* requestObj) {
+                                  ObjString** bodyOut, ObjMap** headersOut,
+                                  ObjMap* requestObj) {
   *statusOut = 200;
-  *bodyOut = "";
-  *bodyLenOut = 0;
+  *bodyOut = NULL;
   *headersOut = NULL;
 
   if (isObjType(value, OBJ_FUNCTION) || isObjType(value, OBJ_BOUND_METHOD)) {
@@ -905,13 +926,11 @@ static bool httpResponseFromValue(VM* vm, Value value, int* statusOut,
     if (!vmCallValue(vm, value, 1, &request, &result)) {
       return false;
     }
-    return httpResponseFromValue(vm, result, statusOut, bodyOut, bodyLenOut, headersOut, NULL);
+    return httpResponseFromValue(vm, result, statusOut, bodyOut, headersOut, NULL);
   }
 
   if (isObjType(value, OBJ_STRING)) {
-    ObjString* body = (ObjString*)AS_OBJ(value);
-    *bodyOut = body->chars;
-    *bodyLenOut = (size_t)body->length;
+    *bodyOut = (ObjString*)AS_OBJ(value);
     return true;
   }
 
@@ -933,9 +952,7 @@ static bool httpResponseFromValue(VM* vm, Value value, int* statusOut,
     ObjString* bodyKey = copyString(vm, "body");
     if (mapGet(response, bodyKey, &bodyValue)) {
       if (!isObjType(bodyValue, OBJ_STRING)) return false;
-      ObjString* body = (ObjString*)AS_OBJ(bodyValue);
-      *bodyOut = body->chars;
-      *bodyLenOut = (size_t)body->length;
+      *bodyOut = (ObjString*)AS_OBJ(bodyValue);
     }
 
     Value headersValue;
@@ -1009,7 +1026,8 @@ static Value nativeHttpServe(VM* vm, int argc, Value* args) {
         continue;
       }
     }
-    if (!httpWaitForClient(server, HTTP_ACCEPT_TIMEOUT_MS)) {
+    if (!httpWaitReadable(vm, server, HTTP_ACCEPT_TIMEOUT_MS)) {
+      running = !vm->hadError;
       continue;
     }
     struct sockaddr_in clientAddr;
@@ -1030,8 +1048,10 @@ static Value nativeHttpServe(VM* vm, int argc, Value* args) {
     ByteBuffer request;
     bufferInit(&request);
     size_t headerEnd = 0;
-    if (!httpReadHeaders(client, &request, &headerEnd)) {
-      if (request.length >= HTTP_MAX_REQUEST_BYTES) {
+    if (!httpReadHeaders(vm, client, &request, &headerEnd)) {
+      if (vm->hadError) {
+        running = false;
+      } else if (request.length >= HTTP_MAX_REQUEST_BYTES) {
         (void)httpSendResponse(client, 413, "payload too large",
                                strlen("payload too large"), NULL, corsConfig);
       } else if (request.length > 0) {
@@ -1108,9 +1128,13 @@ static Value nativeHttpServe(VM* vm, int argc, Value* args) {
     if (isHandler) {
       long contentLength = httpGetContentLength(request.data, headerEnd);
       if (contentLength > 0) {
-        if (!httpReadBody(client, &request, headerEnd, contentLength)) {
-          (void)httpSendResponse(client, 413, "payload too large",
-                                 strlen("payload too large"), NULL, corsConfig);
+        if (!httpReadBody(vm, client, &request, headerEnd, contentLength)) {
+          if (vm->hadError) {
+            running = false;
+          } else {
+            (void)httpSendResponse(client, 413, "payload too large",
+                                   strlen("payload too large"), NULL, corsConfig);
+          }
           bufferFree(&request);
           erkaoCloseSocket(client);
           continue;
@@ -1131,17 +1155,17 @@ static Value nativeHttpServe(VM* vm, int argc, Value* args) {
     }
 
     int status = 200;
-    const char* body = "";
-    size_t bodyLen = 0;
+    ObjString* body = NULL;
     ObjMap* headers = NULL;
-    if (!httpResponseFromValue(vm, routeValue, &status, &body, &bodyLen, &headers, requestObj)) {
+    if (!httpResponseFromValue(vm, routeValue, &status, &body, &headers, requestObj)) {
       httpSendResponse(client, 500, "invalid response", strlen("invalid response"), NULL, corsConfig);
       bufferFree(&request);
       erkaoCloseSocket(client);
       continue;
     }
 
-    if (!httpSendResponse(client, status, body, bodyLen, headers, corsConfig)) {
+    size_t bodyLength = body ? (size_t)body->length : 0;
+    if (!httpSendResponseParts(client, status, NULL, bodyLength, body, headers, corsConfig)) {
       (void)httpSendResponse(client, 500, "internal error", strlen("internal error"), NULL, NULL);
     }
     bufferFree(&request);
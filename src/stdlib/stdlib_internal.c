@@ -25,7 +25,7 @@ ObjInstance* makeModule(VM* vm, const char* name) {
   ObjString* className = copyString(vm, name);
   ObjMap* methods = newMap(vm);
   ObjClass* klass = newClass(vm, className, methods);
-  ObjInstance* module = newInstance(vm, klass);
+  ObjInstance* module = newInstanceWithFields(vm, klass, newMap(vm));
   ObjString* defaultKey = copyString(vm, "default");
   mapSet(module->fields, defaultKey, OBJ_VAL(module));
   return module;
@@ -247,3 +247,84 @@ bool stdlibUnsafeEnabled(VM* vm, unsigned int featureFlag, const char* featureEn
   if (!featureEnv || featureEnv[0] == '\0') return false;
   return envTruthy(featureEnv);
 }
+
+bool bulkOperandRead(VM* vm, Value value, BulkOperand* operand, const char* message) {
+  operand->data = NULL;
+  operand->length = 0;
+  operand->packed = false;
+  operand->owned = NULL;
+  if (isObjType(value, OBJ_TYPED_ARRAY)) {
+    ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(value);
+    operand->length = array->length;
+    operand->packed = true;
+    if (array->kind == TYPED_F64) {
+      operand->data = (const double*)array->data;
+      return true;
+    }
+  } else if (isObjType(value, OBJ_ARRAY)) {
+    ObjArray* array = (ObjArray*)AS_OBJ(value);
+    for (int i = 0; i < array->count; i++) {
+      if (!IS_NUMBER(array->items[i])) {
+        runtimeErrorValue(vm, message);
+        return false;
+      }
+    }
+    operand->length = array->count;
+  } else {
+    runtimeErrorValue(vm, message);
+    return false;
+  }
+
+  operand->owned = (double*)malloc(sizeof(double) * (size_t)(operand->length + 1));
+  if (!operand->owned) {
+    runtimeErrorValue(vm, "Out of memory while reading numbers.");
+    return false;
+  }
+  if (operand->packed) {
+    ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(value);
+    for (int i = 0; i < array->length; i++) {
+      operand->owned[i] = AS_NUMBER(typedArrayGet(array, i));
+    }
+  } else {
+    ObjArray* array = (ObjArray*)AS_OBJ(value);
+    for (int i = 0; i < array->count; i++) {
+      operand->owned[i] = AS_NUMBER(array->items[i]);
+    }
+  }
+  operand->data = operand->owned;
+  return true;
+}
+
+void bulkOperandFree(BulkOperand* operand) {
+  free(operand->owned);
+  operand->owned = NULL;
+}
+
+bool bulkOutputInit(VM* vm, BulkOutput* output, int length, bool packed) {
+  output->packed = NULL;
+  output->data = NULL;
+  output->length = length;
+  if (packed) {
+    output->packed = newTypedArray(vm, TYPED_F64, length);
+    if (!output->packed) return false;
+    output->data = (double*)output->packed->data;
+    return true;
+  }
+  output->data = (double*)malloc(sizeof(double) * (size_t)(length + 1));
+  if (!output->data) {
+    runtimeErrorValue(vm, "Out of memory while allocating numbers.");
+    return false;
+  }
+  return true;
+}
+
+Value bulkOutputFinish(VM* vm, BulkOutput* output) {
+  if (output->packed) return OBJ_VAL(output->packed);
+  ObjArray* array = newArrayWithCapacity(vm, output->length);
+  for (int i = 0; array && i < output->length; i++) {
+    arrayWrite(array, NUMBER_VAL(output->data[i]));
+  }
+  free(output->data);
+  output->data = NULL;
+  return array ? OBJ_VAL(array) : NULL_VAL;
+}
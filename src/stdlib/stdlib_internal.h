@@ -47,6 +47,31 @@ void stringListAdd(StringList* list, const char* value);
 void stringListAddWithLength(StringList* list, const char* value, size_t length);
 void stringListSort(StringList* list);
 
+// A number array or typed array read as contiguous doubles for the bulk
+// kernels. An f64 typed array is used in place; anything else is copied into
+// `owned`, which bulkOperandFree releases.
+typedef struct {
+  const double* data;
+  int length;
+  bool packed;
+  double* owned;
+} BulkOperand;
+
+bool bulkOperandRead(VM* vm, Value value, BulkOperand* operand, const char* message);
+void bulkOperandFree(BulkOperand* operand);
+
+// Where a bulk kernel writes its result: straight into a new f64 typed array
+// when an input was packed, or into a scratch buffer that bulkOutputFinish
+// turns into a plain array.
+typedef struct {
+  ObjTypedArray* packed;
+  double* data;
+  int length;
+} BulkOutput;
+
+bool bulkOutputInit(VM* vm, BulkOutput* output, int length, bool packed);
+Value bulkOutputFinish(VM* vm, BulkOutput* output);
+
 bool numberIsFinite(double value);
 bool stdlibUnsafeEnabled(VM* vm, unsigned int featureFlag, const char* featureEnv);
 
@@ -1,6 +1,9 @@
 #include "stdlib_internal.h"
 
+#include <inttypes.h>
+
 typedef struct {
+  ObjString* source;
   const char* start;
   const char* current;
   const char* error;
@@ -87,7 +90,27 @@ static bool jsonAppendUtf8(ByteBuffer* buffer, uint32_t codepoint, JsonParser* p
 
 static Value jsonParseValue(VM* vm, JsonParser* parser, bool* ok);
 
+// A string without escapes is the same bytes as the input, so it becomes a
+// view of the source. Keys are short enough to be interned and are looked up
+// straight from the input instead of through a scratch buffer.
+static bool jsonParsePlainString(VM* vm, JsonParser* parser, Value* out) {
+  const char* start = parser->current + 1;
+  const char* end = start;
+  while (*end != '"') {
+    if (*end == '\\' || (unsigned char)*end < 0x20) return false;
+    end++;
+  }
+  ObjString* result = newStringView(vm, parser->source, (int)(start - parser->start),
+                                    (int)(end - start));
+  parser->current = end + 1;
+  *out = result ? OBJ_VAL(result) : NULL_VAL;
+  return result != NULL;
+}
+
 static Value jsonParseString(VM* vm, JsonParser* parser, bool* ok) {
+  Value plain;
+  if (jsonParsePlainString(vm, parser, &plain)) return plain;
+
   ByteBuffer buffer;
   bufferInit(&buffer);
 
@@ -216,12 +239,7 @@ static Value jsonParseNumber(VM* vm, JsonParser* parser, bool* ok) {
     }
   }
 
-  char* end = NULL;
-  double value = strtod(start, &end);
-  if (end != parser->current) {
-    return jsonFail(parser, ok, "json.parse invalid number.");
-  }
-  return NUMBER_VAL(value);
+  return numberFromText(start, (int)(parser->current - start));
 }
 
 static Value jsonParseArray(VM* vm, JsonParser* parser, bool* ok) {
@@ -321,7 +339,7 @@ static bool jsonAppendEscapedString(ByteBuffer* buffer, ObjString* string, const
     return false;
   }
   for (int i = 0; i < string->length; i++) {
-    unsigned char c = (unsigned char)string->chars[i];
+    unsigned char c = (unsigned char)stringChars(string)[i];
     switch (c) {
       case '"':
         bufferAppendN(buffer, "\\\"", 2);
@@ -370,7 +388,7 @@ static bool jsonAppendEscapedString(ByteBuffer* buffer, ObjString* string, const
 static int compareJsonEntries(const void* a, const void* b) {
   const MapEntryValue* left = *(const MapEntryValue* const*)a;
   const MapEntryValue* right = *(const MapEntryValue* const*)b;
-  return strcmp(left->key->chars, right->key->chars);
+  return strcmp(stringChars(left->key), stringChars(right->key));
 }
 
 static bool jsonStringifyArray(VM* vm, ByteBuffer* buffer, ObjArray* array, int depth,
@@ -395,6 +413,28 @@ static bool jsonStringifyArray(VM* vm, ByteBuffer* buffer, ObjArray* array, int
   return true;
 }
 
+// A typed array is written as a plain array of its numbers.
+static bool jsonStringifyTyped(VM* vm, ByteBuffer* buffer, ObjTypedArray* array, int depth,
+                               const char** error) {
+  bufferAppendChar(buffer, '[');
+  if (buffer->failed) {
+    *error = "json.stringify out of memory.";
+    return false;
+  }
+  for (int i = 0; i < array->length; i++) {
+    if (i > 0) bufferAppendChar(buffer, ',');
+    if (!jsonStringifyValue(vm, buffer, typedArrayGet(array, i), depth + 1, error)) {
+      return false;
+    }
+  }
+  bufferAppendChar(buffer, ']');
+  if (buffer->failed) {
+    *error = "json.stringify out of memory.";
+    return false;
+  }
+  return true;
+}
+
 static bool jsonStringifyMap(VM* vm, ByteBuffer* buffer, ObjMap* map, int depth,
                              const char** error) {
   (void)vm;
@@ -450,7 +490,7 @@ static bool jsonStringifyValue(VM* vm, ByteBuffer* buffer, Value value, int dept
     return false;
   }
 
-  switch (value.type) {
+  switch (valueType(value)) {
     case VAL_NULL:
       bufferAppendN(buffer, "null", 4);
       if (buffer->failed) {
@@ -488,6 +528,16 @@ static bool jsonStringifyValue(VM* vm, ByteBuffer* buffer, Value value, int dept
       }
       return true;
     }
+    case VAL_INT: {
+      char temp[32];
+      int length = snprintf(temp, sizeof(temp), "%" PRId64, AS_INT(value));
+      bufferAppendN(buffer, temp, (size_t)length);
+      if (buffer->failed) {
+        *error = "json.stringify out of memory.";
+        return false;
+      }
+      return true;
+    }
     case VAL_OBJ: {
       Obj* obj = AS_OBJ(value);
       if (obj->type == OBJ_STRING) {
@@ -496,6 +546,9 @@ static bool jsonStringifyValue(VM* vm, ByteBuffer* buffer, Value value, int dept
       if (obj->type == OBJ_ARRAY) {
         return jsonStringifyArray(vm, buffer, (ObjArray*)obj, depth, error);
       }
+      if (obj->type == OBJ_TYPED_ARRAY) {
+        return jsonStringifyTyped(vm, buffer, (ObjTypedArray*)obj, depth, error);
+      }
       if (obj->type == OBJ_MAP) {
         return jsonStringifyMap(vm, buffer, (ObjMap*)obj, depth, error);
       }
@@ -515,8 +568,9 @@ static Value nativeJsonParse(VM* vm, int argc, Value* args) {
 
   ObjString* input = (ObjString*)AS_OBJ(args[0]);
   JsonParser parser;
-  parser.start = input->chars;
-  parser.current = input->chars;
+  parser.source = input;
+  parser.start = stringChars(input);
+  parser.current = parser.start;
   parser.error = NULL;
 
   bool ok = true;
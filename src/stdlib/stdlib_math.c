@@ -1,4 +1,5 @@
 #include "stdlib_internal.h"
+#include "bulk_kernels.h"
 
 #include <math.h>
 
@@ -20,24 +21,28 @@ static double roundNumber(double value) {
 static Value nativeMathAbs(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!expectNumberArg(vm, args[0], "math.abs expects a number.")) return NULL_VAL;
+  if (IS_INT(args[0])) return AS_INT(args[0]) < 0 ? numberNegate(args[0]) : args[0];
   return NUMBER_VAL(fabs(AS_NUMBER(args[0])));
 }
 
 static Value nativeMathFloor(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!expectNumberArg(vm, args[0], "math.floor expects a number.")) return NULL_VAL;
+  if (IS_INT(args[0])) return args[0];
   return NUMBER_VAL(floor(AS_NUMBER(args[0])));
 }
 
 static Value nativeMathCeil(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!expectNumberArg(vm, args[0], "math.ceil expects a number.")) return NULL_VAL;
+  if (IS_INT(args[0])) return args[0];
   return NUMBER_VAL(ceil(AS_NUMBER(args[0])));
 }
 
 static Value nativeMathRound(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!expectNumberArg(vm, args[0], "math.round expects a number.")) return NULL_VAL;
+  if (IS_INT(args[0])) return args[0];
   return NUMBER_VAL(roundNumber(AS_NUMBER(args[0])));
 }
 
@@ -58,48 +63,151 @@ static Value nativeMathPow(VM* vm, int argc, Value* args) {
   return NUMBER_VAL(pow(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
 }
 
+static Value nativeMathIdiv(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!expectNumberArg(vm, args[0], "math.idiv expects numbers.")) return NULL_VAL;
+  if (!expectNumberArg(vm, args[1], "math.idiv expects numbers.")) return NULL_VAL;
+  return numberIntDivide(args[0], args[1]);
+}
+
+static bool isBulkArg(Value value) {
+  return isObjType(value, OBJ_ARRAY) || isObjType(value, OBJ_TYPED_ARRAY);
+}
+
+// Reads a non-empty array for the bulk reductions.
+static bool readSamples(VM* vm, Value value, BulkOperand* samples, const char* message) {
+  if (!bulkOperandRead(vm, value, samples, message)) return false;
+  if (samples->length == 0) {
+    bulkOperandFree(samples);
+    runtimeErrorValue(vm, message);
+    return false;
+  }
+  return true;
+}
+
+static Value bulkMinMax(VM* vm, Value value, bool max, const char* message) {
+  BulkOperand samples;
+  if (!readSamples(vm, value, &samples, message)) return NULL_VAL;
+  const BulkKernels* kernels = bulkKernels();
+  size_t count = (size_t)samples.length;
+  double result = max ? kernels->max(samples.data, count) : kernels->min(samples.data, count);
+  bulkOperandFree(&samples);
+  return NUMBER_VAL(result);
+}
+
 static Value nativeMathMin(VM* vm, int argc, Value* args) {
   if (argc < 1) {
     return runtimeErrorValue(vm, "math.min expects at least one number.");
   }
+  if (argc == 1 && isBulkArg(args[0])) {
+    return bulkMinMax(vm, args[0], false, "math.min expects a non-empty number array.");
+  }
   if (!expectNumberArg(vm, args[0], "math.min expects numbers.")) return NULL_VAL;
-  double result = AS_NUMBER(args[0]);
+  Value result = args[0];
   for (int i = 1; i < argc; i++) {
     if (!expectNumberArg(vm, args[i], "math.min expects numbers.")) return NULL_VAL;
-    double value = AS_NUMBER(args[i]);
-    if (value < result) result = value;
+    if (numberLess(args[i], result)) result = args[i];
   }
-  return NUMBER_VAL(result);
+  return result;
 }
 
 static Value nativeMathMax(VM* vm, int argc, Value* args) {
   if (argc < 1) {
     return runtimeErrorValue(vm, "math.max expects at least one number.");
   }
+  if (argc == 1 && isBulkArg(args[0])) {
+    return bulkMinMax(vm, args[0], true, "math.max expects a non-empty number array.");
+  }
   if (!expectNumberArg(vm, args[0], "math.max expects numbers.")) return NULL_VAL;
-  double result = AS_NUMBER(args[0]);
+  Value result = args[0];
   for (int i = 1; i < argc; i++) {
     if (!expectNumberArg(vm, args[i], "math.max expects numbers.")) return NULL_VAL;
-    double value = AS_NUMBER(args[i]);
-    if (value > result) result = value;
+    if (numberLess(result, args[i])) result = args[i];
   }
-  return NUMBER_VAL(result);
+  return result;
+}
+
+static Value bulkClamp(VM* vm, Value* args) {
+  if (!expectNumberArg(vm, args[1], "math.clamp expects numbers.")) return NULL_VAL;
+  if (!expectNumberArg(vm, args[2], "math.clamp expects numbers.")) return NULL_VAL;
+  double lo = AS_NUMBER(args[1]);
+  double hi = AS_NUMBER(args[2]);
+  if (hi < lo) {
+    return runtimeErrorValue(vm, "math.clamp expects min <= max.");
+  }
+  BulkOperand values;
+  if (!bulkOperandRead(vm, args[0], &values, "math.clamp expects numbers.")) return NULL_VAL;
+  BulkOutput out;
+  bool ok = bulkOutputInit(vm, &out, values.length, values.packed);
+  if (ok) bulkKernels()->clamp(values.data, lo, hi, out.data, (size_t)values.length);
+  bulkOperandFree(&values);
+  return ok ? bulkOutputFinish(vm, &out) : NULL_VAL;
 }
 
 static Value nativeMathClamp(VM* vm, int argc, Value* args) {
   (void)argc;
+  if (isBulkArg(args[0])) return bulkClamp(vm, args);
   if (!expectNumberArg(vm, args[0], "math.clamp expects numbers.")) return NULL_VAL;
   if (!expectNumberArg(vm, args[1], "math.clamp expects numbers.")) return NULL_VAL;
   if (!expectNumberArg(vm, args[2], "math.clamp expects numbers.")) return NULL_VAL;
-  double value = AS_NUMBER(args[0]);
-  double minValue = AS_NUMBER(args[1]);
-  double maxValue = AS_NUMBER(args[2]);
-  if (minValue > maxValue) {
+  Value value = args[0];
+  if (numberLess(args[2], args[1])) {
     return runtimeErrorValue(vm, "math.clamp expects min <= max.");
   }
-  if (value < minValue) value = minValue;
-  if (value > maxValue) value = maxValue;
-  return NUMBER_VAL(value);
+  if (numberLess(value, args[1])) value = args[1];
+  if (numberLess(args[2], value)) value = args[2];
+  return value;
+}
+
+static Value nativeMathSum(VM* vm, int argc, Value* args) {
+  (void)argc;
+  BulkOperand values;
+  if (!bulkOperandRead(vm, args[0], &values, "math.sum expects a number array.")) {
+    return NULL_VAL;
+  }
+  double sum = bulkKernels()->sum(values.data, (size_t)values.length);
+  bulkOperandFree(&values);
+  return NUMBER_VAL(sum);
+}
+
+static Value nativeMathMean(VM* vm, int argc, Value* args) {
+  (void)argc;
+  BulkOperand samples;
+  if (!readSamples(vm, args[0], &samples, "math.mean expects a non-empty number array.")) {
+    return NULL_VAL;
+  }
+  double mean = bulkKernels()->sum(samples.data, (size_t)samples.length) / samples.length;
+  bulkOperandFree(&samples);
+  return NUMBER_VAL(mean);
+}
+
+// The population variance, from the mean and then the squared deviations
+// from it, which loses less precision than summing squares.
+static Value nativeMathVariance(VM* vm, int argc, Value* args) {
+  (void)argc;
+  BulkOperand samples;
+  if (!readSamples(vm, args[0], &samples, "math.variance expects a non-empty number array.")) {
+    return NULL_VAL;
+  }
+  const BulkKernels* kernels = bulkKernels();
+  size_t count = (size_t)samples.length;
+  double mean = kernels->sum(samples.data, count) / samples.length;
+  double variance = kernels->deviation(samples.data, mean, count) / samples.length;
+  bulkOperandFree(&samples);
+  return NUMBER_VAL(variance);
+}
+
+static Value nativeMathCumsum(VM* vm, int argc, Value* args) {
+  (void)argc;
+  BulkOperand values;
+  if (!bulkOperandRead(vm, args[0], &values, "math.cumsum expects a number array.")) {
+    return NULL_VAL;
+  }
+  BulkOutput out;
+  bool ok = bulkOutputInit(vm, &out, values.length, values.packed);
+  if (ok) bulkCumsum(values.data, out.data, (size_t)values.length);
+  bulkOperandFree(&values);
+  return ok ? bulkOutputFinish(vm, &out) : NULL_VAL;
 }
 
 
@@ -110,9 +218,14 @@ void stdlib_register_math(VM* vm, ObjInstance* module) {
   moduleAdd(vm, module, "round", nativeMathRound, 1);
   moduleAdd(vm, module, "sqrt", nativeMathSqrt, 1);
   moduleAdd(vm, module, "pow", nativeMathPow, 2);
+  moduleAdd(vm, module, "idiv", nativeMathIdiv, 2);
   moduleAdd(vm, module, "min", nativeMathMin, -1);
   moduleAdd(vm, module, "max", nativeMathMax, -1);
   moduleAdd(vm, module, "clamp", nativeMathClamp, 3);
+  moduleAdd(vm, module, "sum", nativeMathSum, 1);
+  moduleAdd(vm, module, "mean", nativeMathMean, 1);
+  moduleAdd(vm, module, "variance", nativeMathVariance, 1);
+  moduleAdd(vm, module, "cumsum", nativeMathCumsum, 1);
   moduleAddValue(vm, module, "PI", NUMBER_VAL(3.141592653589793));
   moduleAddValue(vm, module, "E", NUMBER_VAL(2.718281828459045));
 }
@@ -7,30 +7,24 @@ static Value nativePathJoin(VM* vm, int argc, Value* args) {
   }
   ObjString* left = (ObjString*)AS_OBJ(args[0]);
   ObjString* right = (ObjString*)AS_OBJ(args[1]);
-  if (isAbsolutePathString(right->chars)) {
-    return OBJ_VAL(copyStringWithLength(vm, right->chars, right->length));
+  if (isAbsolutePathString(stringChars(right))) {
+    return OBJ_VAL(copyStringWithLength(vm, stringChars(right), right->length));
   }
 
-  char sep = pickSeparator(left->chars, right->chars);
+  char sep = pickSeparator(stringChars(left), stringChars(right));
   bool needSep = left->length > 0 &&
-                 left->chars[left->length - 1] != '/' &&
-                 left->chars[left->length - 1] != '\\';
-  size_t total = (size_t)left->length + (needSep ? 1 : 0) + (size_t)right->length;
-  char* buffer = (char*)malloc(total + 1);
-  if (!buffer) {
-    return runtimeErrorValue(vm, "path.join out of memory.");
-  }
-  memcpy(buffer, left->chars, (size_t)left->length);
-  size_t offset = (size_t)left->length;
+                 stringChars(left)[left->length - 1] != '/' &&
+                 stringChars(left)[left->length - 1] != '\\';
+  int total = left->length + (needSep ? 1 : 0) + right->length;
+  ObjString* result = newStringBuffer(vm, total);
+  if (!result) return NULL_VAL;
+  memcpy(result->bytes, stringChars(left), (size_t)left->length);
+  int offset = left->length;
   if (needSep) {
-    buffer[offset++] = sep;
+    result->bytes[offset++] = sep;
   }
-  memcpy(buffer + offset, right->chars, (size_t)right->length);
-  buffer[total] = '\0';
-
-  ObjString* result = copyStringWithLength(vm, buffer, (int)total);
-  free(buffer);
-  return OBJ_VAL(result);
+  memcpy(result->bytes + offset, stringChars(right), (size_t)right->length);
+  return OBJ_VAL(finishString(vm, result));
 }
 
 static Value nativePathDirname(VM* vm, int argc, Value* args) {
@@ -39,16 +33,16 @@ static Value nativePathDirname(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "path.dirname expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  const char* sep = findLastSeparator(path->chars);
+  const char* sep = findLastSeparator(stringChars(path));
   if (!sep) {
     return OBJ_VAL(copyString(vm, "."));
   }
 
-  size_t length = (size_t)(sep - path->chars);
+  size_t length = (size_t)(sep - stringChars(path));
   if (length == 0) {
     length = 1;
-  } else if (length == 2 && path->chars[1] == ':' &&
-             (path->chars[2] == '\\' || path->chars[2] == '/')) {
+  } else if (length == 2 && stringChars(path)[1] == ':' &&
+             (stringChars(path)[2] == '\\' || stringChars(path)[2] == '/')) {
     length = 3;
   }
 
@@ -56,7 +50,7 @@ static Value nativePathDirname(VM* vm, int argc, Value* args) {
     length = (size_t)path->length;
   }
 
-  return OBJ_VAL(copyStringWithLength(vm, path->chars, (int)length));
+  return OBJ_VAL(copyStringWithLength(vm, stringChars(path), (int)length));
 }
 
 static Value nativePathBasename(VM* vm, int argc, Value* args) {
@@ -65,8 +59,8 @@ static Value nativePathBasename(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "path.basename expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  const char* sep = findLastSeparator(path->chars);
-  const char* base = sep ? sep + 1 : path->chars;
+  const char* sep = findLastSeparator(stringChars(path));
+  const char* base = sep ? sep + 1 : stringChars(path);
   return OBJ_VAL(copyString(vm, base));
 }
 
@@ -76,8 +70,8 @@ static Value nativePathExtname(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "path.extname expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  const char* sep = findLastSeparator(path->chars);
-  const char* base = sep ? sep + 1 : path->chars;
+  const char* sep = findLastSeparator(stringChars(path));
+  const char* base = sep ? sep + 1 : stringChars(path);
   const char* dot = strrchr(base, '.');
   if (!dot || dot == base) {
     return OBJ_VAL(copyString(vm, ""));
@@ -91,7 +85,7 @@ static Value nativePathIsAbs(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "path.isAbs expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  return BOOL_VAL(isAbsolutePathString(path->chars));
+  return BOOL_VAL(isAbsolutePathString(stringChars(path)));
 }
 
 static Value nativePathStem(VM* vm, int argc, Value* args) {
@@ -100,8 +94,8 @@ static Value nativePathStem(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "path.stem expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  const char* sep = findLastSeparator(path->chars);
-  const char* base = sep ? sep + 1 : path->chars;
+  const char* sep = findLastSeparator(stringChars(path));
+  const char* base = sep ? sep + 1 : stringChars(path);
   const char* dot = strrchr(base, '.');
   if (!dot || dot == base) {
     return OBJ_VAL(copyString(vm, base));
@@ -115,7 +109,7 @@ static Value nativePathNormalize(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "path.normalize expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  const char* text = path->chars;
+  const char* text = stringChars(path);
   bool hasBackslash = strchr(text, '\\') != NULL;
   char sep = hasBackslash ? '\\' : '/';
   bool isAbs = isAbsolutePathString(text);
@@ -224,8 +218,8 @@ static Value nativePathSplit(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "path.split expects a path string.");
   }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
-  const char* sep = findLastSeparator(path->chars);
-  const char* base = sep ? sep + 1 : path->chars;
+  const char* sep = findLastSeparator(stringChars(path));
+  const char* base = sep ? sep + 1 : stringChars(path);
   const char* dot = strrchr(base, '.');
   ObjMap* map = newMap(vm);
 
@@ -238,9 +232,9 @@ static Value nativePathSplit(VM* vm, int argc, Value* args) {
   if (!sep) {
     dirValue = OBJ_VAL(copyString(vm, "."));
   } else {
-    size_t length = (size_t)(sep - path->chars);
+    size_t length = (size_t)(sep - stringChars(path));
     if (length == 0) length = 1;
-    dirValue = OBJ_VAL(copyStringWithLength(vm, path->chars, (int)length));
+    dirValue = OBJ_VAL(copyStringWithLength(vm, stringChars(path), (int)length));
   }
 
   Value baseValue = OBJ_VAL(copyString(vm, base));
@@ -10,9 +10,14 @@ static Value nativePluginLoad(VM* vm, int argc, Value* args) {
   if (!isObjType(args[0], OBJ_STRING)) {
     return runtimeErrorValue(vm, "plugin.load expects a path string.");
   }
+  // Plugins register parser rules for the whole process, which workers read
+  // while they compile.
+  if (vm->workerParent) {
+    return runtimeErrorValue(vm, "plugin.load is not available in a worker.");
+  }
   ObjString* path = (ObjString*)AS_OBJ(args[0]);
   char error[256];
-  if (!pluginLoad(vm, path->chars, error, sizeof(error))) {
+  if (!pluginLoad(vm, stringChars(path), error, sizeof(error))) {
     return runtimeErrorValue(vm, error);
   }
   return BOOL_VAL(true);
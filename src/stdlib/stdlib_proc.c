@@ -1,4 +1,5 @@
 #include "stdlib_internal.h"
+#include "platform.h"
 
 #include <ctype.h>
 #include <limits.h>
@@ -9,6 +10,7 @@
 #include <process.h>
 #else
 #include <errno.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -28,6 +30,62 @@ static bool procLooksLikeProgramPath(const char* text) {
   return true;
 }
 
+#ifndef _WIN32
+static Value procExitValue(int status) {
+  if (WIFEXITED(status)) {
+    return INT_VAL(WEXITSTATUS(status));
+  }
+  if (WIFSIGNALED(status)) {
+    return INT_VAL(128 + WTERMSIG(status));
+  }
+  return INT_VAL(status);
+}
+
+static bool procReap(pid_t pid, int* status) {
+  for (;;) {
+    pid_t waited = waitpid(pid, status, 0);
+    if (waited == pid) return true;
+    if (waited < 0 && errno == EINTR) continue;
+    return false;
+  }
+}
+
+// A pidfd turns readable when the child exits, so a task parks on it in the
+// event loop and the main script keeps running tasks while it waits.
+static Value procReaped(VM* vm, intptr_t fd, intptr_t data, int events) {
+  (void)events;
+  int status = 0;
+  bool reaped = procReap((pid_t)data, &status);
+  close((int)fd);
+  if (!reaped) return runtimeErrorValue(vm, "proc.run failed while waiting for process.");
+  return procExitValue(status);
+}
+
+static Value procWait(VM* vm, pid_t pid) {
+  int pidfd = -1;
+#ifdef SYS_pidfd_open
+  pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+#endif
+  if (pidfd >= 0) {
+    if (fiberCanPark(vm)) {
+      if (!ioPark(vm, pidfd, PLATFORM_POLL_READ, procReaped, (intptr_t)pid)) close(pidfd);
+      return NULL_VAL;
+    }
+    int events = 0;
+    if (!ioBlock(vm, pidfd, PLATFORM_POLL_READ, -1, &events)) {
+      close(pidfd);
+      return NULL_VAL;
+    }
+    return procReaped(vm, pidfd, (intptr_t)pid, events);
+  }
+  int status = 0;
+  if (!procReap(pid, &status)) {
+    return runtimeErrorValue(vm, "proc.run failed while waiting for process.");
+  }
+  return procExitValue(status);
+}
+#endif
+
 static Value nativeProcRun(VM* vm, int argc, Value* args) {
   if (!stdlibUnsafeEnabled(vm, ERKAO_UNSAFE_PROC, "ERKAO_ALLOW_PROC")) {
     return runtimeErrorValue(vm,
@@ -47,7 +105,7 @@ static Value nativeProcRun(VM* vm, int argc, Value* args) {
       return runtimeErrorValue(vm, "proc.run expects args to be an array of strings.");
     }
     procArgs = (ObjArray*)AS_OBJ(args[1]);
-  } else if (!procLooksLikeProgramPath(program->chars)) {
+  } else if (!procLooksLikeProgramPath(stringChars(program))) {
     return runtimeErrorValue(vm,
                              "proc.run executes a program directly (no shell). "
                              "Pass arguments using an array.");
@@ -59,14 +117,14 @@ static Value nativeProcRun(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "proc.run out of memory.");
   }
   memset(argv, 0, sizeof(char*) * ((size_t)extra + 2));
-  argv[0] = program->chars;
+  argv[0] = stringChars(program);
   for (int i = 0; i < extra; i++) {
     if (!isObjType(procArgs->items[i], OBJ_STRING)) {
       free(argv);
       return runtimeErrorValue(vm, "proc.run expects args to be an array of strings.");
     }
     ObjString* part = (ObjString*)AS_OBJ(procArgs->items[i]);
-    argv[i + 1] = part->chars;
+    argv[i + 1] = stringChars(part);
   }
   argv[extra + 1] = NULL;
 
@@ -79,7 +137,7 @@ static Value nativeProcRun(VM* vm, int argc, Value* args) {
   if (result > INT_MAX) {
     return runtimeErrorValue(vm, "proc.run exit code overflow.");
   }
-  return NUMBER_VAL((double)result);
+  return INT_VAL(result);
 #else
   pid_t pid = fork();
   if (pid < 0) {
@@ -91,23 +149,8 @@ static Value nativeProcRun(VM* vm, int argc, Value* args) {
     _exit(127);
   }
 
-  int status = 0;
-  for (;;) {
-    pid_t waited = waitpid(pid, &status, 0);
-    if (waited == pid) break;
-    if (waited < 0 && errno == EINTR) continue;
-    free(argv);
-    return runtimeErrorValue(vm, "proc.run failed while waiting for process.");
-  }
   free(argv);
-
-  if (WIFEXITED(status)) {
-    return NUMBER_VAL((double)WEXITSTATUS(status));
-  }
-  if (WIFSIGNALED(status)) {
-    return NUMBER_VAL((double)(128 + WTERMSIG(status)));
-  }
-  return NUMBER_VAL((double)status);
+  return procWait(vm, pid);
 #endif
 }
 
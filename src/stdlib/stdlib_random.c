@@ -23,11 +23,11 @@
 #endif
 #endif
 
-static uint64_t gRandomState = 0;
-static bool gRandomSeeded = false;
-static bool gRandomDeterministic = false;
-static bool gRandomHasSpare = false;
-static double gRandomSpare = 0.0;
+static ERKAO_THREAD_LOCAL uint64_t gRandomState = 0;
+static ERKAO_THREAD_LOCAL bool gRandomSeeded = false;
+static ERKAO_THREAD_LOCAL bool gRandomDeterministic = false;
+static ERKAO_THREAD_LOCAL bool gRandomHasSpare = false;
+static ERKAO_THREAD_LOCAL double gRandomSpare = 0.0;
 
 static void randomSeedFallbackIfNeeded(void) {
   if (gRandomSeeded) return;
@@ -181,7 +181,7 @@ static Value nativeRandomInt(VM* vm, int argc, Value* args) {
     if (max <= 0) {
       return runtimeErrorValue(vm, "random.int expects max > 0.");
     }
-    return NUMBER_VAL((double)randomNextBounded((uint64_t)max));
+    return INT_VAL((int64_t)randomNextBounded((uint64_t)max));
   }
 
   if (!IS_NUMBER(args[1])) {
@@ -194,7 +194,7 @@ static Value nativeRandomInt(VM* vm, int argc, Value* args) {
   }
   uint64_t span = (uint64_t)(max - min);
   uint64_t value = randomNextBounded(span);
-  return NUMBER_VAL((double)(min + (int)value));
+  return INT_VAL(min + (int)value);
 }
 
 static Value nativeRandomFloat(VM* vm, int argc, Value* args) {
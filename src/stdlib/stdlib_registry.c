@@ -15,15 +15,19 @@ void stdlib_register_math(VM* vm, ObjInstance* module);
 void stdlib_register_random(VM* vm, ObjInstance* module);
 void stdlib_register_str(VM* vm, ObjInstance* module);
 void stdlib_register_array(VM* vm, ObjInstance* module);
+void stdlib_register_typed(VM* vm, ObjInstance* module);
 void stdlib_register_os(VM* vm, ObjInstance* module);
 void stdlib_register_time(VM* vm, ObjInstance* module);
-void stdlib_register_vec(VM* vm, ObjInstance* vec2, ObjInstance* vec3, ObjInstance* vec4);
+void stdlib_register_worker(VM* vm, ObjInstance* module);
+void stdlib_register_vec(VM* vm, ObjInstance* vec, ObjInstance* vec2, ObjInstance* vec3,
+                         ObjInstance* vec4);
 void stdlib_register_http(VM* vm, ObjInstance* module);
 void stdlib_register_proc(VM* vm, ObjInstance* module);
 void stdlib_register_env(VM* vm, ObjInstance* module);
 void stdlib_register_di(VM* vm, ObjInstance* module);
 void stdlib_register_ffi(VM* vm, ObjInstance* module);
 void stdlib_register_plugin(VM* vm, ObjInstance* module);
+void stdlib_register_gc(VM* vm, ObjInstance* module);
 
 void defineStdlib(VM* vm) {
   stdlib_register_globals(vm);
@@ -60,6 +64,10 @@ void defineStdlib(VM* vm) {
   stdlib_register_array(vm, array);
   defineGlobal(vm, "array", OBJ_VAL(array));
 
+  ObjInstance* typed = makeModule(vm, "typed");
+  stdlib_register_typed(vm, typed);
+  defineGlobal(vm, "typed", OBJ_VAL(typed));
+
   ObjInstance* os = makeModule(vm, "os");
   stdlib_register_os(vm, os);
   defineGlobal(vm, "os", OBJ_VAL(os));
@@ -68,10 +76,16 @@ void defineStdlib(VM* vm) {
   stdlib_register_time(vm, timeModule);
   defineGlobal(vm, "time", OBJ_VAL(timeModule));
 
+  ObjInstance* worker = makeModule(vm, "worker");
+  stdlib_register_worker(vm, worker);
+  defineGlobal(vm, "worker", OBJ_VAL(worker));
+
+  ObjInstance* vec = makeModule(vm, "vec");
   ObjInstance* vec2 = makeModule(vm, "vec2");
   ObjInstance* vec3 = makeModule(vm, "vec3");
   ObjInstance* vec4 = makeModule(vm, "vec4");
-  stdlib_register_vec(vm, vec2, vec3, vec4);
+  stdlib_register_vec(vm, vec, vec2, vec3, vec4);
+  defineGlobal(vm, "vec", OBJ_VAL(vec));
   defineGlobal(vm, "vec2", OBJ_VAL(vec2));
   defineGlobal(vm, "vec3", OBJ_VAL(vec3));
   defineGlobal(vm, "vec4", OBJ_VAL(vec4));
@@ -102,6 +116,10 @@ void defineStdlib(VM* vm) {
   stdlib_register_plugin(vm, plugin);
   defineGlobal(vm, "plugin", OBJ_VAL(plugin));
 
+  ObjInstance* gc = makeModule(vm, "gc");
+  stdlib_register_gc(vm, gc);
+  defineGlobal(vm, "gc", OBJ_VAL(gc));
+
 #if ERKAO_HAS_GRAPHICS
   defineGraphicsModule(vm, makeModule, moduleAdd, defineGlobal);
 #endif
@@ -2,23 +2,34 @@
 
 #include <limits.h>
 
+// memmem is not portable; the first byte narrows the candidates with memchr.
+static const char* findBytes(const char* haystack, int haystackLength, const char* needle,
+                             int needleLength) {
+  if (needleLength == 0) return haystack;
+  const char* cursor = haystack;
+  const char* last = haystack + haystackLength - needleLength;
+  while (cursor <= last) {
+    cursor = (const char*)memchr(cursor, needle[0], (size_t)(last - cursor + 1));
+    if (!cursor) return NULL;
+    if (memcmp(cursor, needle, (size_t)needleLength) == 0) return cursor;
+    cursor++;
+  }
+  return NULL;
+}
+
 static Value nativeStrUpper(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!isObjType(args[0], OBJ_STRING)) {
     return runtimeErrorValue(vm, "str.upper expects a string.");
   }
   ObjString* input = (ObjString*)AS_OBJ(args[0]);
-  char* buffer = (char*)malloc((size_t)input->length + 1);
-  if (!buffer) {
-    return runtimeErrorValue(vm, "str.upper out of memory.");
-  }
+  const char* chars = stringData(input);
+  ObjString* result = newStringBuffer(vm, input->length);
+  if (!result) return NULL_VAL;
   for (int i = 0; i < input->length; i++) {
-    buffer[i] = (char)toupper((unsigned char)input->chars[i]);
+    result->bytes[i] = (char)toupper((unsigned char)chars[i]);
   }
-  buffer[input->length] = '\0';
-  ObjString* result = takeStringWithLength(vm, buffer, input->length);
-  if (!result) return NULL_VAL;
-  return OBJ_VAL(result);
+  return OBJ_VAL(finishString(vm, result));
 }
 
 static Value nativeStrLower(VM* vm, int argc, Value* args) {
@@ -27,34 +38,32 @@ static Value nativeStrLower(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "str.lower expects a string.");
   }
   ObjString* input = (ObjString*)AS_OBJ(args[0]);
-  char* buffer = (char*)malloc((size_t)input->length + 1);
-  if (!buffer) {
-    return runtimeErrorValue(vm, "str.lower out of memory.");
-  }
+  const char* chars = stringData(input);
+  ObjString* result = newStringBuffer(vm, input->length);
+  if (!result) return NULL_VAL;
   for (int i = 0; i < input->length; i++) {
-    buffer[i] = (char)tolower((unsigned char)input->chars[i]);
+    result->bytes[i] = (char)tolower((unsigned char)chars[i]);
   }
-  buffer[input->length] = '\0';
-  ObjString* result = takeStringWithLength(vm, buffer, input->length);
-  if (!result) return NULL_VAL;
-  return OBJ_VAL(result);
+  return OBJ_VAL(finishString(vm, result));
 }
 
+// The trims and str.slice return views of their input instead of copies.
 static Value nativeStrTrim(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!isObjType(args[0], OBJ_STRING)) {
     return runtimeErrorValue(vm, "str.trim expects a string.");
   }
   ObjString* input = (ObjString*)AS_OBJ(args[0]);
+  const char* chars = stringData(input);
   int start = 0;
   int end = input->length;
-  while (start < end && isspace((unsigned char)input->chars[start])) {
+  while (start < end && isspace((unsigned char)chars[start])) {
     start++;
   }
-  while (end > start && isspace((unsigned char)input->chars[end - 1])) {
+  while (end > start && isspace((unsigned char)chars[end - 1])) {
     end--;
   }
-  ObjString* result = copyStringWithLength(vm, input->chars + start, end - start);
+  ObjString* result = newStringView(vm, input, start, end - start);
   if (!result) return NULL_VAL;
   return OBJ_VAL(result);
 }
@@ -65,11 +74,12 @@ static Value nativeStrTrimStart(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "str.trimStart expects a string.");
   }
   ObjString* input = (ObjString*)AS_OBJ(args[0]);
+  const char* chars = stringData(input);
   int start = 0;
-  while (start < input->length && isspace((unsigned char)input->chars[start])) {
+  while (start < input->length && isspace((unsigned char)chars[start])) {
     start++;
   }
-  ObjString* result = copyStringWithLength(vm, input->chars + start, input->length - start);
+  ObjString* result = newStringView(vm, input, start, input->length - start);
   if (!result) return NULL_VAL;
   return OBJ_VAL(result);
 }
@@ -80,11 +90,35 @@ static Value nativeStrTrimEnd(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "str.trimEnd expects a string.");
   }
   ObjString* input = (ObjString*)AS_OBJ(args[0]);
+  const char* chars = stringData(input);
   int end = input->length;
-  while (end > 0 && isspace((unsigned char)input->chars[end - 1])) {
+  while (end > 0 && isspace((unsigned char)chars[end - 1])) {
     end--;
   }
-  ObjString* result = copyStringWithLength(vm, input->chars, end);
+  ObjString* result = newStringView(vm, input, 0, end);
+  if (!result) return NULL_VAL;
+  return OBJ_VAL(result);
+}
+
+// Byte offsets, clamped and counted from the end when negative, like
+// array.slice.
+static Value nativeStrSlice(VM* vm, int argc, Value* args) {
+  if (argc < 1 || argc > 3 || !isObjType(args[0], OBJ_STRING) ||
+      (argc >= 2 && !IS_NUMBER(args[1])) || (argc >= 3 && !IS_NUMBER(args[2]))) {
+    return runtimeErrorValue(vm, "str.slice expects (text[, start[, end]]).");
+  }
+  ObjString* text = (ObjString*)AS_OBJ(args[0]);
+  int length = text->length;
+  int start = argc >= 2 ? (int)AS_NUMBER(args[1]) : 0;
+  int end = argc >= 3 ? (int)AS_NUMBER(args[2]) : length;
+  if (start < 0) start = length + start;
+  if (end < 0) end = length + end;
+  if (start < 0) start = 0;
+  if (end < 0) end = 0;
+  if (start > length) start = length;
+  if (end > length) end = length;
+  if (end < start) end = start;
+  ObjString* result = newStringView(vm, text, start, end - start);
   if (!result) return NULL_VAL;
   return OBJ_VAL(result);
 }
@@ -97,7 +131,7 @@ static Value nativeStrStartsWith(VM* vm, int argc, Value* args) {
   ObjString* text = (ObjString*)AS_OBJ(args[0]);
   ObjString* prefix = (ObjString*)AS_OBJ(args[1]);
   if (prefix->length > text->length) return BOOL_VAL(false);
-  return BOOL_VAL(memcmp(text->chars, prefix->chars, (size_t)prefix->length) == 0);
+  return BOOL_VAL(memcmp(stringData(text), stringData(prefix), (size_t)prefix->length) == 0);
 }
 
 static Value nativeStrEndsWith(VM* vm, int argc, Value* args) {
@@ -108,8 +142,8 @@ static Value nativeStrEndsWith(VM* vm, int argc, Value* args) {
   ObjString* text = (ObjString*)AS_OBJ(args[0]);
   ObjString* suffix = (ObjString*)AS_OBJ(args[1]);
   if (suffix->length > text->length) return BOOL_VAL(false);
-  const char* start = text->chars + (text->length - suffix->length);
-  return BOOL_VAL(memcmp(start, suffix->chars, (size_t)suffix->length) == 0);
+  const char* start = stringData(text) + (text->length - suffix->length);
+  return BOOL_VAL(memcmp(start, stringData(suffix), (size_t)suffix->length) == 0);
 }
 
 static Value nativeStrContains(VM* vm, int argc, Value* args) {
@@ -120,9 +154,12 @@ static Value nativeStrContains(VM* vm, int argc, Value* args) {
   ObjString* text = (ObjString*)AS_OBJ(args[0]);
   ObjString* needle = (ObjString*)AS_OBJ(args[1]);
   if (needle->length == 0) return BOOL_VAL(true);
-  return BOOL_VAL(strstr(text->chars, needle->chars) != NULL);
+  return BOOL_VAL(findBytes(stringData(text), text->length, stringData(needle),
+                            needle->length) != NULL);
 }
 
+// Fields are views of `text`, so splitting a large input copies nothing but
+// the short fields that get interned.
 static Value nativeStrSplit(VM* vm, int argc, Value* args) {
   (void)argc;
   if (!isObjType(args[0], OBJ_STRING) || !isObjType(args[1], OBJ_STRING)) {
@@ -130,6 +167,7 @@ static Value nativeStrSplit(VM* vm, int argc, Value* args) {
   }
   ObjString* text = (ObjString*)AS_OBJ(args[0]);
   ObjString* sep = (ObjString*)AS_OBJ(args[1]);
+  const char* chars = stringData(text);
 
   ObjArray* array = newArray(vm);
   if (!array) {
@@ -137,32 +175,23 @@ static Value nativeStrSplit(VM* vm, int argc, Value* args) {
   }
   if (sep->length == 0) {
     for (int i = 0; i < text->length; i++) {
-      char chunk[2];
-      chunk[0] = text->chars[i];
-      chunk[1] = '\0';
-      ObjString* piece = copyStringWithLength(vm, chunk, 1);
+      ObjString* piece = copyStringWithLength(vm, chars + i, 1);
       if (!piece) return NULL_VAL;
       arrayWrite(array, OBJ_VAL(piece));
     }
     return OBJ_VAL(array);
   }
 
-  const char* current = text->chars;
-  const char* end = text->chars + text->length;
-  while (current <= end) {
-    const char* found = strstr(current, sep->chars);
-    if (!found) {
-      int length = (int)(end - current);
-      ObjString* piece = copyStringWithLength(vm, current, length);
-      if (!piece) return NULL_VAL;
-      arrayWrite(array, OBJ_VAL(piece));
-      break;
-    }
-    int length = (int)(found - current);
-    ObjString* piece = copyStringWithLength(vm, current, length);
+  const char* needle = stringData(sep);
+  int start = 0;
+  for (;;) {
+    const char* found = findBytes(chars + start, text->length - start, needle, sep->length);
+    int end = found ? (int)(found - chars) : text->length;
+    ObjString* piece = newStringView(vm, text, start, end - start);
     if (!piece) return NULL_VAL;
     arrayWrite(array, OBJ_VAL(piece));
-    current = found + sep->length;
+    if (!found) break;
+    start = end + sep->length;
   }
 
   return OBJ_VAL(array);
@@ -171,69 +200,46 @@ static Value nativeStrSplit(VM* vm, int argc, Value* args) {
 static Value nativeStrBuilder(VM* vm, int argc, Value* args) {
   (void)argc;
   (void)args;
-  ObjArray* array = newArray(vm);
-  if (!array) return NULL_VAL;
-  return OBJ_VAL(array);
+  ObjStringBuilder* builder = newStringBuilder(vm);
+  if (!builder) return NULL_VAL;
+  return OBJ_VAL(builder);
 }
 
+// Strings are copied in; numbers and other values are formatted in place the
+// way print shows them.
 static Value nativeStrAppend(VM* vm, int argc, Value* args) {
   (void)argc;
-  if (!isObjType(args[0], OBJ_ARRAY) || !isObjType(args[1], OBJ_STRING)) {
-    return runtimeErrorValue(vm, "str.append expects (builder, text).");
+  if (!isObjType(args[0], OBJ_STRING_BUILDER)) {
+    return runtimeErrorValue(vm, "str.append expects (builder, value).");
+  }
+  if (!stringBuilderAppend((ObjStringBuilder*)AS_OBJ(args[0]), args[1])) {
+    return runtimeErrorValue(vm, "str.append out of memory.");
   }
-  ObjArray* array = (ObjArray*)AS_OBJ(args[0]);
-  arrayWrite(array, args[1]);
   return args[0];
 }
 
-static Value nativeStrBuild(VM* vm, int argc, Value* args) {
-  if (argc < 1) {
-    return runtimeErrorValue(vm, "str.build expects (builder, sep?).");
+static Value nativeStrAppendChar(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_STRING_BUILDER) || !IS_NUMBER(args[1])) {
+    return runtimeErrorValue(vm, "str.appendChar expects (builder, codePoint).");
   }
-  if (!isObjType(args[0], OBJ_ARRAY)) {
-    return runtimeErrorValue(vm, "str.build expects (builder, sep?).");
+  double code = AS_NUMBER(args[1]);
+  if (!(code >= 0 && code <= 0x10ffff) || code != (double)(uint32_t)code) {
+    return runtimeErrorValue(vm, "str.appendChar expects a code point.");
   }
-  ObjArray* array = (ObjArray*)AS_OBJ(args[0]);
-
-  const char* sepChars = "";
-  int sepLength = 0;
-  if (argc >= 2) {
-    if (!isObjType(args[1], OBJ_STRING)) {
-      return runtimeErrorValue(vm, "str.build expects (builder, sep?).");
-    }
-    ObjString* sep = (ObjString*)AS_OBJ(args[1]);
-    sepChars = sep->chars;
-    sepLength = sep->length;
+  if (!stringBuilderAppendChar((ObjStringBuilder*)AS_OBJ(args[0]), (uint32_t)code)) {
+    return runtimeErrorValue(vm, "str.appendChar out of memory.");
   }
+  return args[0];
+}
 
-  ByteBuffer buffer;
-  bufferInit(&buffer);
-
-  for (int i = 0; i < array->count; i++) {
-    if (!isObjType(array->items[i], OBJ_STRING)) {
-      bufferFree(&buffer);
-      return runtimeErrorValue(vm, "str.build expects an array of strings.");
-    }
-    ObjString* item = (ObjString*)AS_OBJ(array->items[i]);
-    if (i > 0 && sepLength > 0) {
-      bufferAppendN(&buffer, sepChars, (size_t)sepLength);
-      if (buffer.failed) {
-        bufferFree(&buffer);
-        return runtimeErrorValue(vm, "str.build out of memory.");
-      }
-    }
-    if (item->length > 0) {
-      bufferAppendN(&buffer, item->chars, (size_t)item->length);
-      if (buffer.failed) {
-        bufferFree(&buffer);
-        return runtimeErrorValue(vm, "str.build out of memory.");
-      }
-    }
+static Value nativeStrBuild(VM* vm, int argc, Value* args) {
+  if (argc < 1 || argc > 2 || !isObjType(args[0], OBJ_STRING_BUILDER) ||
+      (argc == 2 && !isObjType(args[1], OBJ_STRING))) {
+    return runtimeErrorValue(vm, "str.build expects (builder, sep?).");
   }
-
-  ObjString* result = copyStringWithLength(vm, buffer.data ? buffer.data : "",
-                                           (int)buffer.length);
-  bufferFree(&buffer);
+  ObjString* sep = argc == 2 ? (ObjString*)AS_OBJ(args[1]) : NULL;
+  ObjString* result = stringBuilderTake(vm, (ObjStringBuilder*)AS_OBJ(args[0]), sep);
   if (!result) return NULL_VAL;
   return OBJ_VAL(result);
 }
@@ -256,14 +262,14 @@ static Value nativeStrJoin(VM* vm, int argc, Value* args) {
     }
     ObjString* item = (ObjString*)AS_OBJ(array->items[i]);
     if (i > 0 && sep->length > 0) {
-      bufferAppendN(&buffer, sep->chars, (size_t)sep->length);
+      bufferAppendN(&buffer, stringChars(sep), (size_t)sep->length);
       if (buffer.failed) {
         bufferFree(&buffer);
         return runtimeErrorValue(vm, "str.join out of memory.");
       }
     }
     if (item->length > 0) {
-      bufferAppendN(&buffer, item->chars, (size_t)item->length);
+      bufferAppendN(&buffer, stringChars(item), (size_t)item->length);
       if (buffer.failed) {
         bufferFree(&buffer);
         return runtimeErrorValue(vm, "str.join out of memory.");
@@ -292,27 +298,27 @@ static Value nativeStrReplace(VM* vm, int argc, Value* args) {
     return OBJ_VAL(text);
   }
 
-  const char* found = strstr(text->chars, needle->chars);
+  const char* found = strstr(stringChars(text), stringChars(needle));
   if (!found) {
     return OBJ_VAL(text);
   }
 
   ByteBuffer buffer;
   bufferInit(&buffer);
-  bufferAppendN(&buffer, text->chars, (size_t)(found - text->chars));
+  bufferAppendN(&buffer, stringChars(text), (size_t)(found - stringChars(text)));
   if (buffer.failed) {
     bufferFree(&buffer);
     return runtimeErrorValue(vm, "str.replace out of memory.");
   }
   if (repl->length > 0) {
-    bufferAppendN(&buffer, repl->chars, (size_t)repl->length);
+    bufferAppendN(&buffer, stringChars(repl), (size_t)repl->length);
     if (buffer.failed) {
       bufferFree(&buffer);
       return runtimeErrorValue(vm, "str.replace out of memory.");
     }
   }
   const char* tail = found + needle->length;
-  bufferAppendN(&buffer, tail, (size_t)(text->chars + text->length - tail));
+  bufferAppendN(&buffer, tail, (size_t)(stringChars(text) + text->length - tail));
   if (buffer.failed) {
     bufferFree(&buffer);
     return runtimeErrorValue(vm, "str.replace out of memory.");
@@ -339,8 +345,8 @@ static Value nativeStrReplaceAll(VM* vm, int argc, Value* args) {
     return OBJ_VAL(text);
   }
 
-  const char* cursor = text->chars;
-  const char* found = strstr(cursor, needle->chars);
+  const char* cursor = stringChars(text);
+  const char* found = strstr(cursor, stringChars(needle));
   if (!found) {
     return OBJ_VAL(text);
   }
@@ -354,16 +360,16 @@ static Value nativeStrReplaceAll(VM* vm, int argc, Value* args) {
       return runtimeErrorValue(vm, "str.replaceAll out of memory.");
     }
     if (repl->length > 0) {
-      bufferAppendN(&buffer, repl->chars, (size_t)repl->length);
+      bufferAppendN(&buffer, stringChars(repl), (size_t)repl->length);
       if (buffer.failed) {
         bufferFree(&buffer);
         return runtimeErrorValue(vm, "str.replaceAll out of memory.");
       }
     }
     cursor = found + needle->length;
-    found = strstr(cursor, needle->chars);
+    found = strstr(cursor, stringChars(needle));
   }
-  bufferAppendN(&buffer, cursor, (size_t)(text->chars + text->length - cursor));
+  bufferAppendN(&buffer, cursor, (size_t)(stringChars(text) + text->length - cursor));
   if (buffer.failed) {
     bufferFree(&buffer);
     return runtimeErrorValue(vm, "str.replaceAll out of memory.");
@@ -394,20 +400,14 @@ static Value nativeStrRepeat(VM* vm, int argc, Value* args) {
   if (text->length > 0 && count > INT_MAX / text->length) {
     return runtimeErrorValue(vm, "str.repeat result too large.");
   }
-  int total = text->length * count;
-  char* buffer = (char*)malloc((size_t)total + 1);
-  if (!buffer) {
-    return runtimeErrorValue(vm, "str.repeat out of memory.");
-  }
-  char* cursor = buffer;
+  ObjString* result = newStringBuffer(vm, text->length * count);
+  if (!result) return NULL_VAL;
+  char* cursor = result->bytes;
   for (int i = 0; i < count; i++) {
-    memcpy(cursor, text->chars, (size_t)text->length);
+    memcpy(cursor, stringChars(text), (size_t)text->length);
     cursor += text->length;
   }
-  buffer[total] = '\0';
-  ObjString* result = takeStringWithLength(vm, buffer, total);
-  if (!result) return NULL_VAL;
-  return OBJ_VAL(result);
+  return OBJ_VAL(finishString(vm, result));
 }
 
 
@@ -417,6 +417,7 @@ void stdlib_register_str(VM* vm, ObjInstance* module) {
   moduleAdd(vm, module, "trim", nativeStrTrim, 1);
   moduleAdd(vm, module, "trimStart", nativeStrTrimStart, 1);
   moduleAdd(vm, module, "trimEnd", nativeStrTrimEnd, 1);
+  moduleAdd(vm, module, "slice", nativeStrSlice, -1);
   moduleAdd(vm, module, "startsWith", nativeStrStartsWith, 2);
   moduleAdd(vm, module, "endsWith", nativeStrEndsWith, 2);
   moduleAdd(vm, module, "contains", nativeStrContains, 2);
@@ -424,6 +425,7 @@ void stdlib_register_str(VM* vm, ObjInstance* module) {
   moduleAdd(vm, module, "join", nativeStrJoin, 2);
   moduleAdd(vm, module, "builder", nativeStrBuilder, 0);
   moduleAdd(vm, module, "append", nativeStrAppend, 2);
+  moduleAdd(vm, module, "appendChar", nativeStrAppendChar, 2);
   moduleAdd(vm, module, "build", nativeStrBuild, -1);
   moduleAdd(vm, module, "replace", nativeStrReplace, 3);
   moduleAdd(vm, module, "replaceAll", nativeStrReplaceAll, 3);
@@ -1,12 +1,5 @@
 #include "stdlib_internal.h"
 
-#ifdef _WIN32
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#include <windows.h>
-#endif
-
 #include <time.h>
 
 static Value nativeTimeNow(VM* vm, int argc, Value* args) {
@@ -28,18 +21,7 @@ static Value nativeTimeSleep(VM* vm, int argc, Value* args) {
   if (seconds < 0) {
     return runtimeErrorValue(vm, "time.sleep expects a non-negative number.");
   }
-#ifdef _WIN32
-  DWORD ms = (DWORD)(seconds * 1000.0);
-  Sleep(ms);
-#else
-  struct timespec ts;
-  ts.tv_sec = (time_t)seconds;
-  ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1000000000.0);
-  if (ts.tv_nsec < 0) ts.tv_nsec = 0;
-  if (nanosleep(&ts, NULL) != 0) {
-    return runtimeErrorValue(vm, "time.sleep failed.");
-  }
-#endif
+  fiberSleep(vm, seconds);
   return NULL_VAL;
 }
 
@@ -78,7 +60,7 @@ static Value nativeTimeFormat(VM* vm, int argc, Value* args) {
     return runtimeErrorValue(vm, "time.format failed.");
   }
   char buffer[256];
-  size_t written = strftime(buffer, sizeof(buffer), format->chars, &tmValue);
+  size_t written = strftime(buffer, sizeof(buffer), stringChars(format), &tmValue);
   if (written == 0) {
     return runtimeErrorValue(vm, "time.format failed to format.");
   }
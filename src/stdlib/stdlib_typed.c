@@ -0,0 +1,150 @@
+#include "stdlib_internal.h"
+
+#include <string.h>
+
+// Builds a typed array from a length, a plain array of numbers or another
+// typed array. Converting from another kind stores each element as the new
+// kind would, so f64 -> u8 keeps the low bits like an element store.
+static Value typedMake(VM* vm, TypedKind kind, Value source, const char* message) {
+  if (IS_NUMBER(source)) {
+    double length = AS_NUMBER(source);
+    if (length < 0 || length > (double)INT32_MAX || length != (double)(int)length) {
+      return runtimeErrorValue(vm, message);
+    }
+    ObjTypedArray* array = newTypedArray(vm, kind, (int)length);
+    if (!array) return NULL_VAL;
+    return OBJ_VAL(array);
+  }
+  if (isObjType(source, OBJ_ARRAY)) {
+    ObjArray* items = (ObjArray*)AS_OBJ(source);
+    for (int i = 0; i < items->count; i++) {
+      if (!IS_NUMBER(items->items[i])) {
+        return runtimeErrorValue(vm, "Typed array elements must be numbers.");
+      }
+    }
+    ObjTypedArray* array = newTypedArray(vm, kind, items->count);
+    if (!array) return NULL_VAL;
+    for (int i = 0; i < items->count; i++) {
+      typedArraySet(array, i, items->items[i]);
+    }
+    return OBJ_VAL(array);
+  }
+  if (isObjType(source, OBJ_TYPED_ARRAY)) {
+    ObjTypedArray* from = (ObjTypedArray*)AS_OBJ(source);
+    ObjTypedArray* array = newTypedArray(vm, kind, from->length);
+    if (!array) return NULL_VAL;
+    if (from->kind == kind) {
+      memcpy(array->data, from->data, (size_t)from->length * typedKindSize(kind));
+    } else {
+      for (int i = 0; i < from->length; i++) {
+        typedArraySet(array, i, typedArrayGet(from, i));
+      }
+    }
+    return OBJ_VAL(array);
+  }
+  return runtimeErrorValue(vm, message);
+}
+
+static Value nativeTypedF64(VM* vm, int argc, Value* args) {
+  (void)argc;
+  return typedMake(vm, TYPED_F64, args[0],
+                   "typed.f64 expects a length, an array of numbers or a typed array.");
+}
+
+static Value nativeTypedI32(VM* vm, int argc, Value* args) {
+  (void)argc;
+  return typedMake(vm, TYPED_I32, args[0],
+                   "typed.i32 expects a length, an array of numbers or a typed array.");
+}
+
+static Value nativeTypedU8(VM* vm, int argc, Value* args) {
+  (void)argc;
+  return typedMake(vm, TYPED_U8, args[0],
+                   "typed.u8 expects a length, an array of numbers or a typed array.");
+}
+
+// Indices follow array.slice: negative ones count from the end and both are
+// clamped. The result shares storage with the source.
+static Value nativeTypedSlice(VM* vm, int argc, Value* args) {
+  if (argc < 1 || argc > 3) {
+    return runtimeErrorValue(vm, "typed.slice expects (typed[, start[, end]]).");
+  }
+  if (!isObjType(args[0], OBJ_TYPED_ARRAY)) {
+    return runtimeErrorValue(vm, "typed.slice expects a typed array.");
+  }
+  ObjTypedArray* source = (ObjTypedArray*)AS_OBJ(args[0]);
+  int count = source->length;
+  int start = 0;
+  int end = count;
+  if (argc >= 2) {
+    if (!IS_NUMBER(args[1])) {
+      return runtimeErrorValue(vm, "typed.slice expects numeric indices.");
+    }
+    start = (int)AS_NUMBER(args[1]);
+  }
+  if (argc >= 3) {
+    if (!IS_NUMBER(args[2])) {
+      return runtimeErrorValue(vm, "typed.slice expects numeric indices.");
+    }
+    end = (int)AS_NUMBER(args[2]);
+  }
+  if (start < 0) start = count + start;
+  if (end < 0) end = count + end;
+  if (start < 0) start = 0;
+  if (end < 0) end = 0;
+  if (start > count) start = count;
+  if (end > count) end = count;
+  if (end < start) end = start;
+
+  ObjTypedArray* view = newTypedView(vm, source, start, end - start);
+  if (!view) return NULL_VAL;
+  return OBJ_VAL(view);
+}
+
+static Value nativeTypedToArray(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_TYPED_ARRAY)) {
+    return runtimeErrorValue(vm, "typed.toArray expects a typed array.");
+  }
+  ObjTypedArray* source = (ObjTypedArray*)AS_OBJ(args[0]);
+  ObjArray* result = newArrayWithCapacity(vm, source->length);
+  for (int i = 0; i < source->length; i++) {
+    arrayWrite(result, typedArrayGet(source, i));
+  }
+  return OBJ_VAL(result);
+}
+
+static Value nativeTypedKind(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_TYPED_ARRAY)) {
+    return runtimeErrorValue(vm, "typed.kind expects a typed array.");
+  }
+  ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(args[0]);
+  return OBJ_VAL(copyString(vm, typedKindName(array->kind)));
+}
+
+static Value nativeTypedFill(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_TYPED_ARRAY) || !IS_NUMBER(args[1])) {
+    return runtimeErrorValue(vm, "typed.fill expects (typed, number).");
+  }
+  ObjTypedArray* array = (ObjTypedArray*)AS_OBJ(args[0]);
+  if (array->length > 0) {
+    typedArraySet(array, 0, args[1]);
+    size_t size = typedKindSize(array->kind);
+    for (int i = 1; i < array->length; i++) {
+      memcpy(array->data + (size_t)i * size, array->data, size);
+    }
+  }
+  return args[0];
+}
+
+void stdlib_register_typed(VM* vm, ObjInstance* module) {
+  moduleAdd(vm, module, "f64", nativeTypedF64, 1);
+  moduleAdd(vm, module, "i32", nativeTypedI32, 1);
+  moduleAdd(vm, module, "u8", nativeTypedU8, 1);
+  moduleAdd(vm, module, "slice", nativeTypedSlice, -1);
+  moduleAdd(vm, module, "toArray", nativeTypedToArray, 1);
+  moduleAdd(vm, module, "kind", nativeTypedKind, 1);
+  moduleAdd(vm, module, "fill", nativeTypedFill, 2);
+}
@@ -1,4 +1,5 @@
 #include "stdlib_internal.h"
+#include "bulk_kernels.h"
 
 #include <math.h>
 
@@ -301,8 +302,125 @@ static Value nativeVec4Dist(VM* vm, int argc, Value* args) {
   return vecDistN(vm, 4, args, "vec4.dist expects two vec4 arrays.");
 }
 
+// The vec module works on number arrays or typed arrays of any length. The
+// result is an f64 typed array when either input is packed, and a plain
+// array otherwise.
+
+typedef void (*BulkBinaryFn)(const double* a, const double* b, double* out, size_t count);
+
+static bool bulkReadPair(VM* vm, Value* args, BulkOperand* a, BulkOperand* b,
+                         const char* message) {
+  if (!bulkOperandRead(vm, args[0], a, message)) return false;
+  if (!bulkOperandRead(vm, args[1], b, message)) {
+    bulkOperandFree(a);
+    return false;
+  }
+  if (a->length != b->length) {
+    bulkOperandFree(a);
+    bulkOperandFree(b);
+    runtimeErrorValue(vm, message);
+    return false;
+  }
+  return true;
+}
+
+static Value bulkBinary(VM* vm, Value* args, BulkBinaryFn kernel, const char* message) {
+  BulkOperand a;
+  BulkOperand b;
+  if (!bulkReadPair(vm, args, &a, &b, message)) return NULL_VAL;
+  BulkOutput out;
+  bool ok = bulkOutputInit(vm, &out, a.length, a.packed || b.packed);
+  if (ok) kernel(a.data, b.data, out.data, (size_t)a.length);
+  bulkOperandFree(&a);
+  bulkOperandFree(&b);
+  return ok ? bulkOutputFinish(vm, &out) : NULL_VAL;
+}
+
+static Value nativeVecAdd(VM* vm, int argc, Value* args) {
+  (void)argc;
+  return bulkBinary(vm, args, bulkKernels()->add,
+                    "vec.add expects two number arrays of the same length.");
+}
+
+static Value nativeVecSub(VM* vm, int argc, Value* args) {
+  (void)argc;
+  return bulkBinary(vm, args, bulkKernels()->sub,
+                    "vec.sub expects two number arrays of the same length.");
+}
+
+static Value nativeVecMul(VM* vm, int argc, Value* args) {
+  (void)argc;
+  return bulkBinary(vm, args, bulkKernels()->mul,
+                    "vec.mul expects two number arrays of the same length.");
+}
+
+static Value nativeVecScale(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!IS_NUMBER(args[1])) {
+    return runtimeErrorValue(vm, "vec.scale expects (array, scalar).");
+  }
+  BulkOperand a;
+  if (!bulkOperandRead(vm, args[0], &a, "vec.scale expects (array, scalar).")) return NULL_VAL;
+  BulkOutput out;
+  bool ok = bulkOutputInit(vm, &out, a.length, a.packed);
+  if (ok) bulkKernels()->scale(a.data, AS_NUMBER(args[1]), out.data, (size_t)a.length);
+  bulkOperandFree(&a);
+  return ok ? bulkOutputFinish(vm, &out) : NULL_VAL;
+}
+
+static Value nativeVecDot(VM* vm, int argc, Value* args) {
+  (void)argc;
+  BulkOperand a;
+  BulkOperand b;
+  if (!bulkReadPair(vm, args, &a, &b, "vec.dot expects two number arrays of the same length.")) {
+    return NULL_VAL;
+  }
+  double dot = bulkKernels()->dot(a.data, b.data, (size_t)a.length);
+  bulkOperandFree(&a);
+  bulkOperandFree(&b);
+  return NUMBER_VAL(dot);
+}
+
+static Value nativeVecLen(VM* vm, int argc, Value* args) {
+  (void)argc;
+  BulkOperand a;
+  if (!bulkOperandRead(vm, args[0], &a, "vec.len expects a number array.")) return NULL_VAL;
+  double len = sqrt(bulkKernels()->dot(a.data, a.data, (size_t)a.length));
+  bulkOperandFree(&a);
+  return NUMBER_VAL(len);
+}
+
+static Value nativeVecNorm(VM* vm, int argc, Value* args) {
+  (void)argc;
+  const BulkKernels* kernels = bulkKernels();
+  BulkOperand a;
+  if (!bulkOperandRead(vm, args[0], &a, "vec.norm expects a number array.")) return NULL_VAL;
+  double len = sqrt(kernels->dot(a.data, a.data, (size_t)a.length));
+  BulkOutput out;
+  bool ok = bulkOutputInit(vm, &out, a.length, a.packed);
+  if (ok) kernels->scale(a.data, len <= 0.0 ? 0.0 : 1.0 / len, out.data, (size_t)a.length);
+  bulkOperandFree(&a);
+  return ok ? bulkOutputFinish(vm, &out) : NULL_VAL;
+}
+
+static Value nativeVecSimd(VM* vm, int argc, Value* args) {
+  (void)argc;
+  (void)args;
+  return OBJ_VAL(copyString(vm, bulkKernels()->name));
+}
+
+
+void stdlib_register_vec(VM* vm, ObjInstance* vec, ObjInstance* vec2, ObjInstance* vec3,
+                         ObjInstance* vec4) {
+  moduleAdd(vm, vec, "add", nativeVecAdd, 2);
+  moduleAdd(vm, vec, "sub", nativeVecSub, 2);
+  moduleAdd(vm, vec, "mul", nativeVecMul, 2);
+  moduleAdd(vm, vec, "scale", nativeVecScale, 2);
+  moduleAdd(vm, vec, "dot", nativeVecDot, 2);
+  moduleAdd(vm, vec, "len", nativeVecLen, 1);
+  moduleAdd(vm, vec, "norm", nativeVecNorm, 1);
+  moduleAdd(vm, vec, "simd", nativeVecSimd, 0);
 
-void stdlib_register_vec(VM* vm, ObjInstance* vec2, ObjInstance* vec3, ObjInstance* vec4) {
   moduleAdd(vm, vec2, "make", nativeVec2Make, 2);
   moduleAdd(vm, vec2, "add", nativeVec2Add, 2);
   moduleAdd(vm, vec2, "sub", nativeVec2Sub, 2);
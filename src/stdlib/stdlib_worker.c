@@ -0,0 +1,65 @@
+#include "stdlib_internal.h"
+
+static Value nativeWorkerSpawn(VM* vm, int argc, Value* args) {
+  if (argc < 1) {
+    return runtimeErrorValue(vm, "worker.spawn expects a script path or a function.");
+  }
+  ObjWorker* worker = workerSpawn(vm, args[0], argc - 1, args + 1);
+  if (!worker) return NULL_VAL;
+  return OBJ_VAL(worker);
+}
+
+static Value nativeWorkerParent(VM* vm, int argc, Value* args) {
+  (void)argc;
+  (void)args;
+  ObjWorker* parent = workerParentHandle(vm);
+  if (!parent) return NULL_VAL;
+  return OBJ_VAL(parent);
+}
+
+static Value nativeWorkerSend(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_WORKER)) {
+    return runtimeErrorValue(vm, "worker.send expects a worker.");
+  }
+  bool sent;
+  if (!workerSend(vm, (ObjWorker*)AS_OBJ(args[0]), args[1], &sent)) return NULL_VAL;
+  return BOOL_VAL(sent);
+}
+
+static Value nativeWorkerRecv(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_WORKER)) {
+    return runtimeErrorValue(vm, "worker.recv expects a worker.");
+  }
+  Value value;
+  if (!workerRecv(vm, (ObjWorker*)AS_OBJ(args[0]), &value)) return NULL_VAL;
+  return value;
+}
+
+static Value nativeWorkerClose(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_WORKER)) {
+    return runtimeErrorValue(vm, "worker.close expects a worker.");
+  }
+  workerClose((ObjWorker*)AS_OBJ(args[0]));
+  return NULL_VAL;
+}
+
+static Value nativeWorkerTerminate(VM* vm, int argc, Value* args) {
+  (void)argc;
+  if (!isObjType(args[0], OBJ_WORKER) || !((ObjWorker*)AS_OBJ(args[0]))->child) {
+    return runtimeErrorValue(vm, "worker.terminate expects a worker started by this script.");
+  }
+  workerTerminate((ObjWorker*)AS_OBJ(args[0]));
+  return NULL_VAL;
+}
+
+void stdlib_register_worker(VM* vm, ObjInstance* module) {
+  moduleAdd(vm, module, "spawn", nativeWorkerSpawn, -1);
+  moduleAdd(vm, module, "parent", nativeWorkerParent, 0);
+  moduleAdd(vm, module, "send", nativeWorkerSend, 2);
+  moduleAdd(vm, module, "recv", nativeWorkerRecv, 1);
+  moduleAdd(vm, module, "close", nativeWorkerClose, 1);
+  moduleAdd(vm, module, "terminate", nativeWorkerTerminate, 1);
+}
@@ -1,5 +1,7 @@
 #include "stdlib_internal.h"
 
+#include <inttypes.h>
+
 typedef struct {
   char* text;
   int indent;
@@ -269,9 +271,9 @@ static Value yamlParseScalar(VM* vm, const char* text, bool* ok, const char** er
   }
 
   char* end = NULL;
-  double number = strtod(trimmed, &end);
+  strtod(trimmed, &end);
   if (end && *end == '\0' && end != trimmed) {
-    return NUMBER_VAL(number);
+    return numberFromText(trimmed, (int)(end - trimmed));
   }
   ObjString* str = copyString(vm, trimmed);
   if (!str) {
@@ -449,7 +451,7 @@ static Value nativeYamlParse(VM* vm, int argc, Value* args) {
   }
   ObjString* input = (ObjString*)AS_OBJ(args[0]);
   YamlParser parser;
-  if (!yamlCollectLines(&parser, input->chars)) {
+  if (!yamlCollectLines(&parser, stringChars(input))) {
     free(parser.lines);
     free(parser.buffer);
     return runtimeErrorValue(vm, parser.error ? parser.error : "yaml.parse failed.");
@@ -496,7 +498,7 @@ static bool yamlAppendEscaped(ByteBuffer* buffer, ObjString* string) {
   bufferAppendChar(buffer, '"');
   if (buffer->failed) return false;
   for (int i = 0; i < string->length; i++) {
-    char c = string->chars[i];
+    char c = stringChars(string)[i];
     switch (c) {
       case '\\': bufferAppendN(buffer, "\\\\", 2); break;
       case '"': bufferAppendN(buffer, "\\\"", 2); break;
@@ -602,14 +604,14 @@ static bool yamlStringifyMap(VM* vm, ByteBuffer* buffer, ObjMap* map,
       continue;
     }
     yamlAppendIndent(buffer, indent);
-    if (yamlStringNeedsQuotes(key->chars)) {
+    if (yamlStringNeedsQuotes(stringChars(key))) {
       if (!yamlAppendEscaped(buffer, key)) {
         free(keys);
         *error = "yaml.stringify out of memory.";
         return false;
       }
     } else {
-      bufferAppendN(buffer, key->chars, (size_t)key->length);
+      bufferAppendN(buffer, stringChars(key), (size_t)key->length);
       if (buffer->failed) {
         free(keys);
         *error = "yaml.stringify out of memory.";
@@ -686,7 +688,9 @@ static bool yamlStringifyValue(VM* vm, ByteBuffer* buffer, Value value,
       return false;
     }
     char num[64];
-    int length = snprintf(num, sizeof(num), "%g", AS_NUMBER(value));
+    int length = IS_INT(value)
+                     ? snprintf(num, sizeof(num), "%" PRId64, AS_INT(value))
+                     : snprintf(num, sizeof(num), "%g", AS_NUMBER(value));
     if (length < 0) length = 0;
     if (length >= (int)sizeof(num)) length = (int)sizeof(num) - 1;
     bufferAppendN(buffer, num, (size_t)length);
@@ -698,14 +702,14 @@ static bool yamlStringifyValue(VM* vm, ByteBuffer* buffer, Value value,
   }
   if (isObjType(value, OBJ_STRING)) {
     ObjString* str = (ObjString*)AS_OBJ(value);
-    if (yamlStringNeedsQuotes(str->chars)) {
+    if (yamlStringNeedsQuotes(stringChars(str))) {
       if (!yamlAppendEscaped(buffer, str)) {
         *error = "yaml.stringify out of memory.";
         return false;
       }
       return true;
     }
-    bufferAppendN(buffer, str->chars, (size_t)str->length);
+    bufferAppendN(buffer, stringChars(str), (size_t)str->length);
     if (buffer->failed) {
       *error = "yaml.stringify out of memory.";
       return false;
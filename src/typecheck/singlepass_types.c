@@ -20,7 +20,7 @@ static Type TYPE_BOOL_VALUE = { TYPE_BOOL, NULL, NULL, NULL, NULL, NULL, 0, NULL
 static Type TYPE_NULL_VALUE = { TYPE_NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL,
                                 NULL, 0, NULL, 0, NULL, 0, false };
 
-TypeRegistry* gTypeRegistry = NULL;
+ERKAO_THREAD_LOCAL TypeRegistry* gTypeRegistry = NULL;
 
 bool typecheckEnabled(Compiler* c) {
   return c->typecheck && c->typecheck->enabled;
@@ -1054,6 +1054,27 @@ Type* typeFunctionN(TypeChecker* tc, int paramCount, Type* returnType, ...) {
 }
 
 
+static Type* typeLookupFsMember(TypeChecker* tc, Token name) {
+  Type* any = typeAny();
+  Type* number = typeNumber();
+  Type* string = typeString();
+  Type* boolean = typeBool();
+  Type* arrayString = typeArray(tc, string);
+  if (tokenMatches(name, "readText")) return typeFunctionN(tc, 1, string, string);
+  if (tokenMatches(name, "writeText")) return typeFunctionN(tc, 2, boolean, string, string);
+  if (tokenMatches(name, "readBytes")) return typeFunctionN(tc, 1, any, string);
+  if (tokenMatches(name, "writeBytes")) return typeFunctionN(tc, 2, boolean, string, any);
+  if (tokenMatches(name, "exists")) return typeFunctionN(tc, 1, boolean, string);
+  if (tokenMatches(name, "cwd")) return typeFunctionN(tc, 0, string);
+  if (tokenMatches(name, "listDir")) return typeFunctionN(tc, 1, arrayString, string);
+  if (tokenMatches(name, "isFile")) return typeFunctionN(tc, 1, boolean, string);
+  if (tokenMatches(name, "isDir")) return typeFunctionN(tc, 1, boolean, string);
+  if (tokenMatches(name, "size")) return typeFunctionN(tc, 1, number, string);
+  if (tokenMatches(name, "remove")) return typeFunctionN(tc, 1, boolean, string);
+  if (tokenMatches(name, "glob")) return typeFunctionN(tc, 1, arrayString, string);
+  return NULL;
+}
+
 Type* typeLookupStdlibMember(Compiler* c, Type* objectType, Token name) {
   if (!typecheckEnabled(c)) return typeAny();
   if (!objectType || typeIsAny(objectType)) return typeAny();
@@ -1065,16 +1086,8 @@ Type* typeLookupStdlibMember(Compiler* c, Type* objectType, Token name) {
   Type* boolean = typeBool();
 
   if (typeNamedIs(objectType, "fs")) {
-    Type* arrayString = typeArray(tc, string);
-    if (tokenMatches(name, "readText")) return typeFunctionN(tc, 1, string, string);
-    if (tokenMatches(name, "writeText")) return typeFunctionN(tc, 2, boolean, string, string);
-    if (tokenMatches(name, "exists")) return typeFunctionN(tc, 1, boolean, string);
-    if (tokenMatches(name, "cwd")) return typeFunctionN(tc, 0, string);
-    if (tokenMatches(name, "listDir")) return typeFunctionN(tc, 1, arrayString, string);
-    if (tokenMatches(name, "isFile")) return typeFunctionN(tc, 1, boolean, string);
-    if (tokenMatches(name, "isDir")) return typeFunctionN(tc, 1, boolean, string);
-    if (tokenMatches(name, "size")) return typeFunctionN(tc, 1, number, string);
-    if (tokenMatches(name, "glob")) return typeFunctionN(tc, 1, arrayString, string);
+    Type* member = typeLookupFsMember(tc, name);
+    if (member) return member;
   }
 
   if (typeNamedIs(objectType, "path")) {
@@ -1103,7 +1116,7 @@ Type* typeLookupStdlibMember(Compiler* c, Type* objectType, Token name) {
     if (tokenMatches(name, "pow")) return typeFunctionN(tc, 2, number, number, number);
     if (tokenMatches(name, "min")) return typeFunctionN(tc, -1, number);
     if (tokenMatches(name, "max")) return typeFunctionN(tc, -1, number);
-    if (tokenMatches(name, "clamp")) return typeFunctionN(tc, 3, number, number, number, number);
+    if (tokenMatches(name, "clamp")) return typeFunctionN(tc, 3, any, any, number, number);
     if (tokenMatches(name, "PI") || tokenMatches(name, "E")) return number;
   }
 
@@ -1130,9 +1143,11 @@ Type* typeLookupStdlibMember(Compiler* c, Type* objectType, Token name) {
     if (tokenMatches(name, "endsWith")) return typeFunctionN(tc, 2, boolean, string, string);
     if (tokenMatches(name, "contains")) return typeFunctionN(tc, 2, boolean, string, string);
     if (tokenMatches(name, "split")) return typeFunctionN(tc, 2, arrayString, string, string);
+    if (tokenMatches(name, "slice")) return typeFunctionN(tc, -1, string);
     if (tokenMatches(name, "join")) return typeFunctionN(tc, 2, string, arrayString, string);
-    if (tokenMatches(name, "builder")) return typeFunctionN(tc, 0, arrayString);
-    if (tokenMatches(name, "append")) return typeFunctionN(tc, 2, arrayString, arrayString, string);
+    if (tokenMatches(name, "builder")) return typeFunctionN(tc, 0, any);
+    if (tokenMatches(name, "append")) return typeFunctionN(tc, 2, any, any, any);
+    if (tokenMatches(name, "appendChar")) return typeFunctionN(tc, 2, any, any, number);
     if (tokenMatches(name, "build")) return typeFunctionN(tc, -1, string);
     if (tokenMatches(name, "replace")) return typeFunctionN(tc, 3, string, string, string, string);
     if (tokenMatches(name, "replaceAll")) return typeFunctionN(tc, 3, string, string, string, string);
@@ -1301,11 +1316,15 @@ void typeDefineStdlib(Compiler* c) {
       typeDefineSynthetic(c, "next", typeFunctionN(tc, 1, mapStringAny, any));
       typeDefineSynthetic(c, "arrayRest", typeFunctionN(tc, 2, arrayAny, arrayAny, number));
       typeDefineSynthetic(c, "mapRest", typeFunctionN(tc, 2, mapStringAny, mapStringAny, arrayString));
-      typeDefineSynthetic(c, "spawn", typeFunctionN(tc, -1, mapStringAny));
-      typeDefineSynthetic(c, "await", typeFunctionN(tc, 1, any, mapStringAny));
-      typeDefineSynthetic(c, "channel", typeFunctionN(tc, 0, mapStringAny));
-      typeDefineSynthetic(c, "send", typeFunctionN(tc, 2, typeNull(), mapStringAny, any));
-      typeDefineSynthetic(c, "recv", typeFunctionN(tc, 1, any, mapStringAny));
+      Type* taskType = typeNamed(tc, copyString(c->vm, "task"));
+      Type* channelType = typeNamed(tc, copyString(c->vm, "channel"));
+      typeDefineSynthetic(c, "spawn", typeFunctionN(tc, -1, taskType));
+      typeDefineSynthetic(c, "await", typeFunctionN(tc, 1, any, any));
+      typeDefineSynthetic(c, "channel", typeFunctionN(tc, -1, channelType));
+      typeDefineSynthetic(c, "send", typeFunctionN(tc, 2, typeBool(), channelType, any));
+      typeDefineSynthetic(c, "recv", typeFunctionN(tc, 1, any, channelType));
+      typeDefineSynthetic(c, "close", typeFunctionN(tc, 1, typeNull(), channelType));
+      typeDefineSynthetic(c, "select", typeFunctionN(tc, 1, any, typeArray(tc, channelType)));
       typeDefineSynthetic(c, "sleep", typeFunctionN(tc, 1, typeNull(), number));
     }
     typeDefineSynthetic(c, "Option", typeNamed(tc, copyString(c->vm, "Option")));
@@ -1319,8 +1338,11 @@ void typeDefineStdlib(Compiler* c) {
     typeDefineSynthetic(c, "random", typeNamed(tc, copyString(c->vm, "random")));
     typeDefineSynthetic(c, "str", typeNamed(tc, copyString(c->vm, "str")));
     typeDefineSynthetic(c, "array", typeNamed(tc, copyString(c->vm, "array")));
+    typeDefineSynthetic(c, "typed", typeNamed(tc, copyString(c->vm, "typed")));
     typeDefineSynthetic(c, "os", typeNamed(tc, copyString(c->vm, "os")));
     typeDefineSynthetic(c, "time", typeNamed(tc, copyString(c->vm, "time")));
+    typeDefineSynthetic(c, "worker", typeNamed(tc, copyString(c->vm, "worker")));
+    typeDefineSynthetic(c, "vec", typeNamed(tc, copyString(c->vm, "vec")));
     typeDefineSynthetic(c, "vec2", typeNamed(tc, copyString(c->vm, "vec2")));
     typeDefineSynthetic(c, "vec3", typeNamed(tc, copyString(c->vm, "vec3")));
     typeDefineSynthetic(c, "vec4", typeNamed(tc, copyString(c->vm, "vec4")));